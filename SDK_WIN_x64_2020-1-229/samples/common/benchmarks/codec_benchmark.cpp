@@ -0,0 +1,119 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+// Writes and reads one model as .xml, .xml.gz and .xml.zst in streaming
+// mode, and prints the file size and the time each way. Codecs that aren't
+// compiled in are left out. The files go to the directory given first, so
+// a slow disk can be measured by pointing it there. The second argument
+// scales both sides of the grid the model is made of; at 1 the plain file
+// is about 20 MB. The third, if given, limits reads and writes of the files
+// to that many MB per second through CXmlCodecFile::SetRateLimit, which
+// stands in for a network share.
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "../xmlcodec.h"
+#include "../xmlfile.h"
+#include "./xmlbenchmark.h"
+
+using XmlBenchmark::CTimer;
+using XmlBenchmark::Megabytes;
+
+// A grid of textured quads, with random heights that need all their digits,
+// so the text compresses about as well as a real export's
+static void BuildModel(XmlModelInfo& model_info, int scale) {
+  std::mt19937 random(5);
+  std::uniform_real_distribution<double> height(0.0, 10.0);
+  XmlMaterialInfo material;
+  material.name_ = "Brick";
+  material.has_color_ = true;
+  material.color_.red = 200;
+  material.color_.green = 80;
+  material.color_.blue = 60;
+  material.color_.alpha = 255;
+  model_info.materials_.push_back(material);
+
+  const int size = 150 * scale;
+  for (int row = 0; row < size; ++row) {
+    for (int column = 0; column < size; ++column) {
+      XmlFaceInfo face;
+      face.has_single_loop_ = true;
+      face.front_mat_name_ = "Brick";
+      face.has_front_texture_ = true;
+      for (int i = 0; i < 4; ++i) {
+        XmlFaceVertex vertex;
+        const double x = (column + (i & 1)) / 3.0;
+        const double y = (row + (i >> 1)) / 7.0;
+        vertex.vertex_ = XmlGeomUtils::CPoint3d(x, y, height(random));
+        vertex.front_texture_coord_ = XmlGeomUtils::CPoint3d(x, y, 1.0);
+        face.vertices_.push_back(vertex);
+      }
+      model_info.entities_.faces_.push_back(face);
+    }
+  }
+}
+
+static double FileMegabytes(const std::string& filename) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (file == NULL)
+    return 0.0;
+  fseek(file, 0, SEEK_END);
+  const double size = Megabytes(ftell(file));
+  fclose(file);
+  return size;
+}
+
+int main(int argc, char** argv) {
+  const std::string directory = argc > 1 ? argv[1] : ".";
+  const int scale = argc > 2 ? atoi(argv[2]) : 1;
+  const double rate_limit = argc > 3 ? atof(argv[3]) : 0.0;
+  CXmlCodecFile::SetRateLimit(rate_limit * 1024.0 * 1024.0);
+  XmlModelInfo model_info;
+  BuildModel(model_info, scale);
+
+  const char* extensions[] = { ".xml", ".xml.gz", ".xml.zst" };
+  if (rate_limit > 0.0)
+    printf("I/O limited to %.1f MB/s\n", rate_limit);
+  printf("file        size      export    import\n");
+  for (int e = 0; e < 3; ++e) {
+    const std::string filename =
+        directory + "/codec_benchmark" + extensions[e];
+    if (!CXmlCodecFile::IsSupported(CXmlCodecFile::CodecOf(filename))) {
+      printf("%-9s  not compiled in\n", extensions[e]);
+      continue;
+    }
+
+    CTimer write_timer;
+    {
+      CXmlFile file;
+      if (!file.Open(filename, CXmlFile::kWriteStreaming))
+        return 1;
+      file.WriteHeader(20, 1, 229);
+      file.WriteModelInfo(model_info);
+      if (!file.Close(false))
+        return 1;
+    }
+    const double write_seconds = write_timer.seconds();
+
+    CTimer read_timer;
+    {
+      CXmlFile file;
+      XmlModelInfo read_back;
+      if (!file.Open(filename, false, CXmlFile::kReadStreaming) ||
+          !file.GetModelInfo(read_back))
+        return 1;
+      file.Close(false);
+      if (read_back.entities_.faces_.size() !=
+          model_info.entities_.faces_.size())
+        return 1;
+    }
+    const double read_seconds = read_timer.seconds();
+
+    printf("%-9s %7.1fMB  %8.3fs  %8.3fs\n", extensions[e],
+           FileMegabytes(filename), write_seconds, read_seconds);
+    remove(filename.c_str());
+  }
+  return 0;
+}
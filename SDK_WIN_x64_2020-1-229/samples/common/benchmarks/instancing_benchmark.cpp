@@ -0,0 +1,165 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+// Builds the instanced meshes of a furnished model and flattens the same
+// model, and prints the time, the peak heap use and the size of the result
+// each way. The model is rooms of furniture: top level groups holding
+// instances of a few hundred definitions, some of them mirrored, each with
+// a nested group. The first argument is the number of instances (50000 by
+// default), the second the number of definitions (300).
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../xmlfile.h"
+#include "../xmlflattener.h"
+#include "../xmlinstancer.h"
+#include "./xmlbenchmark.h"
+
+using XmlBenchmark::CTimer;
+using XmlBenchmark::Megabytes;
+
+static const int kInstancesPerRoom = 100;
+
+static SUTransformation MakeTransform(double angle, double scale, double x,
+                                      double y, double z) {
+  const double c = cos(angle) * scale;
+  const double s = sin(angle) * scale;
+  SUTransformation transform = {
+    { c, s, 0.0, 0.0,
+      -s, c, 0.0, 0.0,
+      0.0, 0.0, scale, 0.0,
+      x, y, z, 1.0 }
+  };
+  return transform;
+}
+
+// A face of 'count' corners around (x, y, z)
+static XmlFaceInfo MakeFace(int count, double x, double y, double z) {
+  XmlFaceInfo face;
+  face.has_single_loop_ = true;
+  for (int i = 0; i < count; ++i) {
+    const double angle = 2.0 * 3.141592653589793 * i / count;
+    XmlFaceVertex vertex;
+    vertex.vertex_ =
+        XmlGeomUtils::CPoint3d(x + cos(angle), y + sin(angle), z);
+    face.vertices_.push_back(vertex);
+  }
+  return face;
+}
+
+static void BuildModel(XmlModelInfo& model_info, int instance_count,
+                       int definition_count) {
+  std::mt19937 random(22);
+  for (int i = 0; i < definition_count; ++i) {
+    model_info.definitions_.emplace_back();
+    XmlComponentDefinitionInfo& definition = model_info.definitions_.back();
+    definition.name_ = "Furniture " + std::to_string(i);
+    for (int j = 0; j < 12; ++j) {
+      definition.entities_.faces_.push_back(
+          MakeFace(4 + j % 3, 0.0, j * 0.5, i % 7 * 0.25));
+    }
+    definition.entities_.faces_.back().front_mat_name_ = "Fabric";
+    definition.entities_.groups_.emplace_back();
+    XmlGroupInfo& group = definition.entities_.groups_.back();
+    group.transform_ = MakeTransform(0.0, 1.0, 0.0, 0.0, -1.0);
+    for (int j = 0; j < 4; ++j) {
+      group.entities_->faces_.push_back(MakeFace(4, j, 0.0, 0.0));
+    }
+  }
+
+  std::uniform_int_distribution<int> pick(0, definition_count - 1);
+  std::uniform_real_distribution<double> angle(0.0, 6.283185307179586);
+  const char* materials[] = { "", "Oak", "Walnut", "Steel" };
+  for (int i = 0; i < instance_count; ++i) {
+    if (i % kInstancesPerRoom == 0) {
+      model_info.entities_.groups_.emplace_back();
+      model_info.entities_.groups_.back().transform_ =
+          MakeTransform(0.0, 1.0, i * 0.1, 0.0, 0.0);
+    }
+    XmlComponentInstanceInfo instance;
+    instance.definition_name_ =
+        model_info.definitions_[pick(random)].name_;
+    instance.material_name_ = materials[i % 4];
+    // Every tenth one mirrored
+    instance.transform_ = MakeTransform(angle(random),
+                                        i % 10 == 0 ? -1.0 : 1.0, i % 10,
+                                        i % 13, 0.0);
+    model_info.entities_.groups_.back().entities_->component_instances_
+        .push_back(instance);
+  }
+}
+
+static size_t BatchBytes(const XmlTriangleBatch& batch) {
+  return (batch.positions_.size() + batch.normals_.size() +
+          batch.texture_coords_.size()) * sizeof(double) +
+         batch.indices_.size() * sizeof(uint32_t);
+}
+
+static size_t Triangles(const XmlTriangleBatch& batch) {
+  return batch.indices_.size() / 3;
+}
+
+int main(int argc, char** argv) {
+  const int instance_count = argc > 1 ? atoi(argv[1]) : 50000;
+  const int definition_count = argc > 2 ? atoi(argv[2]) : 300;
+  if (instance_count < 1 || definition_count < 1)
+    return 1;
+  XmlModelInfo model_info;
+  BuildModel(model_info, instance_count, definition_count);
+  printf("%d instances of %d definitions\n", instance_count,
+         definition_count);
+  printf("            time      peak heap   result     triangles drawn\n");
+
+  {
+    XmlBenchmark::ResetPeakBytes();
+    const size_t before = XmlBenchmark::LiveBytes();
+    CTimer timer;
+    XmlInstancedModel model;
+    if (!CXmlInstancer().Build(model_info, model))
+      return 1;
+    const double seconds = timer.seconds();
+    const size_t peak = XmlBenchmark::PeakBytes() - before;
+    size_t bytes = 0;
+    size_t triangles = 0;
+    std::vector<size_t> mesh_triangles(model.meshes_.size(), 0);
+    for (size_t i = 0; i < model.meshes_.size(); ++i) {
+      for (size_t j = 0; j < model.meshes_[i].batches_.size(); ++j) {
+        bytes += BatchBytes(model.meshes_[i].batches_[j]);
+        mesh_triangles[i] += Triangles(model.meshes_[i].batches_[j]);
+      }
+    }
+    for (size_t i = 0; i < model.instance_sets_.size(); ++i) {
+      const XmlInstanceSet& set = model.instance_sets_[i];
+      bytes += set.transforms_.size() * sizeof(double);
+      triangles += mesh_triangles[set.mesh_] * (set.transforms_.size() / 16);
+    }
+    printf("instanced %7.3fs  %8.1fMB  %8.1fMB  %10zu\n", seconds,
+           Megabytes(peak), Megabytes(bytes), triangles);
+    printf("          %zu meshes, %zu instance sets\n", model.meshes_.size(),
+           model.instance_sets_.size());
+  }
+
+  {
+    XmlBenchmark::ResetPeakBytes();
+    const size_t before = XmlBenchmark::LiveBytes();
+    CTimer timer;
+    std::vector<XmlTriangleBatch> batches;
+    if (!CXmlFlattener().Flatten(model_info, batches))
+      return 1;
+    const double seconds = timer.seconds();
+    const size_t peak = XmlBenchmark::PeakBytes() - before;
+    size_t bytes = 0;
+    size_t triangles = 0;
+    for (size_t i = 0; i < batches.size(); ++i) {
+      bytes += BatchBytes(batches[i]);
+      triangles += Triangles(batches[i]);
+    }
+    printf("flattened %7.3fs  %8.1fMB  %8.1fMB  %10zu\n", seconds,
+           Megabytes(peak), Megabytes(bytes), triangles);
+  }
+  return 0;
+}
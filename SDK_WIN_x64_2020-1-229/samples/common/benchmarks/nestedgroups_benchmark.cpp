@@ -0,0 +1,111 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+// Reads models of deeply nested groups. Reading used to copy every nested
+// group once per level above it, so the time grew with the square of the
+// depth; it should now grow in step with the size of the file. The text of
+// a chain grows with the square of its depth too, from the indentation, so
+// compare the time per megabyte rather than per group.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "../xmlfile.h"
+#include "./xmlbenchmark.h"
+
+using XmlBenchmark::CTimer;
+using XmlBenchmark::Megabytes;
+
+static void AddFace(XmlEntitiesInfo& entities, double z) {
+  XmlFaceInfo face;
+  face.has_single_loop_ = true;
+  for (int i = 0; i < 4; ++i) {
+    XmlFaceVertex vertex;
+    vertex.vertex_ = XmlGeomUtils::CPoint3d(i & 1, i >> 1, z);
+    face.vertices_.push_back(vertex);
+  }
+  entities.faces_.push_back(face);
+}
+
+static const SUTransformation kIdentity = {
+  { 1.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0,
+    0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.0, 1.0 }
+};
+
+// 'width' groups in each group, 'depth' levels down, with a face in each
+static void AddGroups(XmlEntitiesInfo& entities, int width, int depth,
+                      size_t& count) {
+  AddFace(entities, depth);
+  if (depth == 0)
+    return;
+  for (int i = 0; i < width; ++i) {
+    entities.groups_.emplace_back();
+    entities.groups_.back().transform_ = kIdentity;
+    ++count;
+    AddGroups(*entities.groups_.back().entities_, width, depth - 1, count);
+  }
+}
+
+static double FileMegabytes(const std::string& filename) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (file == NULL)
+    return 0.0;
+  fseek(file, 0, SEEK_END);
+  const double size = Megabytes(ftell(file));
+  fclose(file);
+  return size;
+}
+
+static void Measure(const char* shape, int width, int depth) {
+  size_t group_count = 0;
+  std::string filename = "nestedgroups_benchmark.xml";
+  {
+    XmlModelInfo model_info;
+    AddGroups(model_info.entities_, width, depth, group_count);
+    CXmlFile file;
+    if (!file.Open(filename, CXmlFile::kWriteStreaming))
+      exit(1);
+    file.WriteHeader(20, 1, 229);
+    file.WriteModelInfo(model_info);
+    if (!file.Close(false))
+      exit(1);
+  }
+
+  const double file_size = FileMegabytes(filename);
+  const CXmlFile::ReadMode modes[] = {
+    CXmlFile::kReadStreaming, CXmlFile::kReadDom
+  };
+  const char* mode_names[] = { "streaming", "dom" };
+  for (int m = 0; m < 2; ++m) {
+    CXmlFile file;
+    XmlModelInfo model_info;
+    XmlBenchmark::ResetPeakBytes();
+    const size_t start_bytes = XmlBenchmark::LiveBytes();
+    CTimer timer;
+    bool ok = file.Open(filename, false, modes[m]) &&
+              file.GetModelInfo(model_info);
+    file.Close(false);
+    const double seconds = timer.seconds();
+    if (!ok)
+      exit(1);
+    printf("%-6s %5d x %-5d %8zu groups %8.1fMB  %-9s  %8.3fs  "
+           "%8.4fs/MB  peak %8.1fMB\n",
+           shape, width, depth, group_count, file_size, mode_names[m],
+           seconds, seconds / file_size,
+           Megabytes(XmlBenchmark::PeakBytes() - start_bytes));
+  }
+  remove(filename.c_str());
+}
+
+int main(int argc, char** argv) {
+  // The chains go deeper, and the tree wider, with a larger scale
+  const int scale = argc > 1 ? atoi(argv[1]) : 4;
+  printf("shape  width x depth            file\n");
+  for (int depth = 1000; depth <= 1000 * scale; depth *= 2) {
+    Measure("chain", 1, depth);
+  }
+  for (int depth = 3; depth <= 3 + scale; ++depth) {
+    Measure("tree", 6, depth);
+  }
+  return 0;
+}
@@ -0,0 +1,148 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+// Parses SkpToXML text with tinyxml2 and prints the throughput. The program
+// is built three times, like tinyxml2_scan_test: tinyxml2_benchmark with the
+// default scans (AVX2 where the CPU has it, else SSE2),
+// tinyxml2_sse2_benchmark with TIXML_NO_AVX2 and tinyxml2_scalar_benchmark
+// with TIXML_NO_SIMD. Run all three on the same input and compare.
+//
+// The input is the file given first, such as a large export, or else two
+// generated models of about 50 MB each at the default scale: one with
+// version 3 vertex elements, which is mostly tags and attributes, and one
+// with version 4 packed faces, which is mostly long text. The second
+// argument scales the generated models, the third is how many times each
+// is parsed; the best time is printed.
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "../tinyxml2.h"
+#include "./xmlbenchmark.h"
+
+using XmlBenchmark::CTimer;
+using XmlBenchmark::Megabytes;
+
+#if defined(TIXML_NO_SIMD)
+static const char* kBuild = "scalar";
+#elif defined(TIXML_NO_AVX2)
+static const char* kBuild = "sse2";
+#else
+static const char* kBuild = "default";
+#endif
+
+static void AppendNumber(double value, std::string& text) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.17g", value);
+  if (!text.empty() && text[text.size() - 1] != '>')
+    text += ' ';
+  text += buffer;
+}
+
+static void AppendVertex(double x, double y, double z, double u, double v,
+                         std::string& text) {
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer),
+           "<Vertex>\n<Point x=\"%.17g\" y=\"%.17g\" z=\"%.17g\"/>\n"
+           "<FrontTextureCoords u=\"%.17g\" v=\"%.17g\"/>\n</Vertex>\n",
+           x, y, z, u, v);
+  text += buffer;
+}
+
+// A grid of textured quads, each split into two triangles, in the layout
+// CXmlFile writes for 'xml_version'
+static std::string MakeDocument(int xml_version, int scale) {
+  std::mt19937 random(3);
+  std::uniform_real_distribution<double> height(0.0, 10.0);
+  std::string text;
+  text += "<SkpToXML xmlversion=\"" + std::to_string(xml_version) +
+          "\" skpversion=\"20.1.229\" units=\"inches\"/>\n";
+  text += "<Materials Count=\"1\">\n<Material Name=\"Brick &amp; Mortar\">\n"
+          "<Color red=\"200\" green=\"80\" blue=\"60\" alpha=\"255\"/>\n"
+          "</Material>\n</Materials>\n<Geometry>\n";
+  const int size = (xml_version >= 4 ? 310 : 225) * scale;
+  for (int row = 0; row < size; ++row) {
+    for (int column = 0; column < size; ++column) {
+      text += "<Face>\n<FrontMaterial Name=\"Brick &amp; Mortar\" "
+              "HasTexture=\"true\"/>\n<Layer Name=\"Layer0\"/>\n"
+              "<Triangles Count=\"2\">\n";
+      double corners[4][5];
+      for (int i = 0; i < 4; ++i) {
+        corners[i][0] = (column + (i & 1)) / 3.0;
+        corners[i][1] = (row + (i >> 1)) / 7.0;
+        corners[i][2] = height(random);
+        corners[i][3] = corners[i][0] * 0.25;
+        corners[i][4] = corners[i][1] * 0.25;
+      }
+      const int indices[] = { 0, 1, 3, 0, 3, 2 };
+      if (xml_version >= 4) {
+        std::string points, coords;
+        for (int i = 0; i < 4; ++i) {
+          for (int j = 0; j < 3; ++j)
+            AppendNumber(corners[i][j], points);
+          AppendNumber(corners[i][3], coords);
+          AppendNumber(corners[i][4], coords);
+        }
+        text += "<Points>" + points + "</Points>\n";
+        text += "<FrontTextureCoords>" + coords + "</FrontTextureCoords>\n";
+        text += "<Indices>0 1 3 0 3 2</Indices>\n";
+      } else {
+        for (int i = 0; i < 6; ++i) {
+          const double* corner = corners[indices[i]];
+          AppendVertex(corner[0], corner[1], corner[2], corner[3], corner[4],
+                       text);
+        }
+      }
+      text += "</Triangles>\n</Face>\n";
+    }
+  }
+  text += "</Geometry>\n";
+  return text;
+}
+
+static std::string ReadFile(const char* filename) {
+  std::string text;
+  FILE* file = fopen(filename, "rb");
+  if (file == NULL)
+    return text;
+  char buffer[64 * 1024];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    text.append(buffer, size);
+  fclose(file);
+  return text;
+}
+
+// Returns false if the text doesn't parse
+static bool Measure(const char* name, const std::string& text, int repeats) {
+  tinyxml2::XMLDocument doc;
+  double best = 0.0;
+  for (int i = 0; i < repeats; ++i) {
+    CTimer timer;
+    if (doc.Parse(text.data(), text.size()) != tinyxml2::XML_NO_ERROR)
+      return false;
+    const double seconds = timer.seconds();
+    if (i == 0 || seconds < best)
+      best = seconds;
+  }
+  printf("%-8s %-10s %8.1fMB  %8.3fs  %8.1fMB/s\n", kBuild, name,
+         Megabytes(text.size()), best, Megabytes(text.size()) / best);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const char* filename = argc > 1 && *argv[1] != 0 ? argv[1] : NULL;
+  const int scale = argc > 2 ? atoi(argv[2]) : 1;
+  const int repeats = argc > 3 ? atoi(argv[3]) : 5;
+  if (scale < 1 || repeats < 1)
+    return 1;
+
+  printf("build    input          size      best     throughput\n");
+  if (filename != NULL) {
+    const std::string text = ReadFile(filename);
+    return !text.empty() && Measure("file", text, repeats) ? 0 : 1;
+  }
+  return Measure("version 3", MakeDocument(3, scale), repeats) &&
+         Measure("version 4", MakeDocument(4, scale), repeats) ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmlbenchmark.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace XmlBenchmark {
+
+static std::atomic<size_t> live_bytes(0);
+static std::atomic<size_t> peak_bytes(0);
+
+size_t LiveBytes() {
+  return live_bytes;
+}
+
+size_t PeakBytes() {
+  return peak_bytes;
+}
+
+void ResetPeakBytes() {
+  peak_bytes = live_bytes.load();
+}
+
+// Every block starts with its size, in a header that keeps the block
+// aligned for any type
+union BlockHeader {
+  size_t size_;
+  max_align_t align_;
+};
+
+static void* Allocate(size_t size) {
+  BlockHeader* header =
+      static_cast<BlockHeader*>(malloc(sizeof(BlockHeader) + size));
+  if (header == NULL)
+    throw std::bad_alloc();
+  header->size_ = size;
+  const size_t live = live_bytes += size;
+  size_t peak = peak_bytes;
+  while (live > peak && !peak_bytes.compare_exchange_weak(peak, live)) {
+  }
+  return header + 1;
+}
+
+static void Free(void* block) {
+  if (block == NULL)
+    return;
+  BlockHeader* header = static_cast<BlockHeader*>(block) - 1;
+  live_bytes -= header->size_;
+  free(header);
+}
+
+} // end namespace XmlBenchmark
+
+void* operator new(size_t size) {
+  return XmlBenchmark::Allocate(size);
+}
+
+void* operator new[](size_t size) {
+  return XmlBenchmark::Allocate(size);
+}
+
+void operator delete(void* block) noexcept {
+  XmlBenchmark::Free(block);
+}
+
+void operator delete[](void* block) noexcept {
+  XmlBenchmark::Free(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+  XmlBenchmark::Free(block);
+}
+
+void operator delete[](void* block, size_t) noexcept {
+  XmlBenchmark::Free(block);
+}
@@ -0,0 +1,40 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_BENCHMARKS_XMLBENCHMARK_H
+#define SKPTOXML_COMMON_BENCHMARKS_XMLBENCHMARK_H
+
+#include <stddef.h>
+#include <chrono>
+
+// Helpers for the benchmark programs. Each program replaces the global
+// operator new through xmlbenchmark.cpp, so it can tell how much memory a
+// piece of code allocates on the heap.
+
+namespace XmlBenchmark {
+
+class CTimer {
+ public:
+  CTimer() : start_(std::chrono::steady_clock::now()) {}
+
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start_).count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Heap bytes allocated and not yet freed
+size_t LiveBytes();
+// The most LiveBytes has been since the last ResetPeakBytes
+size_t PeakBytes();
+void ResetPeakBytes();
+
+inline double Megabytes(size_t bytes) {
+  return bytes / (1024.0 * 1024.0);
+}
+
+} // end namespace XmlBenchmark
+
+#endif // SKPTOXML_COMMON_BENCHMARKS_XMLBENCHMARK_H
@@ -0,0 +1,104 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <locale.h>
+#include <cstdlib>
+#include <string>
+
+#include "../tinyxml2.h"
+#include "./xmltest.h"
+
+using tinyxml2::XMLUtil;
+
+namespace {
+
+// Switches LC_NUMERIC to a locale whose decimal point is a comma for as
+// long as it lives, if one is installed
+class CCommaLocale {
+ public:
+  CCommaLocale() : active_(false) {
+    const char* locales[] = {
+      "de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8",
+      "fr_FR", "German", "French"
+    };
+    for (size_t i = 0; !active_ && i < sizeof(locales) / sizeof(*locales);
+         ++i) {
+      active_ = setlocale(LC_NUMERIC, locales[i]) != NULL &&
+                std::string(localeconv()->decimal_point) == ",";
+    }
+    if (!active_)
+      setlocale(LC_NUMERIC, "C");
+  }
+  ~CCommaLocale() { setlocale(LC_NUMERIC, "C"); }
+
+  bool active() const { return active_; }
+
+ private:
+  bool active_;
+};
+
+std::string Format(double value) {
+  char buffer[64];
+  XMLUtil::ToStr(value, buffer, sizeof(buffer));
+  return buffer;
+}
+
+} // end namespace
+
+// Neither direction depends on the locale's decimal point
+XML_TEST(IgnoresLocale) {
+  CCommaLocale locale;
+  if (!locale.active())
+    XML_SKIP("no locale with a decimal comma is installed");
+  // The C library does follow it, so this would catch a parser using it
+  XML_EXPECT_EQ(1.0, strtod("1.5", NULL));
+
+  double value = 0.0;
+  XML_EXPECT(XMLUtil::ToDouble("1.5", &value));
+  XML_EXPECT_EQ(1.5, value);
+  // Past the fast paths, to the slow one
+  XML_EXPECT(XMLUtil::ToDouble("1.00000000000000000000000000001", &value));
+  XML_EXPECT_EQ(1.0, value);
+  XML_EXPECT(XMLUtil::ToDouble("2.5e-310", &value));
+  XML_EXPECT_EQ(2.5e-310, value);
+  // Like sscanf in the C locale, the number ends at the comma
+  XML_EXPECT(XMLUtil::ToDouble("1,5", &value));
+  XML_EXPECT_EQ(1.0, value);
+
+  XML_EXPECT_EQ(std::string("0.25"), Format(0.25));
+  XML_EXPECT_EQ(std::string("0.1"), Format(0.1));
+  XML_EXPECT_EQ(std::string("1.2345678901234567e+300"),
+                Format(1.2345678901234567e300));
+
+  // And so neither do the attributes of a document
+  tinyxml2::XMLDocument doc;
+  tinyxml2::XMLElement* element = doc.NewElement("Point");
+  doc.InsertEndChild(element);
+  element->SetAttribute("x", -1.0 / 3.0);
+  tinyxml2::XMLPrinter printer;
+  doc.Print(&printer);
+  XML_EXPECT(std::string(printer.CStr()).find(',') == std::string::npos);
+  tinyxml2::XMLDocument parsed;
+  XML_ASSERT(parsed.Parse(printer.CStr()) == tinyxml2::XML_NO_ERROR);
+  XML_EXPECT(parsed.FirstChildElement("Point")->DoubleAttribute("x") ==
+             -1.0 / 3.0);
+}
+
+// Numbers longer than any fixed buffer reach strtod whole, trailing
+// exponent included
+XML_TEST(LongNumbersAreReadWhole) {
+  CCommaLocale locale;
+  if (!locale.active())
+    XML_SKIP("no locale with a decimal comma is installed");
+  const std::string zeros(300, '0');
+  double value = 0.0;
+  XML_EXPECT(XMLUtil::ToDouble(("1." + zeros + "e5").c_str(), &value));
+  XML_EXPECT_EQ(1e5, value);
+  XML_EXPECT(XMLUtil::ToDouble(("1" + zeros + "e-300").c_str(), &value));
+  XML_EXPECT_EQ(1.0, value);
+  XML_EXPECT(XMLUtil::ToDouble(("-0." + zeros + "25e301").c_str(), &value));
+  XML_EXPECT_EQ(-2.5, value);
+  // The slow path parses exactly
+  XML_EXPECT(XMLUtil::ToDouble(("9007199254740993." + zeros + "1").c_str(),
+                               &value));
+  XML_EXPECT_EQ(9007199254740994.0, value);
+}
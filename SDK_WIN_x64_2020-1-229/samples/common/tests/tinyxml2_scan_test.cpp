@@ -0,0 +1,330 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+// Parses random documents whose DOM is known, so the block scans of the
+// tokenizer are checked against what the text says. The program is built
+// three times: with the default scans, with TIXML_NO_AVX2 and with
+// TIXML_NO_SIMD, and each build must give the same DOM.
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../tinyxml2.h"
+#include "./xmltest.h"
+
+namespace {
+
+// A node as the generator wrote it, and as it must read back
+struct Node {
+  enum Type { kElement, kText, kCData, kComment };
+
+  Type type_;
+  // Element name, or the text of the other nodes
+  std::string value_;
+  std::vector<std::pair<std::string, std::string> > attributes_;
+  std::vector<Node> children_;
+};
+
+// Writes random documents. Token lengths go past the 16 and 32 byte blocks
+// of the scans, and the special characters land anywhere in a block.
+class CDocumentWriter {
+ public:
+  CDocumentWriter(unsigned seed, bool process_entities)
+    : random_(seed), process_entities_(process_entities) {}
+
+  // A document of one root element, and its DOM in 'root'
+  std::string Write(Node& root);
+
+ private:
+  int Next(int count) { return static_cast<int>(random_() % count); }
+
+  void WriteElement(int depth, Node& node);
+  void WriteSpace(bool required);
+  std::string Name();
+  // Text up to 'max_length' chars that needs no escaping in the document,
+  // with the text it reads back as in 'value'
+  void WriteText(int max_length, char quote, std::string& value);
+  // Markup text read back as written but for line ends, which mustn't
+  // hold 'end'
+  void WriteRaw(int max_length, const char* end, std::string& value);
+
+  // tinyxml2 reads "\n\r" as one line end, which the pieces don't expect
+  bool LineFeedThenReturn(const char* piece) const {
+    return piece[0] == '\r' && !text_.empty() && text_.back() == '\n';
+  }
+
+  std::mt19937 random_;
+  bool process_entities_;
+  std::string text_;
+};
+
+std::string CDocumentWriter::Write(Node& root) {
+  text_.clear();
+  if (Next(4) == 0)
+    text_ += "<?xml version=\"1.0\"?>\n";
+  WriteElement(0, root);
+  WriteSpace(false);
+  return text_;
+}
+
+void CDocumentWriter::WriteSpace(bool required) {
+  static const char* kSpaces[] = { " ", "\t", "\n", "\r\n", "  " };
+  const int count = Next(4) == 0 ? Next(40) : Next(3);
+  if (required && count == 0)
+    text_ += ' ';
+  for (int i = 0; i < count; ++i) {
+    text_ += kSpaces[Next(5)];
+  }
+}
+
+std::string CDocumentWriter::Name() {
+  static const char kStart[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_:";
+  static const char kRest[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_:0123456789-.";
+  std::string name(1, kStart[Next(sizeof(kStart) - 1)]);
+  const int length = Next(3) == 0 ? Next(70) : Next(10);
+  for (int i = 0; i < length; ++i) {
+    if (Next(20) == 0)
+      name += "\xc3\xa9";  // UTF-8 bytes count as name characters
+    else
+      name += kRest[Next(sizeof(kRest) - 1)];
+  }
+  return name;
+}
+
+void CDocumentWriter::WriteText(int max_length, char quote,
+                                std::string& value) {
+  struct Piece {
+    const char* text_;
+    const char* value_;
+  };
+  static const Piece kPieces[] = {
+    { "&amp;", "&" }, { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" },
+    { "&apos;", "'" }, { "&#65;", "A" }, { "&#x42;", "B" },
+    { "\r\n", "\n" }, { "\r ", "\n " }, { "\n", "\n" }, { "\t", "\t" },
+    { ">", ">" }, { "]]", "]]" }, { "-", "-" }, { "\xc3\xa9", "\xc3\xa9" },
+    { "\"", "\"" }, { "'", "'" }
+  };
+  const int piece_count = sizeof(kPieces) / sizeof(*kPieces);
+  const int length = 1 + Next(max_length);
+  // Mostly plain runs, so some texts have nothing to translate at all
+  const bool plain = Next(3) == 0;
+  for (int i = 0; i < length; ++i) {
+    if (plain || Next(6) != 0) {
+      const char c = static_cast<char>(Next(3) == 0 ? ' ' : 'a' + Next(26));
+      text_ += c;
+      value += c;
+      continue;
+    }
+    const Piece& piece = kPieces[Next(piece_count)];
+    if ((piece.text_[0] == quote && piece.text_[1] == 0) ||
+        LineFeedThenReturn(piece.text_))
+      continue;
+    text_ += piece.text_;
+    const bool entity = piece.text_[0] == '&';
+    value += entity && !process_entities_ ? piece.text_ : piece.value_;
+  }
+}
+
+void CDocumentWriter::WriteRaw(int max_length, const char* end,
+                               std::string& value) {
+  static const char* kPieces[] = {
+    "a", "b", " ", "-", ">", "]", "&", "<", "\t", "\n", "\r\n", "\xc3\xa9"
+  };
+  const int length = Next(max_length);
+  const size_t start = text_.size();
+  for (int i = 0; i < length; ++i) {
+    const char* piece = kPieces[Next(12)];
+    if (LineFeedThenReturn(piece))
+      continue;
+    text_ += piece;
+    // The end of the markup mustn't come early
+    if (text_.find(end, start) != std::string::npos) {
+      text_.resize(text_.size() - strlen(piece));
+      continue;
+    }
+    value += strcmp(piece, "\r\n") == 0 ? "\n" : piece;
+  }
+}
+
+void CDocumentWriter::WriteElement(int depth, Node& node) {
+  node.type_ = Node::kElement;
+  node.value_ = Name();
+  text_ += '<';
+  text_ += node.value_;
+  const int attribute_count = Next(5);
+  for (int i = 0; i < attribute_count; ++i) {
+    std::string name = Name() + std::to_string(i);
+    WriteSpace(true);
+    text_ += name;
+    WriteSpace(false);
+    text_ += '=';
+    WriteSpace(false);
+    const char quote = Next(2) ? '"' : '\'';
+    text_ += quote;
+    std::string value;
+    if (Next(8) != 0)
+      WriteText(Next(2) ? 12 : 90, quote, value);
+    text_ += quote;
+    node.attributes_.push_back(std::make_pair(name, value));
+  }
+  WriteSpace(false);
+  const int child_count = depth < 4 ? Next(6) : 0;
+  if (child_count == 0 && Next(2)) {
+    text_ += "/>";
+    return;
+  }
+  text_ += '>';
+
+  bool last_text = false;
+  for (int i = 0; i < child_count; ++i) {
+    node.children_.push_back(Node());
+    Node& child = node.children_.back();
+    const int type = Next(8);
+    if (type < 3 && !last_text) {
+      // Texts start and end with a letter, so no white space rules apply
+      child.type_ = Node::kText;
+      text_ += 'x';
+      child.value_ = "x";
+      WriteText(Next(2) ? 14 : 120, 0, child.value_);
+      text_ += 'y';
+      child.value_ += 'y';
+      last_text = true;
+      continue;
+    }
+    last_text = false;
+    if (type == 3) {
+      child.type_ = Node::kCData;
+      text_ += "<![CDATA[";
+      WriteRaw(Next(2) ? 10 : 80, "]]>", child.value_);
+      text_ += "]]>";
+    } else if (type == 4) {
+      child.type_ = Node::kComment;
+      text_ += "<!--";
+      WriteRaw(Next(2) ? 10 : 80, "-->", child.value_);
+      text_ += "-->";
+    } else {
+      WriteElement(depth + 1, child);
+    }
+  }
+  text_ += "</";
+  text_ += node.value_;
+  text_ += '>';
+}
+
+// A readable form of a DOM, for comparing one with the other
+void Describe(const Node& node, std::string& text) {
+  switch (node.type_) {
+    case Node::kElement:
+      text += "<" + node.value_;
+      for (size_t i = 0; i < node.attributes_.size(); ++i) {
+        text += " " + node.attributes_[i].first + "=[" +
+                node.attributes_[i].second + "]";
+      }
+      text += ">";
+      for (size_t i = 0; i < node.children_.size(); ++i) {
+        Describe(node.children_[i], text);
+      }
+      text += "</>";
+      break;
+    case Node::kText:
+      text += "[" + node.value_ + "]";
+      break;
+    case Node::kCData:
+      text += "[CDATA " + node.value_ + "]";
+      break;
+    case Node::kComment:
+      text += "[Comment " + node.value_ + "]";
+      break;
+  }
+}
+
+void Describe(const tinyxml2::XMLNode* node, std::string& text) {
+  if (const tinyxml2::XMLElement* element = node->ToElement()) {
+    text += std::string("<") + element->Name();
+    for (const tinyxml2::XMLAttribute* attribute = element->FirstAttribute();
+         attribute != NULL; attribute = attribute->Next()) {
+      text += std::string(" ") + attribute->Name() + "=[" +
+              attribute->Value() + "]";
+    }
+    text += ">";
+    for (const tinyxml2::XMLNode* child = node->FirstChild(); child != NULL;
+         child = child->NextSibling()) {
+      Describe(child, text);
+    }
+    text += "</>";
+  } else if (const tinyxml2::XMLText* text_node = node->ToText()) {
+    text += std::string(text_node->CData() ? "[CDATA " : "[") +
+            text_node->Value() + "]";
+  } else if (node->ToComment() != NULL) {
+    text += std::string("[Comment ") + node->Value() + "]";
+  }
+}
+
+void CheckDocuments(unsigned seed, bool process_entities) {
+  CDocumentWriter writer(seed, process_entities);
+  for (int i = 0; i < 4000; ++i) {
+    Node root;
+    const std::string text = writer.Write(root);
+    std::string expected;
+    Describe(root, expected);
+
+    // An allocation of just the text, so reads past it would be caught
+    std::vector<char> buffer(text.begin(), text.end());
+    tinyxml2::XMLDocument doc(process_entities);
+    if (doc.Parse(buffer.data(), buffer.size()) != tinyxml2::XML_NO_ERROR ||
+        doc.RootElement() == NULL) {
+      XmlTest::Fail(__FILE__, __LINE__, "can't parse " + text);
+      return;
+    }
+    std::string actual;
+    Describe(doc.RootElement(), actual);
+    if (actual != expected) {
+      XmlTest::Fail(__FILE__, __LINE__, "parsed\n" + text + "\nas\n" +
+                    actual + "\ninstead of\n" + expected);
+      return;
+    }
+
+    // Cut off anywhere, the scans still stop at the end of the text. This
+    // tinyxml2 accepts some unclosed elements, so either result will do.
+    const size_t cut = static_cast<size_t>(seed + i) % text.size();
+    std::vector<char> cut_buffer(text.begin(), text.begin() + cut);
+    tinyxml2::XMLDocument cut_doc(process_entities);
+    cut_doc.Parse(cut_buffer.data(), cut_buffer.size());
+  }
+}
+
+} // end namespace
+
+XML_TEST(ParsesRandomDocuments) {
+  CheckDocuments(14, true);
+}
+
+XML_TEST(ParsesRandomDocumentsLeavingEntities) {
+  CheckDocuments(41, false);
+}
+
+// Text without anything to translate is handed out in place, the rest
+// is translated
+XML_TEST(TranslatesOnlyWhatNeedsIt) {
+  const char* texts[] = {
+    "<a>plain text well past one block of thirty-two bytes</a>",
+    "<a>an entity &amp; past the first block of thirty-two bytes</a>",
+    "<a>a line end\r\nafter the first block of sixteen</a>",
+    "<a>0123456789abcdefghijklmnopqrstuvwxyz0123456789&lt;</a>",
+  };
+  const char* values[] = {
+    "plain text well past one block of thirty-two bytes",
+    "an entity & past the first block of thirty-two bytes",
+    "a line end\nafter the first block of sixteen",
+    "0123456789abcdefghijklmnopqrstuvwxyz0123456789<",
+  };
+  for (int i = 0; i < 4; ++i) {
+    tinyxml2::XMLDocument doc;
+    XML_ASSERT(doc.Parse(texts[i]) == tinyxml2::XML_NO_ERROR);
+    XML_EXPECT_EQ(std::string(values[i]),
+                  std::string(doc.RootElement()->GetText()));
+  }
+}
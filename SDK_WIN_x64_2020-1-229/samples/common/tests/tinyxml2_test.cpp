@@ -0,0 +1,437 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <stdint.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../tinyxml2.h"
+#include "./xmltest.h"
+
+using tinyxml2::XMLUtil;
+
+static uint64_t Bits(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static double FromBits(uint64_t bits) {
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static std::string Format(double value) {
+  char buffer[64];
+  XMLUtil::ToStr(value, buffer, sizeof(buffer));
+  return buffer;
+}
+
+// The shortest digits that read back as 'value', laid out the way ToStr
+// promises: fixed for decimal exponents from -4 to 15, else scientific
+static std::string Shortest(double value) {
+  char buffer[64];
+  int precision = 1;
+  for (; precision < 17; ++precision) {
+    snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, value);
+    if (strtod(buffer, NULL) == value)
+      break;
+  }
+  snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, value);
+  std::string text = buffer;
+  const size_t e = text.find('e');
+  const int exponent = atoi(text.c_str() + e + 1);
+  std::string sign = text[0] == '-' ? "-" : "";
+  std::string digits;
+  for (size_t i = sign.size(); i < e; ++i) {
+    if (text[i] != '.')
+      digits += text[i];
+  }
+  while (digits.size() > 1 && digits[digits.size() - 1] == '0') {
+    digits.erase(digits.size() - 1);
+  }
+  const int point = exponent + 1;
+  const int length = static_cast<int>(digits.size());
+  if (exponent < -4 || exponent > 15) {
+    snprintf(buffer, sizeof(buffer), "e%c%02d", exponent < 0 ? '-' : '+',
+             exponent < 0 ? -exponent : exponent);
+    return sign + digits.substr(0, 1) +
+           (length > 1 ? "." + digits.substr(1) : "") + buffer;
+  }
+  if (point <= 0)
+    return sign + "0." + std::string(-point, '0') + digits;
+  if (point >= length)
+    return sign + digits + std::string(point - length, '0');
+  return sign + digits.substr(0, point) + "." + digits.substr(point);
+}
+
+// Parses like strtod, whichever path the text takes
+static void ExpectParsesLikeStrtod(const char* text) {
+  char* end = NULL;
+  const double expected = strtod(text, &end);
+  double actual = -1.0;
+  const bool parsed = XMLUtil::ToDouble(text, &actual);
+  if (parsed != (end != text)) {
+    XmlTest::Fail(__FILE__, __LINE__, std::string("parsed ") + text);
+  } else if (parsed && Bits(expected) != Bits(actual)) {
+    XmlTest::Fail(__FILE__, __LINE__, std::string(text) + ": expected " +
+                  XmlTest::Describe(expected) + ", got " +
+                  XmlTest::Describe(actual));
+  }
+}
+
+XML_TEST(ParsesEdgeCasesLikeStrtod) {
+  const char* texts[] = {
+    "0", "-0", "+0.0", "1", "-1", "0.1", "0.3", "1.5", "123456.789",
+    "  42", "\t-7.25", "3.5abc", "1e5", "1E+5", "1e-5", "2.5e-3x",
+    ".5", "5.", "-.125",
+    // Exact only with 128 bit products, or on the boundary of two doubles
+    "9007199254740993", "9007199254740992.5", "0.1000000000000000055511151231257827",
+    "1.7976931348623157e308", "1.7976931348623158e308", "1e308", "1e309",
+    "2.2250738585072014e-308", "2.2250738585072011e-308", "4.9e-324",
+    "5e-324", "2.4703282292062328e-324", "1e-400", "123e-330",
+    // More digits than fit a 64 bit mantissa, hex, and not numbers
+    "1234567890123456789012345678901234567890",
+    "0.000000000000000000000000000000123456789012345678901234567890",
+    "0x1.8p1", "inf", "-Infinity", "nan", "", "abc", "-", "e5", "."
+  };
+  for (size_t i = 0; i < sizeof(texts) / sizeof(*texts); ++i) {
+    ExpectParsesLikeStrtod(texts[i]);
+  }
+}
+
+XML_TEST(ParsesRandomDecimalsLikeStrtod) {
+  std::mt19937_64 random(13);
+  char text[64];
+  for (int i = 0; i < 200000; ++i) {
+    const uint64_t mantissa = random() >> (random() % 64);
+    const int digits = static_cast<int>(random() % 20);
+    const int exponent = static_cast<int>(random() % 700) - 350;
+    snprintf(text, sizeof(text), "%s%llu.%0*llue%d", i % 2 ? "-" : "",
+             static_cast<unsigned long long>(mantissa % 1000000000000ull),
+             digits > 0 ? digits : 1,
+             static_cast<unsigned long long>(mantissa % 1000000000ull),
+             exponent);
+    ExpectParsesLikeStrtod(text);
+  }
+}
+
+XML_TEST(FormatsShortestDigits) {
+  const double values[] = {
+    0.1, 0.3, 1.5, -2.0, 100.0, 123456.0, 1234567.0, 1e16, 1e21, 1e22,
+    1e-4, 1e-5, 0.000123, -1.25e-7, 3.141592653589793, 1.0 / 3.0,
+    2.0 / 3.0, 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308,
+    9007199254740993.0, 0.1 + 0.2, 1e300 * 10.0
+  };
+  for (size_t i = 0; i < sizeof(values) / sizeof(*values); ++i) {
+    XML_EXPECT_EQ(Shortest(values[i]), Format(values[i]));
+  }
+  XML_EXPECT_EQ(std::string("0"), Format(0.0));
+  XML_EXPECT_EQ(std::string("-0"), Format(-0.0));
+}
+
+// Every double reads back bit for bit from what is written, both with
+// ToDouble and with strtod, and is written in the shortest digits unless
+// Grisu2 misses them
+XML_TEST(FormattedRandomDoublesRoundTrip) {
+  std::mt19937_64 random(17);
+  int longer = 0;
+  const int count = 300000;
+  for (int i = 0; i < count; ++i) {
+    // Random bit patterns, and numbers in the range of coordinates
+    double value = i % 2 ? FromBits(random())
+                         : (static_cast<double>(random() % 2000000001) -
+                            1000000000.0) / 1e6;
+    if (value != value || value - value != 0)
+      continue;
+    const std::string text = Format(value);
+    double parsed = 0.0;
+    XML_ASSERT(XMLUtil::ToDouble(text.c_str(), &parsed));
+    if (Bits(parsed) != Bits(value) ||
+        Bits(strtod(text.c_str(), NULL)) != Bits(value)) {
+      XmlTest::Fail(__FILE__, __LINE__, text + " doesn't read back as " +
+                    Shortest(value));
+      return;
+    }
+    // Of the shortest digits that read back, Grisu2 may pick another last
+    // digit than printf does
+    if (text.size() > Shortest(value).size())
+      ++longer;
+  }
+  // Grisu2 misses the shortest digits about 0.1% of the time, when they
+  // lie too close to the boundary of the values that read back
+  XML_EXPECT(longer < count / 200);
+}
+
+// 'value' and the two doubles on either side of it, short of infinity
+static void AddNeighbours(double value, std::vector<double>& values) {
+  const double inf = std::numeric_limits<double>::infinity();
+  double down = value;
+  double up = value;
+  values.push_back(value);
+  for (int i = 0; i < 2; ++i) {
+    down = std::nextafter(down, -inf);
+    up = std::nextafter(up, inf);
+    if (down != -inf)
+      values.push_back(down);
+    if (up != inf)
+      values.push_back(up);
+  }
+}
+
+// Doubles at the edges of the format round trip, and their 17 digits parse
+// like strtod: every power of two, the limits of the subnormals, the
+// normals and the largest double, and the doubles around every power of ten
+XML_TEST(BoundaryDoublesRoundTrip) {
+  std::vector<double> values;
+  for (int e = -1074; e <= 1023; ++e) {
+    AddNeighbours(std::ldexp(1.0, e), values);
+  }
+  const uint64_t limits[] = {
+    0, 1, 2, 0x000FFFFFFFFFFFFEull, 0x000FFFFFFFFFFFFFull,
+    0x0010000000000000ull, 0x7FEFFFFFFFFFFFFFull
+  };
+  for (size_t i = 0; i < sizeof(limits) / sizeof(*limits); ++i) {
+    AddNeighbours(FromBits(limits[i]), values);
+  }
+  char text[64];
+  for (int k = -324; k <= 308; ++k) {
+    snprintf(text, sizeof(text), "1e%d", k);
+    ExpectParsesLikeStrtod(text);
+    AddNeighbours(strtod(text, NULL), values);
+  }
+
+  size_t failures = 0;
+  for (size_t i = 0; i < values.size(); ++i) {
+    for (int sign = 0; sign < 2; ++sign) {
+      const double value = sign ? -values[i] : values[i];
+      const std::string formatted = Format(value);
+      double parsed = 0.0;
+      if (!XMLUtil::ToDouble(formatted.c_str(), &parsed) ||
+          Bits(parsed) != Bits(value) ||
+          Bits(strtod(formatted.c_str(), NULL)) != Bits(value)) {
+        if (failures++ == 0)
+          XmlTest::Fail(__FILE__, __LINE__, formatted +
+                        " doesn't read back as " + Shortest(value));
+      }
+      snprintf(text, sizeof(text), "%.16e", value);
+      ExpectParsesLikeStrtod(text);
+    }
+  }
+  XML_EXPECT_EQ(static_cast<size_t>(0), failures);
+}
+
+XML_TEST(NonFiniteAndSmallBuffers) {
+  char buffer[64];
+  XMLUtil::ToStr(std::numeric_limits<double>::infinity(), buffer,
+                 sizeof(buffer));
+  XML_EXPECT_EQ(std::string("inf"), std::string(buffer));
+  XMLUtil::ToStr(-std::numeric_limits<double>::infinity(), buffer,
+                 sizeof(buffer));
+  XML_EXPECT_EQ(std::string("-inf"), std::string(buffer));
+  // Too small for the shortest digits, it falls back to %g
+  char small[16];
+  XMLUtil::ToStr(1.0 / 3.0, small, sizeof(small));
+  XML_EXPECT_EQ(std::string("0.333333"), std::string(small));
+}
+
+// Attributes written through the DOM keep every bit
+XML_TEST(DoubleAttributesRoundTrip) {
+  const double values[] = {
+    0.1, -1.0 / 3.0, 1e-300, 6.02214076e23, 123456.78901234567
+  };
+  tinyxml2::XMLDocument doc;
+  tinyxml2::XMLElement* element = doc.NewElement("Point");
+  doc.InsertEndChild(element);
+  char name[8];
+  for (int i = 0; i < 5; ++i) {
+    snprintf(name, sizeof(name), "v%d", i);
+    element->SetAttribute(name, values[i]);
+  }
+  tinyxml2::XMLPrinter printer;
+  doc.Print(&printer);
+
+  tinyxml2::XMLDocument parsed;
+  XML_ASSERT(parsed.Parse(printer.CStr()) == tinyxml2::XML_NO_ERROR);
+  const tinyxml2::XMLElement* point = parsed.FirstChildElement("Point");
+  XML_ASSERT(point != NULL);
+  for (int i = 0; i < 5; ++i) {
+    snprintf(name, sizeof(name), "v%d", i);
+    double value = 0.0;
+    XML_EXPECT(point->QueryDoubleAttribute(name, &value) ==
+               tinyxml2::XML_NO_ERROR);
+    XML_EXPECT_EQ(Bits(values[i]), Bits(value));
+  }
+}
+
+namespace tinyxml2 {
+
+class XMLDocumentTester {
+ public:
+  static const char* CharBuffer(const XMLDocument& doc) {
+    return doc._charBuffer;
+  }
+};
+
+} // end namespace tinyxml2
+
+namespace {
+
+// SCAN_PADDING in tinyxml2.cpp
+const size_t kScanPadding = 32;
+
+// A document of 'count' elements with an attribute and some text each
+std::string MakeDocument(int count) {
+  std::string text = "<Model>";
+  for (int i = 0; i < count; ++i) {
+    text += "<Face n=\"" + std::to_string(i) + "\">text " +
+            std::to_string(i) + "</Face><!-- " + std::to_string(i) + " -->";
+  }
+  return text + "</Model>";
+}
+
+std::string Print(tinyxml2::XMLDocument& doc) {
+  tinyxml2::XMLPrinter printer;
+  doc.Print(&printer);
+  return printer.CStr();
+}
+
+// The text buffer is followed by the terminator and zeroed padding
+bool IsPadded(const tinyxml2::XMLDocument& doc, size_t size) {
+  const char* buffer = tinyxml2::XMLDocumentTester::CharBuffer(doc);
+  for (size_t i = size; i < size + 1 + kScanPadding; ++i) {
+    if (buffer[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+} // end namespace
+
+// A cleared pool hands out its items from the first block again, and only
+// adds blocks of the size set for new ones
+XML_TEST(PoolClearKeepsBlocks) {
+  typedef tinyxml2::MemPoolT<16> Pool;
+  Pool pool;
+  XML_EXPECT_EQ(static_cast<int>(Pool::COUNT) * 16, pool.BlockSize());
+  std::vector<void*> items;
+  for (int i = 0; i < 3 * Pool::COUNT; ++i) {
+    items.push_back(pool.Alloc());
+  }
+  XML_EXPECT_EQ(3, pool.Blocks());
+  XML_EXPECT_EQ(static_cast<size_t>(3 * Pool::COUNT * 16),
+                pool.ReservedBytes());
+
+  pool.Clear();
+  XML_EXPECT_EQ(0, pool.CurrentAllocs());
+  XML_EXPECT(pool.Alloc() == items[0]);
+  for (int i = 1; i < 3 * Pool::COUNT; ++i) {
+    pool.Alloc();
+  }
+  XML_EXPECT_EQ(3, pool.Blocks());
+  XML_EXPECT_EQ(3 * Pool::COUNT, pool.MaxAllocs());
+
+  // Blocks of 10 items from now on, the old ones stay as they are
+  pool.SetBlockSize(160);
+  XML_EXPECT_EQ(160, pool.BlockSize());
+  for (int i = 0; i < 25; ++i) {
+    pool.Alloc();
+  }
+  XML_EXPECT_EQ(6, pool.Blocks());
+  XML_EXPECT_EQ(static_cast<size_t>((3 * Pool::COUNT + 30) * 16),
+                pool.ReservedBytes());
+
+  // At least one item a block, and back to the default
+  pool.SetBlockSize(1);
+  XML_EXPECT_EQ(16, pool.BlockSize());
+  pool.SetBlockSize(0);
+  XML_EXPECT_EQ(static_cast<int>(Pool::COUNT) * 16, pool.BlockSize());
+}
+
+// Parsing again after Reset reuses the pool blocks and the buffer, and
+// reads the same DOM as a new document
+XML_TEST(ResetDocumentParsesAgain) {
+  const std::string text = MakeDocument(500);
+  tinyxml2::XMLDocument fresh;
+  XML_ASSERT(fresh.Parse(text.c_str()) == tinyxml2::XML_NO_ERROR);
+
+  tinyxml2::XMLDocument doc;
+  XML_ASSERT(doc.Parse(text.c_str()) == tinyxml2::XML_NO_ERROR);
+  tinyxml2::XMLMemoryStats first;
+  doc.GetMemoryStats(&first);
+  XML_EXPECT(first.poolBlocks > 4);
+  XML_EXPECT(first.charBufferBytes >= text.size() + 1 + kScanPadding);
+  XML_EXPECT(first.reservedPoolBytes >= first.peakPoolBytes);
+
+  doc.Reset();
+  XML_EXPECT(doc.FirstChild() == NULL);
+  XML_ASSERT(doc.Parse(text.c_str()) == tinyxml2::XML_NO_ERROR);
+  tinyxml2::XMLMemoryStats second;
+  doc.GetMemoryStats(&second);
+  XML_EXPECT_EQ(first.poolBlocks, second.poolBlocks);
+  XML_EXPECT_EQ(first.reservedPoolBytes, second.reservedPoolBytes);
+  XML_EXPECT_EQ(first.peakPoolBytes, second.peakPoolBytes);
+  XML_EXPECT_EQ(first.charBufferBytes, second.charBufferBytes);
+  XML_EXPECT(IsPadded(doc, text.size()));
+  XML_EXPECT(Print(doc) == Print(fresh));
+
+  // Parse resets by itself, and a smaller document keeps the buffer
+  const std::string small = MakeDocument(3);
+  XML_ASSERT(doc.Parse(small.c_str()) == tinyxml2::XML_NO_ERROR);
+  doc.GetMemoryStats(&second);
+  XML_EXPECT_EQ(first.charBufferBytes, second.charBufferBytes);
+  XML_EXPECT(IsPadded(doc, small.size()));
+  tinyxml2::XMLDocument fresh_small;
+  XML_ASSERT(fresh_small.Parse(small.c_str()) == tinyxml2::XML_NO_ERROR);
+  XML_EXPECT(Print(doc) == Print(fresh_small));
+
+  // Clear gives everything back
+  doc.Clear();
+  doc.GetMemoryStats(&second);
+  XML_EXPECT_EQ(static_cast<size_t>(0), second.charBufferBytes);
+}
+
+// A larger document grows the buffer, padding included
+XML_TEST(LargerDocumentGrowsBuffer) {
+  const std::string small = MakeDocument(10);
+  const std::string large = MakeDocument(2000);
+  tinyxml2::XMLDocument doc;
+  XML_ASSERT(doc.Parse(small.c_str()) == tinyxml2::XML_NO_ERROR);
+  tinyxml2::XMLMemoryStats stats;
+  doc.GetMemoryStats(&stats);
+  XML_EXPECT_EQ(small.size() + 1 + kScanPadding, stats.charBufferBytes);
+
+  doc.Reset();
+  XML_ASSERT(doc.Parse(large.c_str()) == tinyxml2::XML_NO_ERROR);
+  doc.GetMemoryStats(&stats);
+  XML_EXPECT_EQ(large.size() + 1 + kScanPadding, stats.charBufferBytes);
+  XML_EXPECT(IsPadded(doc, large.size()));
+  tinyxml2::XMLDocument fresh;
+  XML_ASSERT(fresh.Parse(large.c_str()) == tinyxml2::XML_NO_ERROR);
+  XML_EXPECT(Print(doc) == Print(fresh));
+}
+
+// Larger pool blocks mean fewer of them for the same document
+XML_TEST(PoolBlockSizeTakesEffect) {
+  const std::string text = MakeDocument(1000);
+  tinyxml2::XMLDocument small_blocks;
+  XML_ASSERT(small_blocks.Parse(text.c_str()) == tinyxml2::XML_NO_ERROR);
+  tinyxml2::XMLDocument large_blocks;
+  large_blocks.SetPoolBlockSize(1024 * 1024);
+  XML_ASSERT(large_blocks.Parse(text.c_str()) == tinyxml2::XML_NO_ERROR);
+
+  tinyxml2::XMLMemoryStats small_stats, large_stats;
+  small_blocks.GetMemoryStats(&small_stats);
+  large_blocks.GetMemoryStats(&large_stats);
+  // One block for each of the element, attribute, text and comment pools
+  XML_EXPECT_EQ(4, large_stats.poolBlocks);
+  XML_EXPECT(small_stats.poolBlocks > 4 * 10);
+  XML_EXPECT_EQ(small_stats.peakPoolBytes, large_stats.peakPoolBytes);
+  XML_EXPECT(Print(small_blocks) == Print(large_blocks));
+}
@@ -0,0 +1,180 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <stdint.h>
+#include <utility>
+
+#include "../xmlarena.h"
+#include "../xmlfile.h"
+#include "./xmltest.h"
+#include "./xmltestmodel.h"
+
+// Small allocations are carved out of blocks, aligned as asked
+XML_TEST(SmallAllocationsShareBlocks) {
+  CXmlArena arena;
+  char* first = static_cast<char*>(arena.Allocate(3, 1));
+  void* second = arena.Allocate(sizeof(double), sizeof(double));
+  XML_EXPECT(reinterpret_cast<uintptr_t>(second) % sizeof(double) == 0);
+  XML_EXPECT(static_cast<char*>(second) > first);
+  XML_EXPECT(static_cast<char*>(second) < first + 3 + sizeof(double));
+
+  const XmlArenaStats& stats = arena.stats();
+  XML_EXPECT_EQ(static_cast<size_t>(2), stats.allocation_count_);
+  XML_EXPECT_EQ(static_cast<size_t>(1), stats.block_count_);
+  XML_EXPECT_EQ(static_cast<size_t>(0), stats.large_allocation_count_);
+  XML_EXPECT(stats.allocated_bytes_ >= 3 + sizeof(double));
+  XML_EXPECT(stats.allocated_bytes_ < 3 + 2 * sizeof(double));
+  XML_EXPECT_EQ(static_cast<size_t>(CXmlArena::kFirstBlockSize),
+                stats.current_bytes_);
+
+  // Freeing them does nothing
+  arena.Deallocate(first, 3);
+  XML_EXPECT_EQ(static_cast<size_t>(CXmlArena::kFirstBlockSize),
+                stats.current_bytes_);
+
+  // Blocks double once one is full
+  for (int i = 0; i < CXmlArena::kFirstBlockSize / 1024; ++i)
+    arena.Allocate(1024, 8);
+  XML_EXPECT_EQ(static_cast<size_t>(2), stats.block_count_);
+  XML_EXPECT_EQ(static_cast<size_t>(3 * CXmlArena::kFirstBlockSize),
+                stats.current_bytes_);
+}
+
+// Large allocations go to the heap, and are freed one by one, which the
+// current footprint follows and the peak remembers
+XML_TEST(LargeAllocationsUseTheHeap) {
+  CXmlArena arena;
+  const size_t size = CXmlArena::kLargeAllocationSize;
+  void* large = arena.Allocate(size, 8);
+  void* larger = arena.Allocate(size * 4, 8);
+  XML_ASSERT(large != NULL && larger != NULL);
+  const XmlArenaStats& stats = arena.stats();
+  XML_EXPECT_EQ(static_cast<size_t>(0), stats.block_count_);
+  XML_EXPECT_EQ(static_cast<size_t>(2), stats.large_allocation_count_);
+  XML_EXPECT_EQ(size * 5, stats.current_bytes_);
+  XML_EXPECT_EQ(size * 5, stats.peak_bytes_);
+
+  arena.Deallocate(larger, size * 4);
+  XML_EXPECT_EQ(size, stats.current_bytes_);
+  XML_EXPECT_EQ(size * 5, stats.peak_bytes_);
+  // Pointers the arena didn't hand out are left alone
+  char other[1];
+  arena.Deallocate(other, size);
+  arena.Deallocate(larger, size * 4);
+  XML_EXPECT_EQ(size, stats.current_bytes_);
+
+  // Small allocations after that add to the current footprint again
+  arena.Allocate(16, 8);
+  XML_EXPECT_EQ(size + CXmlArena::kFirstBlockSize, stats.current_bytes_);
+  XML_EXPECT_EQ(size * 5, stats.peak_bytes_);
+  // 'large' is freed with the arena
+}
+
+XML_TEST(StatsAdd) {
+  CXmlArena a;
+  CXmlArena b;
+  a.Allocate(8, 8);
+  b.Allocate(CXmlArena::kLargeAllocationSize, 8);
+  XmlArenaStats stats = a.stats();
+  stats.Add(b.stats());
+  XML_EXPECT_EQ(static_cast<size_t>(2), stats.allocation_count_);
+  XML_EXPECT_EQ(static_cast<size_t>(1), stats.block_count_);
+  XML_EXPECT_EQ(static_cast<size_t>(1), stats.large_allocation_count_);
+  XML_EXPECT_EQ(static_cast<size_t>(CXmlArena::kFirstBlockSize +
+                                    CXmlArena::kLargeAllocationSize),
+                stats.current_bytes_);
+  XML_EXPECT_EQ(stats.current_bytes_, stats.peak_bytes_);
+}
+
+// Vectors without an arena use the heap; with one, they grow in it
+XML_TEST(VectorsAllocateFromTheirArena) {
+  XmlArenaVector<int> heap;
+  heap.assign(100, 7);
+  XML_EXPECT(heap.get_allocator().arena() == NULL);
+
+  CXmlArena arena;
+  XmlArenaVector<int> numbers((CXmlArenaAllocator<int>(&arena)));
+  for (int i = 0; i < 10000; ++i)
+    numbers.push_back(i);
+  XML_EXPECT(arena.stats().allocation_count_ > 1);
+  XML_EXPECT(arena.stats().large_allocation_count_ > 0);
+  // The buffers it outgrew went back to the heap
+  XML_EXPECT(arena.stats().current_bytes_ <
+             CXmlArena::kFirstBlockSize + 3 * 10000 * sizeof(int));
+  XML_EXPECT_EQ(9999, numbers.back());
+
+  // Allocators for other types share the arena
+  CXmlArenaAllocator<double> doubles(numbers.get_allocator());
+  XML_EXPECT(doubles.arena() == &arena);
+  XML_EXPECT(doubles == numbers.get_allocator());
+  XML_EXPECT(doubles != CXmlArenaAllocator<double>());
+}
+
+// Containers take their arena along when assigned, moved or swapped, so
+// their elements are always freed by the arena they came from
+XML_TEST(ArenasPropagate) {
+  CXmlArena arena;
+  const CXmlArenaAllocator<int> in_arena(&arena);
+  XmlArenaVector<int> a(3, 1, in_arena);
+  XmlArenaVector<int> b(5, 2);
+
+  XmlArenaVector<int> copy;
+  copy = a;
+  XML_EXPECT(copy.get_allocator().arena() == &arena);
+  XmlArenaVector<int> constructed(a);
+  XML_EXPECT(constructed.get_allocator().arena() == &arena);
+
+  XmlArenaVector<int> moved;
+  moved = std::move(copy);
+  XML_EXPECT(moved.get_allocator().arena() == &arena);
+  XML_EXPECT_EQ(static_cast<size_t>(3), moved.size());
+
+  a.swap(b);
+  XML_EXPECT(a.get_allocator().arena() == NULL);
+  XML_EXPECT(b.get_allocator().arena() == &arena);
+  XML_EXPECT_EQ(static_cast<size_t>(5), a.size());
+  XML_EXPECT_EQ(1, b[0]);
+
+  // Assigning a heap vector over an arena one takes the heap back
+  b = a;
+  XML_EXPECT(b.get_allocator().arena() == NULL);
+}
+
+// The arena stats of a model read in parallel cover the arenas of every
+// read thread
+XML_TEST(ModelStatsCoverThreadArenas) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected, 3);
+  const std::string filename = XmlTest::TempPath("arena.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+
+  XmlModelInfo no_arena;
+  XmlArenaStats stats;
+  XML_EXPECT(!no_arena.GetArenaStats(stats));
+  XML_EXPECT_EQ(static_cast<size_t>(0), stats.allocation_count_);
+
+  CXmlFile file;
+  file.set_use_arena(true);
+  file.set_read_threads(3);
+  XmlModelInfo actual;
+  XML_ASSERT(XmlTest::ReadModel(file, filename, CXmlFile::kReadMapped,
+                                actual));
+  XML_EXPECT_SAME_MODEL(expected, actual);
+  XML_ASSERT(actual.GetArenaStats(stats));
+  XML_ASSERT(!actual.thread_arenas_.empty());
+
+  XmlArenaStats sum = actual.arena_->stats();
+  size_t thread_allocations = 0;
+  for (size_t i = 0; i < actual.thread_arenas_.size(); ++i) {
+    sum.Add(actual.thread_arenas_[i]->stats());
+    thread_allocations += actual.thread_arenas_[i]->stats().allocation_count_;
+  }
+  XML_EXPECT_EQ(sum.allocation_count_, stats.allocation_count_);
+  XML_EXPECT_EQ(sum.block_count_, stats.block_count_);
+  XML_EXPECT_EQ(sum.current_bytes_, stats.current_bytes_);
+  XML_EXPECT_EQ(sum.peak_bytes_, stats.peak_bytes_);
+  // Which thread reads what is up to the scheduler
+  XML_EXPECT_EQ(actual.arena_->stats().allocation_count_ + thread_allocations,
+                stats.allocation_count_);
+}
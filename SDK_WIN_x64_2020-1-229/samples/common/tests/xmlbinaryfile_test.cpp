@@ -0,0 +1,74 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "../xmlbinaryfile.h"
+#include "../xmlfile.h"
+#include "./xmltest.h"
+#include "./xmltestmodel.h"
+
+using XmlTest::TempPath;
+
+static bool ReadBinaryModel(const std::string& filename,
+                            XmlModelInfo& model_info) {
+  CXmlBinaryFile file;
+  bool ok = file.Open(filename) && file.GetModelInfo(model_info);
+  file.Close();
+  return ok;
+}
+
+XML_TEST(BinaryFileReadsBackEqual) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected, 2);
+  const std::string filename = TempPath("model.skpbin");
+  XML_ASSERT(CXmlBinaryFile::Write(filename, expected));
+  XmlModelInfo actual;
+  XML_ASSERT(ReadBinaryModel(filename, actual));
+  XML_EXPECT_SAME_MODEL(expected, actual);
+}
+
+// XML to binary and back gives the model that was written, whichever
+// version the XML started as
+XML_TEST(XmlToBinaryToXmlRoundTrip) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected);
+  const int versions[] = {
+    CXmlFile::kXmlVersionVertexElements, CXmlFile::kXmlVersionPackedFaces
+  };
+  for (int v = 0; v < 2; ++v) {
+    const std::string xml_file = TempPath("source.xml");
+    const std::string binary_file = TempPath("converted.skpbin");
+    const std::string back_file = TempPath("back.xml");
+    XML_ASSERT(XmlTest::WriteModel(xml_file, expected, versions[v],
+                                   CXmlFile::kWriteStreaming));
+    XML_ASSERT(ConvertXmlToBinary(xml_file, binary_file));
+    XML_ASSERT(ConvertBinaryToXml(binary_file, back_file));
+
+    XmlModelInfo from_binary;
+    XML_ASSERT(ReadBinaryModel(binary_file, from_binary));
+    XML_EXPECT_SAME_MODEL(expected, from_binary);
+    CXmlFile file;
+    XmlModelInfo from_xml;
+    XML_ASSERT(XmlTest::ReadModel(file, back_file, CXmlFile::kReadDom,
+                                  from_xml));
+    XML_EXPECT_SAME_MODEL(expected, from_xml);
+  }
+}
+
+XML_TEST(ConversionReportsFailures) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info);
+  const std::string binary_file = TempPath("failures.skpbin");
+  XML_ASSERT(CXmlBinaryFile::Write(binary_file, model_info));
+  XML_EXPECT(!ConvertBinaryToXml(TempPath("missing.skpbin"),
+                                 TempPath("missing.xml")));
+  XML_EXPECT(!ConvertXmlToBinary(TempPath("missing.xml"),
+                                 TempPath("missing.skpbin")));
+  XML_EXPECT(!ConvertBinaryToXml(binary_file,
+                                 TempPath("no_such_dir/out.xml")));
+
+  // A file cut short is rejected rather than read past its end
+  const std::string data = XmlTest::ReadFile(binary_file);
+  const std::string truncated = TempPath("truncated.skpbin");
+  XML_ASSERT(XmlTest::WriteFile(truncated, data.substr(0, data.size() / 2)));
+  XmlModelInfo actual;
+  XML_EXPECT(!ReadBinaryModel(truncated, actual));
+}
@@ -0,0 +1,474 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../xmlbvh.h"
+#include "../xmlfile.h"
+#include "../xmlflattener.h"
+#include "./xmltest.h"
+#include "./xmltestmodel.h"
+
+using XmlGeomUtils::CPoint3d;
+using XmlGeomUtils::CVector3d;
+
+namespace {
+
+const double kInfinity = std::numeric_limits<double>::infinity();
+
+// A triangle or edge of the model, in model coordinates
+struct Primitive {
+  size_t instance_;
+  XmlBvhHit::Kind kind_;
+  size_t index_;
+  CPoint3d corners_[3];
+};
+
+// What a hit refers to, which several triangles of a face share
+typedef std::tuple<size_t, int, size_t> Key;
+
+Key GetKey(size_t instance, XmlBvhHit::Kind kind, size_t index) {
+  return Key(instance, kind, index);
+}
+
+Key GetKey(const XmlBvhHit& hit) {
+  return GetKey(hit.instance_, hit.kind_, hit.index_);
+}
+
+Key GetKey(const Primitive& primitive) {
+  return GetKey(primitive.instance_, primitive.kind_, primitive.index_);
+}
+
+// Every primitive the hierarchy holds, placed by each of its instances
+std::vector<Primitive> GetPrimitives(const CXmlBvh& bvh) {
+  std::vector<Primitive> primitives;
+  for (size_t i = 0; i < bvh.instance_count(); ++i) {
+    const XmlBvhInstance& instance = bvh.instance(i);
+    const XmlBvhMesh& mesh = bvh.mesh(instance.mesh_);
+    const std::vector<double>& p = mesh.positions_;
+    for (size_t t = 0; t < mesh.triangles_.size() / 3; ++t) {
+      Primitive primitive;
+      primitive.instance_ = i;
+      primitive.kind_ = XmlBvhHit::kTriangle;
+      primitive.index_ = mesh.triangle_faces_[t];
+      for (int j = 0; j < 3; ++j) {
+        const size_t v = mesh.triangles_[t * 3 + j] * 3;
+        primitive.corners_[j] = instance.transform_ *
+                                CPoint3d(p[v], p[v + 1], p[v + 2]);
+      }
+      primitives.push_back(primitive);
+    }
+    const std::vector<double>& e = mesh.edges_;
+    for (size_t k = 0; k < e.size() / 6; ++k) {
+      Primitive primitive;
+      primitive.instance_ = i;
+      primitive.kind_ = XmlBvhHit::kEdge;
+      primitive.index_ = k;
+      for (int j = 0; j < 2; ++j) {
+        const size_t v = k * 6 + j * 3;
+        primitive.corners_[j] = instance.transform_ *
+                                CPoint3d(e[v], e[v + 1], e[v + 2]);
+      }
+      primitive.corners_[2] = primitive.corners_[1];
+      primitives.push_back(primitive);
+    }
+  }
+  return primitives;
+}
+
+double Dot(const CVector3d& a, const CVector3d& b) {
+  return a.x() * b.x() + a.y() * b.y() + a.z() * b.z();
+}
+
+CVector3d Cross(const CVector3d& a, const CVector3d& b) {
+  return CVector3d(a.y() * b.z() - a.z() * b.y(),
+                   a.z() * b.x() - a.x() * b.z(),
+                   a.x() * b.y() - a.y() * b.x());
+}
+
+double Length(const CVector3d& v) {
+  return sqrt(Dot(v, v));
+}
+
+double Largest(const CPoint3d& p) {
+  return std::max(fabs(p.x()), std::max(fabs(p.y()), fabs(p.z())));
+}
+
+// Where the ray meets the plane of the triangle, if that is inside it.
+// Returns infinity for a miss or a triangle without area.
+double RayHitsTriangle(const CPoint3d& origin, const CVector3d& direction,
+                       const Primitive& triangle) {
+  const CPoint3d* c = triangle.corners_;
+  const CVector3d normal = Cross(c[1] - c[0], c[2] - c[0]);
+  const double along = Dot(normal, direction);
+  if (Length(normal) == 0.0 || along == 0.0)
+    return kInfinity;
+  const double t = Dot(normal, c[0] - origin) / along;
+  if (t < 0.0)
+    return kInfinity;
+  const CPoint3d p = origin + direction * t;
+  for (int i = 0; i < 3; ++i) {
+    const CPoint3d& a = c[i];
+    const CPoint3d& b = c[(i + 1) % 3];
+    if (Dot(Cross(b - a, p - a), normal) < 0.0)
+      return kInfinity;
+  }
+  return t;
+}
+
+CPoint3d NearestOnSegment(const CPoint3d& p, const CPoint3d& a,
+                          const CPoint3d& b) {
+  const CVector3d ab = b - a;
+  const double length = Dot(ab, ab);
+  if (length == 0.0)
+    return a;
+  const double t = std::min(1.0, std::max(0.0, Dot(p - a, ab) / length));
+  return a + ab * t;
+}
+
+double Distance(const CPoint3d& a, const CPoint3d& b) {
+  return Length(a - b);
+}
+
+// The distance from the point to the primitive: to the point straight
+// above it if that is inside a triangle, or to its nearest side
+double DistanceTo(const CPoint3d& p, const Primitive& primitive) {
+  const CPoint3d* c = primitive.corners_;
+  double best = kInfinity;
+  const int sides = primitive.kind_ == XmlBvhHit::kTriangle ? 3 : 1;
+  for (int i = 0; i < sides; ++i) {
+    best = std::min(best, Distance(p, NearestOnSegment(p, c[i],
+                                                       c[(i + 1) % 3])));
+  }
+  if (primitive.kind_ == XmlBvhHit::kEdge)
+    return best;
+  CVector3d normal = Cross(c[1] - c[0], c[2] - c[0]);
+  const double length = Length(normal);
+  if (length == 0.0)
+    return best;
+  normal /= length;
+  const CPoint3d above = p - normal * Dot(normal, p - c[0]);
+  for (int i = 0; i < 3; ++i) {
+    if (Dot(Cross(c[(i + 1) % 3] - c[i], above - c[i]), normal) < 0.0)
+      return best;
+  }
+  return std::min(best, Distance(p, above));
+}
+
+// The box around the primitive, as min x y z then max x y z
+void GetBox(const Primitive& primitive, double* box) {
+  for (int i = 0; i < 3; ++i) {
+    box[i] = kInfinity;
+    box[i + 3] = -kInfinity;
+  }
+  for (int j = 0; j < 3; ++j) {
+    const double p[3] = { primitive.corners_[j].x(),
+                          primitive.corners_[j].y(),
+                          primitive.corners_[j].z() };
+    for (int i = 0; i < 3; ++i) {
+      box[i] = std::min(box[i], p[i]);
+      box[i + 3] = std::max(box[i + 3], p[i]);
+    }
+  }
+}
+
+CPoint3d Centroid(const Primitive& primitive) {
+  const CPoint3d* c = primitive.corners_;
+  return CPoint3d((c[0].x() + c[1].x() + c[2].x()) / 3.0,
+                  (c[0].y() + c[1].y() + c[2].y()) / 3.0,
+                  (c[0].z() + c[1].z() + c[2].z()) / 3.0);
+}
+
+// Checks a ray against every triangle. Any of the triangles hit within
+// 'tolerance' of the nearest one may be the one found.
+void ExpectRaycast(const CXmlBvh& bvh,
+                   const std::vector<Primitive>& primitives,
+                   const CPoint3d& origin, const CVector3d& direction,
+                   double max_distance) {
+  const double tolerance =
+      1e-9 * ((1.0 + Largest(origin)) / Length(direction) + 1.0);
+  double nearest = kInfinity;
+  std::vector<double> distances(primitives.size(), kInfinity);
+  for (size_t i = 0; i < primitives.size(); ++i) {
+    if (primitives[i].kind_ != XmlBvhHit::kTriangle ||
+        !bvh.instance(primitives[i].instance_).invertible_)
+      continue;
+    distances[i] = RayHitsTriangle(origin, direction, primitives[i]);
+    if (distances[i] <= max_distance)
+      nearest = std::min(nearest, distances[i]);
+  }
+
+  XmlBvhHit hit;
+  const bool found = bvh.Raycast(origin, direction, max_distance, hit);
+  XML_ASSERT(found == (nearest != kInfinity));
+  if (!found)
+    return;
+  XML_EXPECT(fabs(hit.distance_ - nearest) <= tolerance);
+  XML_EXPECT(hit.kind_ == XmlBvhHit::kTriangle);
+  std::set<Key> candidates;
+  for (size_t i = 0; i < primitives.size(); ++i) {
+    if (distances[i] <= nearest + tolerance)
+      candidates.insert(GetKey(primitives[i]));
+  }
+  XML_EXPECT(candidates.count(GetKey(hit)) == 1);
+  XML_EXPECT(Distance(origin + direction * hit.distance_, hit.point_) <=
+             tolerance * Length(direction));
+}
+
+// Checks a point against every triangle and edge, like ExpectRaycast
+void ExpectNearest(const CXmlBvh& bvh,
+                   const std::vector<Primitive>& primitives,
+                   const CPoint3d& point, double max_distance) {
+  const double tolerance = 1e-9 * (1.0 + Largest(point));
+  double nearest = kInfinity;
+  std::vector<double> distances(primitives.size());
+  for (size_t i = 0; i < primitives.size(); ++i) {
+    distances[i] = DistanceTo(point, primitives[i]);
+    if (distances[i] <= max_distance)
+      nearest = std::min(nearest, distances[i]);
+  }
+
+  XmlBvhHit hit;
+  const bool found = bvh.FindNearest(point, max_distance, hit);
+  XML_ASSERT(found == (nearest != kInfinity));
+  if (!found)
+    return;
+  XML_EXPECT(fabs(hit.distance_ - nearest) <= tolerance);
+  XML_EXPECT(fabs(Distance(point, hit.point_) - hit.distance_) <= tolerance);
+  std::set<Key> candidates;
+  for (size_t i = 0; i < primitives.size(); ++i) {
+    if (distances[i] <= nearest + tolerance)
+      candidates.insert(GetKey(primitives[i]));
+  }
+  XML_EXPECT(candidates.count(GetKey(hit)) == 1);
+}
+
+// Every primitive inside the box is found, and nothing found is clear of
+// it
+void ExpectInBox(const CXmlBvh& bvh, const std::vector<Primitive>& primitives,
+                 const double* box) {
+  std::vector<XmlBvhHit> hits;
+  bvh.FindInBox(CPoint3d(box[0], box[1], box[2]),
+                CPoint3d(box[3], box[4], box[5]), hits);
+  std::set<Key> found;
+  for (size_t i = 0; i < hits.size(); ++i) {
+    found.insert(GetKey(hits[i]));
+  }
+  std::set<Key> touching;
+  for (size_t i = 0; i < primitives.size(); ++i) {
+    double bounds[6];
+    GetBox(primitives[i], bounds);
+    bool inside = true;
+    bool overlaps = true;
+    for (int j = 0; j < 3; ++j) {
+      inside = inside && bounds[j] >= box[j] && bounds[j + 3] <= box[j + 3];
+      overlaps = overlaps && bounds[j] <= box[j + 3] &&
+                 bounds[j + 3] >= box[j];
+    }
+    if (inside)
+      XML_EXPECT(found.count(GetKey(primitives[i])) == 1);
+    if (overlaps)
+      touching.insert(GetKey(primitives[i]));
+  }
+  for (std::set<Key>::const_iterator it = found.begin(); it != found.end();
+       ++it) {
+    XML_EXPECT(touching.count(*it) == 1);
+  }
+}
+
+size_t FlattenedTriangles(const XmlModelInfo& model_info) {
+  std::vector<XmlTriangleBatch> batches;
+  CXmlFlattener().Flatten(model_info, batches);
+  size_t triangles = 0;
+  for (size_t i = 0; i < batches.size(); ++i) {
+    triangles += batches[i].indices_.size() / 3;
+  }
+  return triangles;
+}
+
+XmlComponentInstanceInfo MakeInstance(const std::string& definition,
+                                      const SUTransformation& transform) {
+  XmlComponentInstanceInfo instance;
+  instance.definition_name_ = definition;
+  instance.transform_ = transform;
+  return instance;
+}
+
+} // end namespace
+
+// The hierarchy holds the triangles the flattener gives, and its queries
+// find what testing every primitive finds
+XML_TEST(QueriesMatchBruteForce) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info, 2);
+  CXmlBvh bvh;
+  XML_ASSERT(bvh.Build(model_info));
+  const std::vector<Primitive> primitives = GetPrimitives(bvh);
+  size_t triangles = 0;
+  for (size_t i = 0; i < primitives.size(); ++i) {
+    if (primitives[i].kind_ == XmlBvhHit::kTriangle)
+      ++triangles;
+  }
+  XML_EXPECT_EQ(FlattenedTriangles(model_info), triangles);
+
+  std::mt19937 random(24);
+  std::uniform_int_distribution<size_t> pick(0, primitives.size() - 1);
+  std::uniform_real_distribution<double> offset(-3.0, 3.0);
+  for (int i = 0; i < 300; ++i) {
+    // Near a primitive, towards another or anywhere
+    const CPoint3d near = Centroid(primitives[pick(random)]);
+    const CPoint3d origin = near + CVector3d(offset(random), offset(random),
+                                             offset(random));
+    const CVector3d towards = Centroid(primitives[pick(random)]) - origin;
+    const CVector3d anywhere(offset(random), offset(random), offset(random));
+    ExpectRaycast(bvh, primitives, origin, towards, kInfinity);
+    ExpectRaycast(bvh, primitives, origin, towards, 0.5);
+    ExpectRaycast(bvh, primitives, origin, anywhere, kInfinity);
+    ExpectNearest(bvh, primitives, origin, kInfinity);
+    ExpectNearest(bvh, primitives, origin, 1.0);
+
+    double box[6];
+    for (int j = 0; j < 3; ++j) {
+      const double a = offset(random);
+      const double b = offset(random);
+      box[j] = std::min(a, b);
+      box[j + 3] = std::max(a, b);
+    }
+    const double center[3] = { near.x(), near.y(), near.z() };
+    for (int j = 0; j < 6; ++j) {
+      box[j] += center[j % 3];
+    }
+    ExpectInBox(bvh, primitives, box);
+  }
+}
+
+// The queries find the same whatever the number of threads the hierarchy
+// was built on
+XML_TEST(ThreadsDontChangeTheHits) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info, 2);
+  CXmlBvh expected;
+  expected.set_threads(1);
+  XML_ASSERT(expected.Build(model_info));
+  CXmlBvh bvh;
+  bvh.set_threads(5);
+  XML_ASSERT(bvh.Build(model_info));
+  XML_ASSERT(expected.mesh_count() == bvh.mesh_count());
+  XML_ASSERT(expected.instance_count() == bvh.instance_count());
+
+  std::mt19937 random(24);
+  std::uniform_real_distribution<double> coordinate(-50.0, 150.0);
+  for (int i = 0; i < 100; ++i) {
+    const CPoint3d point(coordinate(random), coordinate(random),
+                         coordinate(random));
+    XmlBvhHit a;
+    XmlBvhHit b;
+    XML_ASSERT(expected.FindNearest(point, kInfinity, a));
+    XML_ASSERT(bvh.FindNearest(point, kInfinity, b));
+    XML_EXPECT_EQ(a.distance_, b.distance_);
+    const CVector3d direction = CPoint3d(50.0, 0.0, 0.0) - point;
+    const bool hit = expected.Raycast(point, direction, kInfinity, a);
+    XML_EXPECT(hit == bvh.Raycast(point, direction, kInfinity, b));
+    if (hit)
+      XML_EXPECT_EQ(a.distance_, b.distance_);
+  }
+}
+
+// An instance flattened onto a line can't be hit by a ray, but is still
+// near things; mirrored ones are hit from either side
+XML_TEST(SingularInstancesAreOnlyNear) {
+  XmlModelInfo model_info;
+  model_info.definitions_.emplace_back();
+  model_info.definitions_.back().name_ = "Panel";
+  model_info.definitions_.back().entities_.faces_.push_back(
+      XmlTest::MakeLoopFace(4, 0.0, 0.0, 0.0));
+  SUTransformation flat = XmlTest::MakeTransform(0.0, 1.0, 10.0, 0.0, 0.0);
+  flat.values[0] = 0.0;
+  SUTransformation mirror = XmlTest::MakeTransform(0.0, 1.0, 20.0, 0.0, 0.0);
+  mirror.values[0] = -1.0;
+  model_info.entities_.component_instances_.push_back(MakeInstance(
+      "Panel", XmlTest::MakeTransform(0.0, 1.0, 0.0, 0.0, 0.0)));
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Panel", flat));
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Panel", mirror));
+  CXmlBvh bvh;
+  XML_ASSERT(bvh.Build(model_info));
+  XML_ASSERT(bvh.mesh_count() == 1);
+  XML_ASSERT(bvh.instance_count() == 3);
+
+  XmlBvhHit hit;
+  const CVector3d down(0.0, 0.0, -1.0);
+  XML_EXPECT(bvh.Raycast(CPoint3d(0.0, 0.1, 2.0), down, kInfinity, hit));
+  XML_EXPECT_EQ(2.0, hit.distance_);
+  XML_EXPECT(!bvh.Raycast(CPoint3d(10.0, 0.1, 2.0), down, kInfinity, hit));
+  XML_EXPECT(bvh.Raycast(CPoint3d(20.0, 0.1, -2.0), down * -1.0, kInfinity,
+                         hit));
+  XML_EXPECT_EQ(2.0, hit.distance_);
+
+  XML_ASSERT(bvh.FindNearest(CPoint3d(10.0, 0.1, 1.0), 2.0, hit));
+  XML_EXPECT_EQ(static_cast<size_t>(1), hit.instance_);
+  XML_EXPECT(fabs(hit.distance_ - 1.0) < 1e-12);
+  XML_EXPECT(!bvh.FindNearest(CPoint3d(10.0, 0.1, 1.0), 0.5, hit));
+}
+
+// Triangles with two corners in one place are as near as their sides
+XML_TEST(DegenerateTrianglesAreNear) {
+  XmlModelInfo model_info;
+  XmlFaceInfo face;
+  face.has_single_loop_ = false;
+  const double corners[3][3] = { { 0.0, 0.0, 0.0 }, { 1.0, 0.0, 0.0 },
+                                 { 1.0, 1.0, 0.0 } };
+  for (int i = 0; i < 3; ++i) {
+    XmlFaceVertex vertex;
+    vertex.vertex_ = CPoint3d(corners[i][0], corners[i][1], corners[i][2]);
+    face.vertices_.push_back(vertex);
+  }
+  const uint32_t indices[] = { 0, 0, 1, 1, 2, 2 };
+  face.indices_.assign(indices, indices + 6);
+  model_info.entities_.faces_.push_back(face);
+  CXmlBvh bvh;
+  XML_ASSERT(bvh.Build(model_info));
+
+  XmlBvhHit hit;
+  XML_ASSERT(bvh.FindNearest(CPoint3d(0.5, 0.0, 1.0), kInfinity, hit));
+  XML_EXPECT_EQ(1.0, hit.distance_);
+  XML_EXPECT_EQ(0.5, hit.point_.x());
+  XML_ASSERT(bvh.FindNearest(CPoint3d(2.0, 0.5, 0.0), kInfinity, hit));
+  XML_EXPECT_EQ(1.0, hit.distance_);
+  XML_EXPECT(!bvh.Raycast(CPoint3d(0.5, 0.0, 1.0),
+                          CVector3d(0.0, 0.0, -1.0), kInfinity, hit));
+}
+
+// Instances of missing definitions, and of definitions that contain
+// themselves, are skipped and reported; the rest can still be queried
+XML_TEST(BrokenInstancesAreSkipped) {
+  XmlModelInfo model_info;
+  const SUTransformation identity =
+      XmlTest::MakeTransform(0.0, 1.0, 0.0, 0.0, 0.0);
+  model_info.definitions_.emplace_back();
+  XmlComponentDefinitionInfo& loop = model_info.definitions_.back();
+  loop.name_ = "Loop";
+  loop.entities_.faces_.push_back(XmlTest::MakeLoopFace(3, 0.0, 0.0, 0.0));
+  loop.entities_.component_instances_.push_back(
+      MakeInstance("Loop", identity));
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Missing", identity));
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Loop", identity));
+
+  CXmlBvh bvh;
+  XML_EXPECT(!bvh.Build(model_info));
+  XML_EXPECT_EQ(static_cast<size_t>(1), bvh.instance_count());
+  XmlBvhHit hit;
+  XML_EXPECT(bvh.Raycast(CPoint3d(0.0, 0.0, 1.0), CVector3d(0.0, 0.0, -1.0),
+                         kInfinity, hit));
+  XML_EXPECT(hit.kind_ == XmlBvhHit::kTriangle);
+  XML_EXPECT_EQ(static_cast<size_t>(0), hit.index_);
+}
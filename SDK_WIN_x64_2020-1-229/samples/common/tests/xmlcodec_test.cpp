@@ -0,0 +1,409 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "../xmlcodec.h"
+#include "../xmlfile.h"
+#include "./xmltest.h"
+#include "./xmltestmodel.h"
+
+using XmlTest::TempPath;
+
+namespace {
+
+// Codecs that aren't compiled in are left out of the round trips, and
+// must fail to open instead
+const CXmlCodecFile::Codec kCodecs[] = {
+  CXmlCodecFile::kCodecNone, CXmlCodecFile::kCodecGzip,
+  CXmlCodecFile::kCodecZstd
+};
+const char* kExtensions[] = { ".xml", ".xml.gz", ".xml.zst" };
+
+// Text that compresses some but not all the way, over several blocks
+std::string MakeData(size_t size) {
+  std::mt19937 random(17);
+  std::string data;
+  data.reserve(size);
+  while (data.size() < size) {
+    data += "<Vertex x=\"" + std::to_string(random() % 1000) + "\"/>\n";
+  }
+  data.resize(size);
+  return data;
+}
+
+bool WriteData(const std::string& filename, CXmlCodecFile::Codec codec,
+               const std::string& data, size_t piece_size) {
+  CXmlCodecFile file;
+  if (!file.OpenWrite(filename, codec))
+    return false;
+  bool ok = true;
+  for (size_t pos = 0; pos < data.size(); pos += piece_size) {
+    const size_t size = std::min(piece_size, data.size() - pos);
+    ok = file.Write(data.data() + pos, size) && ok;
+  }
+  return file.Close() && ok;
+}
+
+// All of a file, and whether it read without an error
+bool ReadData(const std::string& filename, std::string& data) {
+  CXmlCodecFile file;
+  if (!file.OpenRead(filename))
+    return false;
+  data.clear();
+  char buffer[100000];
+  size_t read;
+  while ((read = file.Read(buffer, sizeof(buffer))) > 0) {
+    data.append(buffer, read);
+  }
+  const bool ok = !file.error();
+  return file.Close() && ok;
+}
+
+} // end namespace
+
+XML_TEST(CodecFollowsExtension) {
+  XML_EXPECT(CXmlCodecFile::CodecOf("a.xml") == CXmlCodecFile::kCodecNone);
+  XML_EXPECT(CXmlCodecFile::CodecOf("a.xml.gz") ==
+             CXmlCodecFile::kCodecGzip);
+  XML_EXPECT(CXmlCodecFile::CodecOf("a.XML.GZ") ==
+             CXmlCodecFile::kCodecGzip);
+  XML_EXPECT(CXmlCodecFile::CodecOf("a.xml.zst") ==
+             CXmlCodecFile::kCodecZstd);
+  XML_EXPECT(CXmlCodecFile::CodecOf("gz") == CXmlCodecFile::kCodecNone);
+  XML_EXPECT(CXmlCodecFile::IsSupported(CXmlCodecFile::kCodecNone));
+}
+
+// Data written in pieces of any size reads back the same, across blocks
+XML_TEST(DataRoundTrips) {
+  const std::string data = MakeData(3 * 1024 * 1024 + 123);
+  const size_t piece_sizes[] = { 1000, 1024 * 1024, 5 * 1024 * 1024 };
+  for (int c = 0; c < 3; ++c) {
+    const std::string filename = TempPath("data" + std::string(kExtensions[c]));
+    if (!CXmlCodecFile::IsSupported(kCodecs[c])) {
+      CXmlCodecFile file;
+      XML_EXPECT(!file.OpenWrite(filename, kCodecs[c]));
+      continue;
+    }
+    for (int p = 0; p < 3; ++p) {
+      XML_ASSERT(WriteData(filename, kCodecs[c], data, piece_sizes[p]));
+      std::string read_back;
+      XML_ASSERT(ReadData(filename, read_back));
+      XML_EXPECT(read_back == data);
+    }
+    const std::string file_data = XmlTest::ReadFile(filename);
+    if (kCodecs[c] == CXmlCodecFile::kCodecNone) {
+      XML_EXPECT(file_data == data);
+    } else {
+      XML_EXPECT(file_data.size() < data.size() / 2);
+    }
+    if (kCodecs[c] == CXmlCodecFile::kCodecGzip) {
+      XML_EXPECT(file_data.compare(0, 2, "\x1f\x8b") == 0);
+    } else if (kCodecs[c] == CXmlCodecFile::kCodecZstd) {
+      XML_EXPECT(file_data.compare(0, 4, "\x28\xb5\x2f\xfd") == 0);
+    }
+  }
+}
+
+// An empty file is a valid compressed stream too
+XML_TEST(EmptyDataRoundTrips) {
+  for (int c = 0; c < 3; ++c) {
+    if (!CXmlCodecFile::IsSupported(kCodecs[c]))
+      continue;
+    const std::string filename =
+        TempPath("empty" + std::string(kExtensions[c]));
+    XML_ASSERT(WriteData(filename, kCodecs[c], std::string(), 1));
+    std::string read_back("x");
+    XML_ASSERT(ReadData(filename, read_back));
+    XML_EXPECT(read_back.empty());
+  }
+}
+
+// Skipping decompresses up to the position, and fails past the end
+XML_TEST(SkipMovesThroughCompressedData) {
+  const std::string data = MakeData(2 * 1024 * 1024 + 7);
+  for (int c = 0; c < 3; ++c) {
+    if (!CXmlCodecFile::IsSupported(kCodecs[c]))
+      continue;
+    const std::string filename = TempPath("skip" + std::string(kExtensions[c]));
+    XML_ASSERT(WriteData(filename, kCodecs[c], data, data.size()));
+    CXmlCodecFile file;
+    XML_ASSERT(file.OpenRead(filename));
+    const size_t position = 1024 * 1024 + 5;
+    XML_ASSERT(file.Skip(position));
+    char buffer[64];
+    XML_ASSERT(file.Read(buffer, sizeof(buffer)) == sizeof(buffer));
+    XML_EXPECT(std::string(buffer, sizeof(buffer)) ==
+               data.substr(position, sizeof(buffer)));
+    if (kCodecs[c] != CXmlCodecFile::kCodecNone)
+      XML_EXPECT(!file.Skip(data.size()));
+    file.Close();
+  }
+}
+
+// Streams written one after the other read as one
+XML_TEST(ConcatenatedStreamsReadAsOne) {
+  const std::string first = MakeData(300000);
+  const std::string second = MakeData(1500000);
+  for (int c = 1; c < 3; ++c) {
+    if (!CXmlCodecFile::IsSupported(kCodecs[c]))
+      continue;
+    const std::string filename =
+        TempPath("joined" + std::string(kExtensions[c]));
+    XML_ASSERT(WriteData(filename, kCodecs[c], first, first.size()));
+    const std::string first_file = XmlTest::ReadFile(filename);
+    XML_ASSERT(WriteData(filename, kCodecs[c], second, second.size()));
+    const std::string second_file = XmlTest::ReadFile(filename);
+    XML_ASSERT(XmlTest::WriteFile(filename, first_file + second_file));
+    std::string read_back;
+    XML_ASSERT(ReadData(filename, read_back));
+    XML_EXPECT(read_back == first + second);
+  }
+}
+
+// A compressed stream cut short, or with garbage in it, is an error rather
+// than the end of the data
+XML_TEST(DamagedStreamFailsToRead) {
+  const std::string data = MakeData(1024 * 1024);
+  for (int c = 1; c < 3; ++c) {
+    if (!CXmlCodecFile::IsSupported(kCodecs[c]))
+      continue;
+    const std::string filename =
+        TempPath("damaged" + std::string(kExtensions[c]));
+    XML_ASSERT(WriteData(filename, kCodecs[c], data, data.size()));
+    const std::string file_data = XmlTest::ReadFile(filename);
+    std::string read_back;
+
+    XML_ASSERT(XmlTest::WriteFile(filename,
+                                  file_data.substr(0, file_data.size() - 9)));
+    XML_EXPECT(!ReadData(filename, read_back));
+
+    std::string corrupt = file_data;
+    for (size_t i = corrupt.size() / 2; i < corrupt.size() / 2 + 64; ++i) {
+      corrupt[i] = static_cast<char>(~corrupt[i]);
+    }
+    XML_ASSERT(XmlTest::WriteFile(filename, corrupt));
+    XML_EXPECT(!ReadData(filename, read_back));
+  }
+}
+
+// A model reads back equal from a compressed file in every mode, lazy
+// definitions included
+XML_TEST(CompressedModelsRoundTrip) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected, 2);
+  const CXmlFile::WriteMode write_modes[] = {
+    CXmlFile::kWriteDom, CXmlFile::kWriteStreaming
+  };
+  const CXmlFile::ReadMode read_modes[] = {
+    CXmlFile::kReadDom, CXmlFile::kReadStreaming, CXmlFile::kReadMapped
+  };
+  for (int c = 1; c < 3; ++c) {
+    const std::string filename =
+        TempPath("model" + std::string(kExtensions[c]));
+    if (!CXmlCodecFile::IsSupported(kCodecs[c])) {
+      XML_EXPECT(!XmlTest::WriteModel(filename, expected,
+                                      CXmlFile::kXmlVersionPackedFaces,
+                                      CXmlFile::kWriteStreaming));
+      continue;
+    }
+    for (int w = 0; w < 2; ++w) {
+      XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                     CXmlFile::kXmlVersionPackedFaces,
+                                     write_modes[w]));
+      XML_EXPECT(CXmlCodecFile::CodecOf(filename) == kCodecs[c]);
+      for (int r = 0; r < 3; ++r) {
+        CXmlFile file;
+        XmlModelInfo actual;
+        XML_ASSERT(XmlTest::ReadModel(file, filename, read_modes[r], actual));
+        XML_EXPECT_SAME_MODEL(expected, actual);
+
+        file.set_lazy_definitions(true);
+        XmlModelInfo lazy;
+        XML_ASSERT(file.Open(filename, false, read_modes[r]));
+        XML_ASSERT(file.GetModelInfo(lazy));
+        // Only the DOM can go back to a definition; without it the
+        // definitions are read in full rather than decompressed from the
+        // start for each one
+        XML_ASSERT(!lazy.definitions_.empty());
+        XML_EXPECT_EQ(read_modes[r] != CXmlFile::kReadDom,
+                      lazy.definitions_[0].loaded_);
+        for (size_t i = lazy.definitions_.size(); i-- > 0;) {
+          XML_EXPECT(file.LoadComponentDefinition(lazy, i));
+        }
+        file.Close(false);
+        XML_EXPECT_SAME_MODEL(expected, lazy);
+      }
+    }
+  }
+}
+
+// A compressed file holds the same text as a plain one
+XML_TEST(CompressedTextMatchesPlain) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info);
+  const std::string plain_file = TempPath("text.xml");
+  XML_ASSERT(XmlTest::WriteModel(plain_file, model_info,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  const std::string plain_text = XmlTest::ReadFile(plain_file);
+  for (int c = 1; c < 3; ++c) {
+    if (!CXmlCodecFile::IsSupported(kCodecs[c]))
+      continue;
+    const std::string filename = TempPath("text" + std::string(kExtensions[c]));
+    XML_ASSERT(XmlTest::WriteModel(filename, model_info,
+                                   CXmlFile::kXmlVersionPackedFaces,
+                                   CXmlFile::kWriteStreaming));
+    std::string text;
+    XML_ASSERT(ReadData(filename, text));
+    XML_EXPECT(text == plain_text);
+  }
+}
+
+// The stats count the bytes that went to the file, and the time spent
+// writing them. They stay after Close until the next OpenWrite.
+XML_TEST(WriteStatsMatchFile) {
+  const std::string data = MakeData(9 * 1024 * 1024 + 11);
+  for (int c = 0; c < 3; ++c) {
+    if (!CXmlCodecFile::IsSupported(kCodecs[c]))
+      continue;
+    const std::string filename =
+        TempPath("stats" + std::string(kExtensions[c]));
+    CXmlCodecFile file;
+    XML_ASSERT(file.OpenWrite(filename, kCodecs[c]));
+    XML_ASSERT(file.Write(data.data(), data.size()));
+    XML_ASSERT(file.Close());
+    XmlWriteStats stats;
+    file.GetWriteStats(stats);
+    XML_EXPECT_EQ(static_cast<uint64_t>(XmlTest::ReadFile(filename).size()),
+                  stats.bytes_written_);
+    XML_EXPECT(stats.write_seconds_ > 0.0);
+    // Close always waits for the last block
+    XML_EXPECT(stats.stall_seconds_ > 0.0);
+
+    XML_ASSERT(file.OpenWrite(filename, kCodecs[c]));
+    file.GetWriteStats(stats);
+    XML_EXPECT_EQ(static_cast<uint64_t>(0), stats.bytes_written_);
+    XML_EXPECT(file.Close());
+  }
+}
+
+// A rate limit holds reads and writes of every codec to it, and the time
+// writes wait counts as write time
+XML_TEST(RateLimitSlowsIo) {
+  const std::string data = MakeData(2 * 1024 * 1024);
+  for (int c = 0; c < 3; ++c) {
+    if (!CXmlCodecFile::IsSupported(kCodecs[c]))
+      continue;
+    const std::string filename =
+        TempPath("limited" + std::string(kExtensions[c]));
+    XML_ASSERT(WriteData(filename, kCodecs[c], data, data.size()));
+    const double file_size =
+        static_cast<double>(XmlTest::ReadFile(filename).size());
+    // A quarter of a second for the file each way
+    CXmlCodecFile::SetRateLimit(file_size * 4.0);
+
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    CXmlCodecFile file;
+    XML_ASSERT(file.OpenWrite(filename, kCodecs[c]));
+    XML_EXPECT(file.Write(data.data(), data.size()));
+    XML_EXPECT(file.Close());
+    XmlWriteStats stats;
+    file.GetWriteStats(stats);
+    XML_EXPECT(stats.write_seconds_ >= 0.2);
+    std::string read_back;
+    XML_EXPECT(ReadData(filename, read_back));
+    XML_EXPECT(read_back == data);
+    const double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    XML_EXPECT(seconds >= 0.45);
+
+    CXmlCodecFile::SetRateLimit(0.0);
+  }
+}
+
+#ifndef _WIN32
+// A sink slower than the caller holds the caller up once the queue is
+// full, and the wait is counted as a stall
+XML_TEST(SlowSinkStallsWriter) {
+  const std::string fifo = TempPath("slow_sink");
+  remove(fifo.c_str());
+  XML_ASSERT(mkfifo(fifo.c_str(), 0600) == 0);
+  const double kDelay = 0.3;
+  size_t read_size = 0;
+  std::thread reader([&fifo, &read_size, kDelay] {
+    FILE* file = fopen(fifo.c_str(), "rb");
+    if (file == NULL)
+      return;
+    std::this_thread::sleep_for(std::chrono::duration<double>(kDelay));
+    char buffer[65536];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      read_size += read;
+    }
+    fclose(file);
+  });
+
+  const std::string data = MakeData(8 * 1024 * 1024);
+  CXmlCodecFile file;
+  const bool opened = file.OpenWrite(fifo, CXmlCodecFile::kCodecNone);
+  bool ok = opened && file.Write(data.data(), data.size());
+  ok = file.Close() && ok;
+  reader.join();
+  remove(fifo.c_str());
+  XML_ASSERT(opened);
+  XML_EXPECT(ok);
+  XML_EXPECT_EQ(data.size(), read_size);
+
+  XmlWriteStats stats;
+  file.GetWriteStats(stats);
+  XML_EXPECT_EQ(static_cast<uint64_t>(data.size()), stats.bytes_written_);
+  XML_EXPECT(stats.stall_seconds_ >= kDelay / 2);
+  XML_EXPECT(stats.write_seconds_ >= kDelay / 2);
+}
+#endif
+
+#ifdef __linux__
+// A sink that fails makes the writes fail from then on, and Close report
+// it, however much the caller wrote before noticing
+XML_TEST(FailingSinkFailsClose) {
+  const std::string data = MakeData(5 * 1024 * 1024);
+  for (int c = 0; c < 3; ++c) {
+    if (!CXmlCodecFile::IsSupported(kCodecs[c]))
+      continue;
+    // The full device takes every write and fails it
+    CXmlCodecFile file;
+    XML_ASSERT(file.OpenWrite("/dev/full", kCodecs[c]));
+    for (int i = 0; i < 4; ++i) {
+      file.Write(data.data(), data.size());
+    }
+    XML_EXPECT(!file.Close());
+
+    // Fewer bytes than a block only fail when Close hands them over
+    XML_ASSERT(file.OpenWrite("/dev/full", kCodecs[c]));
+    XML_EXPECT(file.Write(data.data(), 1000));
+    XML_EXPECT(!file.Close());
+    XmlWriteStats stats;
+    file.GetWriteStats(stats);
+    XML_EXPECT_EQ(static_cast<uint64_t>(0), stats.bytes_written_);
+  }
+}
+#endif
+
+// A file that can't be created fails to open for writing
+XML_TEST(UnwritableTargetFailsToOpen) {
+  CXmlCodecFile file;
+  XML_EXPECT(!file.OpenWrite(TempPath("missing/dir/file.xml"),
+                             CXmlCodecFile::kCodecNone));
+  XML_EXPECT(file.Close());
+}
@@ -0,0 +1,303 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <string>
+#include <vector>
+
+#include "../xmldedup.h"
+#include "../xmlfile.h"
+#include "./xmltest.h"
+#include "./xmltestmodel.h"
+
+using XmlDedup::MergeIdenticalDefinitions;
+using XmlTest::TempPath;
+
+namespace {
+
+XmlComponentInstanceInfo MakeInstance(const std::string& definition,
+                                      double x) {
+  XmlComponentInstanceInfo info;
+  info.definition_name_ = definition;
+  info.transform_ = XmlTest::MakeTransform(0.0, 1.0, x, 0.0, 0.0);
+  return info;
+}
+
+// A definition of a face and an edge, the same for the same 'offset'
+XmlComponentDefinitionInfo& AddDefinition(XmlModelInfo& model_info,
+                                          const std::string& name,
+                                          double offset) {
+  model_info.definitions_.emplace_back();
+  XmlComponentDefinitionInfo& info = model_info.definitions_.back();
+  info.name_ = name;
+  XmlFaceInfo face = XmlTest::MakeLoopFace(4, offset, 0.0, 0.0);
+  face.front_mat_name_ = "Red";
+  face.back_mat_name_ = "Red";
+  face.has_front_texture_ = face.has_back_texture_ = true;
+  info.entities_.faces_.push_back(face);
+  XmlEdgeInfo edge;
+  edge.start_.SetLocation(offset, 0.0, 0.0);
+  edge.end_.SetLocation(offset, 1.0, 0.0);
+  info.entities_.edges_.push_back(edge);
+  return info;
+}
+
+std::vector<std::string> Names(const XmlModelInfo& model_info) {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < model_info.definitions_.size(); ++i) {
+    names.push_back(model_info.definitions_[i].name_);
+  }
+  return names;
+}
+
+std::vector<std::string> List(const char* a, const char* b = NULL,
+                              const char* c = NULL) {
+  std::vector<std::string> list(1, a);
+  if (b != NULL)
+    list.push_back(b);
+  if (c != NULL)
+    list.push_back(c);
+  return list;
+}
+
+// The definition name of an instance, read with or without interned names
+const std::string& DefinitionOf(const XmlModelInfo& model_info,
+                                const XmlComponentInstanceInfo& info) {
+  if (info.definition_id_ != CXmlNameTable::kNoName)
+    return model_info.names_.GetName(info.definition_id_);
+  return info.definition_name_;
+}
+
+// Three copies of a chair, a table, instances of each at the top level and
+// in a group, and a room with chairs in it
+void BuildModel(XmlModelInfo& model_info) {
+  AddDefinition(model_info, "Chair", 0.0);
+  AddDefinition(model_info, "Chair#1", 0.0);
+  AddDefinition(model_info, "Table", 5.0);
+  XmlComponentDefinitionInfo& room = AddDefinition(model_info, "Room", 9.0);
+  room.entities_.component_instances_.push_back(MakeInstance("Chair#2", 1.0));
+  room.entities_.component_instances_.push_back(MakeInstance("Table", 2.0));
+  room.entities_.groups_.emplace_back();
+  room.entities_.groups_.back().entities_->component_instances_.push_back(
+      MakeInstance("Chair#1", 3.0));
+  AddDefinition(model_info, "Chair#2", 0.0);
+
+  XmlEntitiesInfo& geometry = model_info.entities_;
+  geometry.component_instances_.push_back(MakeInstance("Chair#1", 1.0));
+  geometry.component_instances_.push_back(MakeInstance("Chair#2", 2.0));
+  geometry.component_instances_.push_back(MakeInstance("Room", 3.0));
+  geometry.groups_.emplace_back();
+  geometry.groups_.back().entities_->component_instances_.push_back(
+      MakeInstance("Chair#2", 4.0));
+}
+
+// The model BuildModel gives once merged
+void CheckMerged(const XmlModelInfo& model_info) {
+  XML_ASSERT(Names(model_info) == List("Chair", "Table", "Room"));
+  XML_EXPECT(model_info.definitions_[0].aliases_ ==
+             List("Chair#1", "Chair#2"));
+  XML_EXPECT(model_info.definitions_[1].aliases_.empty());
+  XML_EXPECT(model_info.definitions_[2].aliases_.empty());
+
+  const XmlEntitiesInfo& geometry = model_info.entities_;
+  XML_ASSERT(geometry.component_instances_.size() == 3);
+  XML_EXPECT_EQ(std::string("Chair"),
+                DefinitionOf(model_info, geometry.component_instances_[0]));
+  XML_EXPECT_EQ(std::string("Chair"),
+                DefinitionOf(model_info, geometry.component_instances_[1]));
+  XML_EXPECT_EQ(std::string("Room"),
+                DefinitionOf(model_info, geometry.component_instances_[2]));
+  XML_EXPECT_EQ(std::string("Chair"), DefinitionOf(model_info,
+      geometry.groups_[0].entities_->component_instances_[0]));
+  // Instances keep their transforms
+  XML_EXPECT_EQ(2.0, geometry.component_instances_[1].transform_.values[12]);
+
+  const XmlEntitiesInfo& room = model_info.definitions_[2].entities_;
+  XML_ASSERT(room.component_instances_.size() == 2);
+  XML_EXPECT_EQ(std::string("Chair"),
+                DefinitionOf(model_info, room.component_instances_[0]));
+  XML_EXPECT_EQ(std::string("Table"),
+                DefinitionOf(model_info, room.component_instances_[1]));
+  XML_EXPECT_EQ(std::string("Chair"), DefinitionOf(model_info,
+      room.groups_[0].entities_->component_instances_[0]));
+}
+
+} // end namespace
+
+// Copies collapse into the first one, whose aliases name them, and every
+// instance refers to it, also inside the definitions that are kept
+XML_TEST(IdenticalDefinitionsCollapse) {
+  XmlModelInfo model_info;
+  BuildModel(model_info);
+  XML_EXPECT_EQ(static_cast<size_t>(2), MergeIdenticalDefinitions(model_info));
+  CheckMerged(model_info);
+  // Nothing left to merge
+  XML_EXPECT_EQ(static_cast<size_t>(0), MergeIdenticalDefinitions(model_info));
+  CheckMerged(model_info);
+}
+
+// Instances read with interned names are redirected by name ID
+XML_TEST(InternedInstancesAreRedirected) {
+  XmlModelInfo expected;
+  BuildModel(expected);
+  const std::string filename = TempPath("dedup_interned.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  const CXmlFile::ReadMode read_modes[] = {
+    CXmlFile::kReadDom, CXmlFile::kReadStreaming
+  };
+  for (int r = 0; r < 2; ++r) {
+    CXmlFile file;
+    file.set_intern_names(true);
+    XmlModelInfo model_info;
+    XML_ASSERT(XmlTest::ReadModel(file, filename, read_modes[r], model_info));
+    XML_EXPECT(model_info.entities_.component_instances_[0].definition_id_ !=
+               CXmlNameTable::kNoName);
+    XML_EXPECT_EQ(static_cast<size_t>(2),
+                  MergeIdenticalDefinitions(model_info));
+    CheckMerged(model_info);
+  }
+}
+
+// Aliases are written with the definitions and read back in every mode
+XML_TEST(AliasesRoundTrip) {
+  XmlModelInfo expected;
+  BuildModel(expected);
+  MergeIdenticalDefinitions(expected);
+  const CXmlFile::WriteMode write_modes[] = {
+    CXmlFile::kWriteDom, CXmlFile::kWriteStreaming
+  };
+  const CXmlFile::ReadMode read_modes[] = {
+    CXmlFile::kReadDom, CXmlFile::kReadStreaming, CXmlFile::kReadMapped
+  };
+  for (int w = 0; w < 2; ++w) {
+    const std::string filename = TempPath("dedup_aliases.xml");
+    XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                   CXmlFile::kXmlVersionPackedFaces,
+                                   write_modes[w]));
+    for (int r = 0; r < 3; ++r) {
+      CXmlFile file;
+      XmlModelInfo actual;
+      XML_ASSERT(XmlTest::ReadModel(file, filename, read_modes[r], actual));
+      XML_EXPECT_SAME_MODEL(expected, actual);
+
+      // A lazy definition gets its aliases when it is loaded
+      file.set_lazy_definitions(true);
+      XmlModelInfo lazy;
+      XML_ASSERT(file.Open(filename, false, read_modes[r]));
+      XML_ASSERT(file.GetModelInfo(lazy));
+      XML_EXPECT(lazy.definitions_[0].aliases_.empty());
+      XML_EXPECT(file.LoadComponentDefinitions(lazy));
+      file.Close(false);
+      XML_EXPECT_SAME_MODEL(expected, lazy);
+    }
+  }
+}
+
+// Definitions whose instances refer to copies merge once the copies have,
+// whichever comes first
+XML_TEST(NestedCopiesMerge) {
+  XmlModelInfo model_info;
+  AddDefinition(model_info, "Seat#1", 1.0).entities_.component_instances_
+      .push_back(MakeInstance("Leg#1", 0.5));
+  AddDefinition(model_info, "Leg", 0.0);
+  AddDefinition(model_info, "Leg#1", 0.0);
+  AddDefinition(model_info, "Seat", 1.0).entities_.component_instances_
+      .push_back(MakeInstance("Leg", 0.5));
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Seat", 0.0));
+
+  XML_EXPECT_EQ(static_cast<size_t>(2), MergeIdenticalDefinitions(model_info));
+  XML_ASSERT(Names(model_info) == List("Seat#1", "Leg"));
+  XML_EXPECT(model_info.definitions_[0].aliases_ == List("Seat"));
+  XML_EXPECT(model_info.definitions_[1].aliases_ == List("Leg#1"));
+  XML_EXPECT_EQ(std::string("Leg"), model_info.definitions_[0].entities_
+                .component_instances_[0].definition_name_);
+  XML_EXPECT_EQ(std::string("Seat#1"),
+                model_info.entities_.component_instances_[0].definition_name_);
+
+  // Aliases of a merged definition move along with it
+  XmlModelInfo again;
+  AddDefinition(again, "Leg", 0.0).aliases_ = List("Leg#1");
+  AddDefinition(again, "Leg#2", 0.0).aliases_ = List("Leg#3");
+  XML_EXPECT_EQ(static_cast<size_t>(1), MergeIdenticalDefinitions(again));
+  XML_ASSERT(again.definitions_.size() == 1);
+  XML_EXPECT(again.definitions_[0].aliases_ ==
+             List("Leg#1", "Leg#2", "Leg#3"));
+}
+
+// Any difference keeps definitions apart: a coordinate 1e-9 away, another
+// material, a transform, or one more entity
+XML_TEST(NearIdenticalDefinitionsStayApart) {
+  XmlModelInfo model_info;
+  AddDefinition(model_info, "Chair", 0.0);
+  AddDefinition(model_info, "Moved", 1e-9);
+  AddDefinition(model_info, "Blue", 0.0).entities_.faces_[0].front_mat_name_ =
+      "Blue";
+  AddDefinition(model_info, "Edge moved", 0.0).entities_.edges_[0].end_
+      .SetLocation(0.0, 1.0 + 1e-9, 0.0);
+  XmlEntitiesInfo& extra =
+      AddDefinition(model_info, "Extra edge", 0.0).entities_;
+  const XmlEdgeInfo edge = extra.edges_[0];
+  extra.edges_.push_back(edge);
+  AddDefinition(model_info, "Holder", 0.0).entities_.component_instances_
+      .push_back(MakeInstance("Chair", 0.0));
+  AddDefinition(model_info, "Other holder", 0.0).entities_
+      .component_instances_.push_back(MakeInstance("Chair", 1e-9));
+  XML_EXPECT_EQ(static_cast<size_t>(0), MergeIdenticalDefinitions(model_info));
+  XML_EXPECT_EQ(static_cast<size_t>(7), model_info.definitions_.size());
+  for (size_t i = 0; i < model_info.definitions_.size(); ++i) {
+    XML_EXPECT(model_info.definitions_[i].aliases_.empty());
+  }
+
+  // -0.0 is written as 0, so it matches
+  AddDefinition(model_info, "Negative zero", -0.0);
+  XML_EXPECT_EQ(static_cast<size_t>(1), MergeIdenticalDefinitions(model_info));
+}
+
+// A definition containing itself doesn't recurse forever. Its copy names
+// itself, so it only merges with a copy that names the first.
+XML_TEST(SelfContainingDefinitions) {
+  XmlModelInfo model_info;
+  AddDefinition(model_info, "Fractal", 0.0).entities_.component_instances_
+      .push_back(MakeInstance("Fractal", 0.5));
+  AddDefinition(model_info, "Fractal#1", 0.0).entities_.component_instances_
+      .push_back(MakeInstance("Fractal#1", 0.5));
+  AddDefinition(model_info, "Fractal#2", 0.0).entities_.component_instances_
+      .push_back(MakeInstance("Fractal", 0.5));
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Fractal#2", 0.0));
+
+  XML_EXPECT_EQ(static_cast<size_t>(1), MergeIdenticalDefinitions(model_info));
+  XML_ASSERT(Names(model_info) == List("Fractal", "Fractal#1"));
+  XML_EXPECT(model_info.definitions_[0].aliases_ == List("Fractal#2"));
+  XML_EXPECT_EQ(std::string("Fractal"),
+                model_info.entities_.component_instances_[0].definition_name_);
+  XML_EXPECT_EQ(std::string("Fractal#1"), model_info.definitions_[1].entities_
+                .component_instances_[0].definition_name_);
+}
+
+// Lazy definitions are found by their index, so nothing moves until they
+// are all loaded
+XML_TEST(UnloadedLazyModelsAreLeftAlone) {
+  XmlModelInfo expected;
+  BuildModel(expected);
+  const std::string filename = TempPath("dedup_lazy.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  CXmlFile file;
+  file.set_lazy_definitions(true);
+  XmlModelInfo model_info;
+  XML_ASSERT(file.Open(filename, false, CXmlFile::kReadDom));
+  XML_ASSERT(file.GetModelInfo(model_info));
+  XML_EXPECT(file.LoadComponentDefinition(model_info, 1));
+  XML_EXPECT_EQ(static_cast<size_t>(0), MergeIdenticalDefinitions(model_info));
+  XML_EXPECT(Names(model_info) == Names(expected));
+  XML_EXPECT_EQ(std::string("Chair#1"),
+                model_info.entities_.component_instances_[0].definition_name_);
+
+  XML_EXPECT(file.LoadComponentDefinitions(model_info));
+  file.Close(false);
+  XML_EXPECT_EQ(static_cast<size_t>(2), MergeIdenticalDefinitions(model_info));
+  CheckMerged(model_info);
+}
@@ -0,0 +1,168 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <vector>
+
+#include "../xmlfacestore.h"
+#include "../xmlfile.h"
+#include "./xmltest.h"
+#include "./xmltestmodel.h"
+
+using XmlGeomUtils::CPoint3d;
+
+namespace {
+
+bool SamePoint(const CPoint3d& a, const CPoint3d& b) {
+  return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+}
+
+// The faces of the test model, with their names given as IDs
+std::vector<XmlFaceInfo> MakeFaces() {
+  std::vector<XmlFaceInfo> faces;
+  XmlFaceInfo loop = XmlTest::MakeLoopFace(5, 1.0, 2.0, 3.0);
+  loop.layer_id_ = 2;
+  loop.front_mat_id_ = 3;
+  loop.has_front_texture_ = true;
+  loop.has_back_texture_ = true;
+  faces.push_back(loop);
+
+  XmlFaceInfo strip = XmlTest::MakeTriangleStrip(4, -1.0, 0.5, 0.0);
+  strip.front_mat_id_ = 1;
+  strip.back_mat_id_ = 3;
+  strip.has_back_texture_ = true;
+  faces.push_back(strip);
+
+  XmlFaceInfo plain = XmlTest::MakeLoopFace(3, 0.0, 0.0, -7.0);
+  plain.front_mat_id_ = 3;
+  faces.push_back(plain);
+
+  // A face without vertices, like one whose loop couldn't be read
+  faces.push_back(XmlFaceInfo());
+  return faces;
+}
+
+// Whether a face read back from a store is the one added, where untextured
+// sides have no texture coordinates
+void ExpectSameFace(const XmlFaceInfo& expected, const XmlFaceInfo& actual) {
+  XML_EXPECT_EQ(expected.layer_id_, actual.layer_id_);
+  XML_EXPECT_EQ(expected.front_mat_id_, actual.front_mat_id_);
+  XML_EXPECT_EQ(expected.back_mat_id_, actual.back_mat_id_);
+  XML_EXPECT_EQ(expected.has_front_texture_, actual.has_front_texture_);
+  XML_EXPECT_EQ(expected.has_back_texture_, actual.has_back_texture_);
+  XML_EXPECT_EQ(expected.has_single_loop_, actual.has_single_loop_);
+  XML_EXPECT(actual.layer_name_.empty());
+  XML_ASSERT(expected.vertices_.size() == actual.vertices_.size());
+  for (size_t i = 0; i < expected.vertices_.size(); ++i) {
+    const XmlFaceVertex& a = expected.vertices_[i];
+    const XmlFaceVertex& b = actual.vertices_[i];
+    XML_EXPECT(SamePoint(a.vertex_, b.vertex_));
+    XML_EXPECT(SamePoint(expected.has_front_texture_ ?
+                             a.front_texture_coord_ : CPoint3d(),
+                         b.front_texture_coord_));
+    XML_EXPECT(SamePoint(expected.has_back_texture_ ?
+                             a.back_texture_coord_ : CPoint3d(),
+                         b.back_texture_coord_));
+  }
+  XML_ASSERT(expected.indices_.size() == actual.indices_.size());
+  for (size_t i = 0; i < expected.indices_.size(); ++i)
+    XML_EXPECT_EQ(expected.indices_[i], actual.indices_[i]);
+}
+
+} // end namespace
+
+// Faces come back from the store the way they went in, by index and by
+// iteration
+XML_TEST(FacesRoundTrip) {
+  const std::vector<XmlFaceInfo> faces = MakeFaces();
+  CXmlFaceStore store;
+  XML_EXPECT(store.empty());
+  store.reserve(faces.size());
+  for (size_t i = 0; i < faces.size(); ++i)
+    store.AddFace(faces[i]);
+  XML_ASSERT(store.size() == faces.size());
+
+  size_t face = 0;
+  for (CXmlFaceStore::const_iterator it = store.begin(); it != store.end();
+       ++it, ++face) {
+    XML_ASSERT(face < faces.size());
+    XML_EXPECT_EQ(face, it->face());
+    XmlFaceInfo info;
+    it->GetFaceInfo(info);
+    ExpectSameFace(faces[face], info);
+  }
+  XML_EXPECT_EQ(faces.size(), face);
+
+  // The views give the same as the infos
+  const CXmlFaceView strip = store[1];
+  XML_EXPECT_EQ(faces[1].vertices_.size(), strip.vertex_count());
+  XML_EXPECT_EQ(faces[1].indices_.size(), strip.index_count());
+  XML_ASSERT(strip.positions() != NULL && strip.indices() != NULL);
+  XML_EXPECT(strip.positions()[3] == faces[1].vertices_[1].vertex_.x());
+  XML_EXPECT_EQ(faces[1].indices_[4], strip.indices()[4]);
+  XML_EXPECT(SamePoint(strip.front_texture_coord(2), CPoint3d()));
+  XML_EXPECT(store[0].indices() == NULL);
+  XML_EXPECT(store[3].positions() == NULL);
+  XML_EXPECT_EQ(static_cast<size_t>(0), store[3].vertex_count());
+
+  store.clear();
+  XML_EXPECT(store.empty());
+  XML_EXPECT(store.begin() == store.end());
+}
+
+// Reading into an info that held another face replaces all of it
+XML_TEST(GetFaceInfoOverwrites) {
+  const std::vector<XmlFaceInfo> faces = MakeFaces();
+  CXmlFaceStore store;
+  store.AddFace(faces[2]);
+  XmlFaceInfo info = faces[1];
+  info.layer_name_ = "Old";
+  store[0].GetFaceInfo(info);
+  ExpectSameFace(faces[2], info);
+}
+
+XML_TEST(RemapNamesRenumbersEveryName) {
+  const std::vector<XmlFaceInfo> faces = MakeFaces();
+  CXmlFaceStore store;
+  for (size_t i = 0; i < faces.size(); ++i)
+    store.AddFace(faces[i]);
+  std::vector<uint32_t> ids;
+  ids.push_back(0);
+  ids.push_back(7);
+  ids.push_back(5);
+  ids.push_back(6);
+  store.RemapNames(ids);
+  for (size_t i = 0; i < faces.size(); ++i) {
+    XML_EXPECT_EQ(ids[faces[i].layer_id_], store[i].layer_id());
+    XML_EXPECT_EQ(ids[faces[i].front_mat_id_], store[i].front_mat_id());
+    XML_EXPECT_EQ(ids[faces[i].back_mat_id_], store[i].back_mat_id());
+  }
+}
+
+// Batches follow the order front materials are first used in, and list the
+// faces of each in store order
+XML_TEST(MaterialBatchesGroupFaces) {
+  const std::vector<XmlFaceInfo> faces = MakeFaces();
+  CXmlFaceStore store;
+  for (size_t i = 0; i < faces.size(); ++i)
+    store.AddFace(faces[i]);
+  std::vector<uint32_t> order;
+  std::vector<XmlFaceBatch> batches;
+  store.GetMaterialBatches(order, batches);
+  XML_ASSERT(batches.size() == 3);
+  XML_EXPECT_EQ(3u, batches[0].material_id_);
+  XML_EXPECT_EQ(0u, batches[0].first_);
+  XML_EXPECT_EQ(2u, batches[0].count_);
+  XML_EXPECT_EQ(1u, batches[1].material_id_);
+  XML_EXPECT_EQ(2u, batches[1].first_);
+  XML_EXPECT_EQ(1u, batches[1].count_);
+  XML_EXPECT_EQ(0u, batches[2].material_id_);
+  XML_EXPECT_EQ(1u, batches[2].count_);
+  const uint32_t expected_order[] = { 0, 2, 1, 3 };
+  XML_ASSERT(order.size() == 4);
+  for (size_t i = 0; i < 4; ++i)
+    XML_EXPECT_EQ(expected_order[i], order[i]);
+
+  CXmlFaceStore empty;
+  empty.GetMaterialBatches(order, batches);
+  XML_EXPECT(order.empty());
+  XML_EXPECT(batches.empty());
+}
@@ -0,0 +1,486 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <sys/stat.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "../tinyxml2.h"
+#include "../xmlfile.h"
+#include "./xmltest.h"
+#include "./xmltestmodel.h"
+
+using XmlTest::TempPath;
+
+// What was written reads back equal, with either reader and from a file
+// written either way
+XML_TEST(DomAndStreamingReadsMatchWrittenModel) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected, 2);
+  const CXmlFile::WriteMode write_modes[] = {
+    CXmlFile::kWriteDom, CXmlFile::kWriteStreaming
+  };
+  const CXmlFile::ReadMode read_modes[] = {
+    CXmlFile::kReadDom, CXmlFile::kReadStreaming
+  };
+  for (int w = 0; w < 2; ++w) {
+    const std::string filename = TempPath("read_" + std::to_string(w) +
+                                          ".xml");
+    XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                   CXmlFile::kXmlVersionPackedFaces,
+                                   write_modes[w]));
+    for (int r = 0; r < 2; ++r) {
+      CXmlFile file;
+      XmlModelInfo actual;
+      XML_ASSERT(XmlTest::ReadModel(file, filename, read_modes[r], actual));
+      XML_EXPECT_SAME_MODEL(expected, actual);
+    }
+  }
+}
+
+// The streaming writer prints the same bytes as the DOM
+XML_TEST(DomAndStreamingWritesMatch) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info);
+  const std::string dom_file = TempPath("write_dom.xml");
+  const std::string streamed_file = TempPath("write_streamed.xml");
+  XML_ASSERT(XmlTest::WriteModel(dom_file, model_info,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteDom));
+  XML_ASSERT(XmlTest::WriteModel(streamed_file, model_info,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  const std::string dom_text = XmlTest::ReadFile(dom_file);
+  XML_EXPECT(!dom_text.empty());
+  XML_EXPECT(dom_text == XmlTest::ReadFile(streamed_file));
+}
+
+// Names and faces read the same whether interned, in a face store, or from
+// an arena
+XML_TEST(StreamingReadOptionsMatchDom) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected);
+  const std::string filename = TempPath("options.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  for (int options = 0; options < 8; ++options) {
+    CXmlFile file;
+    file.set_intern_names((options & 1) != 0);
+    file.set_use_face_store((options & 2) != 0);
+    file.set_use_arena((options & 4) != 0);
+    XmlModelInfo actual;
+    XML_ASSERT(XmlTest::ReadModel(file, filename, CXmlFile::kReadStreaming,
+                                  actual));
+    XML_EXPECT_SAME_MODEL(expected, actual);
+  }
+}
+
+// A file cut short fails to read rather than giving part of a model
+XML_TEST(TruncatedFileFailsToRead) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info);
+  const std::string filename = TempPath("truncated.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, model_info,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  const std::string text = XmlTest::ReadFile(filename);
+  XML_ASSERT(XmlTest::WriteFile(filename, text.substr(0, text.size() / 2)));
+  const CXmlFile::ReadMode read_modes[] = {
+    CXmlFile::kReadDom, CXmlFile::kReadStreaming, CXmlFile::kReadMapped
+  };
+  for (int r = 0; r < 3; ++r) {
+    CXmlFile file;
+    XmlModelInfo actual;
+    XML_EXPECT(!XmlTest::ReadModel(file, filename, read_modes[r], actual));
+  }
+}
+
+// Reading from a mapping gives the same model as the streaming reader,
+// on one thread or several
+XML_TEST(MappedReadMatchesWrittenModel) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected, 2);
+  const std::string filename = TempPath("mapped.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  const unsigned thread_counts[] = { 1, 3 };
+  for (int t = 0; t < 2; ++t) {
+    CXmlFile file;
+    file.set_read_threads(thread_counts[t]);
+    XmlModelInfo actual;
+    XML_ASSERT(XmlTest::ReadModel(file, filename, CXmlFile::kReadMapped,
+                                  actual));
+    XML_EXPECT_SAME_MODEL(expected, actual);
+  }
+}
+
+// A file that can't be opened fails in every read mode
+XML_TEST(MissingFileFailsToOpen) {
+  const CXmlFile::ReadMode read_modes[] = {
+    CXmlFile::kReadDom, CXmlFile::kReadStreaming, CXmlFile::kReadMapped
+  };
+  for (int r = 0; r < 3; ++r) {
+    CXmlFile file;
+    XML_EXPECT(!file.Open(TempPath("missing.xml"), false, read_modes[r]));
+  }
+}
+
+// A streamed file replaces the last one only once it is complete
+XML_TEST(StreamingWriteReplacesOldFile) {
+  const std::string filename = TempPath("replace.xml");
+  XML_ASSERT(XmlTest::WriteFile(filename, "old"));
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info);
+  XML_ASSERT(XmlTest::WriteModel(filename, model_info,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  XML_EXPECT(XmlTest::ReadFile(filename) != "old");
+  XML_EXPECT(!XmlTest::FileExists(filename + ".tmp"));
+
+  // Cancelled, the old file stays and the temporary one goes
+  CXmlFile file;
+  XML_ASSERT(file.Open(filename, CXmlFile::kWriteStreaming));
+  file.WriteHeader(20, 1, 229);
+  XML_EXPECT(XmlTest::FileExists(filename + ".tmp"));
+  XML_EXPECT(file.Close(true));
+  XML_EXPECT(XmlTest::ReadFile(filename) != "old");
+  XML_EXPECT(!XmlTest::FileExists(filename + ".tmp"));
+}
+
+// When the destination can't be replaced, Close fails and the text is kept
+// in the temporary file
+XML_TEST(FailedReplaceKeepsTemporaryFile) {
+  // A directory that isn't empty can't be replaced by a file
+  const std::string filename = TempPath("blocked.xml");
+  mkdir(filename.c_str(), 0777);
+  const std::string blocker = filename + "/keep";
+  XML_ASSERT(XmlTest::WriteFile(blocker, "old"));
+
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info);
+  XML_EXPECT(!XmlTest::WriteModel(filename, model_info,
+                                  CXmlFile::kXmlVersionPackedFaces,
+                                  CXmlFile::kWriteStreaming));
+  XML_EXPECT_EQ(std::string("old"), XmlTest::ReadFile(blocker));
+  CXmlFile file;
+  XmlModelInfo actual;
+  XML_EXPECT(XmlTest::ReadModel(file, filename + ".tmp",
+                                CXmlFile::kReadStreaming, actual));
+  XML_EXPECT_SAME_MODEL(model_info, actual);
+}
+
+XML_TEST(DomWriteReportsFailure) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info);
+  XML_EXPECT(!XmlTest::WriteModel(TempPath("no_such_dir/dom.xml"),
+                                  model_info,
+                                  CXmlFile::kXmlVersionPackedFaces,
+                                  CXmlFile::kWriteDom));
+}
+
+// Faces written as vertex elements (version 3) or as packed arrays
+// (version 4) read back the same in every read mode
+XML_TEST(VersionsReadBackEqual) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected);
+  const int versions[] = {
+    CXmlFile::kXmlVersionVertexElements, CXmlFile::kXmlVersionPackedFaces
+  };
+  const CXmlFile::ReadMode read_modes[] = {
+    CXmlFile::kReadDom, CXmlFile::kReadStreaming, CXmlFile::kReadMapped
+  };
+  for (int v = 0; v < 2; ++v) {
+    const std::string filename = TempPath("version_" +
+                                          std::to_string(versions[v]) +
+                                          ".xml");
+    XML_ASSERT(XmlTest::WriteModel(filename, expected, versions[v],
+                                   CXmlFile::kWriteStreaming));
+    for (int r = 0; r < 3; ++r) {
+      CXmlFile file;
+      XmlModelInfo actual;
+      XML_ASSERT(XmlTest::ReadModel(file, filename, read_modes[r], actual));
+      XML_EXPECT_EQ(versions[v], file.xml_version());
+      XML_EXPECT_SAME_MODEL(expected, actual);
+    }
+  }
+}
+
+// Packed faces make the file smaller
+XML_TEST(PackedFacesAreSmaller) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info, 2);
+  const std::string v3_file = TempPath("size_v3.xml");
+  const std::string v4_file = TempPath("size_v4.xml");
+  XML_ASSERT(XmlTest::WriteModel(v3_file, model_info,
+                                 CXmlFile::kXmlVersionVertexElements,
+                                 CXmlFile::kWriteDom));
+  XML_ASSERT(XmlTest::WriteModel(v4_file, model_info,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteDom));
+  XML_EXPECT(XmlTest::ReadFile(v4_file).size() <
+             XmlTest::ReadFile(v3_file).size());
+}
+
+// Groups that were moved from can still be copied and assigned
+XML_TEST(MovedFromGroupsCopy) {
+  XmlGroupInfo group;
+  group.entities_->faces_.push_back(XmlTest::MakeLoopFace(3, 0.0, 0.0, 0.0));
+  XmlGroupInfo moved(std::move(group));
+  XML_EXPECT(!group.entities_);
+
+  XmlGroupInfo copy(group);
+  XML_ASSERT(copy.entities_ != NULL);
+  XML_EXPECT(copy.entities_->faces_.empty());
+
+  // Into a moved-from group, and from one
+  group = moved;
+  XML_ASSERT(group.entities_ != NULL);
+  XML_EXPECT_EQ(1u, group.entities_->faces_.size());
+  XML_EXPECT_EQ(1u, moved.entities_->faces_.size());
+  XmlGroupInfo empty(std::move(copy));
+  moved = copy;
+  XML_ASSERT(moved.entities_ != NULL);
+  XML_EXPECT(moved.entities_->faces_.empty());
+  XML_EXPECT_EQ(1u, group.entities_->faces_.size());
+}
+
+// The entities blocks of nested groups are collected depth first
+XML_TEST(BlocksAreCollectedDepthFirst) {
+  XmlEntitiesInfo entities;
+  entities.groups_.resize(2);
+  XmlEntitiesInfo& first = *entities.groups_[0].entities_;
+  first.groups_.resize(1);
+  std::vector<XmlEntitiesInfo*> blocks;
+  entities.CollectBlocks(blocks);
+  XML_ASSERT(blocks.size() == 4);
+  XML_EXPECT(blocks[0] == &entities);
+  XML_EXPECT(blocks[1] == &first);
+  XML_EXPECT(blocks[2] == first.groups_[0].entities_.get());
+  XML_EXPECT(blocks[3] == entities.groups_[1].entities_.get());
+
+  std::vector<const XmlEntitiesInfo*> const_blocks;
+  static_cast<const XmlEntitiesInfo&>(entities).CollectBlocks(const_blocks);
+  XML_EXPECT(std::equal(blocks.begin(), blocks.end(), const_blocks.begin()));
+}
+
+// Interned names get the IDs of a read in file order, on any number of
+// threads
+XML_TEST(NameIdsDontDependOnThreads) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected, 2);
+  // Names first used in the geometry, in a group and after the groups
+  XmlFaceInfo face = XmlTest::MakeLoopFace(3, 0.0, 0.0, 0.0);
+  face.layer_name_ = "Top level";
+  face.front_mat_name_ = "Group";
+  for (size_t i = 0; i < face.vertices_.size(); ++i) {
+    face.vertices_[i].front_texture_coord_ = XmlGeomUtils::CPoint3d();
+    face.vertices_[i].back_texture_coord_ = XmlGeomUtils::CPoint3d();
+  }
+  expected.entities_.faces_.push_back(face);
+  face.layer_name_ = "Group";
+  expected.entities_.groups_[1].entities_->faces_.push_back(face);
+  const std::string filename = TempPath("threads.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  const CXmlFile::ReadMode read_modes[] = {
+    CXmlFile::kReadDom, CXmlFile::kReadMapped
+  };
+  for (int r = 0; r < 2; ++r) {
+    XmlModelInfo serial;
+    CXmlFile serial_file;
+    serial_file.set_intern_names(true);
+    XML_ASSERT(XmlTest::ReadModel(serial_file, filename, read_modes[r],
+                                  serial));
+    for (unsigned threads = 2; threads <= 4; ++threads) {
+      XmlModelInfo parallel;
+      CXmlFile parallel_file;
+      parallel_file.set_intern_names(true);
+      parallel_file.set_use_face_store(threads == 4);
+      parallel_file.set_read_threads(threads);
+      XML_ASSERT(XmlTest::ReadModel(parallel_file, filename, read_modes[r],
+                                    parallel));
+      XML_EXPECT_SAME_MODEL(expected, parallel);
+      XML_ASSERT(serial.names_.size() == parallel.names_.size());
+      for (uint32_t id = 0; id < serial.names_.size(); ++id) {
+        XML_EXPECT_EQ(serial.names_.GetName(id), parallel.names_.GetName(id));
+      }
+    }
+  }
+}
+
+// Lazy definitions load on demand while the file is open, and fail rather
+// than read freed memory once it is closed
+XML_TEST(LazyDefinitionsLoadUntilClosed) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected);
+  const std::string filename = TempPath("lazy.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  const CXmlFile::ReadMode read_modes[] = {
+    CXmlFile::kReadDom, CXmlFile::kReadStreaming, CXmlFile::kReadMapped
+  };
+  for (int r = 0; r < 3; ++r) {
+    CXmlFile file;
+    file.set_lazy_definitions(true);
+    XmlModelInfo actual;
+    XML_ASSERT(file.Open(filename, false, read_modes[r]));
+    XML_ASSERT(file.GetModelInfo(actual));
+    XML_ASSERT(actual.definitions_.size() == expected.definitions_.size());
+    XML_EXPECT(!actual.definitions_[1].loaded_);
+    const XmlComponentDefinitionInfo* info =
+        file.LoadComponentDefinition(actual, expected.definitions_[1].name_);
+    XML_ASSERT(info != NULL);
+    XML_EXPECT(info->loaded_);
+    XML_EXPECT(file.LoadComponentDefinition(actual, "No such name") == NULL);
+
+    file.Close(false);
+    XML_EXPECT(!file.LoadComponentDefinition(actual, 2));
+    XML_EXPECT(file.LoadComponentDefinition(
+        actual, expected.definitions_[2].name_) == NULL);
+    XML_EXPECT(!actual.definitions_[2].loaded_);
+    // Loaded ones stay
+    XML_EXPECT(file.LoadComponentDefinition(actual, 1));
+
+    // Opened again, only the new model loads
+    XML_ASSERT(file.Open(filename, false, read_modes[r]));
+    XML_EXPECT(!file.LoadComponentDefinition(actual, 2));
+    XmlModelInfo reopened;
+    XML_ASSERT(file.GetModelInfo(reopened));
+    XML_EXPECT(file.LoadComponentDefinitions(reopened));
+    file.Close(false);
+    XML_EXPECT_SAME_MODEL(expected, reopened);
+  }
+}
+
+// Version 3 triangles repeat their corners; the readers share the equal
+// ones, in order of first use, and keep corners apart that only differ in
+// texture coordinates
+XML_TEST(Version3CornersAreShared) {
+  XmlModelInfo written;
+  XmlFaceInfo face = XmlTest::MakeTriangleStrip(3, 0.0, 0.0, 0.0);
+  face.front_mat_name_ = "Brick";
+  face.has_front_texture_ = true;
+  face.vertices_[4] = face.vertices_[0];
+  // At the position of corner 1, with a texture coordinate of its own
+  XmlFaceVertex split = face.vertices_[1];
+  split.front_texture_coord_.set_x(0.5);
+  face.vertices_.push_back(split);
+  const uint32_t indices[] = { 0, 1, 2, 3, 5, 2, 4, 1, 3, 0, 5, 4 };
+  face.indices_.assign(indices, indices + 12);
+  written.entities_.faces_.push_back(face);
+  const std::string filename = TempPath("shared_corners.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, written,
+                                 CXmlFile::kXmlVersionVertexElements,
+                                 CXmlFile::kWriteStreaming));
+
+  const uint32_t expected_indices[] = {
+    0, 1, 2, 3, 4, 2, 0, 1, 3, 0, 4, 0
+  };
+  const CXmlFile::ReadMode read_modes[] = {
+    CXmlFile::kReadDom, CXmlFile::kReadStreaming
+  };
+  for (int r = 0; r < 2; ++r) {
+    CXmlFile file;
+    XmlModelInfo actual;
+    XML_ASSERT(XmlTest::ReadModel(file, filename, read_modes[r], actual));
+    XML_ASSERT(actual.entities_.faces_.size() == 1);
+    const XmlFaceInfo& read = actual.entities_.faces_[0];
+    XML_ASSERT(read.vertices_.size() == 5);
+    XML_ASSERT(read.indices_.size() == 12);
+    for (size_t i = 0; i < 12; ++i)
+      XML_EXPECT_EQ(expected_indices[i], read.indices_[i]);
+    const size_t sources[] = { 0, 1, 2, 3, 5 };
+    for (size_t i = 0; i < 5; ++i) {
+      const XmlFaceVertex& expected = face.vertices_[sources[i]];
+      XML_EXPECT(read.vertices_[i].vertex_.x() == expected.vertex_.x());
+      XML_EXPECT(read.vertices_[i].vertex_.y() == expected.vertex_.y());
+      XML_EXPECT(read.vertices_[i].vertex_.z() == expected.vertex_.z());
+      XML_EXPECT(read.vertices_[i].front_texture_coord_.x() ==
+                 expected.front_texture_coord_.x());
+    }
+  }
+}
+
+// One file object reading several files in turn with the DOM, which it
+// keeps between them, reads each like a new one would
+XML_TEST(ReusedDomReadsLikeNewFile) {
+  const int sizes[] = { 1, 3, 2, 3 };
+  std::string filenames[4];
+  XmlModelInfo expected[4];
+  for (int i = 0; i < 4; ++i) {
+    filenames[i] = TempPath("reuse_" + std::to_string(i) + ".xml");
+    XmlTest::BuildTestModel(expected[i], sizes[i]);
+    XML_ASSERT(XmlTest::WriteModel(filenames[i], expected[i],
+                                   CXmlFile::kXmlVersionPackedFaces,
+                                   CXmlFile::kWriteStreaming));
+  }
+
+  CXmlFile reused;
+  tinyxml2::XMLMemoryStats stats;
+  XML_EXPECT(!reused.GetDomMemoryStats(stats));
+  tinyxml2::XMLMemoryStats largest = {};
+  for (int i = 0; i < 4; ++i) {
+    XmlModelInfo actual;
+    XML_ASSERT(XmlTest::ReadModel(reused, filenames[i], CXmlFile::kReadDom,
+                                  actual));
+    XML_EXPECT_SAME_MODEL(expected[i], actual);
+
+    CXmlFile fresh;
+    XmlModelInfo fresh_actual;
+    XML_ASSERT(XmlTest::ReadModel(fresh, filenames[i], CXmlFile::kReadDom,
+                                  fresh_actual));
+    XML_EXPECT_SAME_MODEL(fresh_actual, actual);
+
+    // The memory of the largest file so far is kept, not added to
+    XML_ASSERT(reused.GetDomMemoryStats(stats));
+    if (i == 1) {
+      largest = stats;
+    } else if (i == 3) {
+      XML_EXPECT_EQ(largest.poolBlocks, stats.poolBlocks);
+      XML_EXPECT_EQ(largest.reservedPoolBytes, stats.reservedPoolBytes);
+      XML_EXPECT_EQ(largest.charBufferBytes, stats.charBufferBytes);
+    }
+    XML_EXPECT(stats.charBufferBytes >= XmlTest::ReadFile(filenames[i]).size());
+  }
+}
+
+// The DOM block size applies from the next Open, and gives fewer, larger
+// blocks
+XML_TEST(DomBlockSizeTakesEffect) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected, 3);
+  const std::string filename = TempPath("block_size.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+
+  CXmlFile small_blocks;
+  XmlModelInfo small_actual;
+  XML_ASSERT(XmlTest::ReadModel(small_blocks, filename, CXmlFile::kReadDom,
+                                small_actual));
+  tinyxml2::XMLMemoryStats small_stats;
+  XML_ASSERT(small_blocks.GetDomMemoryStats(small_stats));
+
+  CXmlFile large_blocks;
+  large_blocks.set_dom_block_size(1024 * 1024);
+  XML_EXPECT_EQ(1024 * 1024, large_blocks.dom_block_size());
+  XmlModelInfo large_actual;
+  XML_ASSERT(XmlTest::ReadModel(large_blocks, filename, CXmlFile::kReadDom,
+                                large_actual));
+  XML_EXPECT_SAME_MODEL(expected, large_actual);
+  tinyxml2::XMLMemoryStats large_stats;
+  XML_ASSERT(large_blocks.GetDomMemoryStats(large_stats));
+  // At most one block for each node pool
+  XML_EXPECT(large_stats.poolBlocks <= 4);
+  XML_EXPECT(small_stats.poolBlocks > large_stats.poolBlocks);
+  XML_EXPECT_EQ(small_stats.peakPoolBytes, large_stats.peakPoolBytes);
+}
@@ -0,0 +1,370 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../xmlfile.h"
+#include "../xmlflattener.h"
+#include "./xmltest.h"
+#include "./xmltestmodel.h"
+
+using XmlGeomUtils::CPoint3d;
+
+namespace {
+
+// What the flattener should give for one batch, worked out the slow way
+struct ReferenceBatch {
+  std::string material_name_;
+  std::string layer_name_;
+  std::vector<double> positions_;
+  std::vector<double> texture_coords_;
+  size_t triangles_;
+};
+
+// a * b by columns, which applies b first
+SUTransformation Multiply(const SUTransformation& a,
+                          const SUTransformation& b) {
+  SUTransformation product;
+  for (int column = 0; column < 4; ++column) {
+    for (int row = 0; row < 4; ++row) {
+      double sum = 0.0;
+      for (int i = 0; i < 4; ++i) {
+        sum += a.values[i * 4 + row] * b.values[column * 4 + i];
+      }
+      product.values[column * 4 + row] = sum;
+    }
+  }
+  return product;
+}
+
+// Walks the model like CXmlFile writes it, transforming every vertex on
+// its own
+class CReferenceFlattener {
+ public:
+  explicit CReferenceFlattener(const XmlModelInfo& model_info)
+    : model_info_(model_info) {}
+
+  void Flatten(std::vector<ReferenceBatch>& batches) {
+    batches_ = &batches;
+    const SUTransformation identity = XmlTest::MakeTransform(0.0, 1.0, 0.0,
+                                                             0.0, 0.0);
+    Flatten(model_info_.entities_, identity, std::string(), std::string());
+  }
+
+ private:
+  void Flatten(const XmlEntitiesInfo& entities, const SUTransformation& t,
+               const std::string& material, const std::string& layer) {
+    for (size_t i = 0; i < entities.component_instances_.size(); ++i) {
+      const XmlComponentInstanceInfo& info = entities.component_instances_[i];
+      for (size_t d = 0; d < model_info_.definitions_.size(); ++d) {
+        if (model_info_.definitions_[d].name_ != info.definition_name_)
+          continue;
+        Flatten(model_info_.definitions_[d].entities_,
+                Multiply(t, info.transform_),
+                info.material_name_.empty() ? material : info.material_name_,
+                info.layer_name_.empty() ? layer : info.layer_name_);
+      }
+    }
+    for (size_t i = 0; i < entities.groups_.size(); ++i) {
+      const XmlGroupInfo& group = entities.groups_[i];
+      Flatten(*group.entities_, Multiply(t, group.transform_), material,
+              layer);
+    }
+    // The faces of a block are batched under their own names first, in
+    // order of first use, so two names that inherit the same one take turns
+    std::vector<std::pair<std::string, std::string> > own_names;
+    for (size_t i = 0; i < entities.faces_.size(); ++i) {
+      const XmlFaceInfo& face = entities.faces_[i];
+      const std::pair<std::string, std::string> names(face.front_mat_name_,
+                                                      face.layer_name_);
+      if (std::find(own_names.begin(), own_names.end(), names) ==
+          own_names.end())
+        own_names.push_back(names);
+    }
+    for (size_t n = 0; n < own_names.size(); ++n) {
+      ReferenceBatch& batch = FindBatch(
+          own_names[n].first.empty() ? material : own_names[n].first,
+          own_names[n].second.empty() ? layer : own_names[n].second);
+      for (size_t i = 0; i < entities.faces_.size(); ++i) {
+        const XmlFaceInfo& face = entities.faces_[i];
+        if (face.front_mat_name_ == own_names[n].first &&
+            face.layer_name_ == own_names[n].second)
+          AddFace(face, t, batch);
+      }
+    }
+  }
+
+  static void AddFace(const XmlFaceInfo& face, const SUTransformation& t,
+                      ReferenceBatch& batch) {
+    for (size_t j = 0; j < face.vertices_.size(); ++j) {
+      const CPoint3d& p = face.vertices_[j].vertex_;
+      for (int row = 0; row < 3; ++row) {
+        batch.positions_.push_back(
+            t.values[row] * p.x() + t.values[4 + row] * p.y() +
+            t.values[8 + row] * p.z() + t.values[12 + row]);
+      }
+      const CPoint3d& coord = face.vertices_[j].front_texture_coord_;
+      batch.texture_coords_.push_back(
+          face.has_front_texture_ ? coord.x() : 0.0);
+      batch.texture_coords_.push_back(
+          face.has_front_texture_ ? coord.y() : 0.0);
+    }
+    batch.triangles_ += face.has_single_loop_ ?
+        face.vertices_.size() - 2 : face.indices_.size() / 3;
+  }
+
+  ReferenceBatch& FindBatch(const std::string& material,
+                            const std::string& layer) {
+    for (size_t i = 0; i < batches_->size(); ++i) {
+      ReferenceBatch& batch = (*batches_)[i];
+      if (batch.material_name_ == material && batch.layer_name_ == layer)
+        return batch;
+    }
+    batches_->push_back(ReferenceBatch());
+    batches_->back().material_name_ = material;
+    batches_->back().layer_name_ = layer;
+    batches_->back().triangles_ = 0;
+    return batches_->back();
+  }
+
+  const XmlModelInfo& model_info_;
+  std::vector<ReferenceBatch>* batches_;
+};
+
+bool Near(double expected, double actual) {
+  return fabs(expected - actual) <= 1e-9 * (1.0 + fabs(expected));
+}
+
+void ExpectSameBatches(const std::vector<XmlTriangleBatch>& expected,
+                       const std::vector<XmlTriangleBatch>& actual) {
+  XML_ASSERT(expected.size() == actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    XML_EXPECT(expected[i].material_name_ == actual[i].material_name_);
+    XML_EXPECT(expected[i].layer_name_ == actual[i].layer_name_);
+    XML_EXPECT(expected[i].positions_ == actual[i].positions_);
+    XML_EXPECT(expected[i].normals_ == actual[i].normals_);
+    XML_EXPECT(expected[i].texture_coords_ == actual[i].texture_coords_);
+    XML_EXPECT(expected[i].indices_ == actual[i].indices_);
+  }
+}
+
+// Every triangle winds counterclockwise around its vertices' normal, which
+// is unit length
+void ExpectTrianglesFaceOut(const XmlTriangleBatch& batch) {
+  const std::vector<double>& p = batch.positions_;
+  const std::vector<double>& n = batch.normals_;
+  XML_ASSERT(n.size() == p.size());
+  for (size_t i = 0; i < n.size(); i += 3) {
+    const double length = sqrt(n[i] * n[i] + n[i + 1] * n[i + 1] +
+                               n[i + 2] * n[i + 2]);
+    XML_EXPECT(fabs(length - 1.0) < 1e-12);
+  }
+  for (size_t i = 0; i + 2 < batch.indices_.size(); i += 3) {
+    const size_t a = batch.indices_[i] * 3;
+    const size_t b = batch.indices_[i + 1] * 3;
+    const size_t c = batch.indices_[i + 2] * 3;
+    XML_ASSERT(a < p.size() && b < p.size() && c < p.size());
+    const double u[3] = { p[b] - p[a], p[b + 1] - p[a + 1],
+                          p[b + 2] - p[a + 2] };
+    const double v[3] = { p[c] - p[a], p[c + 1] - p[a + 1],
+                          p[c + 2] - p[a + 2] };
+    const double cross[3] = { u[1] * v[2] - u[2] * v[1],
+                              u[2] * v[0] - u[0] * v[2],
+                              u[0] * v[1] - u[1] * v[0] };
+    const double area = sqrt(cross[0] * cross[0] + cross[1] * cross[1] +
+                             cross[2] * cross[2]);
+    if (area < 1e-6)
+      continue;
+    const double facing = (cross[0] * n[a] + cross[1] * n[a + 1] +
+                           cross[2] * n[a + 2]) / area;
+    XML_EXPECT(facing > 0.99);
+  }
+}
+
+XmlComponentInstanceInfo MakeInstance(const std::string& definition,
+                                      const SUTransformation& transform) {
+  XmlComponentInstanceInfo instance;
+  instance.definition_name_ = definition;
+  instance.transform_ = transform;
+  return instance;
+}
+
+} // end namespace
+
+// The flattened model has the faces of the model where a per vertex walk
+// of the hierarchy puts them, batched the same way
+XML_TEST(FlattenMatchesReference) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info, 2);
+  std::vector<ReferenceBatch> expected;
+  CReferenceFlattener(model_info).Flatten(expected);
+
+  CXmlFlattener flattener;
+  std::vector<XmlTriangleBatch> batches;
+  XML_ASSERT(flattener.Flatten(model_info, batches));
+  XML_ASSERT(batches.size() == expected.size());
+  for (size_t i = 0; i < batches.size(); ++i) {
+    const XmlTriangleBatch& batch = batches[i];
+    XML_EXPECT(batch.material_name_ == expected[i].material_name_);
+    XML_EXPECT(batch.layer_name_ == expected[i].layer_name_);
+    XML_ASSERT(batch.positions_.size() == expected[i].positions_.size());
+    size_t differences = 0;
+    for (size_t j = 0; j < batch.positions_.size(); ++j) {
+      if (!Near(expected[i].positions_[j], batch.positions_[j]))
+        ++differences;
+    }
+    XML_EXPECT_EQ(static_cast<size_t>(0), differences);
+    XML_EXPECT(batch.texture_coords_ == expected[i].texture_coords_);
+    XML_EXPECT_EQ(expected[i].triangles_ * 3, batch.indices_.size());
+    ExpectTrianglesFaceOut(batch);
+  }
+}
+
+// The batches come out the same whatever the number of threads
+XML_TEST(ThreadsDontChangeTheResult) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info, 2);
+  CXmlFlattener flattener;
+  flattener.set_threads(1);
+  std::vector<XmlTriangleBatch> expected;
+  XML_ASSERT(flattener.Flatten(model_info, expected));
+  const unsigned threads[] = { 0, 2, 7 };
+  for (int i = 0; i < 3; ++i) {
+    flattener.set_threads(threads[i]);
+    std::vector<XmlTriangleBatch> batches;
+    XML_ASSERT(flattener.Flatten(model_info, batches));
+    ExpectSameBatches(expected, batches);
+  }
+}
+
+// A model read into the face store, with interned names, flattens like
+// the one it was written from
+XML_TEST(FaceStoreFlattensLikeFaces) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info);
+  const std::string filename = XmlTest::TempPath("store.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, model_info,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  CXmlFile file;
+  file.set_use_face_store(true);
+  XmlModelInfo read_back;
+  XML_ASSERT(XmlTest::ReadModel(file, filename, CXmlFile::kReadStreaming,
+                                read_back));
+
+  CXmlFlattener flattener;
+  std::vector<XmlTriangleBatch> expected;
+  std::vector<XmlTriangleBatch> batches;
+  XML_ASSERT(flattener.Flatten(model_info, expected));
+  XML_ASSERT(flattener.Flatten(read_back, batches));
+  ExpectSameBatches(expected, batches);
+}
+
+// A face seen in a mirror is wound the other way round, so it still faces
+// the way its normal points
+XML_TEST(MirroredFacesStillFaceOut) {
+  XmlModelInfo model_info;
+  model_info.definitions_.emplace_back();
+  model_info.definitions_.back().name_ = "Panel";
+  model_info.definitions_.back().entities_.faces_.push_back(
+      XmlTest::MakeLoopFace(5, 0.0, 0.0, 0.0));
+  SUTransformation mirror = XmlTest::MakeTransform(0.0, 1.0, 3.0, 0.0, 0.0);
+  mirror.values[0] = -1.0;
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Panel", mirror));
+  model_info.entities_.component_instances_.push_back(MakeInstance(
+      "Panel", XmlTest::MakeTransform(0.0, 1.0, 6.0, 0.0, 0.0)));
+
+  std::vector<XmlTriangleBatch> batches;
+  XML_ASSERT(CXmlFlattener().Flatten(model_info, batches));
+  XML_ASSERT(batches.size() == 1);
+  const XmlTriangleBatch& batch = batches[0];
+  XML_ASSERT(batch.indices_.size() == 18);
+  for (size_t i = 0; i < batch.normals_.size(); i += 3) {
+    XML_EXPECT_EQ(1.0, batch.normals_[i + 2]);
+  }
+  ExpectTrianglesFaceOut(batch);
+  // The mirrored copy has the same triangles, each wound backwards
+  for (size_t i = 0; i < 9; i += 3) {
+    XML_EXPECT_EQ(batch.indices_[i], batch.indices_[i + 9] - 5);
+    XML_EXPECT_EQ(batch.indices_[i + 1], batch.indices_[i + 11] - 5);
+    XML_EXPECT_EQ(batch.indices_[i + 2], batch.indices_[i + 10] - 5);
+  }
+}
+
+// Faces without a material or layer take them from the innermost instance
+// that has one; faces with their own keep them
+XML_TEST(FacesInheritFromInnermostInstance) {
+  XmlModelInfo model_info;
+  const SUTransformation identity =
+      XmlTest::MakeTransform(0.0, 1.0, 0.0, 0.0, 0.0);
+  // So the references below stay valid
+  model_info.definitions_.reserve(2);
+  model_info.definitions_.emplace_back();
+  XmlEntitiesInfo& leaf = model_info.definitions_.back().entities_;
+  model_info.definitions_.back().name_ = "Leaf";
+  leaf.faces_.push_back(XmlTest::MakeLoopFace(3, 0.0, 0.0, 0.0));
+  leaf.faces_.push_back(XmlTest::MakeLoopFace(4, 0.0, 0.0, 0.0));
+  leaf.faces_.back().front_mat_name_ = "Own";
+  model_info.definitions_.emplace_back();
+  XmlComponentDefinitionInfo& branch = model_info.definitions_.back();
+  branch.name_ = "Branch";
+  branch.entities_.component_instances_.push_back(
+      MakeInstance("Leaf", identity));
+  branch.entities_.component_instances_.back().material_name_ = "Red";
+
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Branch", identity));
+  XmlComponentInstanceInfo& top = model_info.entities_.component_instances_[0];
+  top.material_name_ = "Glass";
+  top.layer_name_ = "Walls";
+
+  std::vector<XmlTriangleBatch> batches;
+  XML_ASSERT(CXmlFlattener().Flatten(model_info, batches));
+  XML_ASSERT(batches.size() == 2);
+  XML_EXPECT(batches[0].material_name_ == "Red");
+  XML_EXPECT(batches[0].layer_name_ == "Walls");
+  XML_EXPECT_EQ(static_cast<size_t>(3), batches[0].indices_.size());
+  XML_EXPECT(batches[1].material_name_ == "Own");
+  XML_EXPECT(batches[1].layer_name_ == "Walls");
+  XML_EXPECT_EQ(static_cast<size_t>(6), batches[1].indices_.size());
+
+  // On their own, the faces are batched under the names they have
+  std::vector<XmlTriangleBatch> local;
+  CXmlFlattener::TriangulateFaces(model_info.definitions_[0].entities_,
+                                  model_info.names_, local);
+  XML_ASSERT(local.size() == 2);
+  XML_EXPECT(local[0].material_name_.empty());
+  XML_EXPECT(local[0].layer_name_.empty());
+  XML_EXPECT(local[1].material_name_ == "Own");
+}
+
+// Instances of missing definitions, and of definitions that contain
+// themselves, are skipped and reported; the rest is still flattened
+XML_TEST(BrokenInstancesAreSkipped) {
+  XmlModelInfo model_info;
+  const SUTransformation identity =
+      XmlTest::MakeTransform(0.0, 1.0, 0.0, 0.0, 0.0);
+  model_info.definitions_.emplace_back();
+  XmlComponentDefinitionInfo& loop = model_info.definitions_.back();
+  loop.name_ = "Loop";
+  loop.entities_.faces_.push_back(XmlTest::MakeLoopFace(3, 0.0, 0.0, 0.0));
+  loop.entities_.component_instances_.push_back(
+      MakeInstance("Loop", identity));
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Missing", identity));
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Loop", identity));
+  model_info.entities_.faces_.push_back(
+      XmlTest::MakeLoopFace(4, 0.0, 0.0, 0.0));
+
+  std::vector<XmlTriangleBatch> batches;
+  XML_EXPECT(!CXmlFlattener().Flatten(model_info, batches));
+  XML_ASSERT(batches.size() == 1);
+  // The loop's face once, then the top level face
+  XML_EXPECT_EQ(static_cast<size_t>(3 + 6), batches[0].indices_.size());
+  XML_EXPECT_EQ(static_cast<size_t>(3 * 7), batches[0].positions_.size());
+}
@@ -0,0 +1,298 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+// Checks CTransform and its batch kernels against plain scalar math. The
+// program is built three times: with the default kernels, with
+// XMLGEOMUTILS_NO_AVX and with XMLGEOMUTILS_NO_SIMD. Each build must give
+// points bit for bit as the scalar math does.
+
+#include <math.h>
+#include <random>
+#include <vector>
+
+#include "../xmlgeomutils.h"
+#include "./xmltest.h"
+
+using XmlGeomUtils::CPoint3d;
+using XmlGeomUtils::CTransform;
+using XmlGeomUtils::CVector3d;
+
+namespace {
+
+SUTransformation MakeTransform(double angle, double scale, double x,
+                               double y, double z) {
+  const double c = cos(angle) * scale;
+  const double s = sin(angle) * scale;
+  SUTransformation transform = {
+    { c, s, 0.0, 0.0,
+      -s, c, 0.0, 0.0,
+      0.0, 0.0, scale, 0.0,
+      x, y, z, 1.0 }
+  };
+  return transform;
+}
+
+// Any affine transformation, which mirrors about half the time
+CTransform RandomTransform(std::mt19937& random) {
+  std::uniform_real_distribution<double> value(-3.0, 3.0);
+  SUTransformation transform;
+  for (int i = 0; i < 16; ++i) {
+    transform.values[i] = i % 4 == 3 ? 0.0 : value(random);
+  }
+  transform.values[15] = 1.0;
+  return CTransform(transform);
+}
+
+std::vector<double> RandomTriples(std::mt19937& random, size_t count) {
+  std::uniform_real_distribution<double> value(-1e3, 1e3);
+  std::vector<double> triples(count * 3);
+  for (size_t i = 0; i < triples.size(); ++i) {
+    triples[i] = value(random);
+  }
+  return triples;
+}
+
+bool Near(double expected, double actual, double tolerance = 1e-12) {
+  return fabs(expected - actual) <= tolerance * (1.0 + fabs(expected));
+}
+
+// A point through 'm' by columns, adding up the terms in the order the
+// kernels do. Each product is rounded on its own, as the kernels must do
+// it: stored through a volatile, so the compiler can't fuse it with the
+// sum into an FMA.
+void TransformPoint(const double* m, const double* in, double* out) {
+  for (int row = 0; row < 3; ++row) {
+    volatile double terms[3];
+    for (int k = 0; k < 3; ++k) {
+      terms[k] = m[k * 4 + row] * in[k];
+    }
+    out[row] = terms[0] + terms[1];
+    out[row] = out[row] + terms[2];
+    out[row] = out[row] + m[12 + row];
+  }
+}
+
+const size_t kCounts[] = { 0, 1, 2, 3, 4, 5, 17, 1000 };
+
+} // end namespace
+
+// Points come out of every kernel as the scalar math gives them, in double
+// and in float, and no value is written past the last one
+XML_TEST(PointKernelsMatchScalarMath) {
+  std::mt19937 random(23);
+  for (int t = 0; t < 20; ++t) {
+    const CTransform transform = RandomTransform(random);
+    for (size_t c = 0; c < sizeof(kCounts) / sizeof(kCounts[0]); ++c) {
+      const size_t count = kCounts[c];
+      const std::vector<double> points = RandomTriples(random, count);
+      std::vector<double> out(count * 3 + 1, -7.0);
+      std::vector<float> out_float(count * 3 + 1, -7.0f);
+      transform.TransformPoints(count > 0 ? &points[0] : NULL, count,
+                                &out[0]);
+      transform.TransformPoints(count > 0 ? &points[0] : NULL, count,
+                                &out_float[0]);
+      size_t differences = 0;
+      for (size_t i = 0; i < count; ++i) {
+        double expected[3];
+        TransformPoint(transform.values(), &points[i * 3], expected);
+        for (int j = 0; j < 3; ++j) {
+          if (out[i * 3 + j] != expected[j] ||
+              out_float[i * 3 + j] != static_cast<float>(expected[j]))
+            ++differences;
+        }
+      }
+      XML_EXPECT_EQ(static_cast<size_t>(0), differences);
+      XML_EXPECT_EQ(-7.0, out[count * 3]);
+      XML_EXPECT_EQ(-7.0f, out_float[count * 3]);
+    }
+  }
+}
+
+// Normals come out unit length, square to the transformed surface, and the
+// same from every entry point; no value is written past the last one
+XML_TEST(NormalKernelsStayPerpendicular) {
+  std::mt19937 random(29);
+  for (int t = 0; t < 20; ++t) {
+    const CTransform transform = RandomTransform(random);
+    for (size_t c = 0; c < sizeof(kCounts) / sizeof(kCounts[0]); ++c) {
+      const size_t count = kCounts[c];
+      // Each normal with two directions along its surface
+      const std::vector<double> normals = RandomTriples(random, count);
+      const std::vector<double> tangents = RandomTriples(random, count);
+      std::vector<double> out(count * 3 + 1, -7.0);
+      std::vector<float> out_float(count * 3 + 1, -7.0f);
+      transform.TransformNormals(count > 0 ? &normals[0] : NULL, count,
+                                 &out[0]);
+      transform.TransformNormals(count > 0 ? &normals[0] : NULL, count,
+                                 &out_float[0]);
+      size_t differences = 0;
+      for (size_t i = 0; i < count; ++i) {
+        const double* n = &normals[i * 3];
+        const double* u = &tangents[i * 3];
+        const CVector3d normal(n[0], n[1], n[2]);
+        const CVector3d along(n[1] * u[2] - n[2] * u[1],
+                              n[2] * u[0] - n[0] * u[2],
+                              n[0] * u[1] - n[1] * u[0]);
+        const CVector3d moved = transform.TransformVector(along);
+        const CVector3d single = transform.TransformNormal(normal);
+        const double* o = &out[i * 3];
+        const double length = sqrt(o[0] * o[0] + o[1] * o[1] + o[2] * o[2]);
+        const double dot = (o[0] * moved.x() + o[1] * moved.y() +
+                            o[2] * moved.z()) /
+            sqrt(moved.x() * moved.x() + moved.y() * moved.y() +
+                 moved.z() * moved.z());
+        if (!Near(1.0, length) || !Near(0.0, dot, 1e-9) ||
+            single.x() != o[0] || single.y() != o[1] || single.z() != o[2])
+          ++differences;
+        for (int j = 0; j < 3; ++j) {
+          if (out_float[i * 3 + j] != static_cast<float>(o[j]))
+            ++differences;
+        }
+      }
+      XML_EXPECT_EQ(static_cast<size_t>(0), differences);
+      XML_EXPECT_EQ(-7.0, out[count * 3]);
+      XML_EXPECT_EQ(-7.0f, out_float[count * 3]);
+    }
+  }
+}
+
+// A normal keeps pointing out of the side it was on, mirrored or not
+XML_TEST(NormalsKeepTheirSide) {
+  SUTransformation mirror = MakeTransform(0.0, 2.0, 1.0, 2.0, 3.0);
+  mirror.values[0] = -2.0;
+  const CTransform transforms[] = {
+    CTransform(MakeTransform(0.5, 3.0, 1.0, 2.0, 3.0)), CTransform(mirror)
+  };
+  for (int t = 0; t < 2; ++t) {
+    // The face z = 0, with its normal up, and a point above it
+    const CVector3d normal =
+        transforms[t].TransformNormal(CVector3d(0.0, 0.0, 1.0));
+    const CPoint3d origin = transforms[t] * CPoint3d(0.0, 0.0, 0.0);
+    const CPoint3d above = transforms[t] * CPoint3d(0.3, -0.2, 1.0);
+    const CVector3d up = above - origin;
+    XML_EXPECT(normal.x() * up.x() + normal.y() * up.y() +
+               normal.z() * up.z() > 0.0);
+  }
+}
+
+// Zero normals, and normals flattened by a singular transformation, come
+// out zero
+XML_TEST(DegenerateNormalsComeOutZero) {
+  const CTransform transform(MakeTransform(0.3, 2.0, 0.0, 0.0, 0.0));
+  const CVector3d zero = transform.TransformNormal(CVector3d());
+  XML_EXPECT(zero.x() == 0.0 && zero.y() == 0.0 && zero.z() == 0.0);
+
+  SUTransformation flat = MakeTransform(0.0, 1.0, 0.0, 0.0, 0.0);
+  flat.values[10] = 0.0;
+  const CVector3d flattened =
+      CTransform(flat).TransformNormal(CVector3d(1.0, 0.0, 0.0));
+  XML_EXPECT(flattened.x() == 0.0 && flattened.y() == 0.0 &&
+             flattened.z() == 0.0);
+}
+
+// The input can be overwritten by its own result
+XML_TEST(KernelsWorkInPlace) {
+  std::mt19937 random(31);
+  const CTransform transform = RandomTransform(random);
+  const std::vector<double> points = RandomTriples(random, 33);
+  std::vector<double> expected(points.size());
+  transform.TransformPoints(&points[0], 33, &expected[0]);
+  std::vector<double> in_place = points;
+  transform.TransformPoints(&in_place[0], 33, &in_place[0]);
+  XML_EXPECT(in_place == expected);
+
+  transform.TransformNormals(&points[0], 33, &expected[0]);
+  in_place = points;
+  transform.TransformNormals(&in_place[0], 33, &in_place[0]);
+  XML_EXPECT(in_place == expected);
+}
+
+// A product applies its right side first
+XML_TEST(ComposeAppliesRightSideFirst) {
+  std::mt19937 random(37);
+  for (int t = 0; t < 20; ++t) {
+    const CTransform a = RandomTransform(random);
+    const CTransform b = RandomTransform(random);
+    const CPoint3d p(1.5, -2.25, 0.125);
+    const CPoint3d expected = a * (b * p);
+    const CPoint3d actual = (a * b) * p;
+    XML_EXPECT(Near(expected.x(), actual.x(), 1e-10));
+    XML_EXPECT(Near(expected.y(), actual.y(), 1e-10));
+    XML_EXPECT(Near(expected.z(), actual.z(), 1e-10));
+
+    CTransform product = a;
+    product *= b;
+    const CTransform ab = a * b;
+    for (int i = 0; i < 16; ++i) {
+      XML_EXPECT_EQ(ab.values()[i], product.values()[i]);
+      XML_EXPECT_EQ(a.values()[i], (a * CTransform()).values()[i]);
+      XML_EXPECT_EQ(a.values()[i], (CTransform() * a).values()[i]);
+    }
+    XML_EXPECT(Near(a.Determinant() * b.Determinant(), ab.Determinant(),
+                    1e-10));
+  }
+}
+
+// The inverse undoes the transformation; a singular one has none
+XML_TEST(InverseUndoesTransform) {
+  std::mt19937 random(41);
+  for (int t = 0; t < 20; ++t) {
+    const CTransform transform = RandomTransform(random);
+    CTransform inverse;
+    XML_ASSERT(transform.GetInverse(inverse));
+    const CTransform identity = inverse * transform;
+    const CTransform other_way = transform * inverse;
+    for (int i = 0; i < 16; ++i) {
+      const double expected = i % 5 == 0 ? 1.0 : 0.0;
+      XML_EXPECT(Near(expected, identity.values()[i], 1e-9));
+      XML_EXPECT(Near(expected, other_way.values()[i], 1e-9));
+    }
+    XML_EXPECT(Near(1.0, transform.Determinant() * inverse.Determinant(),
+                    1e-9));
+  }
+
+  SUTransformation flat = MakeTransform(0.4, 1.0, 1.0, 2.0, 3.0);
+  flat.values[2] = flat.values[6] = flat.values[10] = 0.0;
+  const CTransform singular(flat);
+  XML_EXPECT_EQ(0.0, singular.Determinant());
+  const CTransform before(MakeTransform(0.1, 2.0, 3.0, 4.0, 5.0));
+  CTransform inverse = before;
+  XML_EXPECT(!singular.GetInverse(inverse));
+  for (int i = 0; i < 16; ++i) {
+    XML_EXPECT_EQ(before.values()[i], inverse.values()[i]);
+  }
+}
+
+// The determinant is the volume scale, negative for a mirror
+XML_TEST(DeterminantTellsMirrors) {
+  const CTransform scaled(MakeTransform(0.7, 2.0, 5.0, 6.0, 7.0));
+  XML_EXPECT(Near(8.0, scaled.Determinant()));
+  XML_EXPECT(!scaled.IsMirrored());
+  SUTransformation mirror = MakeTransform(0.7, 2.0, 5.0, 6.0, 7.0);
+  mirror.values[8] = -mirror.values[8];
+  mirror.values[9] = -mirror.values[9];
+  mirror.values[10] = -mirror.values[10];
+  XML_EXPECT(Near(-8.0, CTransform(mirror).Determinant()));
+  XML_EXPECT(CTransform(mirror).IsMirrored());
+  XML_EXPECT_EQ(1.0, CTransform().Determinant());
+}
+
+// A uniform scale through the last element is divided out
+XML_TEST(LastElementIsDividedOut) {
+  SUTransformation transform = MakeTransform(0.2, 1.0, 4.0, -6.0, 8.0);
+  const CTransform expected(transform);
+  for (int i = 0; i < 16; ++i) {
+    transform.values[i] *= 0.5;
+  }
+  const CTransform halved(transform);
+  for (int i = 0; i < 16; ++i) {
+    XML_EXPECT(Near(expected.values()[i], halved.values()[i]));
+  }
+  XML_EXPECT_EQ(1.0, halved.values()[15]);
+  const CPoint3d p = halved * CPoint3d(1.0, 1.0, 1.0);
+  XML_EXPECT(Near(4.0 + cos(0.2) - sin(0.2), p.x()));
+
+  const SUTransformation back = expected.GetSUTransformation();
+  for (int i = 0; i < 16; ++i) {
+    XML_EXPECT_EQ(expected.values()[i], back.values[i]);
+  }
+}
@@ -0,0 +1,271 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../xmlfile.h"
+#include "../xmlflattener.h"
+#include "../xmlinstancer.h"
+#include "./xmltest.h"
+#include "./xmltestmodel.h"
+
+using XmlGeomUtils::CTransform;
+
+namespace {
+
+// One corner of a world space triangle: position, normal and texture
+// coordinates
+typedef std::vector<double> Corner;
+// Started at its least corner, so the same triangle compares equal however
+// its corners were numbered, but not when it winds the other way
+typedef std::vector<Corner> Triangle;
+// The triangles of each material and layer, in order
+typedef std::map<std::pair<std::string, std::string>,
+                 std::vector<Triangle> > Triangles;
+
+Corner GetCorner(const XmlTriangleBatch& batch, const double* positions,
+                 const double* normals, uint32_t index) {
+  Corner corner(positions + index * 3, positions + index * 3 + 3);
+  corner.insert(corner.end(), normals + index * 3, normals + index * 3 + 3);
+  corner.push_back(batch.texture_coords_[index * 2]);
+  corner.push_back(batch.texture_coords_[index * 2 + 1]);
+  return corner;
+}
+
+// Adds the triangles of a batch whose vertices are at 'positions', wound
+// the other way round if 'mirrored'
+void AddTriangles(const XmlTriangleBatch& batch, const std::string& material,
+                  const std::string& layer, const double* positions,
+                  const double* normals, bool mirrored,
+                  Triangles& triangles) {
+  std::vector<Triangle>& to = triangles[std::make_pair(material, layer)];
+  for (size_t i = 0; i + 2 < batch.indices_.size(); i += 3) {
+    Triangle triangle;
+    for (int j = 0; j < 3; ++j) {
+      const int corner = mirrored && j > 0 ? 3 - j : j;
+      triangle.push_back(GetCorner(batch, positions, normals,
+                                   batch.indices_[i + corner]));
+    }
+    std::rotate(triangle.begin(),
+                std::min_element(triangle.begin(), triangle.end()),
+                triangle.end());
+    to.push_back(triangle);
+  }
+}
+
+Triangles FlattenedTriangles(const std::vector<XmlTriangleBatch>& batches) {
+  Triangles triangles;
+  for (size_t i = 0; i < batches.size(); ++i) {
+    const XmlTriangleBatch& batch = batches[i];
+    if (batch.indices_.empty())
+      continue;
+    AddTriangles(batch, batch.material_name_, batch.layer_name_,
+                 &batch.positions_[0], &batch.normals_[0], false, triangles);
+  }
+  for (Triangles::iterator it = triangles.begin(); it != triangles.end();
+       ++it) {
+    std::sort(it->second.begin(), it->second.end());
+  }
+  return triangles;
+}
+
+// Draws every instance of every set, the way a renderer would
+Triangles ExpandedTriangles(const XmlInstancedModel& model) {
+  Triangles triangles;
+  std::vector<double> positions;
+  std::vector<double> normals;
+  for (size_t s = 0; s < model.instance_sets_.size(); ++s) {
+    const XmlInstanceSet& set = model.instance_sets_[s];
+    const XmlInstancedMesh& mesh = model.meshes_[set.mesh_];
+    for (size_t t = 0; t < set.transforms_.size(); t += 16) {
+      SUTransformation values;
+      std::copy(&set.transforms_[t], &set.transforms_[t] + 16, values.values);
+      const CTransform transform(values);
+      XML_EXPECT(transform.IsMirrored() == set.mirrored_);
+      for (size_t b = 0; b < mesh.batches_.size(); ++b) {
+        const XmlTriangleBatch& batch = mesh.batches_[b];
+        if (batch.indices_.empty())
+          continue;
+        const size_t count = batch.positions_.size() / 3;
+        positions.resize(count * 3);
+        normals.resize(count * 3);
+        transform.TransformPoints(&batch.positions_[0], count,
+                                  &positions[0]);
+        transform.TransformNormals(&batch.normals_[0], count, &normals[0]);
+        AddTriangles(batch,
+                     batch.material_name_.empty() ? set.material_name_
+                                                  : batch.material_name_,
+                     batch.layer_name_.empty() ? set.layer_name_
+                                               : batch.layer_name_,
+                     &positions[0], &normals[0], set.mirrored_, triangles);
+      }
+    }
+  }
+  for (Triangles::iterator it = triangles.begin(); it != triangles.end();
+       ++it) {
+    std::sort(it->second.begin(), it->second.end());
+  }
+  return triangles;
+}
+
+XmlComponentInstanceInfo MakeInstance(const std::string& definition,
+                                      const SUTransformation& transform) {
+  XmlComponentInstanceInfo instance;
+  instance.definition_name_ = definition;
+  instance.transform_ = transform;
+  return instance;
+}
+
+size_t InstanceCount(const XmlInstanceSet& set) {
+  return set.transforms_.size() / 16;
+}
+
+} // end namespace
+
+// Drawn out, the instanced model has the triangles of the flattened one,
+// each of them wound the same way
+XML_TEST(ExpandsToFlattenedModel) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info, 2);
+  std::vector<XmlTriangleBatch> batches;
+  XML_ASSERT(CXmlFlattener().Flatten(model_info, batches));
+  XmlInstancedModel model;
+  XML_ASSERT(CXmlInstancer().Build(model_info, model));
+
+  const Triangles expected = FlattenedTriangles(batches);
+  const Triangles actual = ExpandedTriangles(model);
+  XML_ASSERT(expected.size() == actual.size());
+  for (Triangles::const_iterator e = expected.begin(), a = actual.begin();
+       e != expected.end(); ++e, ++a) {
+    XML_EXPECT(e->first == a->first);
+    XML_EXPECT_EQ(e->second.size(), a->second.size());
+    XML_EXPECT(e->second == a->second);
+  }
+
+  // Each definition and group with faces is stored once
+  size_t blocks = 1 + model_info.entities_.groups_.size() * 2;
+  for (size_t i = 0; i < model_info.definitions_.size(); ++i) {
+    blocks += 1 + model_info.definitions_[i].entities_.groups_.size();
+  }
+  XML_EXPECT_EQ(blocks, model.meshes_.size());
+}
+
+// The model comes out the same whatever the number of threads
+XML_TEST(ThreadsDontChangeTheModel) {
+  XmlModelInfo model_info;
+  XmlTest::BuildTestModel(model_info, 2);
+  CXmlInstancer instancer;
+  instancer.set_threads(1);
+  XmlInstancedModel expected;
+  XML_ASSERT(instancer.Build(model_info, expected));
+  instancer.set_threads(5);
+  XmlInstancedModel model;
+  XML_ASSERT(instancer.Build(model_info, model));
+  XML_ASSERT(expected.meshes_.size() == model.meshes_.size());
+  for (size_t i = 0; i < model.meshes_.size(); ++i) {
+    const std::vector<XmlTriangleBatch>& a = expected.meshes_[i].batches_;
+    const std::vector<XmlTriangleBatch>& b = model.meshes_[i].batches_;
+    XML_ASSERT(a.size() == b.size());
+    for (size_t j = 0; j < a.size(); ++j) {
+      XML_EXPECT(a[j].positions_ == b[j].positions_);
+      XML_EXPECT(a[j].indices_ == b[j].indices_);
+    }
+  }
+  XML_ASSERT(expected.instance_sets_.size() == model.instance_sets_.size());
+  for (size_t i = 0; i < model.instance_sets_.size(); ++i) {
+    XML_EXPECT(expected.instance_sets_[i].transforms_ ==
+               model.instance_sets_[i].transforms_);
+  }
+}
+
+// Instances of one definition share its mesh, and its nested group's, in
+// one set per way they are drawn: mirrored or not, and with the material
+// the mesh inherits
+XML_TEST(InstancesShareMeshes) {
+  XmlModelInfo model_info;
+  model_info.definitions_.emplace_back();
+  XmlComponentDefinitionInfo& chair = model_info.definitions_.back();
+  chair.name_ = "Chair";
+  chair.entities_.faces_.push_back(XmlTest::MakeLoopFace(4, 0.0, 0.0, 0.0));
+  chair.entities_.groups_.emplace_back();
+  XmlGroupInfo& leg = chair.entities_.groups_.back();
+  leg.transform_ = XmlTest::MakeTransform(0.0, 1.0, 0.0, 0.0, -1.0);
+  leg.entities_->faces_.push_back(XmlTest::MakeLoopFace(3, 0.0, 0.0, 0.0));
+  leg.entities_->faces_.back().front_mat_name_ = "Steel";
+  // A group without faces isn't drawn
+  const SUTransformation leg_transform = leg.transform_;
+  chair.entities_.groups_.emplace_back();
+  chair.entities_.groups_.back().transform_ = leg_transform;
+
+  XmlArenaVector<XmlComponentInstanceInfo>& instances =
+      model_info.entities_.component_instances_;
+  for (int i = 0; i < 50; ++i) {
+    instances.push_back(MakeInstance(
+        "Chair", XmlTest::MakeTransform(0.1 * i, 1.0, i, 0.0, 0.0)));
+  }
+  SUTransformation mirror = XmlTest::MakeTransform(0.0, 1.0, 0.0, 0.0, 0.0);
+  mirror.values[5] = -1.0;
+  instances.push_back(MakeInstance("Chair", mirror));
+  instances.push_back(MakeInstance("Chair", mirror));
+  instances.back().material_name_ = "Red";
+
+  XmlInstancedModel model;
+  XML_ASSERT(CXmlInstancer().Build(model_info, model));
+  XML_ASSERT(model.meshes_.size() == 2);
+  XML_EXPECT(model.meshes_[0].definition_name_.empty());
+  XML_EXPECT(model.meshes_[1].definition_name_ == "Chair");
+
+  // The leg has its own material, so the red chair's leg is drawn with the
+  // other mirrored one
+  XML_ASSERT(model.instance_sets_.size() == 5);
+  const XmlInstanceSet* leg_sets = &model.instance_sets_[0];
+  const XmlInstanceSet* seat_sets = &model.instance_sets_[1];
+  if (leg_sets->mesh_ != 0)
+    std::swap(leg_sets, seat_sets);
+  XML_EXPECT_EQ(static_cast<size_t>(50), InstanceCount(*leg_sets));
+  XML_EXPECT(leg_sets->material_name_.empty());
+  XML_EXPECT_EQ(static_cast<size_t>(50), InstanceCount(*seat_sets));
+  size_t mirrored = 0;
+  for (size_t i = 0; i < model.instance_sets_.size(); ++i) {
+    const XmlInstanceSet& set = model.instance_sets_[i];
+    if (!set.mirrored_)
+      continue;
+    mirrored += InstanceCount(set);
+    if (set.mesh_ == 0)
+      XML_EXPECT_EQ(static_cast<size_t>(2), InstanceCount(set));
+  }
+  XML_EXPECT_EQ(static_cast<size_t>(4), mirrored);
+
+  // Drawn out, it is still the flattened model
+  std::vector<XmlTriangleBatch> batches;
+  XML_ASSERT(CXmlFlattener().Flatten(model_info, batches));
+  XML_EXPECT(FlattenedTriangles(batches) == ExpandedTriangles(model));
+}
+
+// Instances of missing definitions, and of definitions that contain
+// themselves, are skipped and reported
+XML_TEST(BrokenInstancesAreSkipped) {
+  XmlModelInfo model_info;
+  const SUTransformation identity =
+      XmlTest::MakeTransform(0.0, 1.0, 0.0, 0.0, 0.0);
+  model_info.definitions_.emplace_back();
+  XmlComponentDefinitionInfo& loop = model_info.definitions_.back();
+  loop.name_ = "Loop";
+  loop.entities_.faces_.push_back(XmlTest::MakeLoopFace(3, 0.0, 0.0, 0.0));
+  loop.entities_.component_instances_.push_back(
+      MakeInstance("Loop", identity));
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Missing", identity));
+  model_info.entities_.component_instances_.push_back(
+      MakeInstance("Loop", identity));
+
+  XmlInstancedModel model;
+  XML_EXPECT(!CXmlInstancer().Build(model_info, model));
+  XML_ASSERT(model.meshes_.size() == 1);
+  XML_ASSERT(model.instance_sets_.size() == 1);
+  XML_EXPECT_EQ(static_cast<size_t>(1),
+                InstanceCount(model.instance_sets_[0]));
+}
@@ -0,0 +1,70 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <string>
+
+#include "../xmlnametable.h"
+#include "./xmltest.h"
+
+// ID 0 is the empty string, before and after clearing
+XML_TEST(EmptyNameIsIdZero) {
+  CXmlNameTable names;
+  XML_EXPECT_EQ(static_cast<size_t>(1), names.size());
+  XML_EXPECT_EQ(std::string(), names.GetName(CXmlNameTable::kNoName));
+  XML_EXPECT_EQ(0u, names.Intern(""));
+  XML_EXPECT_EQ(0u, names.Find(""));
+  XML_EXPECT_EQ(static_cast<size_t>(1), names.size());
+
+  names.Intern("Layer0");
+  names.clear();
+  XML_EXPECT_EQ(static_cast<size_t>(1), names.size());
+  XML_EXPECT_EQ(0u, names.Find(""));
+  XML_EXPECT_EQ(0u, names.Find("Layer0"));
+}
+
+// Names get dense IDs in the order they are first interned, and the same
+// ID every time after
+XML_TEST(InternGivesDenseIds) {
+  CXmlNameTable names;
+  XML_EXPECT_EQ(1u, names.Intern("Layer0"));
+  XML_EXPECT_EQ(2u, names.Intern("Brick"));
+  XML_EXPECT_EQ(1u, names.Intern("Layer0"));
+  XML_EXPECT_EQ(3u, names.Intern("Roof & <Tiles>"));
+  XML_EXPECT_EQ(2u, names.Intern(std::string("Brick")));
+  XML_EXPECT_EQ(static_cast<size_t>(4), names.size());
+  XML_EXPECT_EQ(std::string("Layer0"), names.GetName(1));
+  XML_EXPECT_EQ(std::string("Brick"), names.GetName(2));
+  XML_EXPECT_EQ(std::string("Roof & <Tiles>"), names.GetName(3));
+}
+
+// Find never adds a name, and tells names apart by every character
+XML_TEST(FindOnlyLooksUp) {
+  CXmlNameTable names;
+  names.Intern("Chair");
+  XML_EXPECT_EQ(1u, names.Find("Chair"));
+  XML_EXPECT_EQ(0u, names.Find("chair"));
+  XML_EXPECT_EQ(0u, names.Find("Chair "));
+  XML_EXPECT_EQ(0u, names.Find(std::string("Chair\0#2", 8)));
+  XML_EXPECT_EQ(static_cast<size_t>(2), names.size());
+  XML_EXPECT_EQ(2u, names.Intern(std::string("Chair\0#2", 8)));
+  XML_EXPECT_EQ(2u, names.Find(std::string("Chair\0#2", 8)));
+}
+
+// Copies are independent tables
+XML_TEST(CopiesDontShareNames) {
+  CXmlNameTable names;
+  names.Intern("Glass");
+  CXmlNameTable copy(names);
+  copy.Intern("Steel");
+  XML_EXPECT_EQ(0u, names.Find("Steel"));
+  XML_EXPECT_EQ(2u, copy.Find("Steel"));
+  XML_EXPECT_EQ(1u, copy.Find("Glass"));
+}
+
+// An entity's name is the interned one if it has an ID, else its string
+XML_TEST(ResolvePrefersIds) {
+  CXmlNameTable names;
+  const uint32_t id = names.Intern("Oak");
+  const std::string name("Pine");
+  XML_EXPECT_EQ(std::string("Oak"), names.Resolve(id, name));
+  XML_EXPECT(&names.Resolve(CXmlNameTable::kNoName, name) == &name);
+}
@@ -0,0 +1,99 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <string>
+#include <vector>
+
+#include "../xmltagtable.h"
+#include "./xmltest.h"
+
+namespace {
+
+// The table's hash, so the tests can pick names that share a slot
+size_t Fnv1a(const std::string& name) {
+  size_t hash = 2166136261U;
+  for (size_t i = 0; i < name.size(); ++i) {
+    hash = (hash ^ static_cast<unsigned char>(name[i])) * 16777619U;
+  }
+  return hash;
+}
+
+// 'count' names that all hash to the same slot of a table of up to 4 names,
+// which has 8 slots
+std::vector<std::string> CollidingNames(size_t count) {
+  std::vector<std::string> names;
+  for (int i = 0; names.size() < count; ++i) {
+    const std::string name = "Tag" + std::to_string(i);
+    if ((Fnv1a(name) & 7) == 5)
+      names.push_back(name);
+  }
+  return names;
+}
+
+} // end namespace
+
+// Every name gets its ID, in the order given, and the whole name is matched
+XML_TEST(NamesFindTheirIds) {
+  const std::string names[] = { "Layer", "Layers", "Face", "Vertex", "x" };
+  const CXmlTagTable table(names, 5);
+  XML_EXPECT_EQ(static_cast<size_t>(6), table.size());
+  for (int i = 0; i < 5; ++i) {
+    XML_EXPECT_EQ(i + 1, table.Find(names[i]));
+    XML_EXPECT_EQ(i + 1, table.Find(names[i].c_str()));
+    XML_EXPECT_EQ(i + 1, table.Find(names[i].data(), names[i].size()));
+    XML_EXPECT_EQ(names[i], table.GetName(i + 1));
+  }
+  // A name inside a longer buffer is found by its size
+  const char* buffer = "LayersLayer";
+  XML_EXPECT_EQ(1, table.Find(buffer + 6, 5));
+  XML_EXPECT_EQ(2, table.Find(buffer, 6));
+}
+
+// Other names, prefixes and case variants are unknown
+XML_TEST(OtherNamesAreUnknown) {
+  const std::string names[] = { "Layer", "Face" };
+  const CXmlTagTable table(names, 2);
+  XML_EXPECT_EQ(static_cast<int>(CXmlTagTable::kUnknown), table.Find("Edge"));
+  XML_EXPECT_EQ(static_cast<int>(CXmlTagTable::kUnknown), table.Find("Lay"));
+  XML_EXPECT_EQ(static_cast<int>(CXmlTagTable::kUnknown),
+                table.Find("Layers"));
+  XML_EXPECT_EQ(static_cast<int>(CXmlTagTable::kUnknown), table.Find("layer"));
+  XML_EXPECT_EQ(static_cast<int>(CXmlTagTable::kUnknown), table.Find("Face", 3));
+}
+
+// Names sharing a slot are all found along the probe sequence, and a miss
+// in the same slot stops at the first empty one
+XML_TEST(CollidingNamesAreFound) {
+  const std::vector<std::string> names = CollidingNames(5);
+  const CXmlTagTable table(names.data(), 4);
+  for (int i = 0; i < 4; ++i) {
+    XML_EXPECT_EQ(i + 1, table.Find(names[i]));
+  }
+  XML_EXPECT_EQ(static_cast<int>(CXmlTagTable::kUnknown), table.Find(names[4]));
+
+  // A probe sequence that wraps around the end of the slots
+  std::vector<std::string> wrapping;
+  for (int i = 0; wrapping.size() < 3; ++i) {
+    const std::string name = "Wrap" + std::to_string(i);
+    if ((Fnv1a(name) & 7) == 7)
+      wrapping.push_back(name);
+  }
+  const CXmlTagTable wrapped(wrapping.data(), 3);
+  for (int i = 0; i < 3; ++i) {
+    XML_EXPECT_EQ(i + 1, wrapped.Find(wrapping[i]));
+  }
+}
+
+// An empty table finds nothing, the empty name included, and the empty name
+// can be a tag like any other
+XML_TEST(EmptyNames) {
+  const CXmlTagTable empty(NULL, 0);
+  XML_EXPECT_EQ(static_cast<size_t>(1), empty.size());
+  XML_EXPECT_EQ(static_cast<int>(CXmlTagTable::kUnknown), empty.Find(""));
+  XML_EXPECT_EQ(static_cast<int>(CXmlTagTable::kUnknown), empty.Find("Layer"));
+
+  const std::string names[] = { "Layer", "" };
+  const CXmlTagTable table(names, 2);
+  XML_EXPECT_EQ(2, table.Find(""));
+  XML_EXPECT_EQ(2, table.Find("Layer", 0));
+  XML_EXPECT_EQ(1, table.Find("Layer"));
+}
@@ -0,0 +1,109 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmltest.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace XmlTest {
+
+static int failure_count = 0;
+static int skip_count = 0;
+
+std::vector<TestCase>& TestCases() {
+  static std::vector<TestCase> test_cases;
+  return test_cases;
+}
+
+void Fail(const char* file, int line, const std::string& message) {
+  ++failure_count;
+  printf("%s(%d): %s\n", file, line, message.c_str());
+}
+
+void Skip(const char* file, int line, const std::string& reason) {
+  ++skip_count;
+  printf("%s(%d): skipped, %s\n", file, line, reason.c_str());
+}
+
+static bool IsSelected(const char* name, int argc, char** argv) {
+  if (argc <= 1)
+    return true;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], name) == 0)
+      return true;
+  }
+  return false;
+}
+
+int RunAll(int argc, char** argv) {
+  const std::vector<TestCase>& test_cases = TestCases();
+  int failed_cases = 0;
+  int skipped_cases = 0;
+  int run_cases = 0;
+  for (size_t i = 0; i < test_cases.size(); ++i) {
+    if (!IsSelected(test_cases[i].name_, argc, argv))
+      continue;
+    printf("[ RUN  ] %s\n", test_cases[i].name_);
+    fflush(stdout);
+    const int failures = failure_count;
+    const int skips = skip_count;
+    test_cases[i].function_();
+    ++run_cases;
+    if (failure_count != failures) {
+      ++failed_cases;
+      printf("[ FAIL ] %s\n", test_cases[i].name_);
+    } else if (skip_count != skips) {
+      ++skipped_cases;
+      printf("[ SKIP ] %s\n", test_cases[i].name_);
+    } else {
+      printf("[  OK  ] %s\n", test_cases[i].name_);
+    }
+    fflush(stdout);
+  }
+  printf("%d of %d cases failed, %d skipped\n", failed_cases, run_cases,
+         skipped_cases);
+  if (failed_cases != 0)
+    return 1;
+  return run_cases > 0 && skipped_cases == run_cases ? kSkippedExitCode : 0;
+}
+
+std::string TempPath(const std::string& name) {
+  return "xmltest_" + name;
+}
+
+bool FileExists(const std::string& filename) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (file == NULL)
+    return false;
+  fclose(file);
+  return true;
+}
+
+std::string ReadFile(const std::string& filename) {
+  std::string contents;
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (file == NULL)
+    return contents;
+  char buffer[64 * 1024];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents.append(buffer, size);
+  }
+  fclose(file);
+  return contents;
+}
+
+bool WriteFile(const std::string& filename, const std::string& contents) {
+  FILE* file = fopen(filename.c_str(), "wb");
+  if (file == NULL)
+    return false;
+  bool ok = fwrite(contents.data(), 1, contents.size(), file) ==
+            contents.size();
+  return fclose(file) == 0 && ok;
+}
+
+} // end namespace XmlTest
+
+int main(int argc, char** argv) {
+  return XmlTest::RunAll(argc, argv);
+}
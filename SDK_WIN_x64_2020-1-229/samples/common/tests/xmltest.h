@@ -0,0 +1,101 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_TESTS_XMLTEST_H
+#define SKPTOXML_COMMON_TESTS_XMLTEST_H
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+// A minimal test runner. Every test file is a program of its own whose
+// XML_TEST cases are run by the main() in xmltest.cpp. The XML_EXPECT macros
+// report a failure and carry on, XML_ASSERT also ends the case. XML_SKIP
+// ends a case that can't run here without failing it.
+
+namespace XmlTest {
+
+typedef void (*TestFunction)();
+
+struct TestCase {
+  const char* name_;
+  TestFunction function_;
+};
+
+std::vector<TestCase>& TestCases();
+
+class CRegistrar {
+ public:
+  CRegistrar(const char* name, TestFunction function) {
+    TestCase test_case = { name, function };
+    TestCases().push_back(test_case);
+  }
+};
+
+// Reports a failure of the running case
+void Fail(const char* file, int line, const std::string& message);
+
+template <typename T>
+std::string Describe(const T& value) {
+  std::ostringstream stream;
+  stream.precision(17);
+  stream << value;
+  return stream.str();
+}
+
+// Reports that the running case is skipped
+void Skip(const char* file, int line, const std::string& reason);
+
+// The exit code of a program whose cases were all skipped, which ctest is
+// told to report as a skipped test
+enum { kSkippedExitCode = 77 };
+
+// Runs the cases named on the command line, or all of them. Returns the
+// exit code of the program.
+int RunAll(int argc, char** argv);
+
+// Names a file in the directory the test runs in, which ctest gives every
+// test program a directory of its own for
+std::string TempPath(const std::string& name);
+bool FileExists(const std::string& filename);
+// The contents of a file, empty if it can't be read
+std::string ReadFile(const std::string& filename);
+bool WriteFile(const std::string& filename, const std::string& contents);
+
+} // end namespace XmlTest
+
+#define XML_TEST(name)                                               \
+  static void name();                                                \
+  static XmlTest::CRegistrar name##_registrar(#name, name);          \
+  static void name()
+
+#define XML_EXPECT(condition)                                        \
+  do {                                                               \
+    if (!(condition))                                                \
+      XmlTest::Fail(__FILE__, __LINE__, "expected " #condition);     \
+  } while (0)
+
+#define XML_EXPECT_EQ(expected, actual)                              \
+  do {                                                               \
+    if (!((expected) == (actual))) {                                 \
+      XmlTest::Fail(__FILE__, __LINE__,                              \
+                    "expected " #actual " == " +                     \
+                    XmlTest::Describe(expected) + ", got " +         \
+                    XmlTest::Describe(actual));                      \
+    }                                                                \
+  } while (0)
+
+#define XML_ASSERT(condition)                                        \
+  do {                                                               \
+    if (!(condition)) {                                              \
+      XmlTest::Fail(__FILE__, __LINE__, "expected " #condition);     \
+      return;                                                        \
+    }                                                                \
+  } while (0)
+
+#define XML_SKIP(reason)                                             \
+  do {                                                               \
+    XmlTest::Skip(__FILE__, __LINE__, reason);                       \
+    return;                                                          \
+  } while (0)
+
+#endif // SKPTOXML_COMMON_TESTS_XMLTEST_H
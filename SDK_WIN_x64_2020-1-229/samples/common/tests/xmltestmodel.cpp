@@ -0,0 +1,530 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmltestmodel.h"
+
+#include <math.h>
+#include <vector>
+
+#include "./xmltest.h"
+
+using XmlGeomUtils::CPoint3d;
+
+namespace XmlTest {
+
+static SUColor MakeColor(int red, int green, int blue) {
+  SUColor color;
+  color.red = static_cast<SUByte>(red);
+  color.green = static_cast<SUByte>(green);
+  color.blue = static_cast<SUByte>(blue);
+  // The files don't keep alpha, it reads back opaque
+  color.alpha = 255;
+  return color;
+}
+
+SUTransformation MakeTransform(double angle, double scale, double x,
+                               double y, double z) {
+  const double c = cos(angle) * scale;
+  const double s = sin(angle) * scale;
+  SUTransformation transform = {
+    { c, s, 0.0, 0.0,
+      -s, c, 0.0, 0.0,
+      0.0, 0.0, scale, 0.0,
+      x, y, z, 1.0 }
+  };
+  return transform;
+}
+
+XmlFaceInfo MakeLoopFace(int count, double x, double y, double z) {
+  XmlFaceInfo face;
+  face.has_single_loop_ = true;
+  for (int i = 0; i < count; ++i) {
+    const double angle = 2.0 * 3.141592653589793 * i / count;
+    XmlFaceVertex vertex;
+    vertex.vertex_ = CPoint3d(x + cos(angle) / 3.0, y + sin(angle) / 7.0, z);
+    vertex.front_texture_coord_ = CPoint3d(cos(angle) * 0.1, i / 3.0, 0.0);
+    vertex.back_texture_coord_ = CPoint3d(i * 0.7, -sin(angle), 0.0);
+    face.vertices_.push_back(vertex);
+  }
+  return face;
+}
+
+XmlFaceInfo MakeTriangleStrip(int count, double x, double y, double z) {
+  XmlFaceInfo face;
+  face.has_single_loop_ = false;
+  for (int i = 0; i < count + 2; ++i) {
+    XmlFaceVertex vertex;
+    vertex.vertex_ = CPoint3d(x + (i / 2) * 0.1, y + (i % 2) / 3.0,
+                              z + i * 1e-9);
+    vertex.front_texture_coord_ = CPoint3d(i * 0.25, (i % 2) * 1.5, 0.0);
+    vertex.back_texture_coord_ = CPoint3d(-i / 9.0, 0.125, 0.0);
+    face.vertices_.push_back(vertex);
+  }
+  // Every other triangle is turned, so they all wind the same way
+  for (int i = 0; i < count; ++i) {
+    const uint32_t first = static_cast<uint32_t>(i);
+    face.indices_.push_back(first);
+    face.indices_.push_back(i % 2 == 0 ? first + 1 : first + 2);
+    face.indices_.push_back(i % 2 == 0 ? first + 2 : first + 1);
+  }
+  return face;
+}
+
+static XmlEdgeInfo MakeEdge(double x, double y, double z,
+                            const char* layer, bool has_color) {
+  XmlEdgeInfo edge;
+  edge.has_layer_ = layer != NULL;
+  if (layer != NULL)
+    edge.layer_name_ = layer;
+  edge.has_color_ = has_color;
+  if (has_color)
+    edge.color_ = MakeColor(12, 200, 7);
+  edge.start_ = CPoint3d(x, y, z);
+  edge.end_ = CPoint3d(x + 0.1, y - 1e-7, z + 123456.789);
+  return edge;
+}
+
+// Fills an entities block with faces of every kind, edges and a curve
+static void AddGeometry(XmlEntitiesInfo& entities, int size, double offset) {
+  for (int i = 0; i < size; ++i) {
+    const double x = offset + i * 2.5;
+    XmlFaceInfo loop = MakeLoopFace(3 + i % 4, x, -x, 1.0 / 3.0);
+    loop.front_mat_name_ = "Brick";
+    loop.has_front_texture_ = true;
+    loop.layer_name_ = "Walls";
+    // Untextured sides read back without texture coordinates
+    for (size_t j = 0; j < loop.vertices_.size(); ++j) {
+      loop.vertices_[j].back_texture_coord_ = CPoint3d();
+    }
+    entities.faces_.push_back(loop);
+
+    XmlFaceInfo strip = MakeTriangleStrip(2 + i % 3, x, x, -0.1);
+    strip.front_mat_name_ = "Brick";
+    strip.has_front_texture_ = true;
+    strip.back_mat_name_ = "Roof & <Tiles>";
+    strip.has_back_texture_ = true;
+    entities.faces_.push_back(strip);
+
+    XmlFaceInfo plain = MakeLoopFace(4, x, 0.0, 1e10);
+    plain.back_mat_name_ = "Glass";
+    for (size_t j = 0; j < plain.vertices_.size(); ++j) {
+      plain.vertices_[j].front_texture_coord_ = CPoint3d();
+      plain.vertices_[j].back_texture_coord_ = CPoint3d();
+    }
+    entities.faces_.push_back(plain);
+
+    entities.edges_.push_back(MakeEdge(x, 0.5, -2.0, "Walls", true));
+    entities.edges_.push_back(MakeEdge(x, 1e-300, 3.0, NULL, false));
+  }
+
+  XmlCurveInfo curve;
+  for (int i = 0; i < 3; ++i) {
+    curve.edges_.push_back(MakeEdge(offset + i, 0.0, 0.0,
+                                    i == 1 ? "Layer0" : NULL, i == 2));
+  }
+  entities.curves_.push_back(curve);
+}
+
+static XmlComponentInstanceInfo MakeInstance(const std::string& definition,
+                                             const char* material,
+                                             const char* layer,
+                                             const SUTransformation& t) {
+  XmlComponentInstanceInfo instance;
+  instance.definition_name_ = definition;
+  if (material != NULL)
+    instance.material_name_ = material;
+  if (layer != NULL)
+    instance.layer_name_ = layer;
+  instance.transform_ = t;
+  return instance;
+}
+
+void BuildTestModel(XmlModelInfo& model_info, int size) {
+  model_info = XmlModelInfo();
+
+  XmlMaterialInfo red;
+  red.name_ = "Red";
+  red.has_color_ = true;
+  red.color_ = MakeColor(255, 0, 0);
+  XmlMaterialInfo glass;
+  glass.name_ = "Glass";
+  glass.has_color_ = true;
+  glass.color_ = MakeColor(10, 20, 250);
+  glass.has_alpha_ = true;
+  glass.alpha_ = 0.35;
+  XmlMaterialInfo brick;
+  brick.name_ = "Brick";
+  brick.has_texture_ = true;
+  brick.texture_path_ = "textures/brick \"old\".png";
+  brick.texture_sscale_ = 0.0254;
+  brick.texture_tscale_ = 1.0 / 3.0;
+  XmlMaterialInfo tiles;
+  tiles.name_ = "Roof & <Tiles>";
+  tiles.has_color_ = true;
+  tiles.color_ = MakeColor(128, 64, 32);
+  tiles.has_texture_ = true;
+  tiles.texture_path_ = "tiles.jpg";
+  tiles.texture_sscale_ = 12.0;
+  tiles.texture_tscale_ = 6.5;
+  model_info.materials_.push_back(red);
+  model_info.materials_.push_back(glass);
+  model_info.materials_.push_back(brick);
+  model_info.materials_.push_back(tiles);
+
+  XmlLayerInfo layer0;
+  layer0.name_ = "Layer0";
+  layer0.is_visible_ = true;
+  XmlLayerInfo walls;
+  walls.name_ = "Walls";
+  walls.is_visible_ = false;
+  walls.has_material_info_ = true;
+  walls.material_info_ = glass;
+  walls.material_info_.name_ = "Walls";
+  model_info.layers_.push_back(layer0);
+  model_info.layers_.push_back(walls);
+
+  // Every definition but the first holds an instance of the one before it,
+  // and a group
+  const int definition_count = 3 * size;
+  for (int i = 0; i < definition_count; ++i) {
+    model_info.definitions_.emplace_back();
+    XmlComponentDefinitionInfo& definition = model_info.definitions_.back();
+    definition.name_ = i == 1 ? "Table#1 <large>" : "Chair " + std::to_string(i);
+    AddGeometry(definition.entities_, size, i * 10.0);
+    if (i == 0)
+      continue;
+    definition.entities_.component_instances_.push_back(MakeInstance(
+        model_info.definitions_[i - 1].name_, i % 2 == 0 ? "Red" : NULL,
+        NULL, MakeTransform(0.3 * i, 1.0, i, 2.0 * i, 0.0)));
+    definition.entities_.groups_.emplace_back();
+    XmlGroupInfo& group = definition.entities_.groups_.back();
+    group.transform_ = MakeTransform(-0.7, 2.0, 0.0, 0.0, 1.0 / 7.0);
+    AddGeometry(*group.entities_, 1, -5.0);
+  }
+
+  XmlEntitiesInfo& geometry = model_info.entities_;
+  for (int i = 0; i < definition_count; ++i) {
+    // Some of them mirror
+    SUTransformation t = MakeTransform(i * 0.1, i % 3 == 0 ? -1.5 : 0.5,
+                                       100.0 * i, -3.0, 1e-3 * i);
+    geometry.component_instances_.push_back(MakeInstance(
+        model_info.definitions_[i].name_, i % 2 == 1 ? "Glass" : NULL,
+        i % 3 == 1 ? "Walls" : NULL, t));
+  }
+  for (int i = 0; i < 2 + size; ++i) {
+    geometry.groups_.emplace_back();
+    XmlGroupInfo& group = geometry.groups_.back();
+    group.transform_ = MakeTransform(1.0 + i, 1.0, 0.5, -0.5, 2.0);
+    AddGeometry(*group.entities_, size, i * -7.0);
+    // A group in a group, with an instance
+    group.entities_->groups_.emplace_back();
+    XmlGroupInfo& inner = group.entities_->groups_.back();
+    inner.transform_ = MakeTransform(0.25, 4.0, 1.0, 1.0, 1.0);
+    inner.entities_->component_instances_.push_back(MakeInstance(
+        model_info.definitions_[0].name_, "Red", "Layer0",
+        MakeTransform(0.0, 1.0, 0.0, 0.0, 0.0)));
+    AddGeometry(*inner.entities_, 1, 3.0);
+  }
+  AddGeometry(geometry, size, 1000.0);
+}
+
+bool WriteModel(const std::string& filename, const XmlModelInfo& model_info,
+                int xml_version, CXmlFile::WriteMode write_mode) {
+  CXmlFile file;
+  if (!file.Open(filename, write_mode))
+    return false;
+  file.set_xml_version(xml_version);
+  file.WriteHeader(20, 1, 229);
+  file.WriteModelInfo(model_info);
+  return file.Close(false);
+}
+
+bool ReadModel(CXmlFile& file, const std::string& filename,
+               CXmlFile::ReadMode read_mode, XmlModelInfo& model_info) {
+  bool ok = file.Open(filename, false, read_mode) &&
+            file.GetModelInfo(model_info);
+  file.Close(false);
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+
+// CModelComparer - Finds the first difference between two models
+class CModelComparer {
+ public:
+  CModelComparer(const XmlModelInfo& expected, const XmlModelInfo& actual)
+    : expected_(expected), actual_(actual) {}
+
+  bool Compare(std::string* difference);
+
+ private:
+  // The name of an info that may have been read with interned names
+  static const std::string& Name(const XmlModelInfo& model, uint32_t id,
+                                 const std::string& name) {
+    return id != CXmlNameTable::kNoName ? model.names_.GetName(id) : name;
+  }
+
+  bool Differ(const std::string& what);
+  template <typename T>
+  bool Check(const T& expected, const T& actual, const std::string& what) {
+    if (expected == actual)
+      return true;
+    return Differ(what + ": expected " + Describe(expected) + ", got " +
+                  Describe(actual));
+  }
+
+  bool CompareMaterials(const XmlMaterialInfo& expected,
+                        const XmlMaterialInfo& actual);
+  bool ComparePoints(const CPoint3d& expected, const CPoint3d& actual,
+                     const std::string& what);
+  bool CompareColors(const SUColor& expected, const SUColor& actual);
+  bool CompareTransforms(const SUTransformation& expected,
+                         const SUTransformation& actual);
+  bool CompareEdges(const XmlEdgeInfo& expected, const XmlEdgeInfo& actual);
+  bool CompareFaces(const XmlFaceInfo& expected, const XmlFaceInfo& actual);
+  bool CompareEntities(const XmlEntitiesInfo& expected,
+                       const XmlEntitiesInfo& actual, std::string path);
+
+ private:
+  const XmlModelInfo& expected_;
+  const XmlModelInfo& actual_;
+  std::string path_;
+  std::string difference_;
+};
+
+bool CModelComparer::Differ(const std::string& what) {
+  if (difference_.empty())
+    difference_ = path_ + ": " + what;
+  return false;
+}
+
+bool CModelComparer::ComparePoints(const CPoint3d& expected,
+                                   const CPoint3d& actual,
+                                   const std::string& what) {
+  return Check(expected.x(), actual.x(), what + ".x") &&
+         Check(expected.y(), actual.y(), what + ".y") &&
+         Check(expected.z(), actual.z(), what + ".z");
+}
+
+bool CModelComparer::CompareColors(const SUColor& expected,
+                                   const SUColor& actual) {
+  return Check<int>(expected.red, actual.red, "red") &&
+         Check<int>(expected.green, actual.green, "green") &&
+         Check<int>(expected.blue, actual.blue, "blue") &&
+         Check<int>(expected.alpha, actual.alpha, "alpha");
+}
+
+bool CModelComparer::CompareTransforms(const SUTransformation& expected,
+                                       const SUTransformation& actual) {
+  for (int i = 0; i < 16; ++i) {
+    if (!Check(expected.values[i], actual.values[i],
+               "transform value " + std::to_string(i)))
+      return false;
+  }
+  return true;
+}
+
+bool CModelComparer::CompareMaterials(const XmlMaterialInfo& expected,
+                                      const XmlMaterialInfo& actual) {
+  if (!Check(expected.name_, actual.name_, "material name") ||
+      !Check(expected.has_color_, actual.has_color_, "has_color") ||
+      !Check(expected.has_alpha_, actual.has_alpha_, "has_alpha") ||
+      !Check(expected.has_texture_, actual.has_texture_, "has_texture"))
+    return false;
+  if (expected.has_color_ && !CompareColors(expected.color_, actual.color_))
+    return false;
+  if (expected.has_alpha_ && !Check(expected.alpha_, actual.alpha_, "alpha"))
+    return false;
+  return !expected.has_texture_ ||
+         (Check(expected.texture_path_, actual.texture_path_, "path") &&
+          Check(expected.texture_sscale_, actual.texture_sscale_, "sscale") &&
+          Check(expected.texture_tscale_, actual.texture_tscale_, "tscale"));
+}
+
+bool CModelComparer::CompareEdges(const XmlEdgeInfo& expected,
+                                  const XmlEdgeInfo& actual) {
+  if (!Check(expected.has_layer_, actual.has_layer_, "edge has_layer") ||
+      !Check(expected.has_color_, actual.has_color_, "edge has_color"))
+    return false;
+  if (expected.has_layer_ &&
+      !Check(Name(expected_, expected.layer_id_, expected.layer_name_),
+             Name(actual_, actual.layer_id_, actual.layer_name_),
+             "edge layer"))
+    return false;
+  if (expected.has_color_ && !CompareColors(expected.color_, actual.color_))
+    return false;
+  return ComparePoints(expected.start_, actual.start_, "edge start") &&
+         ComparePoints(expected.end_, actual.end_, "edge end");
+}
+
+bool CModelComparer::CompareFaces(const XmlFaceInfo& expected,
+                                  const XmlFaceInfo& actual) {
+  if (!Check(Name(expected_, expected.layer_id_, expected.layer_name_),
+             Name(actual_, actual.layer_id_, actual.layer_name_),
+             "face layer") ||
+      !Check(Name(expected_, expected.front_mat_id_,
+                  expected.front_mat_name_),
+             Name(actual_, actual.front_mat_id_, actual.front_mat_name_),
+             "front material") ||
+      !Check(Name(expected_, expected.back_mat_id_, expected.back_mat_name_),
+             Name(actual_, actual.back_mat_id_, actual.back_mat_name_),
+             "back material") ||
+      !Check(expected.has_front_texture_, actual.has_front_texture_,
+             "has_front_texture") ||
+      !Check(expected.has_back_texture_, actual.has_back_texture_,
+             "has_back_texture") ||
+      !Check(expected.has_single_loop_, actual.has_single_loop_,
+             "has_single_loop") ||
+      !Check(expected.vertices_.size(), actual.vertices_.size(),
+             "vertex count") ||
+      !Check(expected.indices_.size(), actual.indices_.size(),
+             "index count"))
+    return false;
+  for (size_t i = 0; i < expected.vertices_.size(); ++i) {
+    const std::string vertex = "vertex " + std::to_string(i);
+    const XmlFaceVertex& a = expected.vertices_[i];
+    const XmlFaceVertex& b = actual.vertices_[i];
+    if (!ComparePoints(a.vertex_, b.vertex_, vertex) ||
+        !ComparePoints(a.front_texture_coord_, b.front_texture_coord_,
+                       vertex + " front uv") ||
+        !ComparePoints(a.back_texture_coord_, b.back_texture_coord_,
+                       vertex + " back uv"))
+      return false;
+  }
+  for (size_t i = 0; i < expected.indices_.size(); ++i) {
+    if (!Check(expected.indices_[i], actual.indices_[i],
+               "index " + std::to_string(i)))
+      return false;
+  }
+  return true;
+}
+
+// The faces of a block, from faces_ or from face_store_
+static std::vector<XmlFaceInfo> GetFaces(const XmlEntitiesInfo& entities) {
+  std::vector<XmlFaceInfo> faces(entities.faces_.begin(),
+                                 entities.faces_.end());
+  for (CXmlFaceStore::const_iterator it = entities.face_store_.begin();
+       it != entities.face_store_.end(); ++it) {
+    faces.push_back(XmlFaceInfo());
+    it->GetFaceInfo(faces.back());
+  }
+  return faces;
+}
+
+bool CModelComparer::CompareEntities(const XmlEntitiesInfo& expected,
+                                     const XmlEntitiesInfo& actual,
+                                     std::string path) {
+  path_ = path;
+  if (!Check(expected.component_instances_.size(),
+             actual.component_instances_.size(), "instance count"))
+    return false;
+  for (size_t i = 0; i < expected.component_instances_.size(); ++i) {
+    path_ = path + "/instance " + std::to_string(i);
+    const XmlComponentInstanceInfo& a = expected.component_instances_[i];
+    const XmlComponentInstanceInfo& b = actual.component_instances_[i];
+    if (!Check(Name(expected_, a.definition_id_, a.definition_name_),
+               Name(actual_, b.definition_id_, b.definition_name_),
+               "definition") ||
+        !Check(Name(expected_, a.material_id_, a.material_name_),
+               Name(actual_, b.material_id_, b.material_name_),
+               "material") ||
+        !Check(Name(expected_, a.layer_id_, a.layer_name_),
+               Name(actual_, b.layer_id_, b.layer_name_), "layer") ||
+        !CompareTransforms(a.transform_, b.transform_))
+      return false;
+  }
+
+  path_ = path;
+  if (!Check(expected.groups_.size(), actual.groups_.size(), "group count"))
+    return false;
+  for (size_t i = 0; i < expected.groups_.size(); ++i) {
+    const std::string group = path + "/group " + std::to_string(i);
+    if (!CompareEntities(*expected.groups_[i].entities_,
+                         *actual.groups_[i].entities_, group))
+      return false;
+    path_ = group;
+    if (!CompareTransforms(expected.groups_[i].transform_,
+                           actual.groups_[i].transform_))
+      return false;
+  }
+
+  path_ = path;
+  std::vector<XmlFaceInfo> expected_faces = GetFaces(expected);
+  std::vector<XmlFaceInfo> actual_faces = GetFaces(actual);
+  if (!Check(expected_faces.size(), actual_faces.size(), "face count"))
+    return false;
+  for (size_t i = 0; i < expected_faces.size(); ++i) {
+    path_ = path + "/face " + std::to_string(i);
+    if (!CompareFaces(expected_faces[i], actual_faces[i]))
+      return false;
+  }
+
+  path_ = path;
+  if (!Check(expected.edges_.size(), actual.edges_.size(), "edge count") ||
+      !Check(expected.curves_.size(), actual.curves_.size(), "curve count"))
+    return false;
+  for (size_t i = 0; i < expected.edges_.size(); ++i) {
+    path_ = path + "/edge " + std::to_string(i);
+    if (!CompareEdges(expected.edges_[i], actual.edges_[i]))
+      return false;
+  }
+  for (size_t i = 0; i < expected.curves_.size(); ++i) {
+    path_ = path + "/curve " + std::to_string(i);
+    const XmlCurveInfo& a = expected.curves_[i];
+    const XmlCurveInfo& b = actual.curves_[i];
+    if (!Check(a.edges_.size(), b.edges_.size(), "edge count"))
+      return false;
+    for (size_t j = 0; j < a.edges_.size(); ++j) {
+      if (!CompareEdges(a.edges_[j], b.edges_[j]))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool CModelComparer::Compare(std::string* difference) {
+  bool same = Check(expected_.layers_.size(), actual_.layers_.size(),
+                    "layer count") &&
+              Check(expected_.materials_.size(), actual_.materials_.size(),
+                    "material count") &&
+              Check(expected_.definitions_.size(),
+                    actual_.definitions_.size(), "definition count");
+  for (size_t i = 0; same && i < expected_.layers_.size(); ++i) {
+    path_ = "layer " + std::to_string(i);
+    const XmlLayerInfo& a = expected_.layers_[i];
+    const XmlLayerInfo& b = actual_.layers_[i];
+    same = Check(a.name_, b.name_, "name") &&
+           Check(a.is_visible_, b.is_visible_, "visible") &&
+           Check(a.has_material_info_, b.has_material_info_, "material") &&
+           (!a.has_material_info_ ||
+            CompareMaterials(a.material_info_, b.material_info_));
+  }
+  for (size_t i = 0; same && i < expected_.materials_.size(); ++i) {
+    path_ = "material " + std::to_string(i);
+    same = CompareMaterials(expected_.materials_[i], actual_.materials_[i]);
+  }
+  for (size_t i = 0; same && i < expected_.definitions_.size(); ++i) {
+    const XmlComponentDefinitionInfo& a = expected_.definitions_[i];
+    const XmlComponentDefinitionInfo& b = actual_.definitions_[i];
+    path_ = "definition " + a.name_;
+    same = Check(a.name_, b.name_, "name") &&
+           Check(a.loaded_, b.loaded_, "loaded") &&
+           Check(a.aliases_.size(), b.aliases_.size(), "alias count");
+    for (size_t j = 0; same && j < a.aliases_.size(); ++j) {
+      same = Check(a.aliases_[j], b.aliases_[j], "alias");
+    }
+    same = same && CompareEntities(a.entities_, b.entities_, path_);
+  }
+  same = same && CompareEntities(expected_.entities_, actual_.entities_,
+                                 "geometry");
+  if (!same && difference != NULL)
+    *difference = difference_;
+  return same;
+}
+
+bool SameModel(const XmlModelInfo& expected, const XmlModelInfo& actual,
+               std::string* difference) {
+  CModelComparer comparer(expected, actual);
+  return comparer.Compare(difference);
+}
+
+} // end namespace XmlTest
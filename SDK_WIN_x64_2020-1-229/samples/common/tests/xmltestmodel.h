@@ -0,0 +1,52 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_TESTS_XMLTESTMODEL_H
+#define SKPTOXML_COMMON_TESTS_XMLTESTMODEL_H
+
+#include <string>
+
+#include "../xmlfile.h"
+
+// Models for the tests, and ways to write and compare them.
+
+namespace XmlTest {
+
+// Builds a model that uses every part of the format: layers with and
+// without a material, materials with colors, alpha and textures, nested
+// definitions, instances, groups, loops and triangulated faces textured on
+// either side, edges with layers and colors, and curves. Names need XML
+// escaping and coordinates need all 17 digits. It only holds what the
+// files keep, so it reads back equal from any of them. 'size' scales the
+// number of definitions and the faces of each entities block.
+void BuildTestModel(XmlModelInfo& model_info, int size = 1);
+
+// A face of 'count' corners around (x, y, z), or a strip of 'count'
+// triangles whose vertices are listed in the order the triangles use them
+// first, like the readers share them
+XmlFaceInfo MakeLoopFace(int count, double x, double y, double z);
+XmlFaceInfo MakeTriangleStrip(int count, double x, double y, double z);
+SUTransformation MakeTransform(double angle, double scale, double x,
+                               double y, double z);
+
+// Writes a model as a new file, or reads one, with the options of 'file'
+bool WriteModel(const std::string& filename, const XmlModelInfo& model_info,
+                int xml_version, CXmlFile::WriteMode write_mode);
+bool ReadModel(CXmlFile& file, const std::string& filename,
+               CXmlFile::ReadMode read_mode, XmlModelInfo& model_info);
+
+// Compares two models, whether their names are interned or not and their
+// faces are in faces_ or in face_store_. Returns false with the first
+// difference in 'difference'.
+bool SameModel(const XmlModelInfo& expected, const XmlModelInfo& actual,
+               std::string* difference);
+
+} // end namespace XmlTest
+
+#define XML_EXPECT_SAME_MODEL(expected, actual)                      \
+  do {                                                               \
+    std::string difference;                                          \
+    if (!XmlTest::SameModel(expected, actual, &difference))          \
+      XmlTest::Fail(__FILE__, __LINE__, difference);                 \
+  } while (0)
+
+#endif // SKPTOXML_COMMON_TESTS_XMLTESTMODEL_H
@@ -0,0 +1,273 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <math.h>
+#include <string.h>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../xmlfile.h"
+#include "../xmlweld.h"
+#include "./xmltest.h"
+#include "./xmltestmodel.h"
+
+using XmlGeomUtils::CPoint3d;
+
+namespace {
+
+XmlEdgeInfo MakeEdge(const CPoint3d& start, const CPoint3d& end) {
+  XmlEdgeInfo edge;
+  edge.start_ = start;
+  edge.end_ = end;
+  return edge;
+}
+
+// The same bits, so NaNs compare equal
+bool Same(const CPoint3d& a, const CPoint3d& b) {
+  const double p[3] = { a.x(), a.y(), a.z() };
+  const double q[3] = { b.x(), b.y(), b.z() };
+  return memcmp(p, q, sizeof(p)) == 0;
+}
+
+// Welds the points the slow way: each goes onto the earliest vertex so far
+// within 'tolerance' on every axis, or becomes a vertex of its own
+void ReferenceWeld(std::vector<CPoint3d>& points, double tolerance,
+                   std::vector<uint32_t>& indices) {
+  std::vector<CPoint3d> vertices;
+  indices.clear();
+  for (size_t i = 0; i < points.size(); ++i) {
+    CPoint3d& p = points[i];
+    size_t v = 0;
+    while (v < vertices.size() &&
+           !(fabs(p.x() - vertices[v].x()) <= tolerance &&
+             fabs(p.y() - vertices[v].y()) <= tolerance &&
+             fabs(p.z() - vertices[v].z()) <= tolerance)) {
+      ++v;
+    }
+    if (v == vertices.size())
+      vertices.push_back(p);
+    p = vertices[v];
+    indices.push_back(static_cast<uint32_t>(v));
+  }
+}
+
+// The entities blocks of a model in the order WeldModel gives them
+void CollectBlocks(XmlEntitiesInfo& entities,
+                   std::vector<XmlEntitiesInfo*>& blocks) {
+  blocks.push_back(&entities);
+  for (size_t i = 0; i < entities.groups_.size(); ++i) {
+    CollectBlocks(*entities.groups_[i].entities_, blocks);
+  }
+}
+
+bool SameVertices(const XmlWeldedVertices& a, const XmlWeldedVertices& b) {
+  return a.positions_ == b.positions_ &&
+         a.face_vertices_ == b.face_vertices_ &&
+         a.face_offsets_ == b.face_offsets_ &&
+         a.edge_vertices_ == b.edge_vertices_;
+}
+
+XmlFaceVertex MakeVertex(double x, double y, double s) {
+  XmlFaceVertex vertex;
+  vertex.vertex_ = CPoint3d(x, y, 0.0);
+  vertex.front_texture_coord_ = CPoint3d(s, 0.0, 0.0);
+  return vertex;
+}
+
+} // end namespace
+
+// A vertex goes onto the earliest one in reach, even when a later one is in
+// its own grid cell
+XML_TEST(EarliestVertexInReachWins) {
+  XmlEntitiesInfo entities;
+  // Cells are 1 wide. The first two are too far apart to weld, and the
+  // third is in reach of both, in the cell of the second.
+  entities.edges_.push_back(MakeEdge(CPoint3d(0.1, 0.5, 0.5),
+                                     CPoint3d(1.9, 0.5, 0.5)));
+  entities.edges_.push_back(MakeEdge(CPoint3d(1.05, 0.5, 0.5),
+                                     CPoint3d(5.0, 0.5, 0.5)));
+  XmlWeldedVertices vertices;
+  XML_EXPECT_EQ(static_cast<size_t>(1),
+                XmlWeld::WeldEntities(entities, 1.0, &vertices));
+  XML_EXPECT(Same(CPoint3d(0.1, 0.5, 0.5), entities.edges_[1].start_));
+  const uint32_t expected[] = { 0, 1, 0, 2 };
+  XML_EXPECT(vertices.edge_vertices_ ==
+             std::vector<uint32_t>(expected, expected + 4));
+  XML_EXPECT_EQ(static_cast<size_t>(9), vertices.positions_.size());
+}
+
+// Edge ends in clusters a little apart weld like comparing each with every
+// earlier vertex does
+XML_TEST(WeldMatchesBruteForce) {
+  std::mt19937 random(25);
+  std::uniform_int_distribution<int> spot(-4, 4);
+  std::uniform_real_distribution<double> jitter(-0.0015, 0.0015);
+  const double tolerance = XmlGeomUtils::EqualTol;
+  std::vector<CPoint3d> points;
+  for (int i = 0; i < 4000; ++i) {
+    points.push_back(CPoint3d(spot(random) * 0.0025 + jitter(random),
+                              spot(random) * 0.0025 + jitter(random),
+                              spot(random) * 0.0025 + jitter(random)));
+  }
+  XmlEntitiesInfo entities;
+  for (size_t i = 0; i < points.size(); i += 2) {
+    entities.edges_.push_back(MakeEdge(points[i], points[i + 1]));
+  }
+  std::vector<uint32_t> expected;
+  ReferenceWeld(points, tolerance, expected);
+
+  XmlWeldedVertices vertices;
+  const size_t welded = XmlWeld::WeldEntities(entities, tolerance,
+                                              &vertices);
+  XML_ASSERT(vertices.edge_vertices_.size() == expected.size());
+  XML_EXPECT(vertices.edge_vertices_ == expected);
+  XML_EXPECT_EQ(points.size() - vertices.positions_.size() / 3, welded);
+  size_t differences = 0;
+  for (size_t i = 0; i < points.size(); ++i) {
+    const XmlEdgeInfo& edge = entities.edges_[i / 2];
+    if (!Same(points[i], i % 2 == 0 ? edge.start_ : edge.end_))
+      ++differences;
+  }
+  XML_EXPECT_EQ(static_cast<size_t>(0), differences);
+}
+
+// A triangulated face keeps one corner for corners that weld with the same
+// texture coordinates; a single loop face only has its corners moved
+XML_TEST(TriangulatedFacesShareCorners) {
+  XmlEntitiesInfo entities;
+  XmlFaceInfo strip;
+  strip.has_single_loop_ = false;
+  strip.vertices_.push_back(MakeVertex(0.0, 0.0, 0.0));
+  strip.vertices_.push_back(MakeVertex(1.0, 0.0, 0.0));
+  strip.vertices_.push_back(MakeVertex(0.0, 1.0, 0.0));
+  strip.vertices_.push_back(MakeVertex(1.0, 0.0005, 0.0));
+  strip.vertices_.push_back(MakeVertex(0.0005, 1.0, 0.5));
+  strip.vertices_.push_back(MakeVertex(1.0, 1.0, 0.0));
+  const uint32_t indices[] = { 0, 1, 2, 3, 5, 4 };
+  strip.indices_.assign(indices, indices + 6);
+  entities.faces_.push_back(strip);
+  XmlFaceInfo loop = XmlTest::MakeLoopFace(4, 0.0, 0.0, 0.0);
+  loop.vertices_[2].vertex_ = loop.vertices_[1].vertex_ +
+                              XmlGeomUtils::CVector3d(0.0, 0.0, 0.0005);
+  entities.faces_.push_back(loop);
+
+  XmlWeldedVertices vertices;
+  XML_EXPECT_EQ(static_cast<size_t>(3),
+                XmlWeld::WeldEntities(entities, XmlGeomUtils::EqualTol,
+                                      &vertices));
+  // The corner with other texture coordinates keeps a vertex of its own
+  const XmlFaceInfo& face = entities.faces_[0];
+  XML_ASSERT(face.vertices_.size() == 5);
+  const uint32_t expected[] = { 0, 1, 2, 1, 4, 3 };
+  XML_EXPECT(std::vector<uint32_t>(face.indices_.begin(),
+                                   face.indices_.end()) ==
+             std::vector<uint32_t>(expected, expected + 6));
+  XML_EXPECT(Same(face.vertices_[2].vertex_, face.vertices_[3].vertex_));
+  XML_EXPECT_EQ(0.5, face.vertices_[3].front_texture_coord_.x());
+
+  XML_ASSERT(entities.faces_[1].vertices_.size() == 4);
+  XML_EXPECT(Same(entities.faces_[1].vertices_[1].vertex_,
+                  entities.faces_[1].vertices_[2].vertex_));
+  const uint32_t offsets[] = { 0, 5, 9 };
+  XML_EXPECT(vertices.face_offsets_ ==
+             std::vector<uint32_t>(offsets, offsets + 3));
+  XML_EXPECT_EQ(static_cast<size_t>(3 * 7), vertices.positions_.size());
+}
+
+// Points the grid can't hold are left where they are with vertices of their
+// own, and so is everything when the tolerance isn't a positive number
+XML_TEST(UngriddablePointsAreNeverWelded) {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const double infinity = std::numeric_limits<double>::infinity();
+  const CPoint3d points[] = {
+    CPoint3d(nan, 0.0, 0.0), CPoint3d(nan, 0.0, 0.0),
+    CPoint3d(0.0, infinity, 0.0), CPoint3d(0.0, infinity, 0.0),
+    CPoint3d(0.0, 0.0, -1e300), CPoint3d(0.0, 0.0, -1e300),
+    CPoint3d(1.0, 2.0, 3.0), CPoint3d(1.0, 2.0, 3.0005)
+  };
+  XmlEntitiesInfo entities;
+  for (int i = 0; i < 8; i += 2) {
+    entities.edges_.push_back(MakeEdge(points[i], points[i + 1]));
+  }
+  XmlWeldedVertices vertices;
+  XML_EXPECT_EQ(static_cast<size_t>(1),
+                XmlWeld::WeldEntities(entities, XmlGeomUtils::EqualTol,
+                                      &vertices));
+  const uint32_t expected[] = { 0, 1, 2, 3, 4, 5, 6, 6 };
+  XML_EXPECT(vertices.edge_vertices_ ==
+             std::vector<uint32_t>(expected, expected + 8));
+  for (int i = 0; i < 6; ++i) {
+    const XmlEdgeInfo& edge = entities.edges_[i / 2];
+    XML_EXPECT(Same(points[i], i % 2 == 0 ? edge.start_ : edge.end_));
+  }
+
+  const double tolerances[] = { 0.0, -1.0, nan, 1e-320 };
+  for (int i = 0; i < 4; ++i) {
+    XmlEntitiesInfo copies;
+    copies.edges_.push_back(MakeEdge(points[6], points[6]));
+    XML_EXPECT_EQ(static_cast<size_t>(0),
+                  XmlWeld::WeldEntities(copies, tolerances[i], &vertices));
+    XML_EXPECT_EQ(static_cast<size_t>(6), vertices.positions_.size());
+  }
+}
+
+// Faces welded in the face store come out like the same faces welded in
+// faces_, and the model welds the same on any number of threads
+XML_TEST(ModelWeldsAlike) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected, 2);
+  const std::string filename = XmlTest::TempPath("weld.xml");
+  XML_ASSERT(XmlTest::WriteModel(filename, expected,
+                                 CXmlFile::kXmlVersionPackedFaces,
+                                 CXmlFile::kWriteStreaming));
+  CXmlFile file;
+  file.set_use_face_store(true);
+  XmlModelInfo stored;
+  XML_ASSERT(XmlTest::ReadModel(file, filename, CXmlFile::kReadStreaming,
+                                stored));
+
+  const size_t welded = XmlWeld::WeldModel(expected, 0.15, 1);
+  XML_EXPECT(welded > 0);
+  XML_EXPECT_EQ(welded, XmlWeld::WeldModel(stored, 0.15, 4));
+  XML_EXPECT_SAME_MODEL(expected, stored);
+  // Welded vertices move no further
+  XmlWeld::WeldModel(stored, 0.15);
+  XML_EXPECT_SAME_MODEL(expected, stored);
+}
+
+// The model gives the welded vertices of each block, the same as welding
+// the blocks one at a time, on any number of threads
+XML_TEST(ModelGivesVerticesPerBlock) {
+  XmlModelInfo expected;
+  XmlTest::BuildTestModel(expected, 2);
+  std::vector<XmlEntitiesInfo*> blocks;
+  CollectBlocks(expected.entities_, blocks);
+  for (size_t i = 0; i < expected.definitions_.size(); ++i) {
+    CollectBlocks(expected.definitions_[i].entities_, blocks);
+  }
+  std::vector<XmlWeldedVertices> expected_vertices(blocks.size());
+  size_t expected_welded = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    expected_welded += XmlWeld::WeldEntities(*blocks[i], 0.15,
+                                             &expected_vertices[i]);
+  }
+
+  const unsigned threads[] = { 1, 4 };
+  for (int t = 0; t < 2; ++t) {
+    XmlModelInfo model_info;
+    XmlTest::BuildTestModel(model_info, 2);
+    // Entries from before are replaced
+    std::vector<XmlWeldedVertices> vertices(3);
+    vertices[0].positions_.push_back(1.0);
+    XML_EXPECT_EQ(expected_welded,
+                  XmlWeld::WeldModel(model_info, 0.15, threads[t], &vertices));
+    XML_EXPECT_SAME_MODEL(expected, model_info);
+    XML_ASSERT(vertices.size() == blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      XML_EXPECT(SameVertices(expected_vertices[i], vertices[i]));
+      XML_EXPECT_EQ(blocks[i]->faces_.size() + 1,
+                    vertices[i].face_offsets_.size());
+    }
+  }
+}
@@ -295,11 +295,11 @@ template< int SIZE >
 class MemPoolT : public MemPool
 {
 public:
-    MemPoolT() : _root(0), _currentAllocs(0), _nAllocs(0), _maxAllocs(0), _nUntracked(0)	{}
+    MemPoolT() : _root(0), _blockIndex(0), _blockUsed(0), _blockCount(COUNT), _nReserved(0), _currentAllocs(0), _nAllocs(0), _maxAllocs(0), _nUntracked(0)	{}
     ~MemPoolT() {
         // Delete the blocks.
         for( int i=0; i<_blockPtrs.Size(); ++i ) {
-            delete _blockPtrs[i];
+            delete [] _blockPtrs[i].chunk;
         }
     }
 
@@ -311,19 +311,14 @@ public:
     }
 
     virtual void* Alloc() {
-        if ( !_root ) {
-            // Need a new block.
-            Block* block = new Block();
-            _blockPtrs.Push( block );
-
-            for( int i=0; i<COUNT-1; ++i ) {
-                block->chunk[i].next = &block->chunk[i+1];
-            }
-            block->chunk[COUNT-1].next = 0;
-            _root = block->chunk;
+        // Freed items first, then the ones never handed out
+        Chunk* result = _root;
+        if ( result ) {
+            _root = result->next;
+        }
+        else {
+            result = Carve();
         }
-        void* result = _root;
-        _root = _root->next;
 
         ++_currentAllocs;
         if ( _currentAllocs > _maxAllocs ) {
@@ -358,6 +353,50 @@ public:
         return _nUntracked;
     }
 
+    /*
+    	Frees every item at once but keeps the blocks, so a pool that is
+    	filled again doesn't have to allocate them again. Objects still in
+    	the pool are not destroyed: only call this once they are gone or
+    	will never be used again. The blocks are not touched, and are
+    	handed out from the first one on again.
+    */
+    void Clear() {
+        _root = 0;
+        _blockIndex = 0;
+        _blockUsed = 0;
+        _currentAllocs = 0;
+        _nUntracked = 0;
+    }
+
+    /*
+    	Size in bytes of the blocks allocated from now on, at least one
+    	item, or 0 for the default. Large documents need fewer, larger
+    	blocks.
+    */
+    void SetBlockSize( int bytes ) {
+        if ( bytes <= 0 ) {
+            _blockCount = COUNT;
+        }
+        else {
+            _blockCount = bytes / SIZE > 0 ? bytes / SIZE : 1;
+        }
+    }
+    int BlockSize() const {
+        return _blockCount * SIZE;
+    }
+
+    // High-water mark of the items in use since the pool was created
+    int MaxAllocs() const {
+        return _maxAllocs;
+    }
+    int Blocks() const {
+        return _blockPtrs.Size();
+    }
+    // Bytes held in blocks, whether in use or not
+    size_t ReservedBytes() const {
+        return (size_t)_nReserved * SIZE;
+    }
+
 	// This number is perf sensitive. 4k seems like a good tradeoff on my machine.
 	// The test file is large, 170k.
 	// Release:		VS2010 gcc(no opt)
@@ -375,10 +414,33 @@ private:
         char    mem[SIZE];
     };
     struct Block {
-        Chunk chunk[COUNT];
+        Chunk*  chunk;
+        int     count;
     };
-    DynArray< Block*, 10 > _blockPtrs;
-    Chunk* _root;
+
+    // Takes the next item that was never handed out, adding a block when
+    // all of them have been
+    Chunk* Carve() {
+        while ( _blockIndex < _blockPtrs.Size() && _blockUsed == _blockPtrs[_blockIndex].count ) {
+            ++_blockIndex;
+            _blockUsed = 0;
+        }
+        if ( _blockIndex == _blockPtrs.Size() ) {
+            Block block;
+            block.chunk = new Chunk[_blockCount];
+            block.count = _blockCount;
+            _blockPtrs.Push( block );
+            _nReserved += _blockCount;
+        }
+        return &_blockPtrs[_blockIndex].chunk[_blockUsed++];
+    }
+
+    DynArray< Block, 10 > _blockPtrs;
+    Chunk* _root;       // freed items
+    int _blockIndex;    // block items are carved from
+    int _blockUsed;     // items carved from it so far
+    int _blockCount;    // items per new block
+    int _nReserved;     // items in all blocks
 
     int _currentAllocs;
     int _nAllocs;
@@ -1403,6 +1465,16 @@ enum Whitespace {
 };
 
 
+/// Memory held by a document, see XMLDocument::GetMemoryStats().
+struct XMLMemoryStats
+{
+    size_t  peakPoolBytes;      ///< Sum of the high-water marks of the node pools
+    size_t  reservedPoolBytes;  ///< Bytes in pool blocks, in use or free
+    int     poolBlocks;         ///< Number of pool blocks
+    size_t  charBufferBytes;    ///< Capacity of the buffer of the parsed text
+};
+
+
 /** A Document binds together all the functionality.
 	It can be saved, loaded, and printed to the screen.
 	All Nodes are connected and allocated to a Document.
@@ -1411,6 +1483,8 @@ enum Whitespace {
 class XMLDocument : public XMLNode
 {
     friend class XMLElement;
+    // Lets the unit tests look at the character buffer
+    friend class XMLDocumentTester;
 public:
     /// constructor
     XMLDocument( bool processEntities = true, Whitespace = PRESERVE_WHITESPACE );
@@ -1582,6 +1656,24 @@ public:
     /// Clear the document, resetting it to the initial state.
     void Clear();
 
+    /**
+    	Clear the document, but keep the node pools and the character
+    	buffer for the next Parse() or LoadFile(), which then don't have
+    	to allocate them again. Use it to read many files in turn with
+    	one document. The memory is held until Clear() or destruction.
+    */
+    void Reset();
+
+    /**
+    	Set the size in bytes of the blocks the node pools allocate from
+    	now on, or 0 for the default of 4k. That suits small documents;
+    	large ones make fewer allocations with larger blocks.
+    */
+    void SetPoolBlockSize( int bytes );
+
+    /// Get the memory held by the document.
+    void GetMemoryStats( XMLMemoryStats* stats ) const;
+
     // internal
     char* Identify( char* p, XMLNode** node );
 
@@ -1596,6 +1688,10 @@ private:
     XMLDocument( const XMLDocument& );	// not supported
     void operator=( const XMLDocument& );	// not supported
 
+    // Makes the character buffer hold at least 'size' characters, followed
+    // by zeros
+    char* ReserveCharBuffer( size_t size );
+
     bool        _writeBOM;
     bool        _processEntities;
     XMLError    _errorID;
@@ -1603,6 +1699,7 @@ private:
     const char* _errorStr1;
     const char* _errorStr2;
     char*       _charBuffer;
+    size_t      _charBufferCapacity;
 
     MemPoolT< sizeof(XMLElement) >	 _elementPool;
     MemPoolT< sizeof(XMLAttribute) > _attributePool;
@@ -1902,6 +1999,14 @@ public:
 
     void PushDeclaration( const char* value );
     void PushUnknown( const char* value );
+    /** Add text that is already printed, such as a whole element printed
+        earlier at the same depth. It is copied as is, without escaping.
+    */
+    void PushRaw( const char* text, int size );
+    /// Whether the start tag of the open element still waits for its '>'.
+    bool ElementJustOpened() const {
+        return _elementJustOpened;
+    }
 
     virtual bool VisitEnter( const XMLDocument& /*doc*/ );
     virtual bool VisitExit( const XMLDocument& /*doc*/ )			{
@@ -1931,6 +2036,15 @@ public:
     int CStrSize() const {
         return _buffer.Size();
     }
+    /**
+    	If in print to memory mode, empty the buffer, so
+    	that the output can be taken a piece at a time.
+    	The printer carries on where it was.
+    */
+    void ClearBuffer() {
+        _buffer.PopArr( _buffer.Size() );
+        _buffer.Push( 0 );
+    }
 
 private:
     void SealElement();
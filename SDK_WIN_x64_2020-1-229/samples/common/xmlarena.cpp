@@ -0,0 +1,76 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmlarena.h"
+
+void XmlArenaStats::Add(const XmlArenaStats& stats) {
+  allocation_count_ += stats.allocation_count_;
+  allocated_bytes_ += stats.allocated_bytes_;
+  block_count_ += stats.block_count_;
+  large_allocation_count_ += stats.large_allocation_count_;
+  current_bytes_ += stats.current_bytes_;
+  peak_bytes_ += stats.peak_bytes_;
+}
+
+//------------------------------------------------------------------------------
+
+CXmlArena::CXmlArena()
+  : next_(NULL),
+    end_(NULL),
+    block_size_(kFirstBlockSize) {
+}
+
+CXmlArena::~CXmlArena() {
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    ::operator delete(blocks_[i]);
+  }
+  for (std::set<void*>::iterator it = large_allocations_.begin();
+       it != large_allocations_.end(); ++it) {
+    ::operator delete(*it);
+  }
+}
+
+void CXmlArena::AddBytes(size_t size) {
+  stats_.current_bytes_ += size;
+  if (stats_.current_bytes_ > stats_.peak_bytes_)
+    stats_.peak_bytes_ = stats_.current_bytes_;
+}
+
+void* CXmlArena::Allocate(size_t size, size_t alignment) {
+  ++stats_.allocation_count_;
+
+  if (size >= kLargeAllocationSize) {
+    void* p = ::operator new(size);
+    large_allocations_.insert(p);
+    ++stats_.large_allocation_count_;
+    stats_.allocated_bytes_ += size;
+    AddBytes(size);
+    return p;
+  }
+
+  size_t padding = static_cast<size_t>(-reinterpret_cast<ptrdiff_t>(next_)) &
+                   (alignment - 1);
+  if (next_ == NULL || static_cast<size_t>(end_ - next_) < padding + size) {
+    next_ = static_cast<char*>(::operator new(block_size_));
+    end_ = next_ + block_size_;
+    padding = 0;
+    blocks_.push_back(next_);
+    ++stats_.block_count_;
+    AddBytes(block_size_);
+    if (block_size_ < kMaxBlockSize)
+      block_size_ *= 2;
+  }
+
+  char* p = next_ + padding;
+  next_ = p + size;
+  stats_.allocated_bytes_ += padding + size;
+  return p;
+}
+
+void CXmlArena::Deallocate(void* p, size_t size) {
+  if (size < kLargeAllocationSize)
+    return;
+  if (large_allocations_.erase(p) != 0) {
+    ::operator delete(p);
+    stats_.current_bytes_ -= size;
+  }
+}
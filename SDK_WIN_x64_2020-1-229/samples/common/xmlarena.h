@@ -0,0 +1,131 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLARENA_H
+#define SKPTOXML_COMMON_XMLARENA_H
+
+#include <stddef.h>
+#include <limits>
+#include <new>
+#include <set>
+#include <type_traits>
+#include <vector>
+
+// Usage counters of a CXmlArena
+struct XmlArenaStats {
+  XmlArenaStats()
+    : allocation_count_(0), allocated_bytes_(0), block_count_(0),
+      large_allocation_count_(0), current_bytes_(0), peak_bytes_(0) {}
+
+  // Adds the counters of another arena. The peaks are added too, which
+  // overstates the joint peak if the arenas peaked at different times.
+  void Add(const XmlArenaStats& stats);
+
+  // All allocations, and the bytes handed out including alignment padding
+  size_t allocation_count_;
+  size_t allocated_bytes_;
+  // Blocks the small allocations are carved out of
+  size_t block_count_;
+  // Allocations passed on to the heap
+  size_t large_allocation_count_;
+  // Memory taken from the heap by the blocks and the live large allocations
+  size_t current_bytes_;
+  size_t peak_bytes_;
+};
+
+// CXmlArena - A monotonic allocator for the many small objects of a model.
+// Small allocations are carved out of blocks by bumping a pointer and are
+// never freed one by one: the blocks are released all at once when the
+// arena is destroyed. The objects in them are still destroyed one by one,
+// so this saves the frees but not the destructors. Large allocations, such as the buffers of growing
+// vectors, go to the heap and are freed as usual, since keeping every
+// buffer a vector outgrew would double its memory. Not thread safe.
+class CXmlArena {
+ public:
+  enum {
+    kFirstBlockSize = 64 * 1024,
+    // Blocks double in size up to this
+    kMaxBlockSize = 16 * 1024 * 1024,
+    // Allocations from this size on go to the heap
+    kLargeAllocationSize = 16 * 1024
+  };
+
+  CXmlArena();
+  ~CXmlArena();
+
+  // Returns 'size' bytes aligned to 'alignment', which must be a power of 2
+  // and at most the alignment of operator new
+  void* Allocate(size_t size, size_t alignment);
+  // Only large allocations are freed, others stay until the arena goes
+  void Deallocate(void* p, size_t size);
+
+  const XmlArenaStats& stats() const { return stats_; }
+
+ private:
+  // Not copyable
+  CXmlArena(const CXmlArena&);
+  CXmlArena& operator=(const CXmlArena&);
+
+  void AddBytes(size_t size);
+
+ private:
+  std::vector<char*> blocks_;
+  std::set<void*> large_allocations_;
+  char* next_;
+  char* end_;
+  size_t block_size_;
+  XmlArenaStats stats_;
+};
+
+// CXmlArenaAllocator - Standard allocator on top of a CXmlArena. Without an
+// arena it uses the heap, so containers using it behave as usual by
+// default. Containers take their arena along when they are copied or
+// assigned, and must be gone before it is.
+template <typename T>
+class CXmlArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  CXmlArenaAllocator(CXmlArena* arena = NULL) : arena_(arena) {}
+  template <typename U>
+  CXmlArenaAllocator(const CXmlArenaAllocator<U>& allocator)
+    : arena_(allocator.arena()) {}
+
+  CXmlArena* arena() const { return arena_; }
+
+  T* allocate(size_t count) {
+    if (count > (std::numeric_limits<size_t>::max)() / sizeof(T))
+      throw std::bad_alloc();
+    if (arena_ == NULL)
+      return static_cast<T*>(::operator new(count * sizeof(T)));
+    return static_cast<T*>(arena_->Allocate(count * sizeof(T),
+                                            std::alignment_of<T>::value));
+  }
+
+  void deallocate(T* p, size_t count) {
+    if (arena_ == NULL)
+      ::operator delete(p);
+    else
+      arena_->Deallocate(p, count * sizeof(T));
+  }
+
+  template <typename U>
+  bool operator==(const CXmlArenaAllocator<U>& allocator) const {
+    return arena_ == allocator.arena();
+  }
+  template <typename U>
+  bool operator!=(const CXmlArenaAllocator<U>& allocator) const {
+    return arena_ != allocator.arena();
+  }
+
+ private:
+  CXmlArena* arena_;
+};
+
+// A std::vector allocating from a CXmlArena
+template <typename T>
+using XmlArenaVector = std::vector<T, CXmlArenaAllocator<T> >;
+
+#endif // SKPTOXML_COMMON_XMLARENA_H
@@ -0,0 +1,734 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "./xmlbinaryfile.h"
+#include "./xmlfile.h"
+
+using namespace XmlGeomUtils;
+
+static const char kMagic[8] = { 'S', 'K', 'P', 'X', 'M', 'L', 'B', 0 };
+
+// Size of one record of each section
+static const size_t kRecordSizes[kXmlBinarySectionCount] = {
+  sizeof(uint32_t),            // kXmlBinaryStringOffsets
+  sizeof(char),                // kXmlBinaryStringData
+  sizeof(XmlBinaryLayer),      // kXmlBinaryLayers
+  sizeof(XmlBinaryMaterial),   // kXmlBinaryMaterials
+  sizeof(XmlBinaryDefinition), // kXmlBinaryDefinitions
+  sizeof(XmlBinaryEntities),   // kXmlBinaryEntities
+  sizeof(XmlBinaryInstance),   // kXmlBinaryInstances
+  sizeof(XmlBinaryGroup),      // kXmlBinaryGroups
+  sizeof(XmlBinaryFace),       // kXmlBinaryFaces
+  sizeof(XmlBinaryEdge),       // kXmlBinaryEdges
+  sizeof(XmlBinaryCurve),      // kXmlBinaryCurves
+  3 * sizeof(double),          // kXmlBinaryPositions
+  2 * sizeof(double),          // kXmlBinaryTextureCoords
+  sizeof(uint32_t)             // kXmlBinaryIndices
+};
+
+static bool IsLittleEndian() {
+  const uint32_t value = 1;
+  unsigned char first_byte = 0;
+  memcpy(&first_byte, &value, 1);
+  return first_byte == 1;
+}
+
+static uint32_t ToIndex(size_t value) {
+  return static_cast<uint32_t>(value);
+}
+
+static void SetColor(const SUColor& color, uint8_t* record) {
+  record[0] = color.red;
+  record[1] = color.green;
+  record[2] = color.blue;
+  record[3] = color.alpha;
+}
+
+static void GetColor(const uint8_t* record, SUColor& color) {
+  color.red = record[0];
+  color.green = record[1];
+  color.blue = record[2];
+  color.alpha = record[3];
+}
+
+static void SetPoint(const CPoint3d& point, double* record) {
+  record[0] = point.x();
+  record[1] = point.y();
+  record[2] = point.z();
+}
+
+//------------------------------------------------------------------------------
+
+// CXmlBinaryBuilder - Collects the sections of a new file in memory
+class CXmlBinaryBuilder {
+ public:
+  CXmlBinaryBuilder();
+
+  void AddModel(const XmlModelInfo& model_info);
+  bool Save(const std::string& filename) const;
+
+ private:
+  uint32_t AddString(const std::string& str);
+  // Adds the name of an info that may have been read with interned names
+  uint32_t AddName(uint32_t id, const std::string& name);
+  void SetMaterial(const XmlMaterialInfo& info, XmlBinaryMaterial& record);
+  uint32_t AddEntities(const XmlEntitiesInfo& entities);
+  void AddFace(const XmlFaceInfo& info);
+  void AddEdge(const XmlEdgeInfo& info);
+  void AddTextureCoord(const CPoint3d& coord);
+
+  // The records of a section, other than the string offsets
+  const void* GetSection(int section, size_t* count) const;
+
+ private:
+  // The names of the model being added
+  const CXmlNameTable* names_;
+  std::map<std::string, uint32_t> string_ids_;
+  std::vector<uint32_t> string_offsets_;
+  std::vector<char> string_data_;
+  std::vector<XmlBinaryLayer> layers_;
+  std::vector<XmlBinaryMaterial> materials_;
+  std::vector<XmlBinaryDefinition> definitions_;
+  std::vector<XmlBinaryEntities> entities_;
+  std::vector<XmlBinaryInstance> instances_;
+  std::vector<XmlBinaryGroup> groups_;
+  std::vector<XmlBinaryFace> faces_;
+  std::vector<XmlBinaryEdge> edges_;
+  std::vector<XmlBinaryCurve> curves_;
+  std::vector<double> positions_;
+  std::vector<double> texture_coords_;
+  std::vector<uint32_t> indices_;
+};
+
+CXmlBinaryBuilder::CXmlBinaryBuilder() : names_(NULL) {
+  // String 0 is the empty string
+  string_ids_[std::string()] = 0;
+  string_offsets_.push_back(0);
+  string_data_.push_back(0);
+}
+
+uint32_t CXmlBinaryBuilder::AddString(const std::string& str) {
+  std::pair<std::map<std::string, uint32_t>::iterator, bool> inserted =
+      string_ids_.insert(std::make_pair(str, ToIndex(string_offsets_.size())));
+  if (inserted.second) {
+    string_offsets_.push_back(ToIndex(string_data_.size()));
+    string_data_.insert(string_data_.end(), str.begin(), str.end());
+    string_data_.push_back(0);
+  }
+  return inserted.first->second;
+}
+
+uint32_t CXmlBinaryBuilder::AddName(uint32_t id, const std::string& name) {
+  return AddString(names_->Resolve(id, name));
+}
+
+void CXmlBinaryBuilder::SetMaterial(const XmlMaterialInfo& info,
+                                    XmlBinaryMaterial& record) {
+  record.name_ = AddString(info.name_);
+  record.flags_ = 0;
+  if (info.has_color_) {
+    record.flags_ |= XmlBinaryMaterial::kHasColor;
+    SetColor(info.color_, record.color_);
+  }
+  if (info.has_alpha_)
+    record.flags_ |= XmlBinaryMaterial::kHasAlpha;
+  record.alpha_ = info.alpha_;
+  if (info.has_texture_) {
+    record.flags_ |= XmlBinaryMaterial::kHasTexture;
+    record.texture_path_ = AddString(info.texture_path_);
+    record.texture_sscale_ = info.texture_sscale_;
+    record.texture_tscale_ = info.texture_tscale_;
+  }
+}
+
+void CXmlBinaryBuilder::AddModel(const XmlModelInfo& model_info) {
+  names_ = &model_info.names_;
+  for (size_t i = 0; i < model_info.layers_.size(); ++i) {
+    const XmlLayerInfo& info = model_info.layers_[i];
+    XmlBinaryLayer record = XmlBinaryLayer();
+    record.name_ = AddString(info.name_);
+    if (info.is_visible_)
+      record.flags_ |= XmlBinaryLayer::kIsVisible;
+    if (info.has_material_info_) {
+      record.flags_ |= XmlBinaryLayer::kHasMaterial;
+      SetMaterial(info.material_info_, record.material_);
+    }
+    layers_.push_back(record);
+  }
+
+  for (size_t i = 0; i < model_info.materials_.size(); ++i) {
+    XmlBinaryMaterial record = XmlBinaryMaterial();
+    SetMaterial(model_info.materials_[i], record);
+    materials_.push_back(record);
+  }
+
+  // The model's geometry goes first, so it is entities block 0
+  AddEntities(model_info.entities_);
+
+  for (size_t i = 0; i < model_info.definitions_.size(); ++i) {
+    const XmlComponentDefinitionInfo& info = model_info.definitions_[i];
+    XmlBinaryDefinition record = XmlBinaryDefinition();
+    record.name_ = AddString(info.name_);
+    record.entities_ = AddEntities(info.entities_);
+    definitions_.push_back(record);
+  }
+}
+
+uint32_t CXmlBinaryBuilder::AddEntities(const XmlEntitiesInfo& entities) {
+  const uint32_t index = ToIndex(entities_.size());
+  entities_.push_back(XmlBinaryEntities());
+  XmlBinaryEntities record = XmlBinaryEntities();
+
+  record.instances_.first_ = ToIndex(instances_.size());
+  record.instances_.count_ = ToIndex(entities.component_instances_.size());
+  for (size_t i = 0; i < entities.component_instances_.size(); ++i) {
+    const XmlComponentInstanceInfo& info = entities.component_instances_[i];
+    XmlBinaryInstance instance = XmlBinaryInstance();
+    instance.definition_name_ = AddName(info.definition_id_,
+                                        info.definition_name_);
+    instance.layer_name_ = AddName(info.layer_id_, info.layer_name_);
+    instance.material_name_ = AddName(info.material_id_, info.material_name_);
+    memcpy(instance.transform_, info.transform_.values,
+           sizeof(instance.transform_));
+    instances_.push_back(instance);
+  }
+
+  // The group records have to be contiguous, so their entities are added
+  // once this block is complete
+  record.groups_.first_ = ToIndex(groups_.size());
+  record.groups_.count_ = ToIndex(entities.groups_.size());
+  for (size_t i = 0; i < entities.groups_.size(); ++i) {
+    XmlBinaryGroup group = XmlBinaryGroup();
+    memcpy(group.transform_, entities.groups_[i].transform_.values,
+           sizeof(group.transform_));
+    groups_.push_back(group);
+  }
+
+  record.faces_.first_ = ToIndex(faces_.size());
+  record.faces_.count_ = ToIndex(entities.faces_.size() +
+                                 entities.face_store_.size());
+  for (size_t i = 0; i < entities.faces_.size(); ++i) {
+    AddFace(entities.faces_[i]);
+  }
+  XmlFaceInfo face_info;
+  for (CXmlFaceStore::const_iterator it = entities.face_store_.begin();
+       it != entities.face_store_.end(); ++it) {
+    it->GetFaceInfo(face_info);
+    AddFace(face_info);
+  }
+
+  record.edges_.first_ = ToIndex(edges_.size());
+  record.edges_.count_ = ToIndex(entities.edges_.size());
+  for (size_t i = 0; i < entities.edges_.size(); ++i) {
+    AddEdge(entities.edges_[i]);
+  }
+
+  // The edges of curves follow the block's own edges
+  record.curves_.first_ = ToIndex(curves_.size());
+  record.curves_.count_ = ToIndex(entities.curves_.size());
+  for (size_t i = 0; i < entities.curves_.size(); ++i) {
+    const XmlCurveInfo& info = entities.curves_[i];
+    XmlBinaryCurve curve = XmlBinaryCurve();
+    curve.edges_.first_ = ToIndex(edges_.size());
+    curve.edges_.count_ = ToIndex(info.edges_.size());
+    for (size_t j = 0; j < info.edges_.size(); ++j) {
+      AddEdge(info.edges_[j]);
+    }
+    curves_.push_back(curve);
+  }
+
+  for (size_t i = 0; i < entities.groups_.size(); ++i) {
+    const uint32_t group_entities = AddEntities(*entities.groups_[i].entities_);
+    groups_[record.groups_.first_ + i].entities_ = group_entities;
+  }
+
+  entities_[index] = record;
+  return index;
+}
+
+void CXmlBinaryBuilder::AddFace(const XmlFaceInfo& info) {
+  XmlBinaryFace record = XmlBinaryFace();
+  record.layer_name_ = AddName(info.layer_id_, info.layer_name_);
+  record.front_mat_name_ = AddName(info.front_mat_id_, info.front_mat_name_);
+  record.back_mat_name_ = AddName(info.back_mat_id_, info.back_mat_name_);
+  if (info.has_front_texture_)
+    record.flags_ |= XmlBinaryFace::kHasFrontTexture;
+  if (info.has_back_texture_)
+    record.flags_ |= XmlBinaryFace::kHasBackTexture;
+  if (info.has_single_loop_)
+    record.flags_ |= XmlBinaryFace::kHasSingleLoop;
+
+  const XmlArenaVector<XmlFaceVertex>& vertices = info.vertices_;
+  record.vertices_.first_ = ToIndex(positions_.size() / 3);
+  record.vertices_.count_ = ToIndex(vertices.size());
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    positions_.push_back(vertices[i].vertex_.x());
+    positions_.push_back(vertices[i].vertex_.y());
+    positions_.push_back(vertices[i].vertex_.z());
+  }
+  if (info.has_front_texture_) {
+    record.front_texture_coords_ = ToIndex(texture_coords_.size() / 2);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      AddTextureCoord(vertices[i].front_texture_coord_);
+    }
+  }
+  if (info.has_back_texture_) {
+    record.back_texture_coords_ = ToIndex(texture_coords_.size() / 2);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      AddTextureCoord(vertices[i].back_texture_coord_);
+    }
+  }
+
+  // Loops use their vertices in order
+  record.indices_.first_ = ToIndex(indices_.size());
+  if (!info.has_single_loop_) {
+    record.indices_.count_ = ToIndex(info.indices_.size());
+    indices_.insert(indices_.end(), info.indices_.begin(),
+                    info.indices_.end());
+  }
+  faces_.push_back(record);
+}
+
+void CXmlBinaryBuilder::AddTextureCoord(const CPoint3d& coord) {
+  texture_coords_.push_back(coord.x());
+  texture_coords_.push_back(coord.y());
+}
+
+void CXmlBinaryBuilder::AddEdge(const XmlEdgeInfo& info) {
+  XmlBinaryEdge record = XmlBinaryEdge();
+  if (info.has_layer_) {
+    record.flags_ |= XmlBinaryEdge::kHasLayer;
+    record.layer_name_ = AddName(info.layer_id_, info.layer_name_);
+  }
+  if (info.has_color_) {
+    record.flags_ |= XmlBinaryEdge::kHasColor;
+    SetColor(info.color_, record.color_);
+  }
+  SetPoint(info.start_, record.start_);
+  SetPoint(info.end_, record.end_);
+  edges_.push_back(record);
+}
+
+template <typename T>
+static const void* SectionData(const std::vector<T>& records) {
+  return records.empty() ? NULL : &records[0];
+}
+
+const void* CXmlBinaryBuilder::GetSection(int section, size_t* count) const {
+  switch (section) {
+    case kXmlBinaryStringData:
+      *count = string_data_.size();
+      return SectionData(string_data_);
+    case kXmlBinaryLayers:
+      *count = layers_.size();
+      return SectionData(layers_);
+    case kXmlBinaryMaterials:
+      *count = materials_.size();
+      return SectionData(materials_);
+    case kXmlBinaryDefinitions:
+      *count = definitions_.size();
+      return SectionData(definitions_);
+    case kXmlBinaryEntities:
+      *count = entities_.size();
+      return SectionData(entities_);
+    case kXmlBinaryInstances:
+      *count = instances_.size();
+      return SectionData(instances_);
+    case kXmlBinaryGroups:
+      *count = groups_.size();
+      return SectionData(groups_);
+    case kXmlBinaryFaces:
+      *count = faces_.size();
+      return SectionData(faces_);
+    case kXmlBinaryEdges:
+      *count = edges_.size();
+      return SectionData(edges_);
+    case kXmlBinaryCurves:
+      *count = curves_.size();
+      return SectionData(curves_);
+    case kXmlBinaryPositions:
+      *count = positions_.size() / 3;
+      return SectionData(positions_);
+    case kXmlBinaryTextureCoords:
+      *count = texture_coords_.size() / 2;
+      return SectionData(texture_coords_);
+    case kXmlBinaryIndices:
+      *count = indices_.size();
+      return SectionData(indices_);
+  }
+  *count = 0;
+  return NULL;
+}
+
+bool CXmlBinaryBuilder::Save(const std::string& filename) const {
+  // The string table needs its end offset, which isn't a string itself
+  std::vector<uint32_t> string_offsets(string_offsets_);
+  string_offsets.push_back(ToIndex(string_data_.size()));
+
+  XmlBinaryHeader header = XmlBinaryHeader();
+  memcpy(header.magic_, kMagic, sizeof(header.magic_));
+  header.version_ = CXmlBinaryFile::kVersion;
+  header.section_count_ = kXmlBinarySectionCount;
+
+  XmlBinarySection sections[kXmlBinarySectionCount];
+  const void* section_data[kXmlBinarySectionCount];
+  uint64_t offset = sizeof(header) + sizeof(sections);
+  for (int i = 0; i < kXmlBinarySectionCount; ++i) {
+    size_t count = 0;
+    if (i == kXmlBinaryStringOffsets) {
+      count = string_offsets.size();
+      section_data[i] = &string_offsets[0];
+    } else {
+      section_data[i] = GetSection(i, &count);
+    }
+    // Records refer to each other with 32 bit indices
+    if (count > 0xffffffff)
+      return false;
+    offset = (offset + 7) & ~static_cast<uint64_t>(7);
+    sections[i].offset_ = offset;
+    sections[i].count_ = count;
+    offset += count * kRecordSizes[i];
+  }
+
+  FILE* file = NULL;
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+  if (fopen_s(&file, filename.c_str(), "wb") != 0)
+    file = NULL;
+#else
+  file = fopen(filename.c_str(), "wb");
+#endif
+  if (file == NULL)
+    return false;
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(sections, sizeof(sections), 1, file) == 1;
+  uint64_t written = sizeof(header) + sizeof(sections);
+  for (int i = 0; ok && i < kXmlBinarySectionCount; ++i) {
+    static const char kPadding[8] = { 0 };
+    const size_t padding = static_cast<size_t>(sections[i].offset_ - written);
+    const size_t size = static_cast<size_t>(sections[i].count_) *
+                        kRecordSizes[i];
+    ok = fwrite(kPadding, 1, padding, file) == padding &&
+         (size == 0 || fwrite(section_data[i], 1, size, file) == size);
+    written = sections[i].offset_ + size;
+  }
+  ok = fclose(file) == 0 && ok;
+  if (!ok)
+    remove(filename.c_str());
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+
+CXmlBinaryFile::CXmlBinaryFile() {
+  Close();
+}
+
+CXmlBinaryFile::~CXmlBinaryFile() {
+  Close();
+}
+
+bool CXmlBinaryFile::Open(const std::string& filename) {
+  Close();
+
+  // The records are used as they are in the file
+  if (!IsLittleEndian() || !mapped_file_.Open(filename))
+    return false;
+
+  const char* data = mapped_file_.data();
+  const uint64_t size = mapped_file_.size();
+  XmlBinaryHeader header;
+  if (size < sizeof(header)) {
+    Close();
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  const uint64_t table_end = sizeof(header) +
+      static_cast<uint64_t>(header.section_count_) * sizeof(XmlBinarySection);
+  if (memcmp(header.magic_, kMagic, sizeof(kMagic)) != 0 ||
+      header.version_ != kVersion ||
+      header.section_count_ < kXmlBinarySectionCount ||
+      table_end > size) {
+    Close();
+    return false;
+  }
+
+  for (int i = 0; i < kXmlBinarySectionCount; ++i) {
+    XmlBinarySection section;
+    memcpy(&section, data + sizeof(header) + i * sizeof(section),
+           sizeof(section));
+    if (section.offset_ % 8 != 0 || section.offset_ > size ||
+        section.count_ > (size - section.offset_) / kRecordSizes[i]) {
+      Close();
+      return false;
+    }
+    sections_[i] = data + section.offset_;
+    counts_[i] = static_cast<size_t>(section.count_);
+  }
+  return true;
+}
+
+void CXmlBinaryFile::Close() {
+  mapped_file_.Close();
+  for (int i = 0; i < kXmlBinarySectionCount; ++i) {
+    sections_[i] = NULL;
+    counts_[i] = 0;
+  }
+}
+
+const char* CXmlBinaryFile::GetString(uint32_t id) const {
+  if (static_cast<size_t>(id) + 1 >= counts_[kXmlBinaryStringOffsets])
+    return NULL;
+  const uint32_t* offsets = static_cast<const uint32_t*>(
+      sections_[kXmlBinaryStringOffsets]);
+  const char* data = static_cast<const char*>(sections_[kXmlBinaryStringData]);
+  const size_t start = offsets[id];
+  const size_t end = offsets[id + 1];
+  if (start >= end || end > counts_[kXmlBinaryStringData] ||
+      data[end - 1] != 0)
+    return NULL;
+  return data + start;
+}
+
+bool CXmlBinaryFile::InRange(const XmlBinaryRange& range,
+                             XmlBinarySectionId section) const {
+  return static_cast<uint64_t>(range.first_) + range.count_ <=
+         counts_[section];
+}
+
+bool CXmlBinaryFile::ReadString(uint32_t id, std::string& str) const {
+  const char* value = GetString(id);
+  if (value == NULL)
+    return false;
+  str = value;
+  return true;
+}
+
+bool CXmlBinaryFile::ReadMaterial(const XmlBinaryMaterial& record,
+                                  XmlMaterialInfo& info) const {
+  info.has_color_ = (record.flags_ & XmlBinaryMaterial::kHasColor) != 0;
+  if (info.has_color_)
+    GetColor(record.color_, info.color_);
+  info.has_alpha_ = (record.flags_ & XmlBinaryMaterial::kHasAlpha) != 0;
+  info.alpha_ = record.alpha_;
+  info.has_texture_ = (record.flags_ & XmlBinaryMaterial::kHasTexture) != 0;
+  if (info.has_texture_) {
+    info.texture_sscale_ = record.texture_sscale_;
+    info.texture_tscale_ = record.texture_tscale_;
+    if (!ReadString(record.texture_path_, info.texture_path_))
+      return false;
+  }
+  return ReadString(record.name_, info.name_);
+}
+
+bool CXmlBinaryFile::ReadEntities(uint32_t index,
+                                  XmlEntitiesInfo& entities) const {
+  if (index >= counts_[kXmlBinaryEntities])
+    return false;
+  const XmlBinaryEntities& record = this->entities()[index];
+  if (!InRange(record.instances_, kXmlBinaryInstances) ||
+      !InRange(record.groups_, kXmlBinaryGroups) ||
+      !InRange(record.faces_, kXmlBinaryFaces) ||
+      !InRange(record.edges_, kXmlBinaryEdges) ||
+      !InRange(record.curves_, kXmlBinaryCurves))
+    return false;
+
+  entities.component_instances_.resize(record.instances_.count_);
+  for (uint32_t i = 0; i < record.instances_.count_; ++i) {
+    const XmlBinaryInstance& instance = instances()[record.instances_.first_ +
+                                                    i];
+    XmlComponentInstanceInfo& info = entities.component_instances_[i];
+    if (!ReadString(instance.definition_name_, info.definition_name_) ||
+        !ReadString(instance.layer_name_, info.layer_name_) ||
+        !ReadString(instance.material_name_, info.material_name_))
+      return false;
+    memcpy(info.transform_.values, instance.transform_,
+           sizeof(instance.transform_));
+  }
+
+  entities.groups_.resize(record.groups_.count_);
+  for (uint32_t i = 0; i < record.groups_.count_; ++i) {
+    const XmlBinaryGroup& group = groups()[record.groups_.first_ + i];
+    XmlGroupInfo& info = entities.groups_[i];
+    // Blocks only contain blocks written after them, so this terminates
+    if (group.entities_ <= index ||
+        !ReadEntities(group.entities_, *info.entities_))
+      return false;
+    memcpy(info.transform_.values, group.transform_,
+           sizeof(group.transform_));
+  }
+
+  entities.faces_.resize(record.faces_.count_);
+  for (uint32_t i = 0; i < record.faces_.count_; ++i) {
+    if (!ReadFace(faces()[record.faces_.first_ + i], entities.faces_[i]))
+      return false;
+  }
+
+  entities.edges_.resize(record.edges_.count_);
+  for (uint32_t i = 0; i < record.edges_.count_; ++i) {
+    if (!ReadEdge(edges()[record.edges_.first_ + i], entities.edges_[i]))
+      return false;
+  }
+
+  entities.curves_.resize(record.curves_.count_);
+  for (uint32_t i = 0; i < record.curves_.count_; ++i) {
+    const XmlBinaryCurve& curve = curves()[record.curves_.first_ + i];
+    if (!InRange(curve.edges_, kXmlBinaryEdges))
+      return false;
+    XmlCurveInfo& info = entities.curves_[i];
+    info.edges_.resize(curve.edges_.count_);
+    for (uint32_t j = 0; j < curve.edges_.count_; ++j) {
+      if (!ReadEdge(edges()[curve.edges_.first_ + j], info.edges_[j]))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool CXmlBinaryFile::ReadFace(const XmlBinaryFace& record,
+                              XmlFaceInfo& info) const {
+  if (!ReadString(record.layer_name_, info.layer_name_) ||
+      !ReadString(record.front_mat_name_, info.front_mat_name_) ||
+      !ReadString(record.back_mat_name_, info.back_mat_name_))
+    return false;
+  info.has_front_texture_ =
+      (record.flags_ & XmlBinaryFace::kHasFrontTexture) != 0;
+  info.has_back_texture_ =
+      (record.flags_ & XmlBinaryFace::kHasBackTexture) != 0;
+  info.has_single_loop_ = (record.flags_ & XmlBinaryFace::kHasSingleLoop) != 0;
+
+  const uint32_t vertex_count = record.vertices_.count_;
+  XmlBinaryRange front_range = { record.front_texture_coords_, vertex_count };
+  XmlBinaryRange back_range = { record.back_texture_coords_, vertex_count };
+  if (!InRange(record.vertices_, kXmlBinaryPositions) ||
+      !InRange(record.indices_, kXmlBinaryIndices) ||
+      (info.has_front_texture_ &&
+       !InRange(front_range, kXmlBinaryTextureCoords)) ||
+      (info.has_back_texture_ &&
+       !InRange(back_range, kXmlBinaryTextureCoords)) ||
+      (info.has_single_loop_ && record.indices_.count_ != 0) ||
+      (!info.has_single_loop_ && record.indices_.count_ % 3 != 0))
+    return false;
+
+  const double* points = positions() + record.vertices_.first_ * 3;
+  const double* front_coords = texture_coords() + front_range.first_ * 2;
+  const double* back_coords = texture_coords() + back_range.first_ * 2;
+  info.vertices_.resize(vertex_count);
+  for (size_t i = 0; i < vertex_count; ++i) {
+    XmlFaceVertex& vertex = info.vertices_[i];
+    vertex.vertex_.SetLocation(points[i * 3], points[i * 3 + 1],
+                               points[i * 3 + 2]);
+    if (info.has_front_texture_) {
+      vertex.front_texture_coord_.SetLocation(front_coords[i * 2],
+                                              front_coords[i * 2 + 1], 0);
+    }
+    if (info.has_back_texture_) {
+      vertex.back_texture_coord_.SetLocation(back_coords[i * 2],
+                                             back_coords[i * 2 + 1], 0);
+    }
+  }
+
+  const uint32_t* face_indices = indices() + record.indices_.first_;
+  info.indices_.assign(face_indices, face_indices + record.indices_.count_);
+  for (size_t i = 0; i < info.indices_.size(); ++i) {
+    if (info.indices_[i] >= vertex_count)
+      return false;
+  }
+  return true;
+}
+
+bool CXmlBinaryFile::ReadEdge(const XmlBinaryEdge& record,
+                              XmlEdgeInfo& info) const {
+  info.has_layer_ = (record.flags_ & XmlBinaryEdge::kHasLayer) != 0;
+  if (info.has_layer_ && !ReadString(record.layer_name_, info.layer_name_))
+    return false;
+  info.has_color_ = (record.flags_ & XmlBinaryEdge::kHasColor) != 0;
+  if (info.has_color_)
+    GetColor(record.color_, info.color_);
+  info.start_.SetLocation(record.start_[0], record.start_[1],
+                          record.start_[2]);
+  info.end_.SetLocation(record.end_[0], record.end_[1], record.end_[2]);
+  return true;
+}
+
+bool CXmlBinaryFile::GetModelInfo(XmlModelInfo& model_info) const {
+  // Clear out the given model info
+  model_info = XmlModelInfo();
+  if (!IsOpen() || counts_[kXmlBinaryEntities] == 0)
+    return false;
+
+  model_info.layers_.resize(counts_[kXmlBinaryLayers]);
+  for (size_t i = 0; i < model_info.layers_.size(); ++i) {
+    const XmlBinaryLayer& record = layers()[i];
+    XmlLayerInfo& info = model_info.layers_[i];
+    if (!ReadString(record.name_, info.name_))
+      return false;
+    info.is_visible_ = (record.flags_ & XmlBinaryLayer::kIsVisible) != 0;
+    info.has_material_info_ =
+        (record.flags_ & XmlBinaryLayer::kHasMaterial) != 0;
+    if (info.has_material_info_ &&
+        !ReadMaterial(record.material_, info.material_info_))
+      return false;
+  }
+
+  model_info.materials_.resize(counts_[kXmlBinaryMaterials]);
+  for (size_t i = 0; i < model_info.materials_.size(); ++i) {
+    if (!ReadMaterial(materials()[i], model_info.materials_[i]))
+      return false;
+  }
+
+  model_info.definitions_.resize(counts_[kXmlBinaryDefinitions]);
+  for (size_t i = 0; i < model_info.definitions_.size(); ++i) {
+    const XmlBinaryDefinition& record = definitions()[i];
+    XmlComponentDefinitionInfo& info = model_info.definitions_[i];
+    if (!ReadString(record.name_, info.name_) || record.entities_ == 0 ||
+        !ReadEntities(record.entities_, info.entities_))
+      return false;
+  }
+
+  return ReadEntities(0, model_info.entities_);
+}
+
+bool CXmlBinaryFile::Write(const std::string& filename,
+                           const XmlModelInfo& model_info) {
+  if (!IsLittleEndian())
+    return false;
+  CXmlBinaryBuilder builder;
+  builder.AddModel(model_info);
+  return builder.Save(filename);
+}
+
+//------------------------------------------------------------------------------
+
+bool ConvertXmlToBinary(const std::string& xml_filename,
+                        const std::string& binary_filename) {
+  CXmlFile file;
+  // Each name is only copied once into the string table that way
+  file.set_intern_names(true);
+  XmlModelInfo model_info;
+  bool ok = file.Open(xml_filename, false, CXmlFile::kReadMapped) &&
+            file.GetModelInfo(model_info);
+  file.Close(false);
+  return ok && CXmlBinaryFile::Write(binary_filename, model_info);
+}
+
+bool ConvertBinaryToXml(const std::string& binary_filename,
+                        const std::string& xml_filename) {
+  CXmlBinaryFile binary_file;
+  XmlModelInfo model_info;
+  if (!binary_file.Open(binary_filename) ||
+      !binary_file.GetModelInfo(model_info))
+    return false;
+  binary_file.Close();
+
+  CXmlFile file;
+  if (!file.Open(xml_filename, CXmlFile::kWriteStreaming))
+    return false;
+  file.WriteHeader(0, 0, 0);
+  file.WriteModelInfo(model_info);
+  return file.Close(false);
+}
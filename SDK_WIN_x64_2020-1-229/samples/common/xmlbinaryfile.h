@@ -0,0 +1,292 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLBINARYFILE_H
+#define SKPTOXML_COMMON_XMLBINARYFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "./xmlmappedfile.h"
+
+struct XmlMaterialInfo;
+struct XmlFaceInfo;
+struct XmlEdgeInfo;
+struct XmlEntitiesInfo;
+struct XmlModelInfo;
+
+// The binary companion format of the XML files. It holds the same
+// information as XmlModelInfo, laid out so that a memory mapped file can be
+// used in place: every record has a fixed size, records refer to each other
+// by index, and vertex data lives in flat arrays.
+//
+// All numbers are little-endian. The file starts with an XmlBinaryHeader,
+// followed by one XmlBinarySection per XmlBinarySectionId that gives the
+// offset and record count of the section. Sections start on 8 byte
+// boundaries.
+//
+// Strings are stored once in a string table and referred to by ID. ID 0 is
+// the empty string, which also stands for "no name". Entities block 0 holds
+// the model's geometry; groups and definitions refer to the blocks holding
+// their entities.
+
+enum XmlBinarySectionId {
+  kXmlBinaryStringOffsets,  // uint32_t per string, plus the end offset
+  kXmlBinaryStringData,     // char, each string null terminated
+  kXmlBinaryLayers,         // XmlBinaryLayer
+  kXmlBinaryMaterials,      // XmlBinaryMaterial
+  kXmlBinaryDefinitions,    // XmlBinaryDefinition
+  kXmlBinaryEntities,       // XmlBinaryEntities
+  kXmlBinaryInstances,      // XmlBinaryInstance
+  kXmlBinaryGroups,         // XmlBinaryGroup
+  kXmlBinaryFaces,          // XmlBinaryFace
+  kXmlBinaryEdges,          // XmlBinaryEdge
+  kXmlBinaryCurves,         // XmlBinaryCurve
+  kXmlBinaryPositions,      // double x, y, z per vertex
+  kXmlBinaryTextureCoords,  // double u, v per vertex
+  kXmlBinaryIndices,        // uint32_t per triangle corner
+  kXmlBinarySectionCount
+};
+
+struct XmlBinaryHeader {
+  char magic_[8];
+  uint32_t version_;
+  uint32_t section_count_;
+};
+
+struct XmlBinarySection {
+  uint64_t offset_;
+  uint64_t count_;
+};
+
+// A run of records in another section
+struct XmlBinaryRange {
+  uint32_t first_;
+  uint32_t count_;
+};
+
+struct XmlBinaryMaterial {
+  enum {
+    kHasColor = 1,
+    kHasAlpha = 2,
+    kHasTexture = 4
+  };
+
+  uint32_t name_;
+  uint32_t flags_;
+  uint8_t color_[4];  // red, green, blue, alpha
+  uint32_t texture_path_;
+  double alpha_;
+  double texture_sscale_;
+  double texture_tscale_;
+};
+
+struct XmlBinaryLayer {
+  enum {
+    kIsVisible = 1,
+    kHasMaterial = 2
+  };
+
+  uint32_t name_;
+  uint32_t flags_;
+  XmlBinaryMaterial material_;
+};
+
+struct XmlBinaryDefinition {
+  uint32_t name_;
+  uint32_t entities_;
+};
+
+struct XmlBinaryEntities {
+  XmlBinaryRange instances_;
+  XmlBinaryRange groups_;
+  XmlBinaryRange faces_;
+  XmlBinaryRange edges_;
+  XmlBinaryRange curves_;
+};
+
+struct XmlBinaryInstance {
+  uint32_t definition_name_;
+  uint32_t layer_name_;
+  uint32_t material_name_;
+  uint32_t reserved_;
+  double transform_[16];
+};
+
+struct XmlBinaryGroup {
+  uint32_t entities_;
+  uint32_t reserved_;
+  double transform_[16];
+};
+
+// The vertices of a face are a range of positions. Textured sides have as
+// many texture coordinates, starting at front/back_texture_coords_. A loop
+// uses its vertices in order; triangles list three vertex numbers (relative
+// to the first vertex) per triangle in indices_.
+struct XmlBinaryFace {
+  enum {
+    kHasFrontTexture = 1,
+    kHasBackTexture = 2,
+    kHasSingleLoop = 4
+  };
+
+  uint32_t layer_name_;
+  uint32_t front_mat_name_;
+  uint32_t back_mat_name_;
+  uint32_t flags_;
+  XmlBinaryRange vertices_;
+  uint32_t front_texture_coords_;
+  uint32_t back_texture_coords_;
+  XmlBinaryRange indices_;
+};
+
+struct XmlBinaryEdge {
+  enum {
+    kHasLayer = 1,
+    kHasColor = 2
+  };
+
+  uint32_t layer_name_;
+  uint32_t flags_;
+  uint8_t color_[4];
+  uint32_t reserved_;
+  double start_[3];
+  double end_[3];
+};
+
+struct XmlBinaryCurve {
+  XmlBinaryRange edges_;
+};
+
+// The records are the file format, so their layout mustn't change with the
+// compiler's padding rules
+static_assert(sizeof(XmlBinaryHeader) == 16 &&
+              offsetof(XmlBinaryHeader, version_) == 8,
+              "XmlBinaryHeader layout");
+static_assert(sizeof(XmlBinarySection) == 16, "XmlBinarySection layout");
+static_assert(sizeof(XmlBinaryRange) == 8, "XmlBinaryRange layout");
+static_assert(sizeof(XmlBinaryMaterial) == 40 &&
+              offsetof(XmlBinaryMaterial, texture_path_) == 12 &&
+              offsetof(XmlBinaryMaterial, alpha_) == 16,
+              "XmlBinaryMaterial layout");
+static_assert(sizeof(XmlBinaryLayer) == 48 &&
+              offsetof(XmlBinaryLayer, material_) == 8,
+              "XmlBinaryLayer layout");
+static_assert(sizeof(XmlBinaryDefinition) == 8, "XmlBinaryDefinition layout");
+static_assert(sizeof(XmlBinaryEntities) == 40 &&
+              offsetof(XmlBinaryEntities, curves_) == 32,
+              "XmlBinaryEntities layout");
+static_assert(sizeof(XmlBinaryInstance) == 144 &&
+              offsetof(XmlBinaryInstance, transform_) == 16,
+              "XmlBinaryInstance layout");
+static_assert(sizeof(XmlBinaryGroup) == 136 &&
+              offsetof(XmlBinaryGroup, transform_) == 8,
+              "XmlBinaryGroup layout");
+static_assert(sizeof(XmlBinaryFace) == 40 &&
+              offsetof(XmlBinaryFace, vertices_) == 16 &&
+              offsetof(XmlBinaryFace, indices_) == 32,
+              "XmlBinaryFace layout");
+static_assert(sizeof(XmlBinaryEdge) == 64 &&
+              offsetof(XmlBinaryEdge, start_) == 16 &&
+              offsetof(XmlBinaryEdge, end_) == 40,
+              "XmlBinaryEdge layout");
+static_assert(sizeof(XmlBinaryCurve) == 8, "XmlBinaryCurve layout");
+
+// CXmlBinaryFile - Reads and writes the binary format. An opened file is
+// mapped read-only; the section accessors point straight into the mapping.
+// Open only checks the header and the section table, so indices read from
+// the records must be range checked by the caller. GetModelInfo does that.
+class CXmlBinaryFile {
+ public:
+  enum { kVersion = 1 };
+
+  CXmlBinaryFile();
+  ~CXmlBinaryFile();
+
+  bool Open(const std::string& filename);
+  void Close();
+  bool IsOpen() const { return mapped_file_.IsOpen(); }
+
+  // Converts the file into XmlModelInfo
+  bool GetModelInfo(XmlModelInfo& model_info) const;
+
+  // Writes a model info as a new file
+  static bool Write(const std::string& filename,
+                    const XmlModelInfo& model_info);
+
+  // Number of records in a section of the opened file
+  size_t GetCount(XmlBinarySectionId section) const {
+    return counts_[section];
+  }
+  // Returns the string with the given ID, or NULL if there is none
+  const char* GetString(uint32_t id) const;
+
+  const XmlBinaryLayer* layers() const {
+    return static_cast<const XmlBinaryLayer*>(sections_[kXmlBinaryLayers]);
+  }
+  const XmlBinaryMaterial* materials() const {
+    return static_cast<const XmlBinaryMaterial*>(
+        sections_[kXmlBinaryMaterials]);
+  }
+  const XmlBinaryDefinition* definitions() const {
+    return static_cast<const XmlBinaryDefinition*>(
+        sections_[kXmlBinaryDefinitions]);
+  }
+  const XmlBinaryEntities* entities() const {
+    return static_cast<const XmlBinaryEntities*>(
+        sections_[kXmlBinaryEntities]);
+  }
+  const XmlBinaryInstance* instances() const {
+    return static_cast<const XmlBinaryInstance*>(
+        sections_[kXmlBinaryInstances]);
+  }
+  const XmlBinaryGroup* groups() const {
+    return static_cast<const XmlBinaryGroup*>(sections_[kXmlBinaryGroups]);
+  }
+  const XmlBinaryFace* faces() const {
+    return static_cast<const XmlBinaryFace*>(sections_[kXmlBinaryFaces]);
+  }
+  const XmlBinaryEdge* edges() const {
+    return static_cast<const XmlBinaryEdge*>(sections_[kXmlBinaryEdges]);
+  }
+  const XmlBinaryCurve* curves() const {
+    return static_cast<const XmlBinaryCurve*>(sections_[kXmlBinaryCurves]);
+  }
+  const double* positions() const {
+    return static_cast<const double*>(sections_[kXmlBinaryPositions]);
+  }
+  const double* texture_coords() const {
+    return static_cast<const double*>(sections_[kXmlBinaryTextureCoords]);
+  }
+  const uint32_t* indices() const {
+    return static_cast<const uint32_t*>(sections_[kXmlBinaryIndices]);
+  }
+
+ private:
+  // Not copyable
+  CXmlBinaryFile(const CXmlBinaryFile&);
+  CXmlBinaryFile& operator=(const CXmlBinaryFile&);
+
+  bool InRange(const XmlBinaryRange& range, XmlBinarySectionId section) const;
+  bool ReadString(uint32_t id, std::string& str) const;
+  bool ReadMaterial(const XmlBinaryMaterial& record,
+                    XmlMaterialInfo& info) const;
+  bool ReadEntities(uint32_t index, XmlEntitiesInfo& entities) const;
+  bool ReadFace(const XmlBinaryFace& record, XmlFaceInfo& info) const;
+  bool ReadEdge(const XmlBinaryEdge& record, XmlEdgeInfo& info) const;
+
+ private:
+  CXmlMappedFile mapped_file_;
+  const void* sections_[kXmlBinarySectionCount];
+  size_t counts_[kXmlBinarySectionCount];
+};
+
+// Converters between the two formats. The XML is written with the latest
+// xml version, and without a SketchUp version since the binary format
+// doesn't keep one.
+bool ConvertXmlToBinary(const std::string& xml_filename,
+                        const std::string& binary_filename);
+bool ConvertBinaryToXml(const std::string& binary_filename,
+                        const std::string& xml_filename);
+
+#endif // SKPTOXML_COMMON_XMLBINARYFILE_H
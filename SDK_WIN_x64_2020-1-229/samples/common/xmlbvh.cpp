@@ -0,0 +1,1060 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmlbvh.h"
+
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+#include "./xmlfile.h"
+#include "./xmlparallel.h"
+
+using XmlGeomUtils::CPoint3d;
+using XmlGeomUtils::CTransform;
+using XmlGeomUtils::CVector3d;
+
+// Centroids are sorted into this many bins along each axis to find a split
+static const int kBins = 16;
+// Ranges up to this size become leaves when splitting doesn't pay off
+static const uint32_t kMaxLeafSize = 8;
+// Ranges this large are split on the calling thread before the rest of the
+// tree is built on several
+static const uint32_t kParallelGrain = 1 << 16;
+
+static const double kInfinity = std::numeric_limits<double>::infinity();
+
+//------------------------------------------------------------------------------
+// Vectors are kept as 3 doubles here, which the meshes store packed.
+
+static void Subtract(const double* a, const double* b, double* out) {
+  out[0] = a[0] - b[0];
+  out[1] = a[1] - b[1];
+  out[2] = a[2] - b[2];
+}
+
+static double Dot(const double* a, const double* b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void Cross(const double* a, const double* b, double* out) {
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static double DistanceSquared(const double* a, const double* b) {
+  double d[3];
+  Subtract(a, b, d);
+  return Dot(d, d);
+}
+
+static XmlBvhBox EmptyBox() {
+  XmlBvhBox box;
+  for (int i = 0; i < 3; ++i) {
+    box.min_[i] = kInfinity;
+    box.max_[i] = -kInfinity;
+  }
+  return box;
+}
+
+static bool IsEmpty(const XmlBvhBox& box) {
+  return box.min_[0] > box.max_[0];
+}
+
+static void Grow(XmlBvhBox& box, const double* point) {
+  for (int i = 0; i < 3; ++i) {
+    box.min_[i] = std::min(box.min_[i], point[i]);
+    box.max_[i] = std::max(box.max_[i], point[i]);
+  }
+}
+
+static void Grow(XmlBvhBox& box, const XmlBvhBox& other) {
+  for (int i = 0; i < 3; ++i) {
+    box.min_[i] = std::min(box.min_[i], other.min_[i]);
+    box.max_[i] = std::max(box.max_[i], other.max_[i]);
+  }
+}
+
+// Half the surface area, which is all the heuristic needs
+static double HalfArea(const XmlBvhBox& box) {
+  if (IsEmpty(box))
+    return 0.0;
+  const double x = box.max_[0] - box.min_[0];
+  const double y = box.max_[1] - box.min_[1];
+  const double z = box.max_[2] - box.min_[2];
+  return x * y + y * z + z * x;
+}
+
+static bool Overlaps(const XmlBvhBox& a, const XmlBvhBox& b) {
+  for (int i = 0; i < 3; ++i) {
+    if (a.min_[i] > b.max_[i] || a.max_[i] < b.min_[i])
+      return false;
+  }
+  return true;
+}
+
+static double DistanceSquared(const double* point, const XmlBvhBox& box) {
+  double sum = 0.0;
+  for (int i = 0; i < 3; ++i) {
+    const double d = std::max(std::max(box.min_[i] - point[i], 0.0),
+                              point[i] - box.max_[i]);
+    sum += d * d;
+  }
+  return sum;
+}
+
+// The box around 'box' once transformed
+static XmlBvhBox TransformBox(const CTransform& transform,
+                              const XmlBvhBox& box) {
+  if (IsEmpty(box))
+    return box;
+  const double* m = transform.values();
+  double center[3];
+  double extent[3];
+  for (int i = 0; i < 3; ++i) {
+    center[i] = (box.min_[i] + box.max_[i]) * 0.5;
+    extent[i] = (box.max_[i] - box.min_[i]) * 0.5;
+  }
+  double world_center[3];
+  transform.TransformPoints(center, 1, world_center);
+  XmlBvhBox result;
+  for (int i = 0; i < 3; ++i) {
+    const double e = fabs(m[i]) * extent[0] + fabs(m[4 + i]) * extent[1] +
+                     fabs(m[8 + i]) * extent[2];
+    result.min_[i] = world_center[i] - e;
+    result.max_[i] = world_center[i] + e;
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+// CXmlBvhBuilder - Builds a hierarchy over boxes by the surface area
+// heuristic. The largest ranges are split on the calling thread until there
+// are enough to go round, then each is built into a node array of its own
+// on a thread of its own, and the arrays are joined.
+class CXmlBvhBuilder {
+ public:
+  explicit CXmlBvhBuilder(const std::vector<XmlBvhBox>& boxes);
+
+  void Build(unsigned threads, std::vector<XmlBvhNode>& nodes,
+             std::vector<uint32_t>& order);
+
+ private:
+  struct Task {
+    uint32_t node_;
+    uint32_t begin_;
+    uint32_t end_;
+  };
+
+  // Sets 'node' to the bounds of [begin, end) of order_, and returns true
+  // with the range partitioned at 'middle' if it should be split. Otherwise
+  // 'node' is made a leaf.
+  bool Split(uint32_t begin, uint32_t end, XmlBvhNode& node,
+             uint32_t& middle);
+  // Appends the tree over [begin, end) to 'nodes', with its root first
+  void BuildSubtree(uint32_t begin, uint32_t end,
+                    std::vector<XmlBvhNode>& nodes);
+
+ private:
+  const std::vector<XmlBvhBox>& boxes_;
+  std::vector<double> centroids_;  // x y z per box
+  std::vector<uint32_t> order_;
+};
+
+CXmlBvhBuilder::CXmlBvhBuilder(const std::vector<XmlBvhBox>& boxes)
+  : boxes_(boxes), centroids_(boxes.size() * 3) {
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      centroids_[i * 3 + j] = (boxes[i].min_[j] + boxes[i].max_[j]) * 0.5;
+    }
+  }
+}
+
+void CXmlBvhBuilder::Build(unsigned threads, std::vector<XmlBvhNode>& nodes,
+                           std::vector<uint32_t>& order) {
+  nodes.clear();
+  order_.resize(boxes_.size());
+  for (size_t i = 0; i < order_.size(); ++i) {
+    order_[i] = static_cast<uint32_t>(i);
+  }
+  if (order_.empty()) {
+    order.clear();
+    return;
+  }
+
+  nodes.push_back(XmlBvhNode());
+  Task root = { 0, 0, static_cast<uint32_t>(order_.size()) };
+  std::vector<Task> tasks(1, root);
+  const size_t thread_count = XmlParallel::ThreadCount(threads);
+  while (thread_count > 1 && !tasks.empty() &&
+         tasks.size() < thread_count * 4) {
+    size_t largest = 0;
+    for (size_t i = 1; i < tasks.size(); ++i) {
+      if (tasks[i].end_ - tasks[i].begin_ >
+          tasks[largest].end_ - tasks[largest].begin_)
+        largest = i;
+    }
+    const Task task = tasks[largest];
+    if (task.end_ - task.begin_ < kParallelGrain)
+      break;
+    tasks[largest] = tasks.back();
+    tasks.pop_back();
+    XmlBvhNode node;
+    uint32_t middle = 0;
+    if (Split(task.begin_, task.end_, node, middle)) {
+      node.first_ = static_cast<uint32_t>(nodes.size());
+      node.count_ = 0;
+      nodes.resize(nodes.size() + 2);
+      Task left = { node.first_, task.begin_, middle };
+      Task right = { node.first_ + 1, middle, task.end_ };
+      tasks.push_back(left);
+      tasks.push_back(right);
+    }
+    nodes[task.node_] = node;
+  }
+
+  std::vector<std::vector<XmlBvhNode> > subtrees(tasks.size());
+  XmlParallel::For(tasks.size(), threads, [&](size_t i, unsigned /*thread*/) {
+    BuildSubtree(tasks[i].begin_, tasks[i].end_, subtrees[i]);
+  });
+
+  // A subtree's root takes the place of its task's node, and the other
+  // nodes move up by the size of the nodes before them
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    std::vector<XmlBvhNode>& subtree = subtrees[i];
+    const uint32_t offset = static_cast<uint32_t>(nodes.size()) - 1;
+    for (size_t j = 0; j < subtree.size(); ++j) {
+      if (subtree[j].count_ == 0)
+        subtree[j].first_ += offset;
+    }
+    nodes[tasks[i].node_] = subtree[0];
+    nodes.insert(nodes.end(), subtree.begin() + 1, subtree.end());
+    std::vector<XmlBvhNode>().swap(subtree);
+  }
+  order.swap(order_);
+}
+
+bool CXmlBvhBuilder::Split(uint32_t begin, uint32_t end, XmlBvhNode& node,
+                           uint32_t& middle) {
+  XmlBvhBox centroid_box = EmptyBox();
+  node.box_ = EmptyBox();
+  for (uint32_t i = begin; i < end; ++i) {
+    Grow(node.box_, boxes_[order_[i]]);
+    Grow(centroid_box, &centroids_[order_[i] * 3]);
+  }
+  node.first_ = begin;
+  node.count_ = end - begin;
+  const uint32_t count = end - begin;
+  if (count <= 1)
+    return false;
+
+  double best_cost = kInfinity;
+  int best_axis = -1;
+  int best_bin = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    const double low = centroid_box.min_[axis];
+    const double extent = centroid_box.max_[axis] - low;
+    if (!(extent > 0.0))
+      continue;
+    const double scale = kBins / extent;
+    uint32_t counts[kBins] = {};
+    XmlBvhBox boxes[kBins];
+    for (int b = 0; b < kBins; ++b) {
+      boxes[b] = EmptyBox();
+    }
+    for (uint32_t i = begin; i < end; ++i) {
+      const uint32_t ref = order_[i];
+      const int b = std::min(
+          static_cast<int>((centroids_[ref * 3 + axis] - low) * scale),
+          kBins - 1);
+      ++counts[b];
+      Grow(boxes[b], boxes_[ref]);
+    }
+    // The cost of splitting after each bin, by area times count on either
+    // side
+    double right_costs[kBins];
+    XmlBvhBox right = EmptyBox();
+    uint32_t right_count = 0;
+    for (int b = kBins - 1; b > 0; --b) {
+      Grow(right, boxes[b]);
+      right_count += counts[b];
+      right_costs[b] = HalfArea(right) * right_count;
+    }
+    XmlBvhBox left = EmptyBox();
+    uint32_t left_count = 0;
+    for (int b = 0; b + 1 < kBins; ++b) {
+      Grow(left, boxes[b]);
+      left_count += counts[b];
+      const double cost = HalfArea(left) * left_count + right_costs[b + 1];
+      if (left_count > 0 && left_count < count && cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin = b;
+      }
+    }
+  }
+
+  if (best_axis >= 0) {
+    // Against a traversal step costing as much as testing one primitive
+    const double area = HalfArea(node.box_);
+    if (area > 0.0 && 1.0 + best_cost / area >= count &&
+        count <= kMaxLeafSize)
+      return false;
+    const double low = centroid_box.min_[best_axis];
+    const double scale =
+        kBins / (centroid_box.max_[best_axis] - centroid_box.min_[best_axis]);
+    const std::vector<double>& centroids = centroids_;
+    const int axis = best_axis;
+    const int bin = best_bin;
+    middle = static_cast<uint32_t>(
+        std::partition(order_.begin() + begin, order_.begin() + end,
+                       [&](uint32_t ref) {
+          return std::min(static_cast<int>(
+                              (centroids[ref * 3 + axis] - low) * scale),
+                          kBins - 1) <= bin;
+        }) - order_.begin());
+    if (middle > begin && middle < end)
+      return true;
+  }
+  // The centroids can't be told apart, so halve the range if a leaf would
+  // be too large
+  if (count <= kMaxLeafSize)
+    return false;
+  middle = begin + count / 2;
+  return true;
+}
+
+void CXmlBvhBuilder::BuildSubtree(uint32_t begin, uint32_t end,
+                                  std::vector<XmlBvhNode>& nodes) {
+  nodes.push_back(XmlBvhNode());
+  Task root = { 0, begin, end };
+  std::vector<Task> stack(1, root);
+  while (!stack.empty()) {
+    const Task task = stack.back();
+    stack.pop_back();
+    XmlBvhNode node;
+    uint32_t middle = 0;
+    if (Split(task.begin_, task.end_, node, middle)) {
+      node.first_ = static_cast<uint32_t>(nodes.size());
+      node.count_ = 0;
+      nodes.resize(nodes.size() + 2);
+      Task left = { node.first_, task.begin_, middle };
+      Task right = { node.first_ + 1, middle, task.end_ };
+      stack.push_back(right);
+      stack.push_back(left);
+    }
+    nodes[task.node_] = node;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+static void AddTriangles(const double* points, size_t count,
+                         bool has_single_loop, const uint32_t* indices,
+                         size_t index_count, uint32_t face,
+                         XmlBvhMesh& mesh, std::vector<uint32_t>& corners) {
+  if (count < 3)
+    return;
+  const uint32_t first = static_cast<uint32_t>(mesh.positions_.size() / 3);
+  mesh.positions_.insert(mesh.positions_.end(), points, points + count * 3);
+  corners.clear();
+  if (has_single_loop) {
+    XmlGeomUtils::TriangulatePolygon(points, count, corners);
+  } else {
+    for (size_t i = 0; i + 2 < index_count; i += 3) {
+      if (indices[i] < count && indices[i + 1] < count &&
+          indices[i + 2] < count)
+        corners.insert(corners.end(), indices + i, indices + i + 3);
+    }
+  }
+  for (size_t i = 0; i < corners.size(); ++i) {
+    mesh.triangles_.push_back(first + corners[i]);
+  }
+  mesh.triangle_faces_.insert(mesh.triangle_faces_.end(), corners.size() / 3,
+                              face);
+}
+
+static void AddEdge(const XmlEdgeInfo& edge, XmlBvhMesh& mesh) {
+  const double points[6] = {
+    edge.start_.x(), edge.start_.y(), edge.start_.z(),
+    edge.end_.x(), edge.end_.y(), edge.end_.z()
+  };
+  mesh.edges_.insert(mesh.edges_.end(), points, points + 6);
+}
+
+static void FillMesh(const XmlEntitiesInfo& entities, XmlBvhMesh& mesh) {
+  std::vector<double> points;
+  std::vector<uint32_t> corners;
+  uint32_t face = 0;
+  for (size_t i = 0; i < entities.faces_.size(); ++i, ++face) {
+    const XmlFaceInfo& info = entities.faces_[i];
+    const size_t count = info.vertices_.size();
+    points.resize(count * 3);
+    for (size_t j = 0; j < count; ++j) {
+      points[j * 3] = info.vertices_[j].vertex_.x();
+      points[j * 3 + 1] = info.vertices_[j].vertex_.y();
+      points[j * 3 + 2] = info.vertices_[j].vertex_.z();
+    }
+    AddTriangles(points.empty() ? NULL : &points[0], count,
+                 info.has_single_loop_,
+                 info.indices_.empty() ? NULL : &info.indices_[0],
+                 info.indices_.size(), face, mesh, corners);
+  }
+  for (CXmlFaceStore::const_iterator it = entities.face_store_.begin();
+       it != entities.face_store_.end(); ++it, ++face) {
+    AddTriangles(it->positions(), it->vertex_count(), it->has_single_loop(),
+                 it->indices(), it->index_count(), face, mesh, corners);
+  }
+  for (size_t i = 0; i < entities.edges_.size(); ++i) {
+    AddEdge(entities.edges_[i], mesh);
+  }
+  for (size_t i = 0; i < entities.curves_.size(); ++i) {
+    const XmlCurveInfo& curve = entities.curves_[i];
+    for (size_t j = 0; j < curve.edges_.size(); ++j) {
+      AddEdge(curve.edges_[j], mesh);
+    }
+  }
+}
+
+static void GetPrimitiveBoxes(const XmlBvhMesh& mesh,
+                              std::vector<XmlBvhBox>& boxes) {
+  const size_t triangles = mesh.triangles_.size() / 3;
+  boxes.resize(triangles + mesh.edges_.size() / 6);
+  for (size_t i = 0; i < triangles; ++i) {
+    boxes[i] = EmptyBox();
+    for (int j = 0; j < 3; ++j) {
+      Grow(boxes[i], &mesh.positions_[mesh.triangles_[i * 3 + j] * 3]);
+    }
+  }
+  for (size_t i = triangles; i < boxes.size(); ++i) {
+    boxes[i] = EmptyBox();
+    Grow(boxes[i], &mesh.edges_[(i - triangles) * 6]);
+    Grow(boxes[i], &mesh.edges_[(i - triangles) * 6 + 3]);
+  }
+}
+
+static void BuildMesh(XmlBvhMesh& mesh, unsigned threads) {
+  std::vector<XmlBvhBox> boxes;
+  GetPrimitiveBoxes(mesh, boxes);
+  CXmlBvhBuilder builder(boxes);
+  builder.Build(threads, mesh.nodes_, mesh.primitives_);
+}
+
+//------------------------------------------------------------------------------
+
+// CXmlBvhCollector - Walks the hierarchy of a model info, giving each
+// entities block with faces or edges a mesh and each place it is used at an
+// instance
+class CXmlBvhCollector {
+ public:
+  CXmlBvhCollector(const XmlModelInfo& model_info,
+                   std::vector<XmlBvhMesh>& meshes,
+                   std::vector<XmlBvhInstance>& instances)
+    : model_info_(model_info), meshes_(meshes), instances_(instances),
+      ok_(true) {}
+
+  bool Run();
+
+ private:
+  void Visit(const XmlEntitiesInfo& entities, const CTransform& transform);
+  void VisitInstance(const XmlComponentInstanceInfo& info,
+                     const CTransform& transform);
+
+ private:
+  const XmlModelInfo& model_info_;
+  std::vector<XmlBvhMesh>& meshes_;
+  std::vector<XmlBvhInstance>& instances_;
+  std::unordered_map<std::string, size_t> definitions_;
+  std::unordered_map<const XmlEntitiesInfo*, size_t> mesh_indices_;
+  // The definitions above the entities being visited
+  std::vector<size_t> path_;
+  bool ok_;
+};
+
+bool CXmlBvhCollector::Run() {
+  const std::vector<XmlComponentDefinitionInfo>& defs =
+      model_info_.definitions_;
+  for (size_t i = 0; i < defs.size(); ++i) {
+    definitions_.insert(std::make_pair(defs[i].name_, i));
+  }
+  Visit(model_info_.entities_, CTransform());
+  return ok_;
+}
+
+void CXmlBvhCollector::Visit(const XmlEntitiesInfo& entities,
+                             const CTransform& transform) {
+  for (size_t i = 0; i < entities.component_instances_.size(); ++i) {
+    VisitInstance(entities.component_instances_[i], transform);
+  }
+  for (size_t i = 0; i < entities.groups_.size(); ++i) {
+    const XmlGroupInfo& group = entities.groups_[i];
+    Visit(*group.entities_, transform * CTransform(group.transform_));
+  }
+  if (entities.faces_.empty() && entities.face_store_.empty() &&
+      entities.edges_.empty() && entities.curves_.empty())
+    return;
+  std::pair<std::unordered_map<const XmlEntitiesInfo*, size_t>::iterator,
+            bool> it = mesh_indices_.insert(
+      std::make_pair(&entities, meshes_.size()));
+  if (it.second) {
+    meshes_.push_back(XmlBvhMesh());
+    meshes_.back().entities_ = &entities;
+  }
+  instances_.push_back(XmlBvhInstance());
+  XmlBvhInstance& instance = instances_.back();
+  instance.mesh_ = it.first->second;
+  instance.transform_ = transform;
+  instance.invertible_ = transform.GetInverse(instance.inverse_);
+}
+
+void CXmlBvhCollector::VisitInstance(const XmlComponentInstanceInfo& info,
+                                     const CTransform& transform) {
+  const CXmlNameTable& names = model_info_.names_;
+  const std::string& name =
+      names.Resolve(info.definition_id_, info.definition_name_);
+  std::unordered_map<std::string, size_t>::const_iterator it =
+      definitions_.find(name);
+  if (it == definitions_.end() ||
+      std::find(path_.begin(), path_.end(), it->second) != path_.end()) {
+    ok_ = false;
+    return;
+  }
+  path_.push_back(it->second);
+  Visit(model_info_.definitions_[it->second].entities_,
+        transform * CTransform(info.transform_));
+  path_.pop_back();
+}
+
+//------------------------------------------------------------------------------
+// Primitive tests
+
+// The ray parameter where the ray enters 'box', or infinity if it misses it
+// before 'limit'. The comparisons are written so that the NaNs of rays
+// parallel to a side leave the bounds as they are.
+static double EnterBox(const XmlBvhBox& box, const double* origin,
+                       const double* inverse_direction, double limit) {
+  double enter = 0.0;
+  double leave = limit;
+  for (int i = 0; i < 3; ++i) {
+    double t0 = (box.min_[i] - origin[i]) * inverse_direction[i];
+    double t1 = (box.max_[i] - origin[i]) * inverse_direction[i];
+    if (t0 > t1)
+      std::swap(t0, t1);
+    enter = t0 > enter ? t0 : enter;
+    leave = t1 < leave ? t1 : leave;
+  }
+  return enter <= leave ? enter : kInfinity;
+}
+
+// Moller-Trumbore, from either side. Returns the ray parameter of the hit,
+// or infinity.
+static double IntersectTriangle(const double* origin, const double* direction,
+                                const double* a, const double* b,
+                                const double* c) {
+  double e1[3], e2[3], p[3], s[3], q[3];
+  Subtract(b, a, e1);
+  Subtract(c, a, e2);
+  Cross(direction, e2, p);
+  const double det = Dot(e1, p);
+  if (det == 0.0)
+    return kInfinity;
+  const double inverse_det = 1.0 / det;
+  Subtract(origin, a, s);
+  const double u = Dot(s, p) * inverse_det;
+  if (u < 0.0 || u > 1.0)
+    return kInfinity;
+  Cross(s, e1, q);
+  const double v = Dot(direction, q) * inverse_det;
+  if (v < 0.0 || u + v > 1.0)
+    return kInfinity;
+  const double t = Dot(e2, q) * inverse_det;
+  return t >= 0.0 ? t : kInfinity;
+}
+
+// Separating axis test of Akenine-Moller
+static bool TriangleTouchesBox(const double* a, const double* b,
+                               const double* c, const XmlBvhBox& box) {
+  double center[3], half[3], v[3][3];
+  for (int i = 0; i < 3; ++i) {
+    center[i] = (box.min_[i] + box.max_[i]) * 0.5;
+    half[i] = (box.max_[i] - box.min_[i]) * 0.5;
+  }
+  Subtract(a, center, v[0]);
+  Subtract(b, center, v[1]);
+  Subtract(c, center, v[2]);
+
+  // The box's faces
+  for (int i = 0; i < 3; ++i) {
+    if (std::min(std::min(v[0][i], v[1][i]), v[2][i]) > half[i] ||
+        std::max(std::max(v[0][i], v[1][i]), v[2][i]) < -half[i])
+      return false;
+  }
+
+  // The box's axes crossed with the triangle's sides, then the triangle's
+  // plane
+  double sides[3][3];
+  Subtract(v[1], v[0], sides[0]);
+  Subtract(v[2], v[1], sides[1]);
+  Subtract(v[0], v[2], sides[2]);
+  double axes[10][3];
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      const double unit[3] = { i == 0 ? 1.0 : 0.0, i == 1 ? 1.0 : 0.0,
+                               i == 2 ? 1.0 : 0.0 };
+      Cross(unit, sides[j], axes[i * 3 + j]);
+    }
+  }
+  Cross(sides[0], sides[1], axes[9]);
+  for (int i = 0; i < 10; ++i) {
+    const double* axis = axes[i];
+    const double p0 = Dot(v[0], axis);
+    const double p1 = Dot(v[1], axis);
+    const double p2 = Dot(v[2], axis);
+    const double r = half[0] * fabs(axis[0]) + half[1] * fabs(axis[1]) +
+                     half[2] * fabs(axis[2]);
+    if (std::min(std::min(p0, p1), p2) > r ||
+        std::max(std::max(p0, p1), p2) < -r)
+      return false;
+  }
+  return true;
+}
+
+static bool SegmentTouchesBox(const double* a, const double* b,
+                              const XmlBvhBox& box) {
+  double enter = 0.0;
+  double leave = 1.0;
+  for (int i = 0; i < 3; ++i) {
+    const double d = b[i] - a[i];
+    if (d == 0.0) {
+      if (a[i] < box.min_[i] || a[i] > box.max_[i])
+        return false;
+      continue;
+    }
+    double t0 = (box.min_[i] - a[i]) / d;
+    double t1 = (box.max_[i] - a[i]) / d;
+    if (t0 > t1)
+      std::swap(t0, t1);
+    enter = std::max(enter, t0);
+    leave = std::min(leave, t1);
+    if (enter > leave)
+      return false;
+  }
+  return true;
+}
+
+static void NearestOnSegment(const double* p, const double* a,
+                             const double* b, double* out) {
+  double ab[3], ap[3];
+  Subtract(b, a, ab);
+  Subtract(p, a, ap);
+  const double length_squared = Dot(ab, ab);
+  double t = length_squared > 0.0 ? Dot(ap, ab) / length_squared : 0.0;
+  t = std::min(std::max(t, 0.0), 1.0);
+  for (int i = 0; i < 3; ++i) {
+    out[i] = a[i] + t * ab[i];
+  }
+}
+
+// From Ericson, Real-Time Collision Detection, 5.1.5
+static void NearestOnTriangle(const double* p, const double* a,
+                              const double* b, const double* c,
+                              double* out) {
+  double ab[3], ac[3], ap[3], bp[3], cp[3];
+  Subtract(b, a, ab);
+  Subtract(c, a, ac);
+  // Degenerate triangles have no inside, and the regions below can't be
+  // told apart on them, so one of their sides is nearest
+  double normal[3];
+  Cross(ab, ac, normal);
+  if (!(Dot(normal, normal) > 0.0)) {
+    const double* sides[3][2] = { { a, b }, { b, c }, { c, a } };
+    double best = 0.0;
+    for (int i = 0; i < 3; ++i) {
+      double candidate[3];
+      NearestOnSegment(p, sides[i][0], sides[i][1], candidate);
+      const double d = DistanceSquared(p, candidate);
+      if (i == 0 || d < best) {
+        best = d;
+        std::copy(candidate, candidate + 3, out);
+      }
+    }
+    return;
+  }
+  Subtract(p, a, ap);
+  const double d1 = Dot(ab, ap);
+  const double d2 = Dot(ac, ap);
+  if (d1 <= 0.0 && d2 <= 0.0) {
+    std::copy(a, a + 3, out);
+    return;
+  }
+  Subtract(p, b, bp);
+  const double d3 = Dot(ab, bp);
+  const double d4 = Dot(ac, bp);
+  if (d3 >= 0.0 && d4 <= d3) {
+    std::copy(b, b + 3, out);
+    return;
+  }
+  const double vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+    const double v = d1 / (d1 - d3);
+    for (int i = 0; i < 3; ++i) {
+      out[i] = a[i] + v * ab[i];
+    }
+    return;
+  }
+  Subtract(p, c, cp);
+  const double d5 = Dot(ab, cp);
+  const double d6 = Dot(ac, cp);
+  if (d6 >= 0.0 && d5 <= d6) {
+    std::copy(c, c + 3, out);
+    return;
+  }
+  const double vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+    const double w = d2 / (d2 - d6);
+    for (int i = 0; i < 3; ++i) {
+      out[i] = a[i] + w * ac[i];
+    }
+    return;
+  }
+  const double va = d3 * d6 - d5 * d4;
+  if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0) {
+    const double w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    for (int i = 0; i < 3; ++i) {
+      out[i] = b[i] + w * (c[i] - b[i]);
+    }
+    return;
+  }
+  const double sum = va + vb + vc;
+  const double v = vb / sum;
+  const double w = vc / sum;
+  for (int i = 0; i < 3; ++i) {
+    out[i] = a[i] + ab[i] * v + ac[i] * w;
+  }
+}
+
+// Transforms the corners of triangle or edge 'primitive' of 'mesh' into
+// 'points', 9 or 6 doubles. Returns true for a triangle.
+static bool GetPrimitive(const XmlBvhMesh& mesh, const CTransform& transform,
+                         uint32_t primitive, double* points) {
+  const uint32_t triangles =
+      static_cast<uint32_t>(mesh.triangles_.size() / 3);
+  if (primitive >= triangles) {
+    transform.TransformPoints(&mesh.edges_[(primitive - triangles) * 6], 2,
+                              points);
+    return false;
+  }
+  for (int i = 0; i < 3; ++i) {
+    transform.TransformPoints(
+        &mesh.positions_[mesh.triangles_[primitive * 3 + i] * 3], 1,
+        points + i * 3);
+  }
+  return true;
+}
+
+static void SetHit(const XmlBvhMesh& mesh, size_t instance,
+                   uint32_t primitive, XmlBvhHit& hit) {
+  const uint32_t triangles =
+      static_cast<uint32_t>(mesh.triangles_.size() / 3);
+  hit.instance_ = instance;
+  if (primitive < triangles) {
+    hit.kind_ = XmlBvhHit::kTriangle;
+    hit.index_ = mesh.triangle_faces_[primitive];
+  } else {
+    hit.kind_ = XmlBvhHit::kEdge;
+    hit.index_ = primitive - triangles;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+CXmlBvh::CXmlBvh() : threads_(0) {
+}
+
+void CXmlBvh::Clear() {
+  meshes_.clear();
+  instances_.clear();
+  nodes_.clear();
+  order_.clear();
+}
+
+bool CXmlBvh::Build(const XmlModelInfo& model_info) {
+  Clear();
+  CXmlBvhCollector collector(model_info, meshes_, instances_);
+  const bool ok = collector.Run();
+
+  // Small meshes are built one per thread, large ones on all threads
+  XmlParallel::For(meshes_.size(), threads_,
+                   [&](size_t i, unsigned /*thread*/) {
+    XmlBvhMesh& mesh = meshes_[i];
+    FillMesh(*mesh.entities_, mesh);
+    if (mesh.triangles_.size() / 3 + mesh.edges_.size() / 6 < kParallelGrain)
+      BuildMesh(mesh, 1);
+  });
+  for (size_t i = 0; i < meshes_.size(); ++i) {
+    XmlBvhMesh& mesh = meshes_[i];
+    if (mesh.triangles_.size() / 3 + mesh.edges_.size() / 6 >=
+        kParallelGrain)
+      BuildMesh(mesh, threads_);
+  }
+
+  // Faces with fewer than 3 vertices leave some meshes empty
+  std::vector<XmlBvhInstance> instances;
+  for (size_t i = 0; i < instances_.size(); ++i) {
+    if (!meshes_[instances_[i].mesh_].nodes_.empty())
+      instances.push_back(instances_[i]);
+  }
+  instances_.swap(instances);
+  std::vector<XmlBvhBox> boxes(instances_.size());
+  for (size_t i = 0; i < instances_.size(); ++i) {
+    const XmlBvhInstance& instance = instances_[i];
+    boxes[i] = TransformBox(instance.transform_,
+                            meshes_[instance.mesh_].nodes_[0].box_);
+  }
+  CXmlBvhBuilder builder(boxes);
+  builder.Build(threads_, nodes_, order_);
+  return ok;
+}
+
+bool CXmlBvh::Raycast(const CPoint3d& origin, const CVector3d& direction,
+                      double max_distance, XmlBvhHit& hit) const {
+  if (nodes_.empty())
+    return false;
+  const double world_origin[3] = { origin.x(), origin.y(), origin.z() };
+  const double world_direction[3] = {
+    direction.x(), direction.y(), direction.z()
+  };
+  double world_inverse[3];
+  for (int i = 0; i < 3; ++i) {
+    world_inverse[i] = 1.0 / world_direction[i];
+  }
+
+  double best = max_distance;
+  bool found = false;
+  std::vector<uint32_t> stack(1, 0);
+  std::vector<uint32_t> mesh_stack;
+  while (!stack.empty()) {
+    const XmlBvhNode& node = nodes_[stack.back()];
+    stack.pop_back();
+    if (EnterBox(node.box_, world_origin, world_inverse, best) == kInfinity)
+      continue;
+    if (node.count_ == 0) {
+      // The nearer child is taken first
+      const double left = EnterBox(nodes_[node.first_].box_, world_origin,
+                                   world_inverse, best);
+      const double right = EnterBox(nodes_[node.first_ + 1].box_,
+                                    world_origin, world_inverse, best);
+      stack.push_back(left <= right ? node.first_ + 1 : node.first_);
+      stack.push_back(left <= right ? node.first_ : node.first_ + 1);
+      continue;
+    }
+
+    for (uint32_t i = node.first_; i < node.first_ + node.count_; ++i) {
+      const XmlBvhInstance& instance = instances_[order_[i]];
+      if (!instance.invertible_)
+        continue;
+      // Transformations are affine, so the ray parameter is the same on
+      // both sides
+      const XmlBvhMesh& mesh = meshes_[instance.mesh_];
+      double local_origin[3];
+      instance.inverse_.TransformPoints(world_origin, 1, local_origin);
+      const CVector3d d = instance.inverse_.TransformVector(direction);
+      const double local_direction[3] = { d.x(), d.y(), d.z() };
+      double local_inverse[3];
+      for (int j = 0; j < 3; ++j) {
+        local_inverse[j] = 1.0 / local_direction[j];
+      }
+      const uint32_t triangles =
+          static_cast<uint32_t>(mesh.triangles_.size() / 3);
+      mesh_stack.assign(1, 0);
+      while (!mesh_stack.empty()) {
+        const XmlBvhNode& mesh_node = mesh.nodes_[mesh_stack.back()];
+        mesh_stack.pop_back();
+        if (EnterBox(mesh_node.box_, local_origin, local_inverse, best) ==
+            kInfinity)
+          continue;
+        if (mesh_node.count_ == 0) {
+          const double left = EnterBox(mesh.nodes_[mesh_node.first_].box_,
+                                       local_origin, local_inverse, best);
+          const double right =
+              EnterBox(mesh.nodes_[mesh_node.first_ + 1].box_, local_origin,
+                       local_inverse, best);
+          mesh_stack.push_back(left <= right ? mesh_node.first_ + 1
+                                             : mesh_node.first_);
+          mesh_stack.push_back(left <= right ? mesh_node.first_
+                                             : mesh_node.first_ + 1);
+          continue;
+        }
+        for (uint32_t j = mesh_node.first_;
+             j < mesh_node.first_ + mesh_node.count_; ++j) {
+          const uint32_t primitive = mesh.primitives_[j];
+          if (primitive >= triangles)
+            continue;
+          const uint32_t* corners = &mesh.triangles_[primitive * 3];
+          const double t = IntersectTriangle(
+              local_origin, local_direction,
+              &mesh.positions_[corners[0] * 3],
+              &mesh.positions_[corners[1] * 3],
+              &mesh.positions_[corners[2] * 3]);
+          if (t != kInfinity && t <= best) {
+            best = t;
+            found = true;
+            SetHit(mesh, order_[i], primitive, hit);
+          }
+        }
+      }
+    }
+  }
+  if (!found)
+    return false;
+  hit.distance_ = best;
+  hit.point_ = origin + direction * best;
+  return true;
+}
+
+void CXmlBvh::FindInBox(const CPoint3d& min, const CPoint3d& max,
+                        std::vector<XmlBvhHit>& hits) const {
+  hits.clear();
+  if (nodes_.empty())
+    return;
+  XmlBvhBox world_box = EmptyBox();
+  const double corners[6] = {
+    min.x(), min.y(), min.z(), max.x(), max.y(), max.z()
+  };
+  Grow(world_box, corners);
+  Grow(world_box, corners + 3);
+  XmlBvhBox everything;
+  for (int i = 0; i < 3; ++i) {
+    everything.min_[i] = -kInfinity;
+    everything.max_[i] = kInfinity;
+  }
+
+  std::vector<uint32_t> stack(1, 0);
+  std::vector<uint32_t> mesh_stack;
+  while (!stack.empty()) {
+    const XmlBvhNode& node = nodes_[stack.back()];
+    stack.pop_back();
+    if (!Overlaps(node.box_, world_box))
+      continue;
+    if (node.count_ == 0) {
+      stack.push_back(node.first_ + 1);
+      stack.push_back(node.first_);
+      continue;
+    }
+
+    for (uint32_t i = node.first_; i < node.first_ + node.count_; ++i) {
+      const XmlBvhInstance& instance = instances_[order_[i]];
+      const XmlBvhMesh& mesh = meshes_[instance.mesh_];
+      // The box as seen from the mesh only culls its nodes; primitives are
+      // tested in model coordinates
+      const XmlBvhBox local_box =
+          instance.invertible_ ? TransformBox(instance.inverse_, world_box)
+                               : everything;
+      mesh_stack.assign(1, 0);
+      while (!mesh_stack.empty()) {
+        const XmlBvhNode& mesh_node = mesh.nodes_[mesh_stack.back()];
+        mesh_stack.pop_back();
+        if (!Overlaps(mesh_node.box_, local_box))
+          continue;
+        if (mesh_node.count_ == 0) {
+          mesh_stack.push_back(mesh_node.first_ + 1);
+          mesh_stack.push_back(mesh_node.first_);
+          continue;
+        }
+        for (uint32_t j = mesh_node.first_;
+             j < mesh_node.first_ + mesh_node.count_; ++j) {
+          const uint32_t primitive = mesh.primitives_[j];
+          double points[9];
+          const bool triangle = GetPrimitive(mesh, instance.transform_,
+                                             primitive, points);
+          if (triangle ? TriangleTouchesBox(points, points + 3, points + 6,
+                                            world_box)
+                       : SegmentTouchesBox(points, points + 3, world_box)) {
+            hits.push_back(XmlBvhHit());
+            SetHit(mesh, order_[i], primitive, hits.back());
+          }
+        }
+      }
+    }
+  }
+}
+
+bool CXmlBvh::FindNearest(const CPoint3d& point, double max_distance,
+                          XmlBvhHit& hit) const {
+  if (nodes_.empty())
+    return false;
+  const double p[3] = { point.x(), point.y(), point.z() };
+  double best = max_distance * max_distance;
+  bool found = false;
+  double nearest[3] = {};
+
+  std::vector<uint32_t> stack(1, 0);
+  std::vector<uint32_t> mesh_stack;
+  while (!stack.empty()) {
+    const XmlBvhNode& node = nodes_[stack.back()];
+    stack.pop_back();
+    if (DistanceSquared(p, node.box_) > best)
+      continue;
+    if (node.count_ == 0) {
+      const double left = DistanceSquared(p, nodes_[node.first_].box_);
+      const double right = DistanceSquared(p, nodes_[node.first_ + 1].box_);
+      stack.push_back(left <= right ? node.first_ + 1 : node.first_);
+      stack.push_back(left <= right ? node.first_ : node.first_ + 1);
+      continue;
+    }
+
+    for (uint32_t i = node.first_; i < node.first_ + node.count_; ++i) {
+      const XmlBvhInstance& instance = instances_[order_[i]];
+      const XmlBvhMesh& mesh = meshes_[instance.mesh_];
+      // Distances aren't kept by every transformation, so mesh nodes are
+      // measured by the boxes around them in model coordinates
+      mesh_stack.assign(1, 0);
+      while (!mesh_stack.empty()) {
+        const XmlBvhNode& mesh_node = mesh.nodes_[mesh_stack.back()];
+        mesh_stack.pop_back();
+        if (DistanceSquared(p, TransformBox(instance.transform_,
+                                            mesh_node.box_)) > best)
+          continue;
+        if (mesh_node.count_ == 0) {
+          const double left = DistanceSquared(
+              p, TransformBox(instance.transform_,
+                              mesh.nodes_[mesh_node.first_].box_));
+          const double right = DistanceSquared(
+              p, TransformBox(instance.transform_,
+                              mesh.nodes_[mesh_node.first_ + 1].box_));
+          mesh_stack.push_back(left <= right ? mesh_node.first_ + 1
+                                             : mesh_node.first_);
+          mesh_stack.push_back(left <= right ? mesh_node.first_
+                                             : mesh_node.first_ + 1);
+          continue;
+        }
+        for (uint32_t j = mesh_node.first_;
+             j < mesh_node.first_ + mesh_node.count_; ++j) {
+          const uint32_t primitive = mesh.primitives_[j];
+          double points[9];
+          double candidate[3];
+          if (GetPrimitive(mesh, instance.transform_, primitive, points)) {
+            NearestOnTriangle(p, points, points + 3, points + 6, candidate);
+          } else {
+            NearestOnSegment(p, points, points + 3, candidate);
+          }
+          const double d = DistanceSquared(p, candidate);
+          if (d <= best) {
+            best = d;
+            found = true;
+            std::copy(candidate, candidate + 3, nearest);
+            SetHit(mesh, order_[i], primitive, hit);
+          }
+        }
+      }
+    }
+  }
+  if (!found)
+    return false;
+  hit.distance_ = sqrt(best);
+  hit.point_ = CPoint3d(nearest[0], nearest[1], nearest[2]);
+  return true;
+}
@@ -0,0 +1,136 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLBVH_H
+#define SKPTOXML_COMMON_XMLBVH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "./xmlgeomutils.h"
+
+struct XmlModelInfo;
+struct XmlEntitiesInfo;
+
+// An axis aligned box. Empty when a minimum is greater than its maximum.
+struct XmlBvhBox {
+  double min_[3];
+  double max_[3];
+};
+
+// A node of a bounding volume hierarchy. A leaf holds 'count_' primitives
+// from 'first_' on in the tree's primitive order. Other nodes have a count
+// of 0 and their two children at 'first_' and 'first_' + 1.
+struct XmlBvhNode {
+  XmlBvhBox box_;
+  uint32_t first_;
+  uint32_t count_;
+};
+
+// The triangles and edges of one entities block, in its own coordinates,
+// and the hierarchy over them. The primitives are numbered triangles first,
+// then edges.
+struct XmlBvhMesh {
+  XmlBvhMesh() : entities_(NULL) {}
+
+  const XmlEntitiesInfo* entities_;
+  std::vector<double> positions_;        // x y z per vertex
+  std::vector<uint32_t> triangles_;      // 3 vertex indices per triangle
+  std::vector<uint32_t> triangle_faces_; // the face of each triangle
+  std::vector<double> edges_;            // start x y z, end x y z per edge
+  std::vector<XmlBvhNode> nodes_;
+  std::vector<uint32_t> primitives_;     // in leaf order
+};
+
+// A place a mesh is at in the model
+struct XmlBvhInstance {
+  XmlBvhInstance() : mesh_(0), invertible_(false) {}
+
+  size_t mesh_;
+  XmlGeomUtils::CTransform transform_;
+  XmlGeomUtils::CTransform inverse_;
+  bool invertible_;
+};
+
+// A triangle or edge found by a query
+struct XmlBvhHit {
+  enum Kind {
+    kTriangle,
+    kEdge
+  };
+
+  XmlBvhHit() : instance_(0), kind_(kTriangle), index_(0), distance_(0.0) {}
+
+  size_t instance_;
+  Kind kind_;
+  // The index of the face the triangle is part of, counting faces_ and then
+  // face_store_, or of the edge, counting edges_ and then the edges of
+  // curves_ in order, in the instance's entities block
+  size_t index_;
+  // Along the ray, in lengths of its direction, or from the point to the
+  // nearest one. 0 for box queries.
+  double distance_;
+  // In model coordinates. Not set by box queries.
+  XmlGeomUtils::CPoint3d point_;
+};
+
+// CXmlBvh - Spatial queries over the faces and edges of a model. Each
+// entities block with faces or edges gets its own bounding volume hierarchy
+// once, however many times it is used, and a top level hierarchy holds the
+// instances and groups placing them in the model. Both are built with the
+// surface area heuristic over binned centroids, on several threads.
+//
+// The hierarchy refers to the model info, which must stay unchanged while
+// it is queried. Faces are triangulated like CXmlFlattener does; points and
+// distances are in model coordinates.
+class CXmlBvh {
+ public:
+  CXmlBvh();
+
+  // The number of threads the hierarchies are built on, 0 meaning one per
+  // core (the default). See XmlParallel::For.
+  unsigned threads() const { return threads_; }
+  void set_threads(unsigned threads) { threads_ = threads; }
+
+  // Replaces the hierarchy by one over 'model_info', whose component
+  // definitions must have been loaded. Returns false if an instance refers
+  // to a definition that isn't in the model, or that contains itself,
+  // which are skipped.
+  bool Build(const XmlModelInfo& model_info);
+  void Clear();
+
+  size_t mesh_count() const { return meshes_.size(); }
+  const XmlBvhMesh& mesh(size_t i) const { return meshes_[i]; }
+  size_t instance_count() const { return instances_.size(); }
+  const XmlBvhInstance& instance(size_t i) const { return instances_[i]; }
+
+  // Finds the first triangle along the ray from 'origin' in 'direction',
+  // no further than 'max_distance' lengths of 'direction'. Edges have no
+  // area and are never hit; pick them with FindNearest. Instances whose
+  // transformation can't be inverted are skipped. Returns false if the ray
+  // hits nothing.
+  bool Raycast(const XmlGeomUtils::CPoint3d& origin,
+               const XmlGeomUtils::CVector3d& direction, double max_distance,
+               XmlBvhHit& hit) const;
+
+  // Replaces 'hits' by the triangles and edges that touch the box from
+  // 'min' to 'max'
+  void FindInBox(const XmlGeomUtils::CPoint3d& min,
+                 const XmlGeomUtils::CPoint3d& max,
+                 std::vector<XmlBvhHit>& hits) const;
+
+  // Finds the point on a triangle or edge nearest to 'point', no further
+  // than 'max_distance' from it. Returns false if there is none.
+  bool FindNearest(const XmlGeomUtils::CPoint3d& point, double max_distance,
+                   XmlBvhHit& hit) const;
+
+ private:
+  unsigned threads_;
+  std::vector<XmlBvhMesh> meshes_;
+  std::vector<XmlBvhInstance> instances_;
+  // The top level hierarchy over instances_
+  std::vector<XmlBvhNode> nodes_;
+  std::vector<uint32_t> order_;
+};
+
+#endif // SKPTOXML_COMMON_XMLBVH_H
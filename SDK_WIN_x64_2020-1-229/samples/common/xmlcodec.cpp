@@ -0,0 +1,665 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <limits.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <system_error>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#endif
+
+#include "./xmlcodec.h"
+
+#ifdef SKPTOXML_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef SKPTOXML_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Uncompressed bytes per block. At most kMaxQueued blocks wait for the
+// background thread, besides the one it works on and the caller's.
+static const size_t kBlockSize = 1024 * 1024;
+static const size_t kMaxQueued = 2;
+// Compressed bytes per read or write
+static const size_t kFileChunkSize = 256 * 1024;
+// How much written data is handed to the system to write out at a time
+static const uint64_t kWriteBehindSize = 4 * kBlockSize;
+
+// See CXmlCodecFile::SetRateLimit
+static std::atomic<double> rate_limit(0.0);
+
+// One direction of one codec, driven by the background thread
+class CXmlCodecStream {
+ public:
+  virtual ~CXmlCodecStream() {}
+
+  bool ok() const { return ok_; }
+
+  // Moves data from [*in, in_end) to [*out, out_end), advancing both. A
+  // compressor given 'finish' has all its input and writes out the end of
+  // the stream. Returns false on corrupt data or if the codec fails.
+  virtual bool Run(const char** in, const char* in_end, char** out,
+                   char* out_end, bool finish) = 0;
+  // Whether the stream is complete: a compressor has written everything
+  // after 'finish', or a decompressor is at the end of a compressed stream
+  // with no output pending.
+  bool ended() const { return ended_; }
+
+ protected:
+  CXmlCodecStream() : ok_(false), ended_(false) {}
+
+  bool ok_;
+  bool ended_;
+};
+
+#ifdef SKPTOXML_HAVE_ZLIB
+class CXmlGzipStream : public CXmlCodecStream {
+ public:
+  CXmlGzipStream(bool compress, int level) : compress_(compress) {
+    memset(&z_, 0, sizeof(z_));
+    // 16 selects the gzip wrapper, 32 lets inflate detect gzip or zlib
+    if (compress_) {
+      ok_ = deflateInit2(&z_, level != 0 ? level : Z_DEFAULT_COMPRESSION,
+                         Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    } else {
+      ok_ = inflateInit2(&z_, 15 + 32) == Z_OK;
+    }
+  }
+
+  ~CXmlGzipStream() {
+    if (!ok_)
+      return;
+    if (compress_)
+      deflateEnd(&z_);
+    else
+      inflateEnd(&z_);
+  }
+
+  bool Run(const char** in, const char* in_end, char** out, char* out_end,
+           bool finish) {
+    // zlib counts in uInt, larger buffers go through in several calls
+    z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(*in));
+    z_.avail_in = static_cast<uInt>(
+        std::min<size_t>(in_end - *in, UINT_MAX));
+    z_.next_out = reinterpret_cast<Bytef*>(*out);
+    z_.avail_out = static_cast<uInt>(
+        std::min<size_t>(out_end - *out, UINT_MAX));
+    const char* in_begin = *in;
+
+    int result = compress_ ? deflate(&z_, finish ? Z_FINISH : Z_NO_FLUSH) :
+                             inflate(&z_, Z_NO_FLUSH);
+    *in = reinterpret_cast<const char*>(z_.next_in);
+    *out = reinterpret_cast<char*>(z_.next_out);
+    if (result == Z_STREAM_END) {
+      ended_ = true;
+      // Concatenated gzip members decompress as one stream
+      if (!compress_ && inflateReset(&z_) != Z_OK)
+        return false;
+      return true;
+    }
+    if (!compress_ && *in != in_begin)
+      ended_ = false;
+    // Z_BUF_ERROR only means no progress was possible
+    return result == Z_OK || result == Z_BUF_ERROR;
+  }
+
+ private:
+  bool compress_;
+  z_stream z_;
+};
+#endif // SKPTOXML_HAVE_ZLIB
+
+#ifdef SKPTOXML_HAVE_ZSTD
+class CXmlZstdStream : public CXmlCodecStream {
+ public:
+  CXmlZstdStream(bool compress, int level)
+    : cctx_(NULL),
+      dctx_(NULL) {
+    if (compress) {
+      cctx_ = ZSTD_createCCtx();
+      ok_ = cctx_ != NULL && !ZSTD_isError(ZSTD_CCtx_setParameter(
+          cctx_, ZSTD_c_compressionLevel,
+          level != 0 ? level : ZSTD_CLEVEL_DEFAULT));
+    } else {
+      dctx_ = ZSTD_createDCtx();
+      ok_ = dctx_ != NULL;
+    }
+  }
+
+  ~CXmlZstdStream() {
+    ZSTD_freeCCtx(cctx_);
+    ZSTD_freeDCtx(dctx_);
+  }
+
+  bool Run(const char** in, const char* in_end, char** out, char* out_end,
+           bool finish) {
+    ZSTD_inBuffer input = { *in, static_cast<size_t>(in_end - *in), 0 };
+    ZSTD_outBuffer output = { *out, static_cast<size_t>(out_end - *out), 0 };
+    size_t result;
+    if (cctx_ != NULL) {
+      result = ZSTD_compressStream2(cctx_, &output, &input,
+                                    finish ? ZSTD_e_end : ZSTD_e_continue);
+      // With ZSTD_e_end, 0 means the frame is complete
+      ended_ = finish && result == 0;
+    } else {
+      // 0 means a frame is complete and flushed, more frames may follow
+      result = ZSTD_decompressStream(dctx_, &output, &input);
+      if (!ZSTD_isError(result) && (input.pos > 0 || output.pos > 0))
+        ended_ = result == 0;
+    }
+    *in += input.pos;
+    *out += output.pos;
+    return !ZSTD_isError(result);
+  }
+
+ private:
+  ZSTD_CCtx* cctx_;
+  ZSTD_DCtx* dctx_;
+};
+#endif // SKPTOXML_HAVE_ZSTD
+
+#if defined(SKPTOXML_HAVE_ZLIB) || defined(SKPTOXML_HAVE_ZSTD)
+static CXmlCodecStream* CreateStream(CXmlCodecFile::Codec codec,
+                                     bool compress, int level) {
+  CXmlCodecStream* stream = NULL;
+  switch (codec) {
+#ifdef SKPTOXML_HAVE_ZLIB
+    case CXmlCodecFile::kCodecGzip:
+      stream = new CXmlGzipStream(compress, level);
+      break;
+#endif
+#ifdef SKPTOXML_HAVE_ZSTD
+    case CXmlCodecFile::kCodecZstd:
+      stream = new CXmlZstdStream(compress, level);
+      break;
+#endif
+    default:
+      return NULL;
+  }
+  if (!stream->ok()) {
+    delete stream;
+    return NULL;
+  }
+  return stream;
+}
+#else
+// No codec is compiled in, and IsSupported keeps compressed files from
+// getting this far
+static CXmlCodecStream* CreateStream(CXmlCodecFile::Codec /*codec*/,
+                                     bool /*compress*/, int /*level*/) {
+  return NULL;
+}
+#endif
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+// Opens a file that is read or written from start to end, and tells the
+// system so
+static FILE* OpenFile(const std::string& filename, bool write) {
+  FILE* file = NULL;
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+  if (fopen_s(&file, filename.c_str(), write ? "wbS" : "rbS") != 0)
+    return NULL;
+#else
+  file = fopen(filename.c_str(), write ? "wb" : "rb");
+  if (file == NULL)
+    return NULL;
+#endif
+#if defined(__linux__)
+  posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(__APPLE__)
+  // The closest to O_DIRECT that works with writes of any size
+  if (write)
+    fcntl(fileno(file), F_NOCACHE, 1);
+#endif
+  return file;
+}
+
+static bool EndsWith(const std::string& str, const char* suffix) {
+  size_t size = strlen(suffix);
+  if (str.size() < size)
+    return false;
+  for (size_t i = 0; i < size; ++i) {
+    char c = str[str.size() - size + i];
+    if (c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+    if (c != suffix[i])
+      return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+
+CXmlCodecFile::CXmlCodecFile()
+  : file_(NULL),
+    codec_(kCodecNone),
+    writing_(false),
+    stream_(NULL),
+    block_pos_(0),
+    closing_(false),
+    finished_(false),
+    failed_(false),
+    flushed_size_(0),
+    dropped_size_(0),
+    rate_limit_(0.0),
+    io_bytes_(0) {
+}
+
+CXmlCodecFile::~CXmlCodecFile() {
+  Close();
+}
+
+CXmlCodecFile::Codec CXmlCodecFile::CodecOf(const std::string& filename) {
+  if (EndsWith(filename, ".gz"))
+    return kCodecGzip;
+  if (EndsWith(filename, ".zst"))
+    return kCodecZstd;
+  return kCodecNone;
+}
+
+bool CXmlCodecFile::IsSupported(Codec codec) {
+  switch (codec) {
+    case kCodecNone:
+      return true;
+#ifdef SKPTOXML_HAVE_ZLIB
+    case kCodecGzip:
+      return true;
+#endif
+#ifdef SKPTOXML_HAVE_ZSTD
+    case kCodecZstd:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+void CXmlCodecFile::SetRateLimit(double bytes_per_second) {
+  rate_limit = bytes_per_second;
+}
+
+bool CXmlCodecFile::OpenRead(const std::string& filename) {
+  Close();
+  codec_ = CodecOf(filename);
+  if (!IsSupported(codec_))
+    return false;
+
+  file_ = OpenFile(filename, false);
+  if (file_ == NULL)
+    return false;
+  writing_ = false;
+  rate_limit_ = rate_limit;
+  io_start_ = std::chrono::steady_clock::now();
+  io_bytes_ = 0;
+  if (codec_ == kCodecNone)
+    return true;
+
+  stream_ = CreateStream(codec_, false, 0);
+  if (stream_ == NULL) {
+    Close();
+    return false;
+  }
+  try {
+    worker_ = std::thread(&CXmlCodecFile::ReadBlocks, this);
+  } catch (const std::system_error&) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool CXmlCodecFile::OpenWrite(const std::string& filename, Codec codec,
+                              int level) {
+  Close();
+  codec_ = codec;
+  if (!IsSupported(codec_))
+    return false;
+
+  file_ = OpenFile(filename, true);
+  if (file_ == NULL)
+    return false;
+  writing_ = true;
+  // Everything is written in blocks or chunks already
+  setvbuf(file_, NULL, _IONBF, 0);
+  stats_ = XmlWriteStats();
+  rate_limit_ = rate_limit;
+  io_start_ = std::chrono::steady_clock::now();
+  io_bytes_ = 0;
+
+  if (codec_ != kCodecNone) {
+    stream_ = CreateStream(codec_, true, level);
+    if (stream_ == NULL) {
+      Close();
+      return false;
+    }
+  }
+  block_.reserve(kBlockSize);
+  try {
+    worker_ = std::thread(&CXmlCodecFile::WriteBlocks, this);
+  } catch (const std::system_error&) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool CXmlCodecFile::Close() {
+  if (file_ == NULL)
+    return true;
+
+  if (worker_.joinable()) {
+    // A writer hands over its last block, a reader stops reading ahead
+    if (writing_ && !block_.empty())
+      QueueBlock();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closing_ = true;
+    }
+    cond_.notify_all();
+    // A writer waits for the last blocks to be written
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    worker_.join();
+    if (writing_)
+      stats_.stall_seconds_ += SecondsSince(start);
+  }
+  bool ok = !failed_;
+  if (fclose(file_) != 0 && writing_)
+    ok = false;
+
+  file_ = NULL;
+  codec_ = kCodecNone;
+  writing_ = false;
+  delete stream_;
+  stream_ = NULL;
+  std::vector<char>().swap(block_);
+  block_pos_ = 0;
+  queue_.clear();
+  spare_.clear();
+  closing_ = false;
+  finished_ = false;
+  failed_ = false;
+  flushed_size_ = 0;
+  dropped_size_ = 0;
+  return ok;
+}
+
+bool CXmlCodecFile::error() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_;
+}
+
+void CXmlCodecFile::GetWriteStats(XmlWriteStats& stats) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats = stats_;
+}
+
+void CXmlCodecFile::Fail() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  failed_ = true;
+}
+
+size_t CXmlCodecFile::Read(char* data, size_t size) {
+  if (file_ == NULL || writing_)
+    return 0;
+  if (codec_ == kCodecNone) {
+    const size_t read = fread(data, 1, size, file_);
+    Throttle(read);
+    return read;
+  }
+
+  size_t read = 0;
+  while (read < size) {
+    if (block_pos_ == block_.size() && !NextBlock())
+      break;
+    size_t count = std::min(size - read, block_.size() - block_pos_);
+    memcpy(data + read, &block_[block_pos_], count);
+    block_pos_ += count;
+    read += count;
+  }
+  return read;
+}
+
+bool CXmlCodecFile::Skip(size_t size) {
+  if (file_ == NULL || writing_)
+    return false;
+  if (codec_ == kCodecNone) {
+#if defined(_MSC_VER)
+    return _fseeki64(file_, static_cast<__int64>(size), SEEK_CUR) == 0;
+#else
+    return fseeko(file_, static_cast<off_t>(size), SEEK_CUR) == 0;
+#endif
+  }
+
+  // A compressed stream has to be decompressed up to there
+  while (size > 0) {
+    if (block_pos_ == block_.size() && !NextBlock())
+      return false;
+    size_t count = std::min(size, block_.size() - block_pos_);
+    block_pos_ += count;
+    size -= count;
+  }
+  return true;
+}
+
+bool CXmlCodecFile::NextBlock() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!block_.empty()) {
+    block_.clear();
+    spare_.push_back(std::vector<char>());
+    spare_.back().swap(block_);
+  }
+  block_pos_ = 0;
+  cond_.wait(lock, [this] { return !queue_.empty() || finished_; });
+  if (queue_.empty())
+    return false;
+  block_.swap(queue_.front());
+  queue_.pop_front();
+  lock.unlock();
+  // There is room in the queue again
+  cond_.notify_all();
+  return true;
+}
+
+bool CXmlCodecFile::Write(const char* data, size_t size) {
+  if (file_ == NULL || !writing_)
+    return false;
+
+  while (size > 0) {
+    size_t count = std::min(size, kBlockSize - block_.size());
+    block_.insert(block_.end(), data, data + count);
+    data += count;
+    size -= count;
+    if (block_.size() == kBlockSize && !QueueBlock())
+      return false;
+  }
+  return !error();
+}
+
+bool CXmlCodecFile::QueueBlock() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Wait for the background thread to catch up, so memory use stays bounded
+  if (queue_.size() >= kMaxQueued && !failed_) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    cond_.wait(lock, [this] { return queue_.size() < kMaxQueued ||
+                                     failed_; });
+    stats_.stall_seconds_ += SecondsSince(start);
+  }
+  if (failed_)
+    return false;
+  queue_.push_back(std::vector<char>());
+  queue_.back().swap(block_);
+  if (!spare_.empty()) {
+    block_.swap(spare_.back());
+    spare_.pop_back();
+  } else {
+    block_.reserve(kBlockSize);
+  }
+  lock.unlock();
+  cond_.notify_all();
+  return true;
+}
+
+void CXmlCodecFile::WriteBlocks() {
+  std::vector<char> block;
+  std::vector<char> output(kFileChunkSize);
+  bool ok = true;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] { return !queue_.empty() || closing_; });
+      if (queue_.empty())
+        break;
+      block.swap(queue_.front());
+      queue_.pop_front();
+    }
+    cond_.notify_all();
+
+    if (stream_ != NULL)
+      ok = ok && Compress(block.data(), block.size(), false, output);
+    else
+      ok = ok && WriteFile(block.data(), block.size());
+    block.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    spare_.push_back(std::vector<char>());
+    spare_.back().swap(block);
+    if (!ok) {
+      // Keeps taking blocks, so the caller doesn't wait forever
+      failed_ = true;
+      cond_.notify_all();
+    }
+  }
+  if (!ok || (stream_ != NULL && !Compress(NULL, 0, true, output)))
+    Fail();
+}
+
+bool CXmlCodecFile::WriteFile(const char* data, size_t size) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  if (fwrite(data, 1, size, file_) != size)
+    return false;
+  Throttle(size);
+  uint64_t file_size;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.bytes_written_ += size;
+    stats_.write_seconds_ += SecondsSince(start);
+    file_size = stats_.bytes_written_;
+  }
+
+#if defined(__linux__)
+  // Start writing out what was just written, and drop what was handed over
+  // the time before, which is most likely on the disk by now. Pages still
+  // being written are left alone. An export then doesn't fill the cache
+  // with a file nobody reads back soon, as O_DIRECT would avoid, but
+  // without its alignment rules.
+  if (file_size - flushed_size_ >= kWriteBehindSize) {
+    const int fd = fileno(file_);
+    sync_file_range(fd, flushed_size_, file_size - flushed_size_,
+                    SYNC_FILE_RANGE_WRITE);
+    if (flushed_size_ > dropped_size_)
+      posix_fadvise(fd, dropped_size_, flushed_size_ - dropped_size_,
+                    POSIX_FADV_DONTNEED);
+    dropped_size_ = flushed_size_;
+    flushed_size_ = file_size;
+  }
+#endif
+  return true;
+}
+
+void CXmlCodecFile::Throttle(size_t size) {
+  if (rate_limit_ <= 0.0)
+    return;
+  io_bytes_ += size;
+  const std::chrono::duration<double> due(io_bytes_ / rate_limit_);
+  std::this_thread::sleep_until(
+      io_start_ +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(due));
+}
+
+bool CXmlCodecFile::Compress(const char* data, size_t size, bool finish,
+                             std::vector<char>& output) {
+  const char* in = data;
+  const char* in_end = data + size;
+  for (;;) {
+    char* out = &output[0];
+    if (!stream_->Run(&in, in_end, &out, out + output.size(), finish))
+      return false;
+    size_t count = out - &output[0];
+    if (count > 0 && !WriteFile(&output[0], count))
+      return false;
+    // A full output buffer may mean more output is pending
+    if (in == in_end && count < output.size() &&
+        (!finish || stream_->ended()))
+      return true;
+  }
+}
+
+void CXmlCodecFile::ReadBlocks() {
+  std::vector<char> input(kFileChunkSize);
+  const char* in = input.data();
+  const char* in_end = in;
+  bool end_of_file = false;
+  bool ok = true;
+  std::vector<char> block;
+  while (ok) {
+    block.resize(kBlockSize);
+    char* out = &block[0];
+    char* out_end = out + block.size();
+    while (out < out_end) {
+      const char* in_begin = in;
+      char* out_begin = out;
+      if (!stream_->Run(&in, in_end, &out, out_end, false)) {
+        ok = false;
+        break;
+      }
+      if (in != in_begin || out != out_begin)
+        continue;
+      // No progress without more input
+      if (end_of_file) {
+        // A truncated file ends in the middle of a compressed stream
+        ok = !ferror(file_) && stream_->ended();
+        break;
+      }
+      size_t read = fread(&input[0], 1, input.size(), file_);
+      Throttle(read);
+      in = input.data();
+      in_end = in + read;
+      end_of_file = read == 0;
+    }
+    block.resize(out - &block[0]);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!block.empty()) {
+      cond_.wait(lock, [this] { return queue_.size() < kMaxQueued ||
+                                       closing_; });
+      if (closing_)
+        break;
+      queue_.push_back(std::vector<char>());
+      queue_.back().swap(block);
+      if (!spare_.empty()) {
+        block.swap(spare_.back());
+        spare_.pop_back();
+      }
+    }
+    if (!ok)
+      failed_ = true;
+    if (!ok || end_of_file) {
+      finished_ = true;
+      lock.unlock();
+      cond_.notify_all();
+      break;
+    }
+    lock.unlock();
+    cond_.notify_all();
+  }
+}
@@ -0,0 +1,145 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLCODEC_H
+#define SKPTOXML_COMMON_XMLCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CXmlCodecStream;
+
+// Counters of a file being written. The caller stalls when it hands over a
+// block while the background thread is still busy with the ones before, so
+// stall time that grows with the file means the disk, or the codec, can't
+// keep up with the caller.
+struct XmlWriteStats {
+  XmlWriteStats()
+    : bytes_written_(0), stall_seconds_(0.0), write_seconds_(0.0) {}
+
+  // Bytes written to the file, after compression
+  uint64_t bytes_written_;
+  // Time the caller waited for the background thread
+  double stall_seconds_;
+  // Time the background thread spent writing to the file
+  double write_seconds_;
+};
+
+// CXmlCodecFile - Reads or writes a file that may be compressed. The codec
+// follows the extension: ".gz" files are gzip and ".zst" files are zstd,
+// anything else is read and written as is. A compressed file is compressed
+// or decompressed a block at a time on a background thread, which overlaps
+// with the caller's work, and is never held in memory as a whole. Files
+// written as is go through the background thread too, in blocks that are
+// large enough for the disk, so writing out one block overlaps with filling
+// the next. The file is opened with hints for sequential access, and on
+// Linux the pages of a written file are dropped from the cache behind the
+// writer.
+//
+// gzip needs zlib and zstd needs libzstd. Builds that link them define
+// SKPTOXML_HAVE_ZLIB or SKPTOXML_HAVE_ZSTD; without them files of that codec
+// fail to open.
+class CXmlCodecFile {
+ public:
+  enum Codec {
+    kCodecNone,
+    kCodecGzip,
+    kCodecZstd
+  };
+
+  CXmlCodecFile();
+  ~CXmlCodecFile();
+
+  static Codec CodecOf(const std::string& filename);
+  static bool IsSupported(Codec codec);
+  // Limits how fast each file opened afterwards is read or written, in
+  // bytes of the file per second, 0 for no limit. The time spent waiting
+  // counts as write time. Benchmarks use it to stand in for a slow network
+  // share.
+  static void SetRateLimit(double bytes_per_second);
+
+  bool OpenRead(const std::string& filename);
+  // The codec is given, so that a temporary file can be written with the
+  // codec of its final name. 'level' is the compression level, 0 for the
+  // codec's default.
+  bool OpenWrite(const std::string& filename, Codec codec, int level = 0);
+  // Waits for the background thread. Returns false if anything failed since
+  // the file was opened, writing the end of a compressed file included.
+  bool Close();
+  bool IsOpen() const { return file_ != NULL; }
+  Codec codec() const { return codec_; }
+
+  // Reads up to 'size' bytes, fewer only at the end of the file or after an
+  // error
+  size_t Read(char* data, size_t size);
+  bool Skip(size_t size);
+  bool Write(const char* data, size_t size);
+  bool error() const;
+  void GetWriteStats(XmlWriteStats& stats) const;
+
+ private:
+  // Not copyable
+  CXmlCodecFile(const CXmlCodecFile&);
+  CXmlCodecFile& operator=(const CXmlCodecFile&);
+
+  // Background thread loops
+  void ReadBlocks();
+  void WriteBlocks();
+  // Compresses 'size' bytes and writes out whatever the codec gives back.
+  // With 'finish', also ends the compressed stream.
+  bool Compress(const char* data, size_t size, bool finish,
+                std::vector<char>& output);
+  // Writes to the file on the background thread, counting the bytes and
+  // the time it takes
+  bool WriteFile(const char* data, size_t size);
+  // Waits until 'size' more bytes of I/O are within the rate limit
+  void Throttle(size_t size);
+  // Hands the block being filled to the background thread
+  bool QueueBlock();
+  // Takes the next decompressed block, false at the end of the file
+  bool NextBlock();
+  void Fail();
+
+ private:
+  FILE* file_;
+  Codec codec_;
+  bool writing_;
+  CXmlCodecStream* stream_;
+
+  // The block the caller fills or drains, and the read position in it
+  std::vector<char> block_;
+  size_t block_pos_;
+
+  // Shared with the background thread. Blocks go to it through queue_, or
+  // come from it when reading, and empty ones go back through spare_.
+  std::thread worker_;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::vector<char> > queue_;
+  std::vector<std::vector<char> > spare_;
+  // The caller is closing the file, so no more blocks follow when writing
+  // and none are needed when reading
+  bool closing_;
+  // The reader has queued its last block
+  bool finished_;
+  bool failed_;
+  XmlWriteStats stats_;
+  // How much of the file the background thread has handed to the system to
+  // write out, and dropped from the cache after that
+  uint64_t flushed_size_;
+  uint64_t dropped_size_;
+
+  // See SetRateLimit. Only one thread reads or writes the file at a time.
+  double rate_limit_;
+  std::chrono::steady_clock::time_point io_start_;
+  uint64_t io_bytes_;
+};
+
+#endif // SKPTOXML_COMMON_XMLCODEC_H
@@ -0,0 +1,377 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmldedup.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./xmlfile.h"
+
+using XmlGeomUtils::CPoint3d;
+
+// Where the canonical form of a definition's entities goes: into a hash to
+// find candidates, or into a string to compare two of them
+class CXmlHashSink {
+ public:
+  CXmlHashSink() : hash_(14695981039346656037ULL) {}
+
+  // FNV-1a, like the digests of CXmlFile
+  void Add(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+      hash_ = (hash_ ^ bytes[i]) * 1099511628211ULL;
+    }
+  }
+
+  uint64_t hash() const { return hash_; }
+
+ private:
+  uint64_t hash_;
+};
+
+class CXmlStringSink {
+ public:
+  void Add(const void* data, size_t size) {
+    text_.append(static_cast<const char*>(data), size);
+  }
+
+  const std::string& text() const { return text_; }
+
+ private:
+  std::string text_;
+};
+
+class CXmlDefinitionMerger {
+ public:
+  explicit CXmlDefinitionMerger(XmlModelInfo& model_info);
+
+  size_t Merge();
+
+ private:
+  enum { kNoDefinition = ~size_t(0) };
+  enum State { kUnvisited, kVisiting, kVisited };
+
+  size_t FindDefinition(const XmlComponentInstanceInfo& info) const;
+  // The definition that 'def' is merged into, itself if none. Compares
+  // 'def' with the definitions before it first if that hasn't been done.
+  size_t Canonical(size_t def);
+  void Visit(size_t def);
+  bool Identical(size_t def, size_t other);
+  // Makes instances refer to the definitions they are merged into
+  void Redirect(XmlEntitiesInfo& entities);
+
+  template <class Sink>
+  void AddEntities(const XmlEntitiesInfo& entities, Sink& sink);
+  template <class Sink>
+  void AddFace(const XmlFaceInfo& info, Sink& sink);
+  template <class Sink>
+  void AddFace(const CXmlFaceView& face, Sink& sink);
+  template <class Sink>
+  void AddEdge(const XmlEdgeInfo& info, Sink& sink);
+  template <class Sink>
+  void AddName(uint32_t id, const std::string& name, Sink& sink);
+  template <class Sink>
+  void AddTransform(const SUTransformation& transform, Sink& sink);
+  template <class Sink>
+  void AddPoint(const CPoint3d& point, Sink& sink);
+  template <class Sink>
+  void AddDouble(double value, Sink& sink);
+  template <class Sink>
+  void AddCount(size_t count, Sink& sink);
+
+ private:
+  XmlModelInfo& model_info_;
+  std::unordered_map<std::string, size_t> definitions_;
+  std::vector<State> states_;
+  std::vector<size_t> canonical_;
+  // The definitions kept so far, by the hash of their entities
+  std::unordered_multimap<uint64_t, size_t> kept_;
+};
+
+CXmlDefinitionMerger::CXmlDefinitionMerger(XmlModelInfo& model_info)
+    : model_info_(model_info) {
+}
+
+size_t CXmlDefinitionMerger::Merge() {
+  std::vector<XmlComponentDefinitionInfo>& defs = model_info_.definitions_;
+  for (size_t i = 0; i < defs.size(); ++i) {
+    if (!defs[i].loaded_)
+      return 0;
+  }
+
+  // Of definitions sharing a name, instances refer to the first one
+  definitions_.reserve(defs.size());
+  for (size_t i = 0; i < defs.size(); ++i) {
+    definitions_.insert(std::make_pair(defs[i].name_, i));
+  }
+  states_.assign(defs.size(), kUnvisited);
+  canonical_.resize(defs.size());
+  for (size_t i = 0; i < defs.size(); ++i) {
+    canonical_[i] = i;
+  }
+  for (size_t i = 0; i < defs.size(); ++i) {
+    Canonical(i);
+  }
+  // A definition can be visited before the ones ahead of it through an
+  // instance, so the first of a set isn't always the one the others were
+  // merged into. The sets stay the same.
+  std::vector<size_t> first(defs.size(), kNoDefinition);
+  for (size_t i = 0; i < defs.size(); ++i) {
+    size_t& first_of_set = first[canonical_[i]];
+    if (first_of_set == kNoDefinition)
+      first_of_set = i;
+    canonical_[i] = first_of_set;
+  }
+
+  size_t merged = 0;
+  for (size_t i = 0; i < defs.size(); ++i) {
+    if (canonical_[i] != i) {
+      ++merged;
+      std::vector<std::string>& aliases = defs[canonical_[i]].aliases_;
+      aliases.push_back(defs[i].name_);
+      aliases.insert(aliases.end(), defs[i].aliases_.begin(),
+                     defs[i].aliases_.end());
+    }
+  }
+  if (merged == 0)
+    return 0;
+
+  // Kept definitions can come after the ones merged into them, so they are
+  // only moved once all instances have their new names
+  Redirect(model_info_.entities_);
+  for (size_t i = 0; i < defs.size(); ++i) {
+    if (canonical_[i] == i)
+      Redirect(defs[i].entities_);
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < defs.size(); ++i) {
+    if (canonical_[i] != i)
+      continue;
+    if (kept != i)
+      defs[kept] = std::move(defs[i]);
+    ++kept;
+  }
+  defs.erase(defs.begin() + kept, defs.end());
+  return merged;
+}
+
+size_t CXmlDefinitionMerger::FindDefinition(
+    const XmlComponentInstanceInfo& info) const {
+  const std::string& name =
+      model_info_.names_.Resolve(info.definition_id_, info.definition_name_);
+  std::unordered_map<std::string, size_t>::const_iterator it =
+      definitions_.find(name);
+  return it != definitions_.end() ? it->second : size_t(kNoDefinition);
+}
+
+size_t CXmlDefinitionMerger::Canonical(size_t def) {
+  // A definition containing itself can only be compared by name
+  if (states_[def] == kUnvisited)
+    Visit(def);
+  return canonical_[def];
+}
+
+void CXmlDefinitionMerger::Visit(size_t def) {
+  states_[def] = kVisiting;
+  CXmlHashSink sink;
+  AddEntities(model_info_.definitions_[def].entities_, sink);
+  typedef std::unordered_multimap<uint64_t, size_t>::const_iterator Iter;
+  std::pair<Iter, Iter> range = kept_.equal_range(sink.hash());
+  for (Iter it = range.first; it != range.second; ++it) {
+    if (Identical(def, it->second)) {
+      canonical_[def] = it->second;
+      break;
+    }
+  }
+  if (canonical_[def] == def)
+    kept_.insert(std::make_pair(sink.hash(), def));
+  states_[def] = kVisited;
+}
+
+bool CXmlDefinitionMerger::Identical(size_t def, size_t other) {
+  CXmlStringSink def_sink;
+  CXmlStringSink other_sink;
+  AddEntities(model_info_.definitions_[def].entities_, def_sink);
+  AddEntities(model_info_.definitions_[other].entities_, other_sink);
+  return def_sink.text() == other_sink.text();
+}
+
+void CXmlDefinitionMerger::Redirect(XmlEntitiesInfo& entities) {
+  for (size_t i = 0; i < entities.component_instances_.size(); ++i) {
+    XmlComponentInstanceInfo& info = entities.component_instances_[i];
+    const size_t def = FindDefinition(info);
+    if (def == kNoDefinition || canonical_[def] == def)
+      continue;
+    const std::string& name = model_info_.definitions_[canonical_[def]].name_;
+    if (info.definition_id_ != CXmlNameTable::kNoName)
+      info.definition_id_ = model_info_.names_.Intern(name);
+    else
+      info.definition_name_ = name;
+  }
+  for (size_t i = 0; i < entities.groups_.size(); ++i) {
+    Redirect(*entities.groups_[i].entities_);
+  }
+}
+
+// The canonical form has the same content as the file, in the same order.
+// Each list is preceded by its size, so entities can't move from one list
+// to the next.
+template <class Sink>
+void CXmlDefinitionMerger::AddEntities(const XmlEntitiesInfo& entities,
+                                       Sink& sink) {
+  AddCount(entities.component_instances_.size(), sink);
+  for (size_t i = 0; i < entities.component_instances_.size(); ++i) {
+    const XmlComponentInstanceInfo& info = entities.component_instances_[i];
+    const size_t def = FindDefinition(info);
+    if (def != kNoDefinition) {
+      AddCount(Canonical(def), sink);
+    } else {
+      AddCount(kNoDefinition, sink);
+      AddName(info.definition_id_, info.definition_name_, sink);
+    }
+    AddName(info.layer_id_, info.layer_name_, sink);
+    AddName(info.material_id_, info.material_name_, sink);
+    AddTransform(info.transform_, sink);
+  }
+
+  AddCount(entities.groups_.size(), sink);
+  for (size_t i = 0; i < entities.groups_.size(); ++i) {
+    const XmlGroupInfo& info = entities.groups_[i];
+    AddEntities(*info.entities_, sink);
+    AddTransform(info.transform_, sink);
+  }
+
+  // Definitions of one model keep their faces in the same kind of container
+  AddCount(entities.faces_.size() + entities.face_store_.size(), sink);
+  for (size_t i = 0; i < entities.faces_.size(); ++i) {
+    AddFace(entities.faces_[i], sink);
+  }
+  for (CXmlFaceStore::const_iterator it = entities.face_store_.begin();
+       it != entities.face_store_.end(); ++it) {
+    AddFace(*it, sink);
+  }
+
+  AddCount(entities.edges_.size(), sink);
+  for (size_t i = 0; i < entities.edges_.size(); ++i) {
+    AddEdge(entities.edges_[i], sink);
+  }
+
+  AddCount(entities.curves_.size(), sink);
+  for (size_t i = 0; i < entities.curves_.size(); ++i) {
+    const XmlCurveInfo& info = entities.curves_[i];
+    AddCount(info.edges_.size(), sink);
+    for (size_t j = 0; j < info.edges_.size(); ++j) {
+      AddEdge(info.edges_[j], sink);
+    }
+  }
+}
+
+template <class Sink>
+void CXmlDefinitionMerger::AddFace(const XmlFaceInfo& info, Sink& sink) {
+  AddName(info.layer_id_, info.layer_name_, sink);
+  AddName(info.front_mat_id_, info.front_mat_name_, sink);
+  AddName(info.back_mat_id_, info.back_mat_name_, sink);
+  const unsigned char flags[3] = {
+    info.has_front_texture_, info.has_back_texture_, info.has_single_loop_
+  };
+  sink.Add(flags, sizeof(flags));
+  AddCount(info.vertices_.size(), sink);
+  for (size_t i = 0; i < info.vertices_.size(); ++i) {
+    const XmlFaceVertex& vertex = info.vertices_[i];
+    AddPoint(vertex.vertex_, sink);
+    if (info.has_front_texture_)
+      AddPoint(vertex.front_texture_coord_, sink);
+    if (info.has_back_texture_)
+      AddPoint(vertex.back_texture_coord_, sink);
+  }
+  AddCount(info.indices_.size(), sink);
+  if (!info.indices_.empty()) {
+    sink.Add(&info.indices_[0], info.indices_.size() * sizeof(uint32_t));
+  }
+}
+
+template <class Sink>
+void CXmlDefinitionMerger::AddFace(const CXmlFaceView& face, Sink& sink) {
+  static const std::string kNoString;
+  AddName(face.layer_id(), kNoString, sink);
+  AddName(face.front_mat_id(), kNoString, sink);
+  AddName(face.back_mat_id(), kNoString, sink);
+  const unsigned char flags[3] = {
+    face.has_front_texture(), face.has_back_texture(), face.has_single_loop()
+  };
+  sink.Add(flags, sizeof(flags));
+  const size_t count = face.vertex_count();
+  AddCount(count, sink);
+  const double* positions = face.positions();
+  for (size_t i = 0; i < count; ++i) {
+    AddPoint(CPoint3d(positions[i * 3], positions[i * 3 + 1],
+                      positions[i * 3 + 2]), sink);
+    if (face.has_front_texture())
+      AddPoint(face.front_texture_coord(i), sink);
+    if (face.has_back_texture())
+      AddPoint(face.back_texture_coord(i), sink);
+  }
+  AddCount(face.index_count(), sink);
+  if (face.index_count() > 0) {
+    sink.Add(face.indices(), face.index_count() * sizeof(uint32_t));
+  }
+}
+
+template <class Sink>
+void CXmlDefinitionMerger::AddEdge(const XmlEdgeInfo& info, Sink& sink) {
+  const unsigned char flags[2] = { info.has_layer_, info.has_color_ };
+  sink.Add(flags, sizeof(flags));
+  if (info.has_layer_)
+    AddName(info.layer_id_, info.layer_name_, sink);
+  if (info.has_color_)
+    sink.Add(&info.color_, sizeof(info.color_));
+  AddPoint(info.start_, sink);
+  AddPoint(info.end_, sink);
+}
+
+template <class Sink>
+void CXmlDefinitionMerger::AddName(uint32_t id, const std::string& name,
+                                   Sink& sink) {
+  // With the terminator, so two names don't run together
+  const std::string& value = model_info_.names_.Resolve(id, name);
+  sink.Add(value.c_str(), value.size() + 1);
+}
+
+template <class Sink>
+void CXmlDefinitionMerger::AddTransform(const SUTransformation& transform,
+                                        Sink& sink) {
+  for (int i = 0; i < 16; ++i) {
+    AddDouble(transform.values[i], sink);
+  }
+}
+
+template <class Sink>
+void CXmlDefinitionMerger::AddPoint(const CPoint3d& point, Sink& sink) {
+  AddDouble(point.x(), sink);
+  AddDouble(point.y(), sink);
+  AddDouble(point.z(), sink);
+}
+
+template <class Sink>
+void CXmlDefinitionMerger::AddDouble(double value, Sink& sink) {
+  // -0.0 is written as 0 and has to match it
+  value += 0.0;
+  sink.Add(&value, sizeof(value));
+}
+
+template <class Sink>
+void CXmlDefinitionMerger::AddCount(size_t count, Sink& sink) {
+  const uint64_t value = count;
+  sink.Add(&value, sizeof(value));
+}
+
+namespace XmlDedup {
+
+size_t MergeIdenticalDefinitions(XmlModelInfo& model_info) {
+  CXmlDefinitionMerger merger(model_info);
+  return merger.Merge();
+}
+
+} // end namespace XmlDedup
@@ -0,0 +1,34 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLDEDUP_H
+#define SKPTOXML_COMMON_XMLDEDUP_H
+
+#include <stddef.h>
+
+struct XmlModelInfo;
+
+// Removes duplicate content from a model info.
+
+namespace XmlDedup {
+
+// Merges component definitions whose entities are identical, such as the
+// copies a library brings in as "Chair#1", "Chair#2" and so on. Faces, edges,
+// instances and groups have to match value for value, including the
+// materials and layers they name and the order they come in. Definitions
+// whose instances refer to merged definitions are compared after those are
+// merged, so nested copies are found too.
+//
+// The first definition of each set of identical ones is kept, and the names
+// of the others are added to its aliases_. They are removed from
+// definitions_, and the component instances of the model and of the kept
+// definitions are changed to refer to the kept one, by name or name ID as
+// they were read.
+//
+// A model with lazy definitions that haven't been loaded is left as is,
+// since CXmlFile finds those by their index. Returns the number of
+// definitions removed.
+size_t MergeIdenticalDefinitions(XmlModelInfo& model_info);
+
+} // end namespace XmlDedup
+
+#endif // SKPTOXML_COMMON_XMLDEDUP_H
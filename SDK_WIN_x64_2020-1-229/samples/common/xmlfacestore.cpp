@@ -0,0 +1,222 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmlfacestore.h"
+#include "./xmlfile.h"
+
+using namespace XmlGeomUtils;
+
+//------------------------------------------------------------------------------
+
+uint32_t CXmlFaceView::layer_id() const {
+  return store_->layers_[face_];
+}
+
+uint32_t CXmlFaceView::front_mat_id() const {
+  return store_->front_materials_[face_];
+}
+
+uint32_t CXmlFaceView::back_mat_id() const {
+  return store_->back_materials_[face_];
+}
+
+bool CXmlFaceView::has_front_texture() const {
+  return (store_->flags_[face_] & CXmlFaceStore::kHasFrontTexture) != 0;
+}
+
+bool CXmlFaceView::has_back_texture() const {
+  return (store_->flags_[face_] & CXmlFaceStore::kHasBackTexture) != 0;
+}
+
+bool CXmlFaceView::has_single_loop() const {
+  return (store_->flags_[face_] & CXmlFaceStore::kHasSingleLoop) != 0;
+}
+
+size_t CXmlFaceView::vertex_count() const {
+  return store_->vertex_offsets_[face_ + 1] - store_->vertex_offsets_[face_];
+}
+
+CPoint3d CXmlFaceView::vertex(size_t i) const {
+  const double* point = &store_->positions_[
+      (store_->vertex_offsets_[face_] + i) * 3];
+  return CPoint3d(point[0], point[1], point[2]);
+}
+
+CPoint3d CXmlFaceView::front_texture_coord(size_t i) const {
+  const uint32_t first = store_->front_texture_coords_[face_];
+  if (first == CXmlFaceStore::kNoTextureCoords)
+    return CPoint3d();
+  const double* coord = &store_->texture_coords_[(first + i) * 2];
+  return CPoint3d(coord[0], coord[1], 0);
+}
+
+CPoint3d CXmlFaceView::back_texture_coord(size_t i) const {
+  const uint32_t first = store_->back_texture_coords_[face_];
+  if (first == CXmlFaceStore::kNoTextureCoords)
+    return CPoint3d();
+  const double* coord = &store_->texture_coords_[(first + i) * 2];
+  return CPoint3d(coord[0], coord[1], 0);
+}
+
+size_t CXmlFaceView::index_count() const {
+  return store_->index_offsets_[face_ + 1] - store_->index_offsets_[face_];
+}
+
+uint32_t CXmlFaceView::index(size_t i) const {
+  return store_->indices_[store_->index_offsets_[face_] + i];
+}
+
+const double* CXmlFaceView::positions() const {
+  if (vertex_count() == 0)
+    return NULL;
+  return &store_->positions_[store_->vertex_offsets_[face_] * 3];
+}
+
+const uint32_t* CXmlFaceView::indices() const {
+  if (index_count() == 0)
+    return NULL;
+  return &store_->indices_[store_->index_offsets_[face_]];
+}
+
+void CXmlFaceView::GetFaceInfo(XmlFaceInfo& info) const {
+  info.layer_name_.clear();
+  info.front_mat_name_.clear();
+  info.back_mat_name_.clear();
+  info.layer_id_ = layer_id();
+  info.front_mat_id_ = front_mat_id();
+  info.back_mat_id_ = back_mat_id();
+  info.has_front_texture_ = has_front_texture();
+  info.has_back_texture_ = has_back_texture();
+  info.has_single_loop_ = has_single_loop();
+
+  const size_t count = vertex_count();
+  info.vertices_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    XmlFaceVertex& vertex_info = info.vertices_[i];
+    vertex_info.vertex_ = vertex(i);
+    vertex_info.front_texture_coord_ = front_texture_coord(i);
+    vertex_info.back_texture_coord_ = back_texture_coord(i);
+  }
+  const uint32_t* first = indices();
+  info.indices_.assign(first, first + index_count());
+}
+
+//------------------------------------------------------------------------------
+
+CXmlFaceStore::CXmlFaceStore() {
+  clear();
+}
+
+void CXmlFaceStore::clear() {
+  layers_.clear();
+  front_materials_.clear();
+  back_materials_.clear();
+  flags_.clear();
+  front_texture_coords_.clear();
+  back_texture_coords_.clear();
+  vertex_offsets_.assign(1, 0);
+  index_offsets_.assign(1, 0);
+  positions_.clear();
+  texture_coords_.clear();
+  indices_.clear();
+}
+
+void CXmlFaceStore::reserve(size_t faces) {
+  layers_.reserve(faces);
+  front_materials_.reserve(faces);
+  back_materials_.reserve(faces);
+  flags_.reserve(faces);
+  front_texture_coords_.reserve(faces);
+  back_texture_coords_.reserve(faces);
+  vertex_offsets_.reserve(faces + 1);
+  index_offsets_.reserve(faces + 1);
+}
+
+void CXmlFaceStore::AddFace(const XmlFaceInfo& info) {
+  layers_.push_back(info.layer_id_);
+  front_materials_.push_back(info.front_mat_id_);
+  back_materials_.push_back(info.back_mat_id_);
+  uint8_t flags = 0;
+  if (info.has_front_texture_)
+    flags |= kHasFrontTexture;
+  if (info.has_back_texture_)
+    flags |= kHasBackTexture;
+  if (info.has_single_loop_)
+    flags |= kHasSingleLoop;
+  flags_.push_back(flags);
+
+  const XmlArenaVector<XmlFaceVertex>& vertices = info.vertices_;
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    positions_.push_back(vertices[i].vertex_.x());
+    positions_.push_back(vertices[i].vertex_.y());
+    positions_.push_back(vertices[i].vertex_.z());
+  }
+  vertex_offsets_.push_back(static_cast<uint32_t>(positions_.size() / 3));
+
+  uint32_t front_coords = kNoTextureCoords;
+  if (info.has_front_texture_) {
+    front_coords = static_cast<uint32_t>(texture_coords_.size() / 2);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      texture_coords_.push_back(vertices[i].front_texture_coord_.x());
+      texture_coords_.push_back(vertices[i].front_texture_coord_.y());
+    }
+  }
+  front_texture_coords_.push_back(front_coords);
+
+  uint32_t back_coords = kNoTextureCoords;
+  if (info.has_back_texture_) {
+    back_coords = static_cast<uint32_t>(texture_coords_.size() / 2);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      texture_coords_.push_back(vertices[i].back_texture_coord_.x());
+      texture_coords_.push_back(vertices[i].back_texture_coord_.y());
+    }
+  }
+  back_texture_coords_.push_back(back_coords);
+
+  indices_.insert(indices_.end(), info.indices_.begin(), info.indices_.end());
+  index_offsets_.push_back(static_cast<uint32_t>(indices_.size()));
+}
+
+void CXmlFaceStore::RemapNames(const std::vector<uint32_t>& ids) {
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    layers_[i] = ids[layers_[i]];
+    front_materials_[i] = ids[front_materials_[i]];
+    back_materials_[i] = ids[back_materials_[i]];
+  }
+}
+
+void CXmlFaceStore::GetMaterialBatches(
+    std::vector<uint32_t>& order, std::vector<XmlFaceBatch>& batches) const {
+  // Counting sort on the material IDs, which are small and dense
+  uint32_t max_material = 0;
+  for (size_t i = 0; i < front_materials_.size(); ++i) {
+    if (front_materials_[i] > max_material)
+      max_material = front_materials_[i];
+  }
+  std::vector<uint32_t> batch_of_material(max_material + 1, 0xffffffff);
+  batches.clear();
+  for (size_t i = 0; i < front_materials_.size(); ++i) {
+    uint32_t& batch = batch_of_material[front_materials_[i]];
+    if (batch == 0xffffffff) {
+      batch = static_cast<uint32_t>(batches.size());
+      XmlFaceBatch new_batch = { front_materials_[i], 0, 0 };
+      batches.push_back(new_batch);
+    }
+    ++batches[batch].count_;
+  }
+
+  uint32_t first = 0;
+  for (size_t i = 0; i < batches.size(); ++i) {
+    batches[i].first_ = first;
+    first += batches[i].count_;
+  }
+
+  order.resize(front_materials_.size());
+  std::vector<uint32_t> next(batches.size());
+  for (size_t i = 0; i < batches.size(); ++i) {
+    next[i] = batches[i].first_;
+  }
+  for (size_t i = 0; i < front_materials_.size(); ++i) {
+    const uint32_t batch = batch_of_material[front_materials_[i]];
+    order[next[batch]++] = static_cast<uint32_t>(i);
+  }
+}
@@ -0,0 +1,155 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLFACESTORE_H
+#define SKPTOXML_COMMON_XMLFACESTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <iterator>
+#include <vector>
+
+#include "./xmlgeomutils.h"
+
+struct XmlFaceInfo;
+class CXmlFaceStore;
+
+// A run of faces in a CXmlFaceStore sharing the same front material
+struct XmlFaceBatch {
+  uint32_t material_id_;
+  uint32_t first_;  // into the order given by GetMaterialBatches
+  uint32_t count_;
+};
+
+// CXmlFaceView - Read-only access to one face of a CXmlFaceStore, with the
+// same information as an XmlFaceInfo. Stays valid until faces are added to
+// the store.
+class CXmlFaceView {
+ public:
+  CXmlFaceView(const CXmlFaceStore* store, size_t face)
+    : store_(store), face_(face) {}
+
+  const CXmlFaceStore* store() const { return store_; }
+  size_t face() const { return face_; }
+
+  // Name IDs, see XmlFaceInfo::layer_id_
+  uint32_t layer_id() const;
+  uint32_t front_mat_id() const;
+  uint32_t back_mat_id() const;
+  bool has_front_texture() const;
+  bool has_back_texture() const;
+  bool has_single_loop() const;
+
+  // See XmlFaceInfo::vertices_ and indices_
+  size_t vertex_count() const;
+  XmlGeomUtils::CPoint3d vertex(size_t i) const;
+  XmlGeomUtils::CPoint3d front_texture_coord(size_t i) const;
+  XmlGeomUtils::CPoint3d back_texture_coord(size_t i) const;
+  size_t index_count() const;
+  uint32_t index(size_t i) const;
+  // The face's part of the store's buffers: x y z per vertex, and the
+  // indices. NULL if the face has none.
+  const double* positions() const;
+  const uint32_t* indices() const;
+
+  // Copies the face into an XmlFaceInfo, with its names as IDs
+  void GetFaceInfo(XmlFaceInfo& info) const;
+
+ private:
+  const CXmlFaceStore* store_;
+  size_t face_;
+};
+
+// CXmlFaceStore - The faces of an entities block kept in a handful of flat
+// arrays instead of one XmlFaceInfo each: every face attribute has its own
+// array, the vertices of all faces share one position and one texture
+// coordinate buffer, and names are kept as IDs into the model's
+// CXmlNameTable. Loading a large model this way takes a few big allocations
+// instead of several per face.
+class CXmlFaceStore {
+ public:
+  // Faces without a texture on a side have this as their first coordinate
+  enum { kNoTextureCoords = 0xffffffff };
+
+  class const_iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef CXmlFaceView value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const CXmlFaceView* pointer;
+    typedef const CXmlFaceView& reference;
+
+    const_iterator(const CXmlFaceStore* store, size_t face)
+      : view_(store, face) {}
+
+    reference operator*() const { return view_; }
+    pointer operator->() const { return &view_; }
+    const_iterator& operator++() {
+      view_ = CXmlFaceView(view_.store(), view_.face() + 1);
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator it = *this;
+      ++*this;
+      return it;
+    }
+    bool operator==(const const_iterator& it) const {
+      return view_.face() == it.view_.face();
+    }
+    bool operator!=(const const_iterator& it) const { return !(*this == it); }
+
+   private:
+    CXmlFaceView view_;
+  };
+
+  CXmlFaceStore();
+
+  size_t size() const { return layers_.size(); }
+  bool empty() const { return layers_.empty(); }
+  void clear();
+  // Preallocates room for a number of faces
+  void reserve(size_t faces);
+
+  // Adds a face read with interned names. Its name strings are ignored.
+  void AddFace(const XmlFaceInfo& info);
+  // Replaces every name ID by ids[ID], for faces read into a table of
+  // their own
+  void RemapNames(const std::vector<uint32_t>& ids);
+  CXmlFaceView operator[](size_t face) const {
+    return CXmlFaceView(this, face);
+  }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+
+  // Lists the faces grouped by front material, in order of first use of the
+  // material. Each batch is a range of 'order'.
+  void GetMaterialBatches(std::vector<uint32_t>& order,
+                          std::vector<XmlFaceBatch>& batches) const;
+
+ private:
+  friend class CXmlFaceView;
+
+  enum {
+    kHasFrontTexture = 1,
+    kHasBackTexture = 2,
+    kHasSingleLoop = 4
+  };
+
+ private:
+  // One entry per face
+  std::vector<uint32_t> layers_;
+  std::vector<uint32_t> front_materials_;
+  std::vector<uint32_t> back_materials_;
+  std::vector<uint8_t> flags_;
+  std::vector<uint32_t> front_texture_coords_;
+  std::vector<uint32_t> back_texture_coords_;
+
+  // One more entry than faces: face i owns [offsets_[i], offsets_[i + 1])
+  std::vector<uint32_t> vertex_offsets_;
+  std::vector<uint32_t> index_offsets_;
+
+  std::vector<double> positions_;       // x y z per vertex
+  std::vector<double> texture_coords_;  // u v per textured side and vertex
+  std::vector<uint32_t> indices_;
+};
+
+#endif // SKPTOXML_COMMON_XMLFACESTORE_H
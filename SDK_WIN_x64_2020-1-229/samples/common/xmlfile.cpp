@@ -1,9 +1,21 @@
 // Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
 
+#include <algorithm>
+#include <cstring>
 #include <vector>
+#include <map>
 #include <sstream>
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
 #include "./xmlfile.h"
+#include "./xmlcodec.h"
+#include "./xmlmappedfile.h"
+#include "./xmlparallel.h"
+#include "./xmlstreamreader.h"
+#include "./xmltagtable.h"
 #include "./tinyxml2.h"
 
 // XML tags
@@ -14,6 +26,7 @@ static const std::string kLayersTag("Layers");
 static const std::string kLayerTag("Layer");
 static const std::string kCompDefsTag("ComponentDefinitions");
 static const std::string kCompDefTag("ComponentDefinition");
+static const std::string kAliasTag("Alias");
 static const std::string kTransformTag("Transformation");
 static const std::string kMaterialsTag("Materials");
 static const std::string kMaterialTag("Material");
@@ -49,72 +62,487 @@ static const std::string kUTag("u");
 static const std::string kVTag("v");
 static const std::string kStartTag("Start");
 static const std::string kEndTag("End");
+static const std::string kPointsTag("Points");
+static const std::string kIndicesTag("Indices");
+
+// IDs of the tags above in kElementTags and kAttributeTags, so the readers can
+// compare integers instead of names. The order must match kElementNames and
+// MakeAttributeNames().
+enum XmlElementId {
+  kElemUnknown = CXmlTagTable::kUnknown,
+  kElemSkpToXML,
+  kElemLayers,
+  kElemLayer,
+  kElemCompDefs,
+  kElemCompDef,
+  kElemTransform,
+  kElemMaterials,
+  kElemMaterial,
+  kElemGeometry,
+  kElemComponentInstance,
+  kElemCurve,
+  kElemGroup,
+  kElemTexture,
+  kElemFace,
+  kElemEdge,
+  kElemFrontMaterial,
+  kElemBackMaterial,
+  kElemTriangles,
+  kElemPoint,
+  kElemFrontTextureCoords,
+  kElemBackTextureCoords,
+  kElemLoop,
+  kElemVertex,
+  kElemStart,
+  kElemEnd,
+  kElemPoints,
+  kElemIndices,
+  kElemAlias
+};
+
+enum XmlAttributeId {
+  kAttrUnknown = CXmlTagTable::kUnknown,
+  kAttrName,
+  kAttrVisible,
+  kAttrAlpha,
+  kAttrPath,
+  kAttrSScale,
+  kAttrTScale,
+  kAttrColor,
+  kAttrCount,
+  kAttrHasTexture,
+  kAttrX,
+  kAttrY,
+  kAttrZ,
+  kAttrU,
+  kAttrV,
+  kAttrXMLVersion,
+  // The 16 transformation values, see MatrixAttribId()
+  kAttrMatrix,
+  kAttrMatrixEnd = kAttrMatrix + 16
+};
+
+static const std::string kElementNames[] = {
+  kSkpToXMLTag, kLayersTag, kLayerTag, kCompDefsTag, kCompDefTag,
+  kTransformTag, kMaterialsTag, kMaterialTag, kGeometryTag,
+  kComponentInstanceTag, kCurveTag, kGroupTag, kTextureTag, kFaceTag,
+  kEdgeTag, kFrontMaterialTag, kBackMaterialTag, kTrianglesTag, kPointTag,
+  kFrontTextureCoordsTag, kBackTextureCoordsTag, kLoopTag, kVertexTag,
+  kStartTag, kEndTag, kPointsTag, kIndicesTag, kAliasTag
+};
+
+static int MatrixAttribId(int row, int col) {
+  return kAttrMatrix + col * 4 + row;
+}
+
+static std::vector<std::string> MakeAttributeNames() {
+  const std::string names[] = {
+    kNameTag, kVisibleTag, kAlphaTag, kPathTag, kSScaleTag, kTScaleTag,
+    kColorTag, kCountTag, kHasTextureTag, kXTag, kYTag, kZTag, kUTag, kVTag,
+    kXMLVersionTag
+  };
+  std::vector<std::string> result(names,
+                                  names + sizeof(names) / sizeof(*names));
+  // Transformation values are named m<row><col>, in MatrixAttribId() order
+  for (int col = 0; col < 4; ++col) {
+    for (int row = 0; row < 4; ++row) {
+      const char name[4] = { 'm', static_cast<char>('0' + row),
+                             static_cast<char>('0' + col), 0 };
+      result.push_back(name);
+    }
+  }
+  return result;
+}
+
+static const CXmlTagTable kElementTags(
+    kElementNames, sizeof(kElementNames) / sizeof(*kElementNames));
+static const std::vector<std::string> kAttributeNames = MakeAttributeNames();
+static const CXmlTagTable kAttributeTags(kAttributeNames.data(),
+                                         kAttributeNames.size());
+
+// The ID of a DOM node's name in kElementTags, kElemUnknown for no node or a
+// node that isn't an element
+static int ElementId(const tinyxml2::XMLNode* node) {
+  if (node == NULL)
+    return kElemUnknown;
+  const tinyxml2::XMLElement* elem = node->ToElement();
+  return elem != NULL ? kElementTags.Find(elem->Value()) : kElemUnknown;
+}
+
+// Reads the double attributes with IDs 'ids' of an element into 'values',
+// in one pass over its attributes rather than a search for each. As with
+// QueryDoubleAttribute(), the first of duplicate attributes wins. Returns
+// false unless all 'count' of them are there and are numbers.
+static bool ReadDoubleAttributes(const tinyxml2::XMLElement* elem,
+                                 const int* ids, int count, double* values) {
+  unsigned found = 0;
+  bool ok = true;
+  for (const tinyxml2::XMLAttribute* attrib = elem->FirstAttribute();
+       attrib != NULL; attrib = attrib->Next()) {
+    const int id = kAttributeTags.Find(attrib->Name());
+    for (int i = 0; i < count; ++i) {
+      if (id == ids[i] && (found & (1U << i)) == 0) {
+        found |= 1U << i;
+        ok &= attrib->QueryDoubleValue(&values[i]) == tinyxml2::XML_NO_ERROR;
+        break;
+      }
+    }
+  }
+  return ok && found == (1U << count) - 1;
+}
+
+// Reads the Name and HasTexture attributes of a face's material element in
+// one pass. The name is cleared if there is none, the flag is left alone.
+static void ReadFaceMaterial(const tinyxml2::XMLElement* elem,
+                             std::string& name, bool& has_texture) {
+  bool found_name = false;
+  bool found_texture = false;
+  for (const tinyxml2::XMLAttribute* attrib = elem->FirstAttribute();
+       attrib != NULL; attrib = attrib->Next()) {
+    const int id = kAttributeTags.Find(attrib->Name());
+    if (id == kAttrName && !found_name) {
+      found_name = true;
+      name = attrib->Value();
+    } else if (id == kAttrHasTexture && !found_texture) {
+      found_texture = true;
+      attrib->QueryBoolValue(&has_texture);
+    }
+  }
+  if (!found_name)
+    name.clear();
+}
 
 using namespace XmlGeomUtils;
 
 //------------------------------------------------------------------------------
 
-XmlGroupInfo::XmlGroupInfo() {
-  entities_ = new XmlEntitiesInfo;
+XmlGroupInfo::XmlGroupInfo(CXmlArena* arena)
+  : entities_(new XmlEntitiesInfo(arena)) {
 }
 
-XmlGroupInfo::XmlGroupInfo(const XmlGroupInfo& info) {
-  entities_ = new XmlEntitiesInfo(*info.entities_);
-  transform_ = info.transform_;
+// A group that was moved from has no entities, it copies as an empty one
+XmlGroupInfo::XmlGroupInfo(const XmlGroupInfo& info)
+  : entities_(info.entities_ ? new XmlEntitiesInfo(*info.entities_)
+                             : new XmlEntitiesInfo()),
+    transform_(info.transform_) {
+}
+
+XmlGroupInfo::XmlGroupInfo(XmlGroupInfo&& info) noexcept
+  : entities_(std::move(info.entities_)),
+    transform_(info.transform_) {
 }
 
 XmlGroupInfo::~XmlGroupInfo() {
-  delete entities_;
 }
 
 const XmlGroupInfo& XmlGroupInfo::operator = (const XmlGroupInfo& info) {
-  *entities_ = *info.entities_;
+  if (!entities_)
+    entities_.reset(new XmlEntitiesInfo());
+  if (info.entities_)
+    *entities_ = *info.entities_;
+  else
+    *entities_ = XmlEntitiesInfo(entities_->arena());
   transform_ = info.transform_;
   return *this;
 }
 
+XmlGroupInfo& XmlGroupInfo::operator = (XmlGroupInfo&& info) noexcept {
+  entities_ = std::move(info.entities_);
+  transform_ = info.transform_;
+  return *this;
+}
+
+// Vectors of these relocate by copying unless moving can't throw
+static_assert(std::is_nothrow_move_constructible<XmlGroupInfo>::value &&
+              std::is_nothrow_move_constructible<XmlEntitiesInfo>::value &&
+              std::is_nothrow_move_constructible<XmlFaceInfo>::value,
+              "entities must be nothrow movable");
+
+void XmlEntitiesInfo::CollectBlocks(
+    std::vector<const XmlEntitiesInfo*>& blocks) const {
+  blocks.push_back(this);
+  for (size_t i = 0; i < groups_.size(); ++i) {
+    static_cast<const XmlEntitiesInfo&>(*groups_[i].entities_)
+        .CollectBlocks(blocks);
+  }
+}
+
+void XmlEntitiesInfo::CollectBlocks(std::vector<XmlEntitiesInfo*>& blocks) {
+  blocks.push_back(this);
+  for (size_t i = 0; i < groups_.size(); ++i) {
+    groups_[i].entities_->CollectBlocks(blocks);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+XmlModelInfo& XmlModelInfo::operator=(const XmlModelInfo& info) {
+  // The current entities may be allocated from the current arena, keep it
+  // until they are gone
+  std::shared_ptr<CXmlArena> old_arena = arena_;
+  std::vector<std::shared_ptr<CXmlArena> > old_thread_arenas = thread_arenas_;
+  names_ = info.names_;
+  layers_ = info.layers_;
+  materials_ = info.materials_;
+  definitions_ = info.definitions_;
+  entities_ = info.entities_;
+  arena_ = info.arena_;
+  thread_arenas_ = info.thread_arenas_;
+  return *this;
+}
+
+XmlModelInfo& XmlModelInfo::operator=(XmlModelInfo&& info) {
+  std::shared_ptr<CXmlArena> old_arena = arena_;
+  std::vector<std::shared_ptr<CXmlArena> > old_thread_arenas = thread_arenas_;
+  names_ = std::move(info.names_);
+  layers_ = std::move(info.layers_);
+  materials_ = std::move(info.materials_);
+  definitions_ = std::move(info.definitions_);
+  entities_ = std::move(info.entities_);
+  arena_ = std::move(info.arena_);
+  thread_arenas_ = std::move(info.thread_arenas_);
+  return *this;
+}
+
+bool XmlModelInfo::GetArenaStats(XmlArenaStats& stats) const {
+  stats = XmlArenaStats();
+  if (!arena_)
+    return false;
+  stats = arena_->stats();
+  for (size_t i = 0; i < thread_arenas_.size(); ++i) {
+    stats.Add(thread_arenas_[i]->stats());
+  }
+  return true;
+}
+
 //------------------------------------------------------------------------------
 
 CXmlFile::CXmlFile()
   : xml_doc_(NULL),
-    create_new_file_(false) {
+    parent_node_(NULL),
+    spare_doc_(NULL),
+    dom_block_size_(0),
+    stream_reader_(NULL),
+    mapped_file_(NULL),
+    printer_(NULL),
+    codec_file_(NULL),
+    flushed_size_(0),
+    quiet_digests_(0),
+    create_new_file_(false),
+    xml_version_(kXmlVersionVertexElements),
+    intern_names_(false),
+    use_arena_(false),
+    use_face_store_(false),
+    read_threads_(1),
+    lazy_definitions_(false) {
 }
 
 CXmlFile::~CXmlFile() {
-  delete xml_doc_;
+  Close(true);
+  delete spare_doc_;
+}
+
+// How much a printer holds before handing it on to the file
+static const int kPrinterFlushSize = 256 * 1024;
+
+// Hands what 'printer' has printed so far to 'file'
+static bool WritePrinted(tinyxml2::XMLPrinter& printer, CXmlCodecFile& file) {
+  bool ok = file.Write(printer.CStr(), printer.CStrSize() - 1);
+  printer.ClearBuffer();
+  return ok;
+}
+
+// Prints a DOM to memory and hands the text on to the file whenever an
+// element ends with enough of it printed, so the text of the whole document
+// is never held at once
+class CXmlChunkPrinter : public tinyxml2::XMLPrinter {
+ public:
+  explicit CXmlChunkPrinter(CXmlCodecFile& file) : file_(file), ok_(true) {}
+
+  virtual bool VisitExit(const tinyxml2::XMLElement& element) {
+    XMLPrinter::VisitExit(element);
+    if (CStrSize() > kPrinterFlushSize)
+      ok_ = WritePrinted(*this, file_) && ok_;
+    return true;
+  }
+
+  bool Finish() {
+    return WritePrinted(*this, file_) && ok_;
+  }
+
+ private:
+  CXmlCodecFile& file_;
+  bool ok_;
+};
+
+// The DOM needs the whole text anyway, so a compressed file is decompressed
+// into memory and parsed from there
+static bool LoadCompressedFile(const std::string& filename,
+                               tinyxml2::XMLDocument& doc) {
+  CXmlCodecFile file;
+  if (!file.OpenRead(filename))
+    return false;
+  std::vector<char> text;
+  size_t size = 0;
+  do {
+    text.resize(size + 1024 * 1024);
+    size += file.Read(&text[size], text.size() - size);
+  } while (size == text.size());
+  return file.Close() &&
+         doc.Parse(text.data(), size) == tinyxml2::XML_NO_ERROR;
+}
+
+// Writes the DOM out through a CXmlCodecFile, which also compresses it if
+// the name says so
+static bool SaveFile(tinyxml2::XMLDocument& doc,
+                     const std::string& filename, XmlWriteStats& stats) {
+  CXmlCodecFile file;
+  if (!file.OpenWrite(filename, CXmlCodecFile::CodecOf(filename)))
+    return false;
+  CXmlChunkPrinter printer(file);
+  doc.Print(&printer);
+  bool ok = printer.Finish();
+  ok = file.Close() && ok;
+  file.GetWriteStats(stats);
+  return ok;
 }
 
-bool CXmlFile::Open(const std::string& filename, bool create_new_file) {
+bool CXmlFile::Open(const std::string& filename, bool create_new_file,
+                    ReadMode read_mode) {
   if (filename.empty())
     return false;
 
-  if (xml_doc_) {
+  if (xml_doc_ || stream_reader_ || printer_) {
     printf("Warning! opening already open file\n");
     return true;
   }
 
   filename_ = filename;
   create_new_file_ = create_new_file;
+  const bool compressed =
+      CXmlCodecFile::CodecOf(filename) != CXmlCodecFile::kCodecNone;
+
+  if (!create_new_file && read_mode == kReadMapped && !compressed) {
+    mapped_file_ = new CXmlMappedFile;
+    if (!mapped_file_->Open(filename)) {
+      // Read the file through the stream reader's own buffer instead
+      delete mapped_file_;
+      mapped_file_ = NULL;
+    }
+  }
+
+  if (!create_new_file && read_mode != kReadDom) {
+    // Only check the header here, the rest is read by GetModelInfo
+    stream_reader_ = new CXmlStreamReader;
+    stream_reader_->set_tag_tables(&kElementTags, &kAttributeTags);
+    return ReadHeader(*stream_reader_, xml_version_);
+  }
 
-  xml_doc_ = new tinyxml2::XMLDocument;
+  if (spare_doc_ != NULL) {
+    xml_doc_ = spare_doc_;
+    spare_doc_ = NULL;
+  } else {
+    xml_doc_ = new tinyxml2::XMLDocument;
+  }
+  xml_doc_->SetPoolBlockSize(dom_block_size_);
   parent_node_ = xml_doc_;
 
   bool ok = true;
 
   if (!create_new_file) {
-    ok = xml_doc_->LoadFile(filename.c_str()) == tinyxml2::XML_NO_ERROR &&
+    ok = (compressed ? LoadCompressedFile(filename, *xml_doc_) :
+          xml_doc_->LoadFile(filename.c_str()) == tinyxml2::XML_NO_ERROR) &&
          ReadHeader(); // Check for valid header
   }
 
   return ok;
 }
 
-void CXmlFile::Close(bool cancelled) {
-  if (create_new_file_ && !cancelled)
-    xml_doc_->SaveFile(filename_.c_str());
-  delete xml_doc_;
-  xml_doc_ = NULL;
+bool CXmlFile::Open(const std::string& filename, WriteMode write_mode) {
+  if (write_mode == kWriteDom)
+    return Open(filename, true);
+
+  if (filename.empty())
+    return false;
+
+  if (xml_doc_ || stream_reader_ || printer_) {
+    printf("Warning! opening already open file\n");
+    return true;
+  }
+
+  // Write next to the destination, so the final rename stays on one volume
+  std::string temp_filename = filename + ".tmp";
+  // Written out, and compressed if need be, on the file's own thread while
+  // the caller carries on printing
+  codec_file_ = new CXmlCodecFile;
+  if (!codec_file_->OpenWrite(temp_filename,
+                              CXmlCodecFile::CodecOf(filename))) {
+    delete codec_file_;
+    codec_file_ = NULL;
+    return false;
+  }
+  printer_ = new tinyxml2::XMLPrinter;
+  flushed_size_ = 0;
+  digests_.clear();
+  quiet_digests_ = 0;
+
+  filename_ = filename;
+  temp_filename_ = temp_filename;
+  create_new_file_ = true;
+  return true;
+}
+
+// Puts the finished temporary file in place of the destination in one
+// step, so a failure leaves the last file as it was
+static bool ReplaceFileWith(const std::string& temp_filename,
+                            const std::string& filename) {
+#ifdef _WIN32
+  return MoveFileExA(temp_filename.c_str(), filename.c_str(),
+                     MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return rename(temp_filename.c_str(), filename.c_str()) == 0;
+#endif
+}
+
+bool CXmlFile::Close(bool cancelled) {
+  bool ok = true;
+  if (printer_ != NULL) {
+    ok = WritePrinted(*printer_, *codec_file_);
+    flushed_size_ = 0;
+    ok = codec_file_->Close() && ok;
+    codec_file_->GetWriteStats(write_stats_);
+    delete codec_file_;
+    codec_file_ = NULL;
+    delete printer_;
+    printer_ = NULL;
+    if (!ok || cancelled) {
+      remove(temp_filename_.c_str());
+    } else if (!ReplaceFileWith(temp_filename_, filename_)) {
+      // The whole text is in the temporary file, leave it for the caller
+      printf("Warning! can't replace %s, the output is in %s\n",
+             filename_.c_str(), temp_filename_.c_str());
+      ok = false;
+    }
+    temp_filename_.clear();
+  }
+
+  if (xml_doc_ && create_new_file_ && !cancelled)
+    ok = SaveFile(*xml_doc_, filename_, write_stats_);
+  if (xml_doc_ != NULL) {
+    // Keep the pools and the text buffer for the next file
+    xml_doc_->Reset();
+    spare_doc_ = xml_doc_;
+    xml_doc_ = NULL;
+  }
   parent_node_ = NULL;
+  delete stream_reader_;
+  stream_reader_ = NULL;
+  delete mapped_file_;
+  mapped_file_ = NULL;
+  // They point into the file
+  definition_sources_.clear();
+  definition_indices_.clear();
+  return ok || cancelled;
 }
 
 static size_t FindLastSlash(const std::string& filename) {
@@ -125,6 +553,78 @@ static size_t FindLastSlash(const std::string& filename) {
   return index;
 }
 
+bool CXmlFile::GetDomMemoryStats(tinyxml2::XMLMemoryStats& stats) const {
+  const tinyxml2::XMLDocument* doc = xml_doc_ != NULL ? xml_doc_ : spare_doc_;
+  if (doc == NULL)
+    return false;
+  doc->GetMemoryStats(&stats);
+  return true;
+}
+
+void CXmlFile::FlushPrinter() {
+  flushed_size_ += printer_->CStrSize() - 1;
+  WritePrinted(*printer_, *codec_file_);
+}
+
+// FNV-1a, like the names in CXmlTagTable
+void CXmlFile::Digest(const void* data, size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  uint64_t& hash = digests_.back();
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+}
+
+void CXmlFile::Digest(const char* text) {
+  // With the terminator, so the texts of two writes don't run together
+  Digest(text, strlen(text) + 1);
+}
+
+void CXmlFile::BeginDigest(bool write_text) {
+  digests_.push_back(14695981039346656037ULL);
+  // Nothing is written inside a quiet digest either, so the quiet ones are
+  // always the innermost
+  if (!write_text || quiet_digests_ > 0)
+    ++quiet_digests_;
+}
+
+uint64_t CXmlFile::EndDigest() {
+  uint64_t digest = digests_.back();
+  digests_.pop_back();
+  if (quiet_digests_ > 0)
+    --quiet_digests_;
+  return digest;
+}
+
+void CXmlFile::AddDigest(uint64_t digest) {
+  if (!digests_.empty())
+    Digest(&digest, sizeof(digest));
+}
+
+void CXmlFile::CopyElement(const char* text, size_t size) {
+  if (printer_ == NULL || quiet_digests_ > 0)
+    return;
+  printer_->PushRaw(text, static_cast<int>(size));
+  if (printer_->CStrSize() > kPrinterFlushSize)
+    FlushPrinter();
+}
+
+uint64_t CXmlFile::text_size() const {
+  if (printer_ == NULL)
+    return 0;
+  // The '>' of an open start tag is printed before any child, so a child's
+  // text starts after it
+  uint64_t size = flushed_size_ + printer_->CStrSize() - 1;
+  return printer_->ElementJustOpened() ? size + 1 : size;
+}
+
+void CXmlFile::GetWriteStats(XmlWriteStats& stats) const {
+  if (codec_file_ != NULL)
+    codec_file_->GetWriteStats(stats);
+  else
+    stats = write_stats_;
+}
+
 std::string CXmlFile::GetTextureDirectory() const {
   // Extract the directory in which we are writing
   size_t index = FindLastSlash(filename_);
@@ -136,34 +636,134 @@ bool CXmlFile::ReadHeader() {
   const tinyxml2::XMLNode* node = xml_doc_->FirstChild();
   const tinyxml2::XMLElement* elem = node->ToElement();
   bool ok = false;
-  if (elem->Value() == kSkpToXMLTag) {
+  if (ElementId(node) == kElemSkpToXML) {
     int version = 0;
     ok = (elem->QueryIntAttribute(kXMLVersionTag.c_str(), &version) ==
-          tinyxml2::XML_NO_ERROR) && (version == 3);
+          tinyxml2::XML_NO_ERROR) &&
+         (version >= kXmlVersionVertexElements) &&
+         (version <= kXmlVersionLatest);
+    xml_version_ = version;
   }
   return ok;
 }
 
 void CXmlFile::WriteHeader(int major_ver, int minor_ver, int build_no) {
-  tinyxml2::XMLElement* elem = xml_doc_->NewElement(kSkpToXMLTag.c_str());
-  tinyxml2::XMLNode* node = xml_doc_->InsertFirstChild(elem);
-  elem->SetAttribute(kXMLVersionTag.c_str(), 3);
-
   // Combine the version
   std::stringstream ss;
   ss << major_ver << '.' << minor_ver << '.' << build_no;
+
+  if (printer_ != NULL) {
+    // A streamed file can only be appended to, so the header has to be
+    // written before anything else
+    WriteStartTag(kSkpToXMLTag.c_str());
+    WriteAttribute(kXMLVersionTag.c_str(), xml_version_);
+    WriteAttribute(kSkpVersionTag.c_str(), ss.str().c_str());
+    WriteAttribute("units", "inches");
+    PopParentNode();
+    return;
+  }
+
+  tinyxml2::XMLElement* elem = xml_doc_->NewElement(kSkpToXMLTag.c_str());
+  xml_doc_->InsertFirstChild(elem);
+  elem->SetAttribute(kXMLVersionTag.c_str(), xml_version_);
   elem->SetAttribute(kSkpVersionTag.c_str(), ss.str().c_str());
   elem->SetAttribute("units", "inches");
 }
 
-tinyxml2::XMLElement* CXmlFile::WriteStartTag(const char* tag) {
-  tinyxml2::XMLElement* elem = xml_doc_->NewElement(tag);
-  parent_node_ = parent_node_->InsertEndChild(elem);
-  return elem;
+void CXmlFile::WriteStartTag(const char* tag) {
+  if (!digests_.empty()) {
+    Digest(tag);
+    if (quiet_digests_ > 0)
+      return;
+  }
+  if (printer_ != NULL) {
+    printer_->OpenElement(tag);
+  } else {
+    tinyxml2::XMLElement* elem = xml_doc_->NewElement(tag);
+    parent_node_ = parent_node_->InsertEndChild(elem);
+  }
+}
+
+void CXmlFile::WriteAttribute(const char* name, const char* value) {
+  if (!digests_.empty()) {
+    Digest(name);
+    Digest(value);
+    if (quiet_digests_ > 0)
+      return;
+  }
+  if (printer_ != NULL)
+    printer_->PushAttribute(name, value);
+  else
+    parent_node_->ToElement()->SetAttribute(name, value);
+}
+
+void CXmlFile::WriteAttribute(const char* name, int value) {
+  if (!digests_.empty()) {
+    Digest(name);
+    Digest(&value, sizeof(value));
+    if (quiet_digests_ > 0)
+      return;
+  }
+  if (printer_ != NULL)
+    printer_->PushAttribute(name, value);
+  else
+    parent_node_->ToElement()->SetAttribute(name, value);
+}
+
+void CXmlFile::WriteAttribute(const char* name, unsigned value) {
+  if (!digests_.empty()) {
+    Digest(name);
+    Digest(&value, sizeof(value));
+    if (quiet_digests_ > 0)
+      return;
+  }
+  if (printer_ != NULL)
+    printer_->PushAttribute(name, value);
+  else
+    parent_node_->ToElement()->SetAttribute(name, value);
+}
+
+void CXmlFile::WriteAttribute(const char* name, bool value) {
+  if (!digests_.empty()) {
+    Digest(name);
+    Digest(&value, sizeof(value));
+    if (quiet_digests_ > 0)
+      return;
+  }
+  if (printer_ != NULL)
+    printer_->PushAttribute(name, value);
+  else
+    parent_node_->ToElement()->SetAttribute(name, value);
+}
+
+void CXmlFile::WriteAttribute(const char* name, double value) {
+  if (!digests_.empty()) {
+    Digest(name);
+    Digest(&value, sizeof(value));
+    if (quiet_digests_ > 0)
+      return;
+  }
+  if (printer_ != NULL)
+    printer_->PushAttribute(name, value);
+  else
+    parent_node_->ToElement()->SetAttribute(name, value);
 }
 
-void CXmlFile::StartLayers() {
+void CXmlFile::WriteText(const char* text) {
+  if (!digests_.empty()) {
+    Digest(text);
+    if (quiet_digests_ > 0)
+      return;
+  }
+  if (printer_ != NULL)
+    printer_->PushText(text);
+  else
+    parent_node_->InsertEndChild(xml_doc_->NewText(text));
+}
+
+void CXmlFile::StartLayers(size_t count) {
   WriteStartTag(kLayersTag.c_str());
+  WriteCount(count);
 }
 
 void CXmlFile::StartGeometry() {
@@ -174,40 +774,71 @@ void CXmlFile::StartGroup() {
   WriteStartTag(kGroupTag.c_str());
 }
 
-void CXmlFile::StartMaterials() {
+void CXmlFile::StartMaterials(size_t count) {
   WriteStartTag(kMaterialsTag.c_str());
+  WriteCount(count);
 }
 
-void CXmlFile::StartComponentDefinitions() {
+void CXmlFile::StartComponentDefinitions(size_t count) {
   WriteStartTag(kCompDefsTag.c_str());
+  WriteCount(count);
+}
+
+void CXmlFile::WriteCount(size_t count) {
+  if (count > 0)
+    WriteAttribute(kCountTag.c_str(), static_cast<unsigned>(count));
 }
 
 void CXmlFile::StartComponentDefinition(const std::string& name) {
-  tinyxml2::XMLElement* elem = WriteStartTag(kCompDefTag.c_str());
-  elem->SetAttribute(kNameTag.c_str(), name.c_str());
+  WriteStartTag(kCompDefTag.c_str());
+  WriteAttribute(kNameTag.c_str(), name.c_str());
 }
 
 bool CXmlFile::ReadComponentDefinitionInfo(
     const tinyxml2::XMLNode* parent_node,
     bool readEntities,
-    XmlComponentDefinitionInfo& info) const {
+    XmlComponentDefinitionInfo& info,
+    CXmlNameTable* names) const {
   const char* name = parent_node->ToElement()->Attribute(kNameTag.c_str());
   if (name == NULL)
     return false;
   info.name_ = name;
-  
-  return !readEntities || ReadEntities(parent_node, info.entities_);
+  if (!readEntities)
+    return true;
+
+  // Aliases come before the entities, which skip them
+  info.aliases_.clear();
+  for (const tinyxml2::XMLNode* child = parent_node->FirstChild();
+       ElementId(child) == kElemAlias; child = child->NextSibling()) {
+    const char* alias = child->ToElement()->Attribute(kNameTag.c_str());
+    if (alias != NULL)
+      info.aliases_.push_back(alias);
+  }
+  return ReadEntities(parent_node, info.entities_, names);
 }
 
 void CXmlFile::PopParentNode() {
-  parent_node_ = parent_node_->Parent();
+  if (!digests_.empty()) {
+    // Can't be part of a name or UTF-8 text
+    static const unsigned char kEndTag = 0xff;
+    Digest(&kEndTag, 1);
+    if (quiet_digests_ > 0)
+      return;
+  }
+  if (printer_ != NULL) {
+    printer_->CloseElement();
+    if (printer_->CStrSize() > kPrinterFlushSize)
+      FlushPrinter();
+  } else {
+    parent_node_ = parent_node_->Parent();
+  }
 }
 
 bool CXmlFile::ReadLayerInfo(const tinyxml2::XMLNode* parent_node,
                              XmlLayerInfo& info) const {
-  const tinyxml2::XMLElement* elem = parent_node->ToElement();
-  if (elem->Value() != kLayerTag)
+  if (ElementId(parent_node) != kElemLayer)
     return false;
+  const tinyxml2::XMLElement* elem = parent_node->ToElement();
 
   bool ok = true;
 
@@ -224,15 +855,16 @@ bool CXmlFile::ReadLayerInfo(const tinyxml2::XMLNode* parent_node,
 
   // Material info (optional)
   const tinyxml2::XMLNode* child = parent_node->FirstChild();
-  info.has_material_info_ = ReadMaterialInfo(child, info.material_info_);
+  info.has_material_info_ =
+      child != NULL && ReadMaterialInfo(child, info.material_info_);
 
   return ok;
 }
 
 void CXmlFile::WriteLayerInfo(const XmlLayerInfo& info) {
-  tinyxml2::XMLElement* elem = WriteStartTag(kLayerTag.c_str());
-  elem->SetAttribute(kNameTag.c_str(), info.name_.c_str());
-  elem->SetAttribute(kVisibleTag.c_str(), info.is_visible_);
+  WriteStartTag(kLayerTag.c_str());
+  WriteAttribute(kNameTag.c_str(), info.name_.c_str());
+  WriteAttribute(kVisibleTag.c_str(), info.is_visible_);
 
   if (info.has_material_info_) {
     WriteMaterialInfo(info.material_info_);
@@ -240,12 +872,22 @@ void CXmlFile::WriteLayerInfo(const XmlLayerInfo& info) {
   PopParentNode();
 }
 
+static bool ParseColor(const char* attrib, SUColor& color) {
+  // %x needs an unsigned int to write to, SUColor has single bytes
+  unsigned red = 0, green = 0, blue = 0;
+  sscanf(attrib, kColorFormat.c_str(), &red, &green, &blue);
+  color.red = static_cast<SUByte>(red);
+  color.green = static_cast<SUByte>(green);
+  color.blue = static_cast<SUByte>(blue);
+  color.alpha = 255;
+  return true;
+}
+
 bool CXmlFile::ReadColor(const tinyxml2::XMLNode* parent_node,
-                         const SUColor& color) const {
+                         SUColor& color) const {
   const char* attrib = parent_node->ToElement()->Attribute(kColorTag.c_str());
   if (attrib != NULL) {
-    sscanf(attrib, kColorFormat.c_str(), &color.red, &color.green, &color.blue);
-    return true;
+    return ParseColor(attrib, color);
   }
   return false;
 }
@@ -253,14 +895,14 @@ bool CXmlFile::ReadColor(const tinyxml2::XMLNode* parent_node,
 void CXmlFile::WriteColor(const SUColor& color) {
   char buf[10] = { 0 };
   sprintf(buf, kColorFormat.c_str(), color.red, color.green, color.blue);
-  parent_node_->ToElement()->SetAttribute(kColorTag.c_str(), buf);
+  WriteAttribute(kColorTag.c_str(), buf);
 }
 
 bool CXmlFile::ReadMaterialInfo(const tinyxml2::XMLNode* parent_node,
                                 XmlMaterialInfo& info) const {
-  const tinyxml2::XMLElement* elem = parent_node->ToElement();
-  if (elem->Value() != kMaterialTag)
+  if (ElementId(parent_node) != kElemMaterial)
     return false;
+  const tinyxml2::XMLElement* elem = parent_node->ToElement();
 
   bool ok = true;
 
@@ -283,7 +925,7 @@ bool CXmlFile::ReadMaterialInfo(const tinyxml2::XMLNode* parent_node,
   const tinyxml2::XMLNode* child = parent_node->FirstChild();
   if (child != NULL) {
     const tinyxml2::XMLElement* child_elem = child->ToElement();
-    if (child_elem->Value() == kTextureTag) {
+    if (ElementId(child) == kElemTexture) {
       info.has_texture_ = true;
       const char* str_path = child_elem->Attribute(kPathTag.c_str());
       if (str_path != NULL) {
@@ -291,10 +933,14 @@ bool CXmlFile::ReadMaterialInfo(const tinyxml2::XMLNode* parent_node,
       } else {
         ok = false;
       }
-      ok &= child_elem->QueryDoubleAttribute(kSScaleTag.c_str(),
-            &info.texture_sscale_) == tinyxml2::XML_NO_ERROR;
-      ok &= child_elem->QueryDoubleAttribute(kTScaleTag.c_str(),
-            &info.texture_tscale_) == tinyxml2::XML_NO_ERROR;
+      static const int kScaleIds[] = { kAttrSScale, kAttrTScale };
+      double scales[2];
+      if (ReadDoubleAttributes(child_elem, kScaleIds, 2, scales)) {
+        info.texture_sscale_ = scales[0];
+        info.texture_tscale_ = scales[1];
+      } else {
+        ok = false;
+      }
     }
   }
 
@@ -303,23 +949,23 @@ bool CXmlFile::ReadMaterialInfo(const tinyxml2::XMLNode* parent_node,
 
 void CXmlFile::WriteMaterialInfo(const XmlMaterialInfo& info) {
   // The material id, name, color, alpha all go on the same line
-  tinyxml2::XMLElement* elem = WriteStartTag(kMaterialTag.c_str());
-  elem->SetAttribute(kNameTag.c_str(), info.name_.c_str());
+  WriteStartTag(kMaterialTag.c_str());
+  WriteAttribute(kNameTag.c_str(), info.name_.c_str());
 
   if (info.has_color_) {
     WriteColor(info.color_);
   }
 
   if (info.has_alpha_) {
-    elem->SetAttribute(kAlphaTag.c_str(), info.alpha_);
+    WriteAttribute(kAlphaTag.c_str(), info.alpha_);
   }
 
   // Material texture
   if (info.has_texture_) {
-    tinyxml2::XMLElement* elem = WriteStartTag(kTextureTag.c_str());
-    elem->SetAttribute(kPathTag.c_str(), info.texture_path_.c_str());
-    elem->SetAttribute(kSScaleTag.c_str(), info.texture_sscale_);
-    elem->SetAttribute(kTScaleTag.c_str(), info.texture_tscale_);
+    WriteStartTag(kTextureTag.c_str());
+    WriteAttribute(kPathTag.c_str(), info.texture_path_.c_str());
+    WriteAttribute(kSScaleTag.c_str(), info.texture_sscale_);
+    WriteAttribute(kTScaleTag.c_str(), info.texture_tscale_);
     PopParentNode();
   }
   PopParentNode();
@@ -327,18 +973,23 @@ void CXmlFile::WriteMaterialInfo(const XmlMaterialInfo& info) {
 
 static bool ReadPoint(const tinyxml2::XMLNode* parent_node,
                       CPoint3d& point) {
-  const tinyxml2::XMLElement* elem = parent_node->ToElement();
-  double x, y, z;
-  if (elem->QueryDoubleAttribute(kXTag.c_str(), &x) ==
-      tinyxml2::XML_NO_ERROR &&
-      elem->QueryDoubleAttribute(kYTag.c_str(), &y) ==
-      tinyxml2::XML_NO_ERROR &&
-      elem->QueryDoubleAttribute(kZTag.c_str(), &z) ==
-      tinyxml2::XML_NO_ERROR) {
-    point.SetLocation(x, y, z);
-    return true;
-  }
-  return false;
+  static const int kIds[] = { kAttrX, kAttrY, kAttrZ };
+  double xyz[3];
+  if (!ReadDoubleAttributes(parent_node->ToElement(), kIds, 3, xyz))
+    return false;
+  point.SetLocation(xyz[0], xyz[1], xyz[2]);
+  return true;
+}
+
+// Reads the u and v attributes of a texture coordinates element
+static bool ReadTextureCoords(const tinyxml2::XMLNode* parent_node,
+                              CPoint3d& coords) {
+  static const int kIds[] = { kAttrU, kAttrV };
+  double uv[2];
+  if (!ReadDoubleAttributes(parent_node->ToElement(), kIds, 2, uv))
+    return false;
+  coords.SetLocation(uv[0], uv[1], 0);
+  return true;
 }
 
 bool CXmlFile::ReadEdgeInfo(const tinyxml2::XMLNode* parent_node,
@@ -347,7 +998,7 @@ bool CXmlFile::ReadEdgeInfo(const tinyxml2::XMLNode* parent_node,
   const tinyxml2::XMLNode* child = parent_node->FirstChild();
   if (child == NULL)
     return false;
-  if (child->Value() == kLayerTag) {
+  if (ElementId(child) == kElemLayer) {
     const tinyxml2::XMLElement* elem = child->ToElement();
     const char* layer_name = elem->Attribute(kNameTag.c_str());
     if (layer_name != NULL) {
@@ -363,7 +1014,7 @@ bool CXmlFile::ReadEdgeInfo(const tinyxml2::XMLNode* parent_node,
     return false;
 
   // Color (optional)
-  if (child->Value() == kMaterialTag) {
+  if (ElementId(child) == kElemMaterial) {
     info.has_color_ = ReadColor(child, info.color_);
     child = child->NextSibling();
   }
@@ -371,11 +1022,11 @@ bool CXmlFile::ReadEdgeInfo(const tinyxml2::XMLNode* parent_node,
   bool ok = true;
 
   // End points
-  if (child != NULL && child->Value() == kStartTag) {
+  if (ElementId(child) == kElemStart) {
     ok &= ReadPoint(child, info.start_);
 
     child = child->NextSibling();
-    if (child != NULL && child->Value() == kEndTag) {
+    if (ElementId(child) == kElemEnd) {
       ok &= ReadPoint(child, info.end_);
     } else {
       ok = false;
@@ -387,13 +1038,21 @@ bool CXmlFile::ReadEdgeInfo(const tinyxml2::XMLNode* parent_node,
   return ok;
 }
 
-void CXmlFile::WriteEdgeInfo(const XmlEdgeInfo& info) {
+// Infos written without a name table only have name strings
+static const char* GetName(const CXmlNameTable* names, uint32_t id,
+                           const std::string& name) {
+  return (names != NULL ? names->Resolve(id, name) : name).c_str();
+}
+
+void CXmlFile::WriteEdgeInfo(const XmlEdgeInfo& info,
+                             const CXmlNameTable* names) {
   WriteStartTag(kEdgeTag.c_str());
 
   // Layer (optional)
   if (info.has_layer_) {
-    tinyxml2::XMLElement* elem = WriteStartTag(kLayerTag.c_str());
-    elem->SetAttribute(kNameTag.c_str(), info.layer_name_.c_str());
+    WriteStartTag(kLayerTag.c_str());
+    WriteAttribute(kNameTag.c_str(),
+                   GetName(names, info.layer_id_, info.layer_name_));
     PopParentNode();
   }
 
@@ -406,117 +1065,248 @@ void CXmlFile::WriteEdgeInfo(const XmlEdgeInfo& info) {
 
   // End points
   {
-    tinyxml2::XMLElement* elem = WriteStartTag(kStartTag.c_str());
-    elem->SetAttribute(kXTag.c_str(), info.start_.x());
-    elem->SetAttribute(kYTag.c_str(), info.start_.y());
-    elem->SetAttribute(kZTag.c_str(), info.start_.z());
+    WriteStartTag(kStartTag.c_str());
+    WriteAttribute(kXTag.c_str(), info.start_.x());
+    WriteAttribute(kYTag.c_str(), info.start_.y());
+    WriteAttribute(kZTag.c_str(), info.start_.z());
     PopParentNode();
   }
   {
-    tinyxml2::XMLElement* elem = WriteStartTag(kEndTag.c_str());
-    elem->SetAttribute(kXTag.c_str(), info.end_.x());
-    elem->SetAttribute(kYTag.c_str(), info.end_.y());
-    elem->SetAttribute(kZTag.c_str(), info.end_.z());
+    WriteStartTag(kEndTag.c_str());
+    WriteAttribute(kXTag.c_str(), info.end_.x());
+    WriteAttribute(kYTag.c_str(), info.end_.y());
+    WriteAttribute(kZTag.c_str(), info.end_.z());
     PopParentNode();
   }
 
   PopParentNode();
 }
 
+// Packed face vertices (version 4). The arrays are whitespace separated
+// numbers: x y z per vertex in Points, u v per vertex in the texture coords
+// and, for triangles, three zero based vertex indices per triangle.
+struct XmlPackedFaceArrays {
+  std::string points_;
+  std::string front_texture_coords_;
+  std::string back_texture_coords_;
+  std::string indices_;
+};
+
+static bool ParseNumber(const char* str, double* value) {
+  return tinyxml2::XMLUtil::ToDouble(str, value);
+}
+
+static bool ParseNumber(const char* str, unsigned* value) {
+  return tinyxml2::XMLUtil::ToUnsigned(str, value);
+}
+
+template <typename T, typename Allocator>
+static bool ParseNumbers(const std::string& text,
+                         std::vector<T, Allocator>& values) {
+  const char* p = text.c_str();
+  for (;;) {
+    while (tinyxml2::XMLUtil::IsWhiteSpace(*p)) {
+      ++p;
+    }
+    if (*p == 0)
+      return true;
+
+    // XMLUtil wants a terminated string
+    char buffer[64];
+    size_t length = 0;
+    while (p[length] != 0 && !tinyxml2::XMLUtil::IsWhiteSpace(p[length])) {
+      ++length;
+    }
+    if (length >= sizeof(buffer))
+      return false;
+    memcpy(buffer, p, length);
+    buffer[length] = 0;
+    p += length;
+
+    T value;
+    if (!ParseNumber(buffer, &value))
+      return false;
+    values.push_back(value);
+  }
+}
+
+static bool UnpackFaceVertices(const XmlPackedFaceArrays& arrays,
+                               int triangle_count, XmlFaceInfo& info) {
+  std::vector<double> points;
+  if (!ParseNumbers(arrays.points_, points) || points.size() % 3 != 0)
+    return false;
+  const size_t vertex_count = points.size() / 3;
+
+  std::vector<double> front_coords, back_coords;
+  if (info.has_front_texture_ &&
+      (!ParseNumbers(arrays.front_texture_coords_, front_coords) ||
+       front_coords.size() != vertex_count * 2))
+    return false;
+  if (info.has_back_texture_ &&
+      (!ParseNumbers(arrays.back_texture_coords_, back_coords) ||
+       back_coords.size() != vertex_count * 2))
+    return false;
+
+  // A loop lists its vertices in order, triangles index them
+  if (!info.has_single_loop_) {
+    if (!ParseNumbers(arrays.indices_, info.indices_) ||
+        info.indices_.size() != static_cast<size_t>(triangle_count) * 3)
+      return false;
+    for (size_t i = 0; i < info.indices_.size(); ++i) {
+      if (info.indices_[i] >= vertex_count)
+        return false;
+    }
+  }
+
+  info.vertices_.resize(vertex_count);
+  for (size_t i = 0; i < vertex_count; ++i) {
+    XmlFaceVertex& vertex = info.vertices_[i];
+    vertex.vertex_.SetLocation(points[i * 3], points[i * 3 + 1],
+                               points[i * 3 + 2]);
+    if (info.has_front_texture_) {
+      vertex.front_texture_coord_.SetLocation(front_coords[i * 2],
+                                              front_coords[i * 2 + 1], 0);
+    }
+    if (info.has_back_texture_) {
+      vertex.back_texture_coord_.SetLocation(back_coords[i * 2],
+                                             back_coords[i * 2 + 1], 0);
+    }
+  }
+  return true;
+}
+
+// Orders face vertices so identical ones can be shared between triangles
+struct XmlFaceVertexLess {
+  static bool Less(const CPoint3d& a, const CPoint3d& b, bool* equal) {
+    *equal = false;
+    if (a.x() != b.x())
+      return a.x() < b.x();
+    if (a.y() != b.y())
+      return a.y() < b.y();
+    if (a.z() != b.z())
+      return a.z() < b.z();
+    *equal = true;
+    return false;
+  }
+
+  bool operator()(const XmlFaceVertex& a, const XmlFaceVertex& b) const {
+    bool equal = false;
+    bool less = Less(a.vertex_, b.vertex_, &equal);
+    if (equal)
+      less = Less(a.front_texture_coord_, b.front_texture_coord_, &equal);
+    if (equal)
+      less = Less(a.back_texture_coord_, b.back_texture_coord_, &equal);
+    return less;
+  }
+};
+
+// Version 3 files repeat the corners of each triangle. Turns them into
+// distinct vertices, in order of first use, and indices. The corners are
+// sorted by position and texture coordinates through a scratch buffer kept
+// by each thread, so no face allocates more than its own arrays.
+static void ShareFaceVertices(XmlFaceInfo& info) {
+  static thread_local std::vector<uint32_t> scratch;
+  const uint32_t count = static_cast<uint32_t>(info.vertices_.size());
+  scratch.resize(count);
+  for (uint32_t i = 0; i < count; ++i)
+    scratch[i] = i;
+  const XmlFaceVertexLess less;
+  const XmlArenaVector<XmlFaceVertex>& corners = info.vertices_;
+  std::sort(scratch.begin(), scratch.end(),
+            [&](uint32_t a, uint32_t b) {
+              if (less(corners[a], corners[b]))
+                return true;
+              return !less(corners[b], corners[a]) && a < b;
+            });
+
+  // Point every corner at the first corner equal to it
+  info.indices_.resize(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    const bool first = i == 0 || less(corners[scratch[i - 1]],
+                                      corners[scratch[i]]);
+    info.indices_[scratch[i]] = first ? scratch[i]
+                                      : info.indices_[scratch[i - 1]];
+  }
+
+  // Keep the first corners, moving them down in place. The scratch buffer
+  // now maps them to their new index.
+  uint32_t vertex_count = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint32_t first = info.indices_[i];
+    if (first == i) {
+      info.vertices_[vertex_count] = info.vertices_[i];
+      scratch[i] = vertex_count++;
+    }
+    info.indices_[i] = scratch[first];
+  }
+  info.vertices_.resize(vertex_count);
+}
+
 bool CXmlFile::ReadFaceInfo(const tinyxml2::XMLNode* parent_node,
                             XmlFaceInfo& info) const {
   // Front material (optional)
   const tinyxml2::XMLNode* child = parent_node->FirstChild();
-  if (child->Value() == kFrontMaterialTag) {
-    const tinyxml2::XMLElement* elem = child->ToElement();
-    const char* mat_name = elem->Attribute(kNameTag.c_str());
-    if (mat_name != NULL)
-      info.front_mat_name_ = mat_name;
-    else
-      info.front_mat_name_.clear();
-    elem->QueryBoolAttribute(kHasTextureTag.c_str(), &info.has_front_texture_);
+  int tag = ElementId(child);
+  if (tag == kElemFrontMaterial) {
+    ReadFaceMaterial(child->ToElement(), info.front_mat_name_,
+                     info.has_front_texture_);
     child = child->NextSibling();
+    tag = ElementId(child);
   }
 
   // Back material (optional)
-  if (child->Value() == kBackMaterialTag) {
-    const tinyxml2::XMLElement* elem = child->ToElement();
-    const char* mat_name = elem->Attribute(kNameTag.c_str());
-    if (mat_name != NULL)
-      info.back_mat_name_ = mat_name;
-    else
-      info.back_mat_name_.clear();
-    elem->QueryBoolAttribute(kHasTextureTag.c_str(), &info.has_back_texture_);
+  if (tag == kElemBackMaterial) {
+    ReadFaceMaterial(child->ToElement(), info.back_mat_name_,
+                     info.has_back_texture_);
     child = child->NextSibling();
+    tag = ElementId(child);
   }
 
   // Layer (optional)
-  if (child->Value() == kLayerTag) {
+  if (tag == kElemLayer) {
     const tinyxml2::XMLElement* elem = child->ToElement();
     const char* layer_name = elem->Attribute(kNameTag.c_str());
     if (layer_name != NULL) {
       info.layer_name_ = layer_name;
     }
     child = child->NextSibling();
+    tag = ElementId(child);
   }
 
   // Loop or Triangles
   bool ok = false;
   int triangle_count = 0;
-  if (child->Value() == kLoopTag) {
+  if (tag == kElemLoop) {
     info.has_single_loop_ = true;
     ok = true;
-  } else if (child->Value() == kTrianglesTag) {
+  } else if (tag == kElemTriangles) {
     info.has_single_loop_ = false;
     const tinyxml2::XMLElement* elem = child->ToElement();
     ok = elem->QueryIntAttribute(kCountTag.c_str(), &triangle_count) == 
          tinyxml2::XML_NO_ERROR;
   }
-  if (ok) {
+  if (ok && xml_version_ >= kXmlVersionPackedFaces) {
+    ok = ReadPackedFaceVertices(child, triangle_count, info);
+  } else if (ok) {
     const tinyxml2::XMLNode* vertex_node = child->FirstChild();
-    while (ok && vertex_node != NULL && vertex_node->Value() == kVertexTag) {
+    while (ok && ElementId(vertex_node) == kElemVertex) {
       // Vertex position
       const tinyxml2::XMLNode* pt_node = vertex_node->FirstChild();
       if (pt_node != NULL) {
-        const tinyxml2::XMLElement* elem = pt_node->ToElement();
         XmlFaceVertex vertex;
         if (ReadPoint(pt_node, vertex.vertex_)) {
           // Front texture coords
           const tinyxml2::XMLNode* node = pt_node;
           if (info.has_front_texture_) {
             node = node->NextSibling();
-            if (node != NULL && node->Value() == kFrontTextureCoordsTag) {
-              elem = node->ToElement();
-              double u, v;
-              if (elem->QueryDoubleAttribute(kUTag.c_str(), &u) ==
-                  tinyxml2::XML_NO_ERROR &&
-                  elem->QueryDoubleAttribute(kVTag.c_str(), &v) ==
-                  tinyxml2::XML_NO_ERROR) {
-                vertex.front_texture_coord_.SetLocation(u, v, 0);
-              } else {
-                ok = false;
-              }
-            } else {
-              ok = false;
-            }
+            ok &= ElementId(node) == kElemFrontTextureCoords &&
+                  ReadTextureCoords(node, vertex.front_texture_coord_);
           }
           // Back texture coords
-          if (info.has_back_texture_) {
+          if (ok && info.has_back_texture_) {
             node = node->NextSibling();
-            if (node != NULL && node->Value() == kBackTextureCoordsTag) {
-              elem = node->ToElement();
-              double u, v;
-              if (elem->QueryDoubleAttribute(kUTag.c_str(), &u) ==
-                  tinyxml2::XML_NO_ERROR &&
-                  elem->QueryDoubleAttribute(kVTag.c_str(), &v) ==
-                  tinyxml2::XML_NO_ERROR) {
-                vertex.back_texture_coord_.SetLocation(u, v, 0);
-              } else {
-                ok = false;
-              }
-            } else {
-              ok = false;
-            }
+            ok &= ElementId(node) == kElemBackTextureCoords &&
+                  ReadTextureCoords(node, vertex.back_texture_coord_);
           }
           
           info.vertices_.push_back(vertex);
@@ -532,36 +1322,66 @@ bool CXmlFile::ReadFaceInfo(const tinyxml2::XMLNode* parent_node,
 
     // If a mesh is given, check the number of vertices
     if (!info.has_single_loop_) {
-      ok &= (info.vertices_.size() == triangle_count * 3);
+      ok &= (info.vertices_.size() == static_cast<size_t>(triangle_count) * 3);
+      ShareFaceVertices(info);
     }
   } // if (ok)
 
   return ok;
 }
 
-void CXmlFile::WriteFaceInfo(const XmlFaceInfo& info) {
+bool CXmlFile::ReadPackedFaceVertices(const tinyxml2::XMLNode* parent_node,
+                                      int triangle_count,
+                                      XmlFaceInfo& info) const {
+  XmlPackedFaceArrays arrays;
+  const tinyxml2::XMLElement* child = parent_node->FirstChildElement();
+  while (child != NULL) {
+    const char* text = child->GetText();
+    if (text != NULL) {
+      const int tag = kElementTags.Find(child->Value());
+      if (tag == kElemPoints)
+        arrays.points_ = text;
+      else if (tag == kElemFrontTextureCoords)
+        arrays.front_texture_coords_ = text;
+      else if (tag == kElemBackTextureCoords)
+        arrays.back_texture_coords_ = text;
+      else if (tag == kElemIndices)
+        arrays.indices_ = text;
+    }
+    child = child->NextSiblingElement();
+  }
+  return UnpackFaceVertices(arrays, triangle_count, info);
+}
+
+void CXmlFile::WriteFaceInfo(const XmlFaceInfo& info,
+                             const CXmlNameTable* names) {
   WriteStartTag(kFaceTag.c_str());
 
   // Front material (optional)
-  if (!info.front_mat_name_.empty()) {
-    tinyxml2::XMLElement* elem = WriteStartTag(kFrontMaterialTag.c_str());
-    elem->SetAttribute(kNameTag.c_str(), info.front_mat_name_.c_str());
-    elem->SetAttribute(kHasTextureTag.c_str(), info.has_front_texture_);
+  const char* front_mat_name =
+      GetName(names, info.front_mat_id_, info.front_mat_name_);
+  if (*front_mat_name != 0) {
+    WriteStartTag(kFrontMaterialTag.c_str());
+    WriteAttribute(kNameTag.c_str(), front_mat_name);
+    WriteAttribute(kHasTextureTag.c_str(), info.has_front_texture_);
     PopParentNode();
   }
 
   // Back material (optional)
-  if (!info.back_mat_name_.empty()) {
-    tinyxml2::XMLElement* elem = WriteStartTag(kBackMaterialTag.c_str());
-    elem->SetAttribute(kNameTag.c_str(), info.back_mat_name_.c_str());
-    elem->SetAttribute(kHasTextureTag.c_str(), info.has_back_texture_);
+  const char* back_mat_name =
+      GetName(names, info.back_mat_id_, info.back_mat_name_);
+  if (*back_mat_name != 0) {
+    WriteStartTag(kBackMaterialTag.c_str());
+    WriteAttribute(kNameTag.c_str(), back_mat_name);
+    WriteAttribute(kHasTextureTag.c_str(), info.has_back_texture_);
     PopParentNode();
   }
 
   // Layer (optional)
-  if (!info.layer_name_.empty()) {
-    tinyxml2::XMLElement* elem = WriteStartTag(kLayerTag.c_str());
-    elem->SetAttribute(kNameTag.c_str(), info.layer_name_.c_str());
+  const char* layer_name = GetName(names, info.layer_id_, info.layer_name_);
+  if (*layer_name != 0) {
+    WriteStartTag(kLayerTag.c_str());
+    WriteAttribute(kNameTag.c_str(), layer_name);
     PopParentNode();
   }
 
@@ -570,41 +1390,129 @@ void CXmlFile::WriteFaceInfo(const XmlFaceInfo& info) {
   if (info.has_single_loop_) {
     WriteStartTag(kLoopTag.c_str());
   } else {
-    tinyxml2::XMLElement* elem = WriteStartTag(kTrianglesTag.c_str());
-    elem->SetAttribute(kCountTag.c_str(), static_cast<unsigned>(count / 3));
+    count = info.indices_.size();
+    WriteStartTag(kTrianglesTag.c_str());
+    WriteAttribute(kCountTag.c_str(), static_cast<unsigned>(count / 3));
   }
 
   // Vertices
-  for (size_t i = 0; i < count; i++) {
-    WriteStartTag(kVertexTag.c_str());
-    const XmlFaceVertex& vertex_info = info.vertices_[i];
-    {
-      tinyxml2::XMLElement* elem = WriteStartTag(kPointTag.c_str());
-      elem->SetAttribute(kXTag.c_str(), vertex_info.vertex_.x());
-      elem->SetAttribute(kYTag.c_str(), vertex_info.vertex_.y());
-      elem->SetAttribute(kZTag.c_str(), vertex_info.vertex_.z());
+  if (xml_version_ >= kXmlVersionPackedFaces) {
+    WritePackedFaceVertices(info);
+  } else {
+    // Each corner of a triangle is written out in full
+    for (size_t i = 0; i < count; i++) {
+      WriteStartTag(kVertexTag.c_str());
+      const XmlFaceVertex& vertex_info = info.has_single_loop_ ?
+          info.vertices_[i] : info.vertices_[info.indices_[i]];
+      {
+        WriteStartTag(kPointTag.c_str());
+        WriteAttribute(kXTag.c_str(), vertex_info.vertex_.x());
+        WriteAttribute(kYTag.c_str(), vertex_info.vertex_.y());
+        WriteAttribute(kZTag.c_str(), vertex_info.vertex_.z());
+        PopParentNode();
+      }
+
+      if (info.has_front_texture_) {
+        WriteStartTag(kFrontTextureCoordsTag.c_str());
+        WriteAttribute(kUTag.c_str(), vertex_info.front_texture_coord_.x());
+        WriteAttribute(kVTag.c_str(), vertex_info.front_texture_coord_.y());
+        PopParentNode();
+      }
+
+      if (info.has_back_texture_) {
+        WriteStartTag(kBackTextureCoordsTag.c_str());
+        WriteAttribute(kUTag.c_str(), vertex_info.back_texture_coord_.x());
+        WriteAttribute(kVTag.c_str(), vertex_info.back_texture_coord_.y());
+        PopParentNode();
+      }
       PopParentNode();
     }
 
+  }
+
+  PopParentNode(); // Loop or Triangles
+  PopParentNode(); // Face
+}
+
+static void AppendNumber(double value, std::string& text) {
+  char buffer[64];
+  tinyxml2::XMLUtil::ToStr(value, buffer, sizeof(buffer));
+  if (!text.empty())
+    text += ' ';
+  text += buffer;
+}
+
+static void AppendNumber(unsigned value, std::string& text) {
+  char buffer[16];
+  tinyxml2::XMLUtil::ToStr(value, buffer, sizeof(buffer));
+  if (!text.empty())
+    text += ' ';
+  text += buffer;
+}
+
+void CXmlFile::WritePackedFaceVertices(const XmlFaceInfo& info) {
+  if (!digests_.empty()) {
+    // The numbers go into the digest rather than their text, which then
+    // isn't made at all if only the digest is needed
+    for (size_t i = 0; i < info.vertices_.size(); ++i) {
+      const XmlFaceVertex& vertex = info.vertices_[i];
+      const double numbers[] = {
+        vertex.vertex_.x(), vertex.vertex_.y(), vertex.vertex_.z(),
+        vertex.front_texture_coord_.x(), vertex.front_texture_coord_.y(),
+        vertex.back_texture_coord_.x(), vertex.back_texture_coord_.y()
+      };
+      Digest(numbers, sizeof(numbers));
+    }
+    if (!info.indices_.empty())
+      Digest(&info.indices_[0], info.indices_.size() * sizeof(uint32_t));
+    if (quiet_digests_ > 0)
+      return;
+  }
+  // Keep the text below out of the digests
+  std::vector<uint64_t> digests;
+  digests.swap(digests_);
+
+  // The vertices are already distinct, triangles refer to them by index
+  std::string points, front_coords, back_coords, indices;
+  for (size_t i = 0; i < info.vertices_.size(); ++i) {
+    const XmlFaceVertex& vertex = info.vertices_[i];
+    AppendNumber(vertex.vertex_.x(), points);
+    AppendNumber(vertex.vertex_.y(), points);
+    AppendNumber(vertex.vertex_.z(), points);
     if (info.has_front_texture_) {
-      tinyxml2::XMLElement* elem =
-          WriteStartTag(kFrontTextureCoordsTag.c_str());
-      elem->SetAttribute(kUTag.c_str(), vertex_info.front_texture_coord_.x());
-      elem->SetAttribute(kVTag.c_str(), vertex_info.front_texture_coord_.y());
-      PopParentNode();
+      AppendNumber(vertex.front_texture_coord_.x(), front_coords);
+      AppendNumber(vertex.front_texture_coord_.y(), front_coords);
     }
-
     if (info.has_back_texture_) {
-      tinyxml2::XMLElement* elem = WriteStartTag(kBackTextureCoordsTag.c_str());
-      elem->SetAttribute(kUTag.c_str(), vertex_info.back_texture_coord_.x());
-      elem->SetAttribute(kVTag.c_str(), vertex_info.back_texture_coord_.y());
-      PopParentNode();
+      AppendNumber(vertex.back_texture_coord_.x(), back_coords);
+      AppendNumber(vertex.back_texture_coord_.y(), back_coords);
+    }
+  }
+  if (!info.has_single_loop_) {
+    for (size_t i = 0; i < info.indices_.size(); ++i) {
+      AppendNumber(static_cast<unsigned>(info.indices_[i]), indices);
     }
-    PopParentNode();
   }
 
-  PopParentNode(); // Loop or Triangles
-  PopParentNode(); // Face
+  WriteStartTag(kPointsTag.c_str());
+  WriteText(points.c_str());
+  PopParentNode();
+  if (info.has_front_texture_) {
+    WriteStartTag(kFrontTextureCoordsTag.c_str());
+    WriteText(front_coords.c_str());
+    PopParentNode();
+  }
+  if (info.has_back_texture_) {
+    WriteStartTag(kBackTextureCoordsTag.c_str());
+    WriteText(back_coords.c_str());
+    PopParentNode();
+  }
+  if (!info.has_single_loop_) {
+    WriteStartTag(kIndicesTag.c_str());
+    WriteText(indices.c_str());
+    PopParentNode();
+  }
+  digests_.swap(digests);
 }
 
 bool CXmlFile::ReadCurveInfo(const tinyxml2::XMLNode* parent_node,
@@ -623,33 +1531,40 @@ bool CXmlFile::ReadCurveInfo(const tinyxml2::XMLNode* parent_node,
   return ok;
 }
 
-void CXmlFile::WriteCurveInfo(const XmlCurveInfo& info) {
+void CXmlFile::WriteCurveInfo(const XmlCurveInfo& info,
+                              const CXmlNameTable* names) {
   WriteStartTag(kCurveTag.c_str());
   
-  for (std::vector<XmlEdgeInfo>::const_iterator it = info.edges_.begin();
+  for (XmlArenaVector<XmlEdgeInfo>::const_iterator it = info.edges_.begin();
        it != info.edges_.end(); ++it) {
-    WriteEdgeInfo(*it);
+    WriteEdgeInfo(*it, names);
   }
 
   PopParentNode();
 }
 
-static std::string MakeMatrixAttribName(int row, int col) {
-  std::stringstream ss;
-  ss << 'm' << row << col;
-  return ss.str();
-}
-
 bool CXmlFile::ReadTransformation(const tinyxml2::XMLNode* parent_node,
                                   SUTransformation& transform) const {
   const tinyxml2::XMLElement* elem = parent_node->LastChildElement();
-  if (elem == NULL || elem->Value() != kTransformTag)
+  if (ElementId(elem) != kElemTransform)
     return false;
 
-  for (int col = 0; col < 4; ++col) {
-    for (int row = 0; row < 4; ++row) {
-      std::string tag = MakeMatrixAttribName(row, col);
-      transform.values[col * 4 + row] = elem->DoubleAttribute(tag.c_str());
+  // One pass over the attributes rather than a search for each value. As
+  // with DoubleAttribute(), missing values are 0 and the first of duplicate
+  // attributes wins.
+  unsigned found = 0;
+  for (int i = 0; i < 16; ++i) {
+    transform.values[i] = 0.0;
+  }
+  for (const tinyxml2::XMLAttribute* attrib = elem->FirstAttribute();
+       attrib != NULL; attrib = attrib->Next()) {
+    const int id = kAttributeTags.Find(attrib->Name());
+    if (id < kAttrMatrix || id >= kAttrMatrixEnd)
+      continue;
+    const int index = id - kAttrMatrix;
+    if ((found & (1U << index)) == 0) {
+      found |= 1U << index;
+      attrib->QueryDoubleValue(&transform.values[index]);
     }
   }
 
@@ -657,50 +1572,353 @@ bool CXmlFile::ReadTransformation(const tinyxml2::XMLNode* parent_node,
 }
 
 void CXmlFile::WriteTransformation(const SUTransformation& transform) {
-  tinyxml2::XMLElement* elem = WriteStartTag(kTransformTag.c_str());
+  WriteStartTag(kTransformTag.c_str());
   for (int col = 0; col < 4; ++col) {
     for (int row = 0; row < 4; ++row) {
-      std::string tag = MakeMatrixAttribName(row, col);
-      elem->SetAttribute(tag.c_str(), transform.values[col * 4 + row]);
+      const std::string& tag =
+          kAttributeTags.GetName(MatrixAttribId(row, col));
+      WriteAttribute(tag.c_str(), transform.values[col * 4 + row]);
     }
   }
   PopParentNode();
 }
 
+void CXmlFile::WriteModelInfo(const XmlModelInfo& model_info) {
+  if (!model_info.layers_.empty()) {
+    StartLayers(model_info.layers_.size());
+    for (size_t i = 0; i < model_info.layers_.size(); ++i) {
+      WriteLayerInfo(model_info.layers_[i]);
+    }
+    PopParentNode();
+  }
+
+  if (!model_info.materials_.empty()) {
+    StartMaterials(model_info.materials_.size());
+    for (size_t i = 0; i < model_info.materials_.size(); ++i) {
+      WriteMaterialInfo(model_info.materials_[i]);
+    }
+    PopParentNode();
+  }
+
+  if (!model_info.definitions_.empty()) {
+    StartComponentDefinitions(model_info.definitions_.size());
+    for (size_t i = 0; i < model_info.definitions_.size(); ++i) {
+      const XmlComponentDefinitionInfo& info = model_info.definitions_[i];
+      StartComponentDefinition(info.name_);
+      for (size_t j = 0; j < info.aliases_.size(); ++j) {
+        WriteStartTag(kAliasTag.c_str());
+        WriteAttribute(kNameTag.c_str(), info.aliases_[j].c_str());
+        PopParentNode();
+      }
+      WriteEntities(info.entities_, model_info.names_);
+      PopParentNode();
+    }
+    PopParentNode();
+  }
+
+  StartGeometry();
+  WriteEntities(model_info.entities_, model_info.names_);
+  PopParentNode();
+}
+
+void CXmlFile::WriteEntities(const XmlEntitiesInfo& entities,
+                             const CXmlNameTable& names) {
+  for (size_t i = 0; i < entities.component_instances_.size(); ++i) {
+    WriteComponentInstanceInfo(entities.component_instances_[i], &names);
+  }
+  for (size_t i = 0; i < entities.groups_.size(); ++i) {
+    const XmlGroupInfo& info = entities.groups_[i];
+    StartGroup();
+    WriteEntities(*info.entities_, names);
+    WriteTransformation(info.transform_);
+    PopParentNode();
+  }
+  for (size_t i = 0; i < entities.faces_.size(); ++i) {
+    WriteFaceInfo(entities.faces_[i], &names);
+  }
+  XmlFaceInfo face_info;
+  for (CXmlFaceStore::const_iterator it = entities.face_store_.begin();
+       it != entities.face_store_.end(); ++it) {
+    it->GetFaceInfo(face_info);
+    WriteFaceInfo(face_info, &names);
+  }
+  for (size_t i = 0; i < entities.edges_.size(); ++i) {
+    WriteEdgeInfo(entities.edges_[i], &names);
+  }
+  for (size_t i = 0; i < entities.curves_.size(); ++i) {
+    WriteCurveInfo(entities.curves_[i], &names);
+  }
+}
+
+// Replace the names of an info with IDs. Clearing the strings keeps their
+// buffers, so infos that are reused don't allocate for every name.
+static void InternNames(CXmlNameTable& names, XmlComponentInstanceInfo& info) {
+  info.definition_id_ = names.Intern(info.definition_name_);
+  info.layer_id_ = names.Intern(info.layer_name_);
+  info.material_id_ = names.Intern(info.material_name_);
+  info.definition_name_.clear();
+  info.layer_name_.clear();
+  info.material_name_.clear();
+}
+
+static void InternNames(CXmlNameTable& names, XmlFaceInfo& info) {
+  info.layer_id_ = names.Intern(info.layer_name_);
+  info.front_mat_id_ = names.Intern(info.front_mat_name_);
+  info.back_mat_id_ = names.Intern(info.back_mat_name_);
+  info.layer_name_.clear();
+  info.front_mat_name_.clear();
+  info.back_mat_name_.clear();
+}
+
+static void InternNames(CXmlNameTable& names, XmlEdgeInfo& info) {
+  info.layer_id_ = names.Intern(info.layer_name_);
+  info.layer_name_.clear();
+}
+
+static void InternNames(CXmlNameTable& names, XmlCurveInfo& info) {
+  for (size_t i = 0; i < info.edges_.size(); ++i) {
+    InternNames(names, info.edges_[i]);
+  }
+}
+
+// Interns the names of a table into another one in ID order, and gives the
+// new ID of every old one. Merging the tables of consecutive parts of a file
+// this way hands out the IDs reading the parts in turn would have.
+// Only the IDs from 'begin' to 'end' are merged, the others are kept.
+static void MergeNames(const CXmlNameTable& from, size_t begin, size_t end,
+                       CXmlNameTable& into, std::vector<uint32_t>& ids) {
+  ids.resize(from.size());
+  for (size_t id = begin; id < end; ++id) {
+    ids[id] = into.Intern(from.GetName(static_cast<uint32_t>(id)));
+  }
+}
+
+// 'nested' says whether the groups are remapped too
+static void RemapNames(const std::vector<uint32_t>& ids,
+                       XmlEntitiesInfo& entities, bool nested = true) {
+  for (size_t i = 0; i < entities.component_instances_.size(); ++i) {
+    XmlComponentInstanceInfo& info = entities.component_instances_[i];
+    info.definition_id_ = ids[info.definition_id_];
+    info.layer_id_ = ids[info.layer_id_];
+    info.material_id_ = ids[info.material_id_];
+  }
+  for (size_t i = 0; nested && i < entities.groups_.size(); ++i) {
+    RemapNames(ids, *entities.groups_[i].entities_);
+  }
+  for (size_t i = 0; i < entities.faces_.size(); ++i) {
+    XmlFaceInfo& info = entities.faces_[i];
+    info.layer_id_ = ids[info.layer_id_];
+    info.front_mat_id_ = ids[info.front_mat_id_];
+    info.back_mat_id_ = ids[info.back_mat_id_];
+  }
+  entities.face_store_.RemapNames(ids);
+  for (size_t i = 0; i < entities.edges_.size(); ++i) {
+    entities.edges_[i].layer_id_ = ids[entities.edges_[i].layer_id_];
+  }
+  for (size_t i = 0; i < entities.curves_.size(); ++i) {
+    XmlCurveInfo& info = entities.curves_[i];
+    for (size_t j = 0; j < info.edges_.size(); ++j) {
+      info.edges_[j].layer_id_ = ids[info.edges_[j].layer_id_];
+    }
+  }
+}
+
+// Reset infos without releasing their memory
+static void ClearInstanceInfo(XmlComponentInstanceInfo& info) {
+  info.definition_name_.clear();
+  info.layer_name_.clear();
+  info.material_name_.clear();
+}
+
+static void ClearEdgeInfo(XmlEdgeInfo& info) {
+  info.has_layer_ = false;
+  info.layer_name_.clear();
+  info.has_color_ = false;
+  info.start_ = CPoint3d();
+  info.end_ = CPoint3d();
+}
+
+static void ClearFaceInfo(XmlFaceInfo& info) {
+  info.layer_name_.clear();
+  info.front_mat_name_.clear();
+  info.back_mat_name_.clear();
+  info.has_front_texture_ = false;
+  info.has_back_texture_ = false;
+  info.has_single_loop_ = false;
+  info.vertices_.clear();
+  info.indices_.clear();
+}
+
+// Appends a copy of a face to the entities, allocated from their arena. The
+// vertices are copied rather than assigned, as assigning would take the
+// allocator of 'info' along.
+static void AddFaceInfo(const XmlFaceInfo& info, XmlEntitiesInfo& entities) {
+  entities.faces_.push_back(XmlFaceInfo(entities.arena()));
+  XmlFaceInfo& face = entities.faces_.back();
+  face.layer_name_ = info.layer_name_;
+  face.front_mat_name_ = info.front_mat_name_;
+  face.back_mat_name_ = info.back_mat_name_;
+  face.layer_id_ = info.layer_id_;
+  face.front_mat_id_ = info.front_mat_id_;
+  face.back_mat_id_ = info.back_mat_id_;
+  face.has_front_texture_ = info.has_front_texture_;
+  face.has_back_texture_ = info.has_back_texture_;
+  face.has_single_loop_ = info.has_single_loop_;
+  face.vertices_.assign(info.vertices_.begin(), info.vertices_.end());
+  face.indices_.assign(info.indices_.begin(), info.indices_.end());
+}
+
+// Count attributes come from the file, so they only ever reserve this many
+// elements up front. Vectors grow past that as usual.
+static const size_t kMaxReserveCount = 64 * 1024;
+
+template <typename T>
+static void ReserveCount(unsigned count, std::vector<T>& values) {
+  values.reserve(values.size() + (std::min)(static_cast<size_t>(count),
+                                            kMaxReserveCount));
+}
+
+template <typename T>
+static void ReserveCount(const tinyxml2::XMLNode* parent_node,
+                         std::vector<T>& values) {
+  unsigned count = 0;
+  if (parent_node->ToElement()->QueryUnsignedAttribute(
+          kCountTag.c_str(), &count) == tinyxml2::XML_NO_ERROR)
+    ReserveCount(count, values);
+}
+
+template <typename T>
+static void ReserveCount(const CXmlStreamReader& reader,
+                         std::vector<T>& values) {
+  unsigned count = 0;
+  if (reader.QueryUnsignedAttribute(kAttrCount, &count))
+    ReserveCount(count, values);
+}
+
+// Layers, materials and definitions keep their names, but get IDs as well so
+// that they can be found by the IDs the entities use
+static void InternModelNames(XmlModelInfo& model_info) {
+  for (size_t i = 0; i < model_info.layers_.size(); ++i) {
+    model_info.names_.Intern(model_info.layers_[i].name_);
+  }
+  for (size_t i = 0; i < model_info.materials_.size(); ++i) {
+    model_info.names_.Intern(model_info.materials_[i].name_);
+  }
+  for (size_t i = 0; i < model_info.definitions_.size(); ++i) {
+    model_info.names_.Intern(model_info.definitions_[i].name_);
+  }
+}
+
 bool CXmlFile::GetModelInfo(XmlModelInfo& model_info) const {
   // Clear out the given model info
-  model_info = XmlModelInfo();
+  if (use_arena_)
+    model_info = XmlModelInfo(std::make_shared<CXmlArena>());
+  else
+    model_info = XmlModelInfo();
+  definition_sources_.clear();
+  definition_indices_.clear();
 
   bool ok = true;
+  CXmlNameTable* names = intern_names() ? &model_info.names_ : NULL;
+  CXmlArena* arena = model_info.arena_.get();
+  const bool parallel = parallel_read();
+  std::vector<XmlReadTask> tasks;
+
+  if (stream_reader_ != NULL) {
+    // Start over from the top, so this can be called more than once
+    CXmlStreamReader& reader = *stream_reader_;
+    int xml_version = 0;
+    if (!ReadHeader(reader, xml_version))
+      return false;
+
+    while (reader.NextChildElement()) {
+      if (reader.tag_id() == kElemLayers) {
+        ok &= ReadLayers(reader, model_info.layers_);
+      } else if (reader.tag_id() == kElemMaterials) {
+        ok &= ReadMaterials(reader, model_info.materials_);
+      } else if (reader.tag_id() == kElemCompDefs && lazy_read()) {
+        ok &= IndexComponentDefinitions(reader, model_info);
+      } else if (reader.tag_id() == kElemCompDefs && parallel) {
+        // Only find the definitions here
+        tasks.clear();
+        while (reader.NextChildElement()) {
+          XmlReadTask task;
+          task.begin_ = reader.tag_offset();
+          reader.SkipElement();
+          task.end_ = reader.offset();
+          tasks.push_back(task);
+        }
+        ok &= ReadTasks(tasks, true, model_info, names);
+      } else if (reader.tag_id() == kElemCompDefs) {
+        ok &= ReadComponentDefinitions(reader, model_info.definitions_,
+                                       names, arena);
+      } else if (reader.tag_id() == kElemGeometry) {
+        tasks.clear();
+        CXmlNameTable outer_names;
+        CXmlNameTable* entity_names =
+            parallel && names != NULL ? &outer_names : names;
+        ok &= ReadEntities(reader, model_info.entities_, NULL, entity_names,
+                           parallel ? &tasks : NULL);
+        ok &= ReadTasks(tasks, false, model_info, names,
+                        parallel ? entity_names : NULL);
+      } else {
+        reader.SkipElement();
+      }
+    }
+    if (names != NULL)
+      InternModelNames(model_info);
+    return ok && !reader.error();
+  }
 
   // Loop through top level tags of the file
   tinyxml2::XMLNode* child = xml_doc_->FirstChild();
   while (child != NULL) {
-    const char* tag = child->ToElement()->Value();
-    if (tag == kLayersTag) {
+    const int tag = kElementTags.Find(child->ToElement()->Value());
+    if (tag == kElemLayers) {
       ok &= ReadLayers(child, model_info.layers_);
-    } else if (tag == kMaterialsTag) {
+    } else if (tag == kElemMaterials) {
       ok &= ReadMaterials(child, model_info.materials_);
-    } else if (tag == kCompDefsTag) {
-      ok &= ReadComponentDefinitions(child, model_info.definitions_);
-    } else if (tag == kGeometryTag) {
-      ok &= ReadEntities(child, model_info.entities_);
+    } else if (tag == kElemCompDefs && lazy_read()) {
+      ok &= IndexComponentDefinitions(child, model_info);
+    } else if (tag == kElemCompDefs && parallel) {
+      tasks.clear();
+      for (const tinyxml2::XMLNode* def = child->FirstChild(); def != NULL;
+           def = def->NextSibling()) {
+        XmlReadTask task;
+        task.node_ = def;
+        tasks.push_back(task);
+      }
+      ok &= ReadTasks(tasks, true, model_info, names);
+    } else if (tag == kElemCompDefs) {
+      ok &= ReadComponentDefinitions(child, model_info.definitions_, names,
+                                     arena);
+    } else if (tag == kElemGeometry) {
+      tasks.clear();
+      CXmlNameTable outer_names;
+      CXmlNameTable* entity_names =
+          parallel && names != NULL ? &outer_names : names;
+      ok &= ReadEntities(child, model_info.entities_, entity_names,
+                         parallel ? &tasks : NULL);
+      ok &= ReadTasks(tasks, false, model_info, names,
+                      parallel ? entity_names : NULL);
     }
     child = child->NextSibling();
   }
 
+  if (names != NULL)
+    InternModelNames(model_info);
   return ok;
 }
 
 bool CXmlFile::ReadLayers(const tinyxml2::XMLNode* parent_node,
                           std::vector<XmlLayerInfo>& layer_infos) const {
   bool ok = true;
+  ReserveCount(parent_node, layer_infos);
   const tinyxml2::XMLNode* child = parent_node->FirstChild();
   while (child != NULL) {
-    XmlLayerInfo info;
-    if (ReadLayerInfo(child, info)) {
-      layer_infos.push_back(info);
-    } else {
+    layer_infos.emplace_back();
+    if (!ReadLayerInfo(child, layer_infos.back())) {
+      layer_infos.pop_back();
       ok = false;
     }
     child = child->NextSibling();
@@ -711,12 +1929,12 @@ bool CXmlFile::ReadLayers(const tinyxml2::XMLNode* parent_node,
 bool CXmlFile::ReadMaterials(const tinyxml2::XMLNode* parent_node,
                              std::vector<XmlMaterialInfo>& mat_infos) const {
   bool ok = true;
+  ReserveCount(parent_node, mat_infos);
   const tinyxml2::XMLNode* child = parent_node->FirstChild();
   while (child != NULL) {
-    XmlMaterialInfo info;
-    if (ReadMaterialInfo(child, info)) {
-      mat_infos.push_back(info);
-    } else {
+    mat_infos.emplace_back();
+    if (!ReadMaterialInfo(child, mat_infos.back())) {
+      mat_infos.pop_back();
       ok = false;
     }
     child = child->NextSibling();
@@ -725,14 +1943,16 @@ bool CXmlFile::ReadMaterials(const tinyxml2::XMLNode* parent_node,
 }
 
 bool CXmlFile::ReadComponentDefinitions(const tinyxml2::XMLNode* parent_node,
-    std::vector<XmlComponentDefinitionInfo>& def_infos) const {
+    std::vector<XmlComponentDefinitionInfo>& def_infos,
+    CXmlNameTable* names, CXmlArena* arena) const {
   bool ok = true;
+  ReserveCount(parent_node, def_infos);
   const tinyxml2::XMLNode* child = parent_node->FirstChild();
   while (child != NULL) {
-    XmlComponentDefinitionInfo info;
-    if (ReadComponentDefinitionInfo(child, true, info)) {
-      def_infos.push_back(info);
-    } else {
+    // Read in place, copying the definition would copy all its entities
+    def_infos.emplace_back(arena);
+    if (!ReadComponentDefinitionInfo(child, true, def_infos.back(), names)) {
+      def_infos.pop_back();
       ok = false;
     }
     child = child->NextSibling();
@@ -742,24 +1962,29 @@ bool CXmlFile::ReadComponentDefinitions(const tinyxml2::XMLNode* parent_node,
 }
 
 void CXmlFile::WriteComponentInstanceInfo(
-    const XmlComponentInstanceInfo& info) {
-  tinyxml2::XMLElement* elem = WriteStartTag(kComponentInstanceTag.c_str());
+    const XmlComponentInstanceInfo& info, const CXmlNameTable* names) {
+  WriteStartTag(kComponentInstanceTag.c_str());
   
   // Definition name
-  StartComponentDefinition(info.definition_name_);
+  WriteStartTag(kCompDefTag.c_str());
+  WriteAttribute(kNameTag.c_str(),
+                 GetName(names, info.definition_id_, info.definition_name_));
   PopParentNode();
 
   // Material (optional)
-  if (!info.material_name_.empty()) {
-    tinyxml2::XMLElement* elem = WriteStartTag(kMaterialTag.c_str());
-    elem->SetAttribute(kNameTag.c_str(), info.material_name_.c_str());
+  const char* material_name =
+      GetName(names, info.material_id_, info.material_name_);
+  if (*material_name != 0) {
+    WriteStartTag(kMaterialTag.c_str());
+    WriteAttribute(kNameTag.c_str(), material_name);
     PopParentNode();
   }
 
   // Layer (optional)
-  if (!info.layer_name_.empty()) {
-    tinyxml2::XMLElement* elem = WriteStartTag(kLayerTag.c_str());
-    elem->SetAttribute(kNameTag.c_str(), info.layer_name_.c_str());
+  const char* layer_name = GetName(names, info.layer_id_, info.layer_name_);
+  if (*layer_name != 0) {
+    WriteStartTag(kLayerTag.c_str());
+    WriteAttribute(kNameTag.c_str(), layer_name);
     PopParentNode();
   }
 
@@ -775,27 +2000,25 @@ bool CXmlFile::ReadComponentInstanceInfo(const tinyxml2::XMLNode* parent_node,
   // Definition name
   XmlComponentDefinitionInfo comp_def;
   const tinyxml2::XMLNode* child = parent_node->FirstChild();
-  ok &= ReadComponentDefinitionInfo(child, false, comp_def);
+  ok &= ReadComponentDefinitionInfo(child, false, comp_def, NULL);
   info.definition_name_ = comp_def.name_;
 
   // Material (optional)
   child = child->NextSibling();
-  if (child != NULL && child->Value() == kMaterialTag) {
-    info.material_name_ = child->ToElement()->Attribute(kNameTag.c_str());
+  int tag = ElementId(child);
+  if (tag == kElemMaterial) {
+    const char* name = child->ToElement()->Attribute(kNameTag.c_str());
+    info.material_name_ = name != NULL ? name : "";
   }
 
   if (child != NULL) {
-    bool foundLayer = false;
-    if (child->Value() == kLayerTag) {
-      foundLayer = true;
-    } else {
+    if (tag != kElemLayer) {
       child = child->NextSibling();
-      if (child != NULL && child->Value() == kLayerTag) {
-        foundLayer = true;
-      }
+      tag = ElementId(child);
     }
-    if (foundLayer) {
-      info.layer_name_ = child->ToElement()->Attribute(kNameTag.c_str());
+    if (tag == kElemLayer) {
+      const char* name = child->ToElement()->Attribute(kNameTag.c_str());
+      info.layer_name_ = name != NULL ? name : "";
     }
   }
 
@@ -805,42 +2028,810 @@ bool CXmlFile::ReadComponentInstanceInfo(const tinyxml2::XMLNode* parent_node,
 }
 
 bool CXmlFile::ReadEntities(const tinyxml2::XMLNode* parent_node,
-                            XmlEntitiesInfo& entities) const {
+                            XmlEntitiesInfo& entities,
+                            CXmlNameTable* names,
+                            std::vector<XmlReadTask>* group_tasks) const {
 
   bool ok = true;
+  CXmlArena* arena = entities.arena();
+  // Faces are read here and then copied into the entities
+  XmlFaceInfo face_info;
 
   const tinyxml2::XMLNode* child = parent_node->FirstChild();
   while (child != NULL) {
-    const char* tag = child->ToElement()->Value();
-    if (tag == kComponentInstanceTag) {
-      XmlComponentInstanceInfo instance;
+    const int tag = kElementTags.Find(child->ToElement()->Value());
+    if (tag == kElemComponentInstance) {
+      entities.component_instances_.emplace_back();
+      XmlComponentInstanceInfo& instance = entities.component_instances_.back();
       ReadComponentInstanceInfo(child, instance);
-      entities.component_instances_.push_back(instance);
-    } else if (tag == kGroupTag) {
-      XmlGroupInfo group;
-      // Recurse into group entities
-      ok &= ReadEntities(child, *group.entities_);
-      // Read the transformation
-      ok &= ReadTransformation(child, group.transform_);
-      entities.groups_.push_back(group);
-    } else if (tag == kFaceTag) {
+      if (names != NULL)
+        InternNames(*names, instance);
+    } else if (tag == kElemGroup && group_tasks != NULL) {
+      XmlReadTask task;
+      task.node_ = child;
+      task.name_count_ = names != NULL ? names->size() : 0;
+      group_tasks->push_back(task);
+    } else if (tag == kElemGroup) {
+      // Read in place, copying the group would copy all its entities
+      entities.groups_.emplace_back(arena);
+      ok &= ReadGroupInfo(child, entities.groups_.back(), names);
+    } else if (tag == kElemFace) {
       // Read faces
-      XmlFaceInfo face_info;
+      ClearFaceInfo(face_info);
       ok &= ReadFaceInfo(child, face_info);
-      entities.faces_.push_back(face_info);
-    } else if (tag == kEdgeTag) {
+      if (names != NULL)
+        InternNames(*names, face_info);
+      if (use_face_store_)
+        entities.face_store_.AddFace(face_info);
+      else
+        AddFaceInfo(face_info, entities);
+    } else if (tag == kElemEdge) {
       // Read edges
-      XmlEdgeInfo edge_info;
+      entities.edges_.emplace_back();
+      XmlEdgeInfo& edge_info = entities.edges_.back();
       ok &= ReadEdgeInfo(child, edge_info);
-      entities.edges_.push_back(edge_info);
-    } else if (tag == kCurveTag) {
+      if (names != NULL)
+        InternNames(*names, edge_info);
+    } else if (tag == kElemCurve) {
       // Read curves
-      XmlCurveInfo curve_info;
+      entities.curves_.emplace_back(arena);
+      XmlCurveInfo& curve_info = entities.curves_.back();
       ok &= ReadCurveInfo(child, curve_info);
-      entities.curves_.push_back(curve_info);
+      if (names != NULL)
+        InternNames(*names, curve_info);
+    }
+    child = child->NextSibling();
+  }
+
+  return ok;
+}
+
+bool CXmlFile::ReadGroupInfo(const tinyxml2::XMLNode* parent_node,
+                             XmlGroupInfo& info, CXmlNameTable* names) const {
+  // Recurse into group entities
+  bool ok = ReadEntities(parent_node, *info.entities_, names);
+  // Read the transformation
+  ok &= ReadTransformation(parent_node, info.transform_);
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+// Streaming reader. These mirror the DOM based functions above, child by
+// child, so both modes produce the same XmlModelInfo for the same file.
+
+// Consumes the remaining children of the current element, up to its end tag
+static void SkipChildren(CXmlStreamReader& reader) {
+  while (reader.NextChildElement()) {
+    reader.SkipElement();
+  }
+}
+
+static bool ReadPoint(CXmlStreamReader& reader, CPoint3d& point) {
+  double x, y, z;
+  bool ok = reader.QueryDoubleAttribute(kAttrX, &x) &&
+            reader.QueryDoubleAttribute(kAttrY, &y) &&
+            reader.QueryDoubleAttribute(kAttrZ, &z);
+  if (ok)
+    point.SetLocation(x, y, z);
+  reader.SkipElement();
+  return ok;
+}
+
+bool CXmlFile::ReadColor(CXmlStreamReader& reader, SUColor& color) const {
+  std::string attrib;
+  return reader.QueryStringAttribute(kAttrColor, &attrib) &&
+         ParseColor(attrib.c_str(), color);
+}
+
+bool CXmlFile::ReadHeader(CXmlStreamReader& reader, int& xml_version) const {
+  bool opened = mapped_file_ != NULL ?
+      reader.Open(mapped_file_->data(), mapped_file_->size()) :
+      reader.Open(filename_);
+  if (!opened ||
+      reader.Next() != CXmlStreamReader::kStartElement ||
+      reader.tag_id() != kElemSkpToXML)
+    return false;
+
+  bool ok = reader.QueryIntAttribute(kAttrXMLVersion, &xml_version) &&
+            (xml_version >= kXmlVersionVertexElements) &&
+            (xml_version <= kXmlVersionLatest);
+  return reader.SkipElement() && ok;
+}
+
+bool CXmlFile::ReadLayers(CXmlStreamReader& reader,
+                          std::vector<XmlLayerInfo>& layer_infos) const {
+  bool ok = true;
+  ReserveCount(reader, layer_infos);
+  while (reader.NextChildElement()) {
+    layer_infos.emplace_back();
+    if (!ReadLayerInfo(reader, layer_infos.back())) {
+      layer_infos.pop_back();
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool CXmlFile::ReadLayerInfo(CXmlStreamReader& reader,
+                             XmlLayerInfo& info) const {
+  if (reader.tag_id() != kElemLayer) {
+    reader.SkipElement();
+    return false;
+  }
+
+  // Name
+  bool ok = reader.QueryStringAttribute(kAttrName, &info.name_);
+
+  // Visibility
+  info.is_visible_ = false;
+  reader.QueryBoolAttribute(kAttrVisible, &info.is_visible_);
+
+  // Material info (optional)
+  if (reader.NextChildElement()) {
+    info.has_material_info_ = ReadMaterialInfo(reader, info.material_info_);
+    SkipChildren(reader);
+  }
+  return ok;
+}
+
+bool CXmlFile::ReadMaterialInfo(CXmlStreamReader& reader,
+                                XmlMaterialInfo& info) const {
+  if (reader.tag_id() != kElemMaterial) {
+    reader.SkipElement();
+    return false;
+  }
+
+  // Name
+  bool ok = reader.QueryStringAttribute(kAttrName, &info.name_);
+
+  // Color (optional)
+  info.has_color_ = ReadColor(reader, info.color_);
+
+  // Alpha (optional)
+  info.has_alpha_ = reader.QueryDoubleAttribute(kAttrAlpha,
+                                                &info.alpha_);
+
+  // Texture (optional)
+  if (reader.NextChildElement()) {
+    if (reader.tag_id() == kElemTexture) {
+      info.has_texture_ = true;
+      ok &= reader.QueryStringAttribute(kAttrPath, &info.texture_path_);
+      ok &= reader.QueryDoubleAttribute(kAttrSScale,
+                                        &info.texture_sscale_);
+      ok &= reader.QueryDoubleAttribute(kAttrTScale,
+                                        &info.texture_tscale_);
+    }
+    reader.SkipElement();
+    SkipChildren(reader);
+  }
+  return ok;
+}
+
+bool CXmlFile::ReadMaterials(CXmlStreamReader& reader,
+                             std::vector<XmlMaterialInfo>& mat_infos) const {
+  bool ok = true;
+  ReserveCount(reader, mat_infos);
+  while (reader.NextChildElement()) {
+    mat_infos.emplace_back();
+    if (!ReadMaterialInfo(reader, mat_infos.back())) {
+      mat_infos.pop_back();
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool CXmlFile::ReadComponentDefinitions(CXmlStreamReader& reader,
+    std::vector<XmlComponentDefinitionInfo>& def_infos,
+    CXmlNameTable* names, CXmlArena* arena) const {
+  bool ok = true;
+  ReserveCount(reader, def_infos);
+  while (reader.NextChildElement()) {
+    // Read in place, copying the definition would copy all its entities
+    def_infos.emplace_back(arena);
+    if (!ReadComponentDefinitionInfo(reader, def_infos.back(), names)) {
+      def_infos.pop_back();
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool CXmlFile::ReadComponentDefinitionInfo(CXmlStreamReader& reader,
+    XmlComponentDefinitionInfo& info, CXmlNameTable* names) const {
+  if (!reader.QueryStringAttribute(kAttrName, &info.name_)) {
+    reader.SkipElement();
+    return false;
+  }
+  info.aliases_.clear();
+  return ReadEntities(reader, info.entities_, NULL, names, NULL,
+                      &info.aliases_);
+}
+
+bool CXmlFile::ReadEdgeInfo(CXmlStreamReader& reader,
+                            XmlEdgeInfo& info) const {
+  // Children are, in order: Layer (optional), Material (optional), Start, End
+  enum { kLayer, kMaterial, kStart, kEnd, kDone } next = kLayer;
+  bool ok = true;
+  while (reader.NextChildElement()) {
+    if (next <= kLayer && reader.tag_id() == kElemLayer) {
+      info.has_layer_ = reader.QueryStringAttribute(kAttrName,
+                                                    &info.layer_name_);
+      next = kMaterial;
+      reader.SkipElement();
+    } else if (next <= kMaterial && reader.tag_id() == kElemMaterial) {
+      info.has_color_ = ReadColor(reader, info.color_);
+      next = kStart;
+      reader.SkipElement();
+    } else if (next <= kStart) {
+      if (reader.tag_id() == kElemStart) {
+        ok &= ReadPoint(reader, info.start_);
+        next = kEnd;
+      } else {
+        ok = false;
+        next = kDone;
+        reader.SkipElement();
+      }
+    } else if (next == kEnd) {
+      if (reader.tag_id() == kElemEnd) {
+        ok &= ReadPoint(reader, info.end_);
+      } else {
+        ok = false;
+        reader.SkipElement();
+      }
+      next = kDone;
+    } else {
+      reader.SkipElement();
+    }
+  }
+  return ok && next == kDone;
+}
+
+static bool ReadTextureCoords(CXmlStreamReader& reader, int tag_id,
+                              CPoint3d& coords) {
+  if (reader.tag_id() != tag_id) {
+    reader.SkipElement();
+    return false;
+  }
+  double u, v;
+  bool ok = reader.QueryDoubleAttribute(kAttrU, &u) &&
+            reader.QueryDoubleAttribute(kAttrV, &v);
+  if (ok)
+    coords.SetLocation(u, v, 0);
+  reader.SkipElement();
+  return ok;
+}
+
+bool CXmlFile::ReadFaceInfo(CXmlStreamReader& reader,
+                            XmlFaceInfo& info) const {
+  // Children are, in order: FrontMaterial, BackMaterial, Layer (all optional)
+  // and then Loop or Triangles
+  enum { kFrontMaterial, kBackMaterial, kLayer, kVertices, kDone } next =
+      kFrontMaterial;
+  bool ok = false;
+  while (reader.NextChildElement()) {
+    if (next <= kFrontMaterial && reader.tag_id() == kElemFrontMaterial) {
+      reader.QueryStringAttribute(kAttrName, &info.front_mat_name_);
+      reader.QueryBoolAttribute(kAttrHasTexture,
+                                &info.has_front_texture_);
+      next = kBackMaterial;
+      reader.SkipElement();
+    } else if (next <= kBackMaterial && reader.tag_id() == kElemBackMaterial) {
+      reader.QueryStringAttribute(kAttrName, &info.back_mat_name_);
+      reader.QueryBoolAttribute(kAttrHasTexture,
+                                &info.has_back_texture_);
+      next = kLayer;
+      reader.SkipElement();
+    } else if (next <= kLayer && reader.tag_id() == kElemLayer) {
+      reader.QueryStringAttribute(kAttrName, &info.layer_name_);
+      next = kVertices;
+      reader.SkipElement();
+    } else if (next <= kVertices && reader.tag_id() == kElemLoop) {
+      info.has_single_loop_ = true;
+      ok = xml_version_ >= kXmlVersionPackedFaces ?
+           ReadPackedFaceVertices(reader, 0, info) :
+           ReadFaceVertices(reader, info);
+      next = kDone;
+    } else if (next <= kVertices && reader.tag_id() == kElemTriangles) {
+      info.has_single_loop_ = false;
+      int triangle_count = 0;
+      ok = reader.QueryIntAttribute(kAttrCount, &triangle_count);
+      if (ok && xml_version_ >= kXmlVersionPackedFaces) {
+        ok = ReadPackedFaceVertices(reader, triangle_count, info);
+      } else if (ok) {
+        ok = ReadFaceVertices(reader, info);
+        // If a mesh is given, check the number of vertices
+        ok &= (info.vertices_.size() == static_cast<size_t>(triangle_count) * 3);
+        ShareFaceVertices(info);
+      } else {
+        reader.SkipElement();
+      }
+      next = kDone;
+    } else {
+      next = kDone;
+      reader.SkipElement();
+    }
+  }
+  return ok;
+}
+
+bool CXmlFile::ReadFaceVertices(CXmlStreamReader& reader,
+                                XmlFaceInfo& info) const {
+  bool ok = true;
+  bool done = false;
+  while (reader.NextChildElement()) {
+    // Stop at the first bad vertex, or at anything that isn't a vertex
+    if (done || !ok || reader.tag_id() != kElemVertex) {
+      done = true;
+      reader.SkipElement();
+      continue;
+    }
+
+    // Vertex position, then the texture coords the face has
+    XmlFaceVertex vertex;
+    bool has_point = false;
+    bool need_front_coords = info.has_front_texture_;
+    bool need_back_coords = info.has_back_texture_;
+    int index = 0;
+    while (reader.NextChildElement()) {
+      if (index++ == 0) {
+        has_point = ReadPoint(reader, vertex.vertex_);
+      } else if (has_point && need_front_coords) {
+        ok &= ReadTextureCoords(reader, kElemFrontTextureCoords,
+                                vertex.front_texture_coord_);
+        need_front_coords = false;
+      } else if (has_point && need_back_coords) {
+        ok &= ReadTextureCoords(reader, kElemBackTextureCoords,
+                                vertex.back_texture_coord_);
+        need_back_coords = false;
+      } else {
+        reader.SkipElement();
+      }
+    }
+
+    if (has_point) {
+      ok &= !need_front_coords && !need_back_coords;
+      info.vertices_.push_back(vertex);
+    } else {
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool CXmlFile::ReadPackedFaceVertices(CXmlStreamReader& reader,
+                                      int triangle_count,
+                                      XmlFaceInfo& info) const {
+  XmlPackedFaceArrays arrays;
+  while (reader.NextChildElement()) {
+    if (reader.tag_id() == kElemPoints)
+      reader.ReadText(&arrays.points_);
+    else if (reader.tag_id() == kElemFrontTextureCoords)
+      reader.ReadText(&arrays.front_texture_coords_);
+    else if (reader.tag_id() == kElemBackTextureCoords)
+      reader.ReadText(&arrays.back_texture_coords_);
+    else if (reader.tag_id() == kElemIndices)
+      reader.ReadText(&arrays.indices_);
+    else
+      reader.SkipElement();
+  }
+  return UnpackFaceVertices(arrays, triangle_count, info);
+}
+
+bool CXmlFile::ReadCurveInfo(CXmlStreamReader& reader,
+                             XmlCurveInfo& info) const {
+  bool ok = true;
+  while (reader.NextChildElement()) {
+    XmlEdgeInfo edge_info;
+    if (ReadEdgeInfo(reader, edge_info)) {
+      info.edges_.push_back(edge_info);
+    } else {
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool CXmlFile::ReadTransformation(CXmlStreamReader& reader,
+                                  SUTransformation& transform) const {
+  for (int col = 0; col < 4; ++col) {
+    for (int row = 0; row < 4; ++row) {
+      double value = 0.0;
+      reader.QueryDoubleAttribute(MatrixAttribId(row, col), &value);
+      transform.values[col * 4 + row] = value;
+    }
+  }
+  reader.SkipElement();
+  return true;
+}
+
+bool CXmlFile::ReadComponentInstanceInfo(CXmlStreamReader& reader,
+    XmlComponentInstanceInfo& info) const {
+  // Children are, in order: ComponentDefinition, Material (optional),
+  // Layer (optional) and Transformation
+  bool ok = false;
+  bool found_layer = false;
+  bool has_transform = false;
+  SUTransformation transform;
+  int index = 0;
+  while (reader.NextChildElement()) {
+    if (index == 0) {
+      // Definition name
+      ok = reader.QueryStringAttribute(kAttrName,
+                                       &info.definition_name_);
+    } else if (index == 1 && reader.tag_id() == kElemMaterial) {
+      reader.QueryStringAttribute(kAttrName, &info.material_name_);
+    } else if (index <= 2 && !found_layer && reader.tag_id() == kElemLayer) {
+      reader.QueryStringAttribute(kAttrName, &info.layer_name_);
+      found_layer = true;
+    }
+    ++index;
+
+    // The transformation is the last child
+    has_transform = reader.tag_id() == kElemTransform;
+    if (has_transform) {
+      ReadTransformation(reader, transform);
+    } else {
+      reader.SkipElement();
+    }
+  }
+
+  if (has_transform)
+    info.transform_ = transform;
+  return ok && has_transform;
+}
+
+bool CXmlFile::ReadEntities(CXmlStreamReader& reader,
+                            XmlEntitiesInfo& entities,
+                            SUTransformation* transform,
+                            CXmlNameTable* names,
+                            std::vector<XmlReadTask>* group_tasks,
+                            std::vector<std::string>* aliases) const {
+  bool ok = true;
+  bool has_transform = false;
+  SUTransformation last_transform;
+  CXmlArena* arena = entities.arena();
+  // Reused for every entity of the block, so their buffers are only
+  // allocated once per entities block. With interned names, the copies that
+  // go into the entities don't allocate any names either.
+  XmlComponentInstanceInfo instance;
+  XmlFaceInfo face_info;
+  XmlEdgeInfo edge_info;
+
+  while (reader.NextChildElement()) {
+    has_transform = false;
+    if (reader.tag_id() == kElemComponentInstance) {
+      ClearInstanceInfo(instance);
+      ReadComponentInstanceInfo(reader, instance);
+      if (names != NULL)
+        InternNames(*names, instance);
+      entities.component_instances_.push_back(instance);
+    } else if (reader.tag_id() == kElemGroup && group_tasks != NULL) {
+      XmlReadTask task;
+      task.begin_ = reader.tag_offset();
+      task.name_count_ = names != NULL ? names->size() : 0;
+      reader.SkipElement();
+      task.end_ = reader.offset();
+      group_tasks->push_back(task);
+    } else if (reader.tag_id() == kElemGroup) {
+      // Read in place, copying the group would copy all its entities
+      entities.groups_.emplace_back(arena);
+      ok &= ReadGroupInfo(reader, entities.groups_.back(), names);
+    } else if (reader.tag_id() == kElemFace) {
+      // Read faces
+      ClearFaceInfo(face_info);
+      ok &= ReadFaceInfo(reader, face_info);
+      if (names != NULL)
+        InternNames(*names, face_info);
+      if (use_face_store_)
+        entities.face_store_.AddFace(face_info);
+      else
+        AddFaceInfo(face_info, entities);
+    } else if (reader.tag_id() == kElemEdge) {
+      // Read edges
+      ClearEdgeInfo(edge_info);
+      ok &= ReadEdgeInfo(reader, edge_info);
+      if (names != NULL)
+        InternNames(*names, edge_info);
+      entities.edges_.push_back(edge_info);
+    } else if (reader.tag_id() == kElemCurve) {
+      // Read curves
+      entities.curves_.emplace_back(arena);
+      XmlCurveInfo& curve_info = entities.curves_.back();
+      ok &= ReadCurveInfo(reader, curve_info);
+      if (names != NULL)
+        InternNames(*names, curve_info);
+    } else if (transform != NULL && reader.tag_id() == kElemTransform) {
+      has_transform = ReadTransformation(reader, last_transform);
+    } else if (aliases != NULL && reader.tag_id() == kElemAlias) {
+      aliases->emplace_back();
+      if (!reader.QueryStringAttribute(kAttrName, &aliases->back()))
+        aliases->pop_back();
+      reader.SkipElement();
+    } else {
+      reader.SkipElement();
+    }
+  }
+
+  // Groups keep their transformation as the last child
+  if (transform != NULL) {
+    if (has_transform)
+      *transform = last_transform;
+    ok &= has_transform;
+  }
+  return ok;
+}
+
+bool CXmlFile::ReadGroupInfo(CXmlStreamReader& reader, XmlGroupInfo& info,
+                             CXmlNameTable* names) const {
+  // Recurse into group entities, the transformation comes last
+  return ReadEntities(reader, *info.entities_, &info.transform_, names);
+}
+
+// Reads the bytes [begin, end) of an uncompressed file
+static bool ReadFileRange(const std::string& filename, size_t begin,
+                          size_t end, std::vector<char>& buffer) {
+  CXmlCodecFile file;
+  if (!file.OpenRead(filename))
+    return false;
+
+  bool ok = file.Skip(begin);
+  buffer.resize(end - begin);
+  ok = ok && (buffer.empty() ||
+              file.Read(&buffer[0], buffer.size()) == buffer.size());
+  return file.Close() && ok;
+}
+
+//------------------------------------------------------------------------------
+// Parallel reads. Every task reads into a name table of its own, since the
+// tasks finish in any order. The top level geometry interns its own names
+// into one more table, and each group task notes how many of those came
+// before it. Afterwards the tables are merged into the model's table in
+// file order: the geometry's names up to the first group, the group's
+// names, the geometry's names up to the next group, and so on. The IDs are
+// then those of a read on one thread. Each thread allocates from an arena
+// of its own.
+
+bool CXmlFile::parallel_read() const {
+  return XmlParallel::ThreadCount(read_threads_) > 1 &&
+         (stream_reader_ == NULL || mapped_file_ != NULL);
+}
+
+bool CXmlFile::ReadTasks(const std::vector<XmlReadTask>& tasks,
+                         bool definitions, XmlModelInfo& model_info,
+                         CXmlNameTable* names,
+                         const CXmlNameTable* outer_names) const {
+  if (names == NULL)
+    outer_names = NULL;
+  if (tasks.empty() && outer_names == NULL)
+    return true;
+
+  // Room for all results, so every task can read in place
+  const size_t count = tasks.size();
+  const size_t first_def = model_info.definitions_.size();
+  const size_t first_group = model_info.entities_.groups_.size();
+  if (definitions)
+    model_info.definitions_.resize(first_def + count);
+  else
+    model_info.entities_.groups_.resize(first_group + count);
+
+  unsigned threads = XmlParallel::ThreadCount(read_threads_);
+  if (threads > count)
+    threads = static_cast<unsigned>(count);
+  std::vector<CXmlArena*> arenas(threads, model_info.arena_.get());
+  if (model_info.arena_) {
+    // The calling thread keeps the model's arena
+    while (model_info.thread_arenas_.size() + 1 < threads) {
+      model_info.thread_arenas_.push_back(std::make_shared<CXmlArena>());
     }
+    for (unsigned i = 1; i < threads; ++i) {
+      arenas[i] = model_info.thread_arenas_[i - 1].get();
+    }
+  }
+
+  std::vector<CXmlNameTable> task_names(names != NULL ? count : 0);
+  std::vector<char> task_ok(count, 0);
+  XmlParallel::For(count, threads, [&](size_t task, unsigned thread) {
+    CXmlNameTable* task_table = names != NULL ? &task_names[task] : NULL;
+    if (definitions) {
+      XmlComponentDefinitionInfo& info =
+          model_info.definitions_[first_def + task];
+      info = XmlComponentDefinitionInfo(arenas[thread]);
+      task_ok[task] = ReadTask(tasks[task], info, task_table);
+    } else {
+      XmlGroupInfo& info = model_info.entities_.groups_[first_group + task];
+      info = XmlGroupInfo(arenas[thread]);
+      task_ok[task] = ReadTask(tasks[task], info, task_table);
+    }
+  });
+
+  // Merge the names, and drop definitions that failed like
+  // ReadComponentDefinitions does
+  bool ok = true;
+  std::vector<uint32_t> ids;
+  std::vector<uint32_t> outer_ids;
+  size_t outer_merged = 0;
+  size_t kept = first_def;
+  for (size_t task = 0; task < count; ++task) {
+    ok &= task_ok[task] != 0;
+    XmlEntitiesInfo& entities = definitions ?
+        model_info.definitions_[first_def + task].entities_ :
+        *model_info.entities_.groups_[first_group + task].entities_;
+    if (outer_names != NULL) {
+      MergeNames(*outer_names, outer_merged, tasks[task].name_count_,
+                 *names, outer_ids);
+      outer_merged = tasks[task].name_count_;
+    }
+    if (names != NULL && (!definitions || task_ok[task])) {
+      const CXmlNameTable& table = task_names[task];
+      MergeNames(table, 0, table.size(), *names, ids);
+      RemapNames(ids, entities);
+    }
+    if (definitions && task_ok[task]) {
+      if (kept != first_def + task) {
+        model_info.definitions_[kept] =
+            std::move(model_info.definitions_[first_def + task]);
+      }
+      ++kept;
+    }
+  }
+  if (definitions)
+    model_info.definitions_.resize(kept);
+  if (outer_names != NULL) {
+    // The groups have their IDs already
+    MergeNames(*outer_names, outer_merged, outer_names->size(), *names,
+               outer_ids);
+    RemapNames(outer_ids, model_info.entities_, false);
+  }
+  return ok;
+}
+
+bool CXmlFile::ReadTask(const XmlReadTask& task,
+                        XmlComponentDefinitionInfo& info,
+                        CXmlNameTable* names) const {
+  if (task.node_ != NULL)
+    return ReadComponentDefinitionInfo(task.node_, true, info, names);
+
+  // Only lazy definitions come from files that aren't mapped
+  std::vector<char> buffer;
+  const char* data = NULL;
+  if (mapped_file_ != NULL) {
+    data = mapped_file_->data() + task.begin_;
+  } else if (ReadFileRange(filename_, task.begin_, task.end_, buffer)) {
+    data = buffer.data();
+  } else {
+    return false;
+  }
+
+  CXmlStreamReader reader;
+  reader.set_tag_tables(&kElementTags, &kAttributeTags);
+  reader.Open(data, task.end_ - task.begin_);
+  return reader.Next() == CXmlStreamReader::kStartElement &&
+         ReadComponentDefinitionInfo(reader, info, names) && !reader.error();
+}
+
+bool CXmlFile::ReadTask(const XmlReadTask& task, XmlGroupInfo& info,
+                        CXmlNameTable* names) const {
+  if (task.node_ != NULL)
+    return ReadGroupInfo(task.node_, info, names);
+
+  CXmlStreamReader reader;
+  reader.set_tag_tables(&kElementTags, &kAttributeTags);
+  reader.Open(mapped_file_->data() + task.begin_, task.end_ - task.begin_);
+  return reader.Next() == CXmlStreamReader::kStartElement &&
+         ReadGroupInfo(reader, info, names) && !reader.error();
+}
+
+//------------------------------------------------------------------------------
+// Lazy definitions. GetModelInfo only finds the definitions and remembers
+// where they are, as tasks like the parallel reads use.
+
+bool CXmlFile::lazy_read() const {
+  // A compressed file read through the stream reader can't seek back to a
+  // definition, only decompress up to it again
+  return lazy_definitions_ &&
+         (stream_reader_ == NULL ||
+          CXmlCodecFile::CodecOf(filename_) == CXmlCodecFile::kCodecNone);
+}
+
+bool CXmlFile::IndexComponentDefinitions(const tinyxml2::XMLNode* parent_node,
+                                         XmlModelInfo& model_info) const {
+  bool ok = true;
+  ReserveCount(parent_node, model_info.definitions_);
+  const tinyxml2::XMLNode* child = parent_node->FirstChild();
+  while (child != NULL) {
+    XmlReadTask task;
+    task.node_ = child;
+    const char* name = child->ToElement()->Attribute(kNameTag.c_str());
+    if (name != NULL)
+      AddLazyDefinition(name, task, model_info);
+    else
+      ok = false;
     child = child->NextSibling();
   }
+  return ok;
+}
 
+bool CXmlFile::IndexComponentDefinitions(CXmlStreamReader& reader,
+                                         XmlModelInfo& model_info) const {
+  bool ok = true;
+  ReserveCount(reader, model_info.definitions_);
+  std::string name;
+  while (reader.NextChildElement()) {
+    XmlReadTask task;
+    task.begin_ = reader.tag_offset();
+    bool has_name = reader.QueryStringAttribute(kAttrName, &name);
+    reader.SkipElement();
+    task.end_ = reader.offset();
+    if (has_name)
+      AddLazyDefinition(name, task, model_info);
+    else
+      ok = false;
+  }
+  return ok;
+}
+
+void CXmlFile::AddLazyDefinition(const std::string& name,
+                                 const XmlReadTask& task,
+                                 XmlModelInfo& model_info) const {
+  model_info.definitions_.emplace_back(model_info.arena_.get());
+  XmlComponentDefinitionInfo& info = model_info.definitions_.back();
+  info.name_ = name;
+  info.loaded_ = false;
+  // The first definition of a name wins, as it does for the importer
+  definition_indices_.insert(
+      std::make_pair(name, model_info.definitions_.size() - 1));
+  definition_sources_.push_back(task);
+}
+
+const XmlComponentDefinitionInfo* CXmlFile::LoadComponentDefinition(
+    XmlModelInfo& model_info, const std::string& name) const {
+  std::map<std::string, size_t>::const_iterator it =
+      definition_indices_.find(name);
+  if (it == definition_indices_.end()) {
+    // Definitions that weren't read lazily are all there
+    for (size_t i = 0; i < model_info.definitions_.size(); ++i) {
+      const XmlComponentDefinitionInfo& info = model_info.definitions_[i];
+      if (info.loaded_ && info.name_ == name)
+        return &info;
+    }
+    return NULL;
+  }
+  if (!LoadComponentDefinition(model_info, it->second))
+    return NULL;
+  return &model_info.definitions_[it->second];
+}
+
+bool CXmlFile::LoadComponentDefinition(XmlModelInfo& model_info,
+                                       size_t index) const {
+  if (index >= model_info.definitions_.size())
+    return false;
+  XmlComponentDefinitionInfo& info = model_info.definitions_[index];
+  if (info.loaded_)
+    return true;
+  // Only the model GetModelInfo returned last can be loaded, and only
+  // while the file is open
+  if (index >= definition_sources_.size() ||
+      (xml_doc_ == NULL && stream_reader_ == NULL))
+    return false;
+
+  CXmlNameTable* names = intern_names() ? &model_info.names_ : NULL;
+  std::string name = info.name_;
+  if (!ReadTask(definition_sources_[index], info, names) ||
+      info.name_ != name) {
+    info.name_ = name;
+    info.aliases_.clear();
+    info.entities_ = XmlEntitiesInfo(model_info.arena_.get());
+    return false;
+  }
+  info.loaded_ = true;
+  return true;
+}
+
+bool CXmlFile::LoadComponentDefinitions(XmlModelInfo& model_info) const {
+  bool ok = true;
+  for (size_t i = 0; i < model_info.definitions_.size(); ++i) {
+    ok &= LoadComponentDefinition(model_info, i);
+  }
   return ok;
 }
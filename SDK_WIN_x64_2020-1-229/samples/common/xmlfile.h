@@ -3,6 +3,9 @@
 #ifndef SKPTOXML_COMMON_XMLFILE_H
 #define SKPTOXML_COMMON_XMLFILE_H
 
+#include <stdint.h>
+#include <cstdio>
+#include <memory>
 #include <string>
 #include <vector>
 #include <map>
@@ -10,16 +13,32 @@
 #include <SketchUpAPI/color.h>
 #include <SketchUpAPI/transformation.h>
 
+#include "./xmlarena.h"
+#include "./xmlcodec.h"
+#include "./xmlfacestore.h"
 #include "./xmlgeomutils.h"
+#include "./xmlnametable.h"
 
 // Forward declarations
 namespace tinyxml2 {
   class XMLDocument;
   class XMLNode;
   class XMLElement;
+  class XMLPrinter;
+  struct XMLMemoryStats;
 }
+class CXmlStreamReader;
+class CXmlMappedFile;
 
 // Helper data transfer types storing model information.
+//
+// Entities name the layers, materials and definitions they use. Files read
+// with CXmlFile::set_intern_names give the names as *_id_ members, which are
+// IDs into XmlModelInfo::names_, and leave the name strings empty.
+//
+// The containers holding the entities take an optional CXmlArena. Files
+// read with CXmlFile::set_use_arena allocate them from an arena owned by the
+// XmlModelInfo.
 
 struct XmlMaterialInfo {
   XmlMaterialInfo()
@@ -47,10 +66,13 @@ struct XmlLayerInfo {
 };
 
 struct XmlEdgeInfo {
-  XmlEdgeInfo() : has_layer_(false), has_color_(false) {}
+  XmlEdgeInfo()
+    : has_layer_(false), layer_id_(CXmlNameTable::kNoName),
+      has_color_(false) {}
 
   bool has_layer_;
   std::string layer_name_;
+  uint32_t layer_id_;
   bool has_color_;
   SUColor color_;
   XmlGeomUtils::CPoint3d start_;
@@ -58,7 +80,9 @@ struct XmlEdgeInfo {
 };
 
 struct XmlCurveInfo {
-  std::vector<XmlEdgeInfo> edges_;
+  explicit XmlCurveInfo(CXmlArena* arena = NULL) : edges_(arena) {}
+
+  XmlArenaVector<XmlEdgeInfo> edges_;
 };
 
 struct XmlFaceVertex {
@@ -68,100 +92,332 @@ struct XmlFaceVertex {
 };
 
 struct XmlFaceInfo {
-  XmlFaceInfo()
-    : has_front_texture_(false),
+  explicit XmlFaceInfo(CXmlArena* arena = NULL)
+    : layer_id_(CXmlNameTable::kNoName),
+      front_mat_id_(CXmlNameTable::kNoName),
+      back_mat_id_(CXmlNameTable::kNoName),
+      has_front_texture_(false),
       has_back_texture_(false),
-      has_single_loop_(false) {}
+      has_single_loop_(false),
+      vertices_(arena),
+      indices_(arena) {}
 
   std::string layer_name_;
   std::string front_mat_name_;
   std::string back_mat_name_;
+  uint32_t layer_id_;
+  uint32_t front_mat_id_;
+  uint32_t back_mat_id_;
   bool has_front_texture_;
   bool has_back_texture_;
   bool has_single_loop_;
   // if single loop, vertices_ are the points in the loop
-  // if triangles, vertices_ are 3 per triangle
-  std::vector<XmlFaceVertex> vertices_;
+  // if triangles, vertices_ are the distinct corners of the triangles and
+  // indices_ refers to 3 of them per triangle
+  XmlArenaVector<XmlFaceVertex> vertices_;
+  XmlArenaVector<uint32_t> indices_;
 };
 
 struct XmlEntitiesInfo;
 struct XmlComponentDefinitionInfo;
 
 struct XmlGroupInfo {
-  XmlGroupInfo();
+  explicit XmlGroupInfo(CXmlArena* arena = NULL);
   XmlGroupInfo(const XmlGroupInfo&);
+  // Moving hands over the entities, so vectors of groups can grow without
+  // copying every nested group
+  XmlGroupInfo(XmlGroupInfo&& info) noexcept;
   ~XmlGroupInfo();
   const XmlGroupInfo& operator = (const XmlGroupInfo&);
-  
-  XmlEntitiesInfo* entities_;
+  XmlGroupInfo& operator = (XmlGroupInfo&& info) noexcept;
+
+  std::unique_ptr<XmlEntitiesInfo> entities_;
   SUTransformation transform_;
 };
 
 struct XmlComponentInstanceInfo {
+  XmlComponentInstanceInfo()
+    : definition_id_(CXmlNameTable::kNoName),
+      layer_id_(CXmlNameTable::kNoName),
+      material_id_(CXmlNameTable::kNoName) {}
+
   std::string definition_name_;
   std::string layer_name_;
   std::string material_name_;
+  uint32_t definition_id_;
+  uint32_t layer_id_;
+  uint32_t material_id_;
   SUTransformation transform_;
 };
 
 struct XmlEntitiesInfo {
-  std::vector<XmlComponentInstanceInfo> component_instances_;
-  std::vector<XmlGroupInfo> groups_;
-  std::vector<XmlFaceInfo>  faces_;
-  std::vector<XmlEdgeInfo>  edges_;
-  std::vector<XmlCurveInfo> curves_;
+  explicit XmlEntitiesInfo(CXmlArena* arena = NULL)
+    : component_instances_(arena), groups_(arena), faces_(arena),
+      edges_(arena), curves_(arena) {}
+
+  // The arena the entities are allocated from, if any
+  CXmlArena* arena() const { return faces_.get_allocator().arena(); }
+
+  // Adds this block and the entities blocks of the groups in it, depth
+  // first, to 'blocks'
+  void CollectBlocks(std::vector<const XmlEntitiesInfo*>& blocks) const;
+  void CollectBlocks(std::vector<XmlEntitiesInfo*>& blocks);
+
+  XmlArenaVector<XmlComponentInstanceInfo> component_instances_;
+  XmlArenaVector<XmlGroupInfo> groups_;
+  XmlArenaVector<XmlFaceInfo>  faces_;
+  // Used instead of faces_ by files read with set_use_face_store. Its few
+  // large arrays stay on the heap.
+  CXmlFaceStore face_store_;
+  XmlArenaVector<XmlEdgeInfo>  edges_;
+  XmlArenaVector<XmlCurveInfo> curves_;
 };
 
 struct XmlComponentDefinitionInfo {
+  explicit XmlComponentDefinitionInfo(CXmlArena* arena = NULL)
+    : entities_(arena), loaded_(true) {}
+
   std::string name_;
+  // The names of identical definitions merged into this one, see
+  // XmlDedup::MergeIdenticalDefinitions. CXmlFile writes them as Alias
+  // elements before the entities, which older readers skip, and reads them
+  // back with the entities. The binary format doesn't keep them.
+  std::vector<std::string> aliases_;
   XmlEntitiesInfo entities_;
+  // False while the entities of a lazy definition haven't been read, see
+  // CXmlFile::set_lazy_definitions
+  bool loaded_;
 };
 
 struct XmlModelInfo {
+  XmlModelInfo() {}
+  explicit XmlModelInfo(const std::shared_ptr<CXmlArena>& arena)
+    : arena_(arena), entities_(arena.get()) {}
+  XmlModelInfo(const XmlModelInfo&) = default;
+  XmlModelInfo(XmlModelInfo&&) = default;
+  XmlModelInfo& operator=(const XmlModelInfo& info);
+  XmlModelInfo& operator=(XmlModelInfo&& info);
+
+  // The usage of the model's arena and of its thread arenas together.
+  // Returns false if the model doesn't have an arena.
+  bool GetArenaStats(XmlArenaStats& stats) const;
+
+  // The arena the entities are allocated from, if any. Declared first, so
+  // it is released after them.
+  std::shared_ptr<CXmlArena> arena_;
+  // The arenas of the other threads of a parallel read, see
+  // CXmlFile::set_read_threads
+  std::vector<std::shared_ptr<CXmlArena> > thread_arenas_;
+  // The names of the layers, materials and definitions, and the names the
+  // entities use. Filled by files read with set_intern_names.
+  CXmlNameTable names_;
   std::vector<XmlLayerInfo> layers_;
   std::vector<XmlMaterialInfo> materials_;
   std::vector<XmlComponentDefinitionInfo> definitions_;
   XmlEntitiesInfo entities_;
 };
 
+// An element CXmlFile reads apart from the rest of the file: a DOM node, or
+// the element's bytes in the file
+struct XmlReadTask {
+  XmlReadTask() : node_(NULL), begin_(0), end_(0), name_count_(0) {}
+
+  const tinyxml2::XMLNode* node_;
+  size_t begin_;
+  size_t end_;
+  // The number of names the enclosing entities had interned when the
+  // element was found
+  size_t name_count_;
+};
+
 class CXmlFile {
  public:
   CXmlFile();
   ~CXmlFile();
 
-  bool Open(const std::string& filename, bool create_new_file);
-  void Close(bool cancelled);
+  // How an existing file is read. kReadDom loads the whole file into a
+  // tinyxml2 DOM, kReadStreaming converts the file into XmlModelInfo in a
+  // single forward pass without keeping the document in memory. kReadMapped
+  // is kReadStreaming over a read-only memory mapping of the file, so
+  // processes reading the same file share its pages; it falls back to
+  // kReadStreaming if the file can't be mapped.
+  enum ReadMode {
+    kReadDom,
+    kReadStreaming,
+    kReadMapped
+  };
+
+  // How a new file is written. kWriteDom builds a tinyxml2 DOM and saves it
+  // on Close. kWriteStreaming prints each tag as soon as it is written, so
+  // memory use doesn't grow with the model. The output goes to a temporary
+  // file that Close puts in place of the real name, or deletes if cancelled.
+  // Either way the text is written out in large blocks on a background
+  // thread, while the caller prints the next ones.
+  enum WriteMode {
+    kWriteDom,
+    kWriteStreaming
+  };
+
+  // Versions of the file format. Version 4 stores the vertices of a face as
+  // a few packed arrays instead of an element tree per vertex.
+  enum {
+    kXmlVersionVertexElements = 3,
+    kXmlVersionPackedFaces = 4,
+    kXmlVersionLatest = kXmlVersionPackedFaces
+  };
+
+  // Files named .xml.gz or .xml.zst are compressed, see CXmlCodecFile. They
+  // are read through the stream reader in kReadMapped mode, and in
+  // kReadDom mode decompressed into the DOM's buffer.
+  bool Open(const std::string& filename, bool create_new_file,
+            ReadMode read_mode = kReadDom);
+  // Creates a new file
+  bool Open(const std::string& filename, WriteMode write_mode);
+  // Close keeps the DOM of a kReadDom or kWriteDom file, emptied, and the
+  // next Open reuses its memory. Converting many files with one CXmlFile
+  // then doesn't allocate the DOM again for each one.
+  // Returns false if a new file couldn't be written. A file that was
+  // written in full but can't replace the destination is left under its
+  // temporary name, and the destination keeps its old contents.
+  bool Close(bool cancelled);
 
   std::string GetTextureDirectory() const;
 
-  // Converts the XML DOM into XmlModelInfo
+  // The version of an opened file, or the version a new file is written as.
+  // Must be set before WriteHeader. New files are version 3 unless set
+  // otherwise, since readers that only know version 3 reject version 4.
+  int xml_version() const { return xml_version_; }
+  void set_xml_version(int version) { xml_version_ = version; }
+
+  // Whether GetModelInfo gives the names used by entities as IDs into
+  // XmlModelInfo::names_ rather than as strings.
+  bool intern_names() const { return intern_names_ || use_face_store_; }
+  void set_intern_names(bool intern) { intern_names_ = intern; }
+
+  // Whether GetModelInfo allocates the entities from a new arena in
+  // XmlModelInfo::arena_. Their small allocations are then carved out of a
+  // few blocks, which are freed together with the model. Off by default:
+  // the model is still torn down entity by entity, since faces, groups and
+  // definitions own strings and heap buffers, so the arena only saves the
+  // frees of the small allocations, and its blocks make the model larger.
+  bool use_arena() const { return use_arena_; }
+  void set_use_arena(bool use) { use_arena_ = use; }
+
+  // Whether GetModelInfo puts faces in XmlEntitiesInfo::face_store_ rather
+  // than in faces_. Implies intern_names, as the store only keeps IDs.
+  bool use_face_store() const { return use_face_store_; }
+  void set_use_face_store(bool use) { use_face_store_ = use; }
+
+  // The number of threads GetModelInfo reads component definitions and top
+  // level groups on, 0 meaning one per core. They are added to the model in
+  // file order either way. With the default of 1 everything is read on the
+  // calling thread, as are files opened with kReadStreaming, whose reader
+  // can't go back to an element.
+  unsigned read_threads() const { return read_threads_; }
+  void set_read_threads(unsigned threads) { read_threads_ = threads; }
+
+  // Whether GetModelInfo only finds the component definitions. Their names
+  // are read, but their entities stay empty, with loaded_ false, until
+  // LoadComponentDefinition reads them. The file must stay open until then.
+  // Compressed files read without a DOM would have to be decompressed from
+  // the start for every definition, so they are read in full instead.
+  bool lazy_definitions() const { return lazy_definitions_; }
+  void set_lazy_definitions(bool lazy) { lazy_definitions_ = lazy; }
+
+  // The size in bytes of the blocks the DOM allocates its nodes in, 0 for
+  // the tinyxml2 default of 4k. Large files need fewer allocations with
+  // larger blocks. Takes effect at the next Open.
+  int dom_block_size() const { return dom_block_size_; }
+  void set_dom_block_size(int bytes) { dom_block_size_ = bytes; }
+
+  // The memory held by the DOM, of the open file or else of the last one.
+  // Returns false if no file has been opened with a DOM.
+  bool GetDomMemoryStats(tinyxml2::XMLMemoryStats& stats) const;
+
+  // How much has been written of the file being written, or else of the
+  // last one, and how long the writing held up the caller. See
+  // XmlWriteStats.
+  void GetWriteStats(XmlWriteStats& stats) const;
+
+  // Read the entities of lazy definitions of the model GetModelInfo gave
+  // last, unless they have been read already. The first returns the
+  // definition, or NULL if there is none of that name or it can't be read.
+  // Once the file is closed, definitions that weren't read can't be.
+  const XmlComponentDefinitionInfo* LoadComponentDefinition(
+      XmlModelInfo& model_info, const std::string& name) const;
+  bool LoadComponentDefinition(XmlModelInfo& model_info, size_t index) const;
+  bool LoadComponentDefinitions(XmlModelInfo& model_info) const;
+
+  // Converts the XML DOM (or stream) into XmlModelInfo
   bool GetModelInfo(XmlModelInfo& model_info) const;
 
   // XML modification functions
-  void StartLayers();
+  // The optional counts are written as Count attributes, which readers use
+  // to reserve room for the children
+  void StartLayers(size_t count = 0);
   void StartGeometry();
   void StartGroup();
-  void StartMaterials();
-  void StartComponentDefinitions();
+  void StartMaterials(size_t count = 0);
+  void StartComponentDefinitions(size_t count = 0);
   void StartComponentDefinition(const std::string& name);
   void PopParentNode();
 
   void WriteHeader(int major_ver, int minor_ver, int build_no);
   void WriteLayerInfo(const XmlLayerInfo& info);
   void WriteMaterialInfo(const XmlMaterialInfo& info);
-  void WriteEdgeInfo(const XmlEdgeInfo& info);
-  void WriteFaceInfo(const XmlFaceInfo& info);
-  void WriteCurveInfo(const XmlCurveInfo& info);
-  void WriteComponentInstanceInfo(const XmlComponentInstanceInfo& info);
+  // 'names' resolves the name IDs of infos read with interned names
+  void WriteEdgeInfo(const XmlEdgeInfo& info,
+                     const CXmlNameTable* names = NULL);
+  void WriteFaceInfo(const XmlFaceInfo& info,
+                     const CXmlNameTable* names = NULL);
+  void WriteCurveInfo(const XmlCurveInfo& info,
+                      const CXmlNameTable* names = NULL);
+  void WriteComponentInstanceInfo(const XmlComponentInstanceInfo& info,
+                                  const CXmlNameTable* names = NULL);
   void WriteTransformation(const SUTransformation& transform);
 
+  // Writes everything after the header from a model info, in the order the
+  // exporter writes it. Empty sections other than Geometry are left out.
+  void WriteModelInfo(const XmlModelInfo& model_info);
+
+  // Incremental writes, in kWriteStreaming mode only. What is written
+  // between BeginDigest and EndDigest also goes into a hash, which EndDigest
+  // returns. With 'write_text' false it only goes into the hash. Digests
+  // nest, and AddDigest adds the hash of a nested one, or of a copied
+  // element, to the enclosing one.
+  void BeginDigest(bool write_text);
+  uint64_t EndDigest();
+  void AddDigest(uint64_t digest);
+  // Copies the text of an element printed by an earlier write, as a child
+  // of the current element
+  void CopyElement(const char* text, size_t size);
+  // The bytes of text written so far, before any compression, where the next
+  // child element starts
+  uint64_t text_size() const;
+
  private:
-  tinyxml2::XMLElement* WriteStartTag(const char* tag);
+  void WriteEntities(const XmlEntitiesInfo& entities,
+                     const CXmlNameTable& names);
+  void WriteStartTag(const char* tag);
+  // Attributes of the most recently started tag
+  void WriteAttribute(const char* name, const char* value);
+  void WriteAttribute(const char* name, int value);
+  void WriteAttribute(const char* name, unsigned value);
+  void WriteAttribute(const char* name, bool value);
+  void WriteAttribute(const char* name, double value);
+  // Text content of the most recently started tag
+  void WriteText(const char* text);
+  void WriteCount(size_t count);
+  void WritePackedFaceVertices(const XmlFaceInfo& info);
   void WriteColor(const SUColor &color);
+  // Hands what printer_ has printed on to codec_file_
+  void FlushPrinter();
+  void Digest(const void* data, size_t size);
+  void Digest(const char* text);
 
   bool ReadHeader();
   bool ReadColor(const tinyxml2::XMLNode* parent_node,
-                 const SUColor& color) const;
+                 SUColor& color) const;
 
   bool ReadLayers(const tinyxml2::XMLNode* parent_node,
                   std::vector<XmlLayerInfo>& layer_infos) const;
@@ -173,15 +429,24 @@ class CXmlFile {
                      std::vector<XmlMaterialInfo>& mat_infos) const;
   bool ReadComponentDefinitionInfo(const tinyxml2::XMLNode* parent_node,
                                    bool readEntities,
-                                   XmlComponentDefinitionInfo& info) const;
+                                   XmlComponentDefinitionInfo& info,
+                                   CXmlNameTable* names) const;
   bool ReadComponentDefinitions(const tinyxml2::XMLNode* parent_node,
-                      std::vector<XmlComponentDefinitionInfo>& def_infos) const;
+                      std::vector<XmlComponentDefinitionInfo>& def_infos,
+                      CXmlNameTable* names, CXmlArena* arena) const;
+  // 'names' is NULL unless names are interned. Given 'group_tasks', groups
+  // are left for ReadTasks.
   bool ReadEntities(const tinyxml2::XMLNode* parent_node,
-                    XmlEntitiesInfo& entities) const;
+                    XmlEntitiesInfo& entities, CXmlNameTable* names,
+                    std::vector<XmlReadTask>* group_tasks = NULL) const;
+  bool ReadGroupInfo(const tinyxml2::XMLNode* parent_node,
+                     XmlGroupInfo& info, CXmlNameTable* names) const;
   bool ReadEdgeInfo(const tinyxml2::XMLNode* parent_node,
                     XmlEdgeInfo& info) const;
   bool ReadFaceInfo(const tinyxml2::XMLNode* parent_node,
                     XmlFaceInfo& info) const;
+  bool ReadPackedFaceVertices(const tinyxml2::XMLNode* parent_node,
+                              int triangle_count, XmlFaceInfo& info) const;
   bool ReadCurveInfo(const tinyxml2::XMLNode* parent_node,
                      XmlCurveInfo& info) const;
   bool ReadTransformation(const tinyxml2::XMLNode* parent_node,
@@ -189,14 +454,103 @@ class CXmlFile {
   bool ReadComponentInstanceInfo(const tinyxml2::XMLNode* parent_node,
                                  XmlComponentInstanceInfo& info) const;
 
+  // Streaming counterparts of the above. Each one is called with the reader
+  // on the start tag of its element and returns with the reader on the
+  // matching end tag.
+  bool ReadHeader(CXmlStreamReader& reader, int& xml_version) const;
+  bool ReadColor(CXmlStreamReader& reader, SUColor& color) const;
+  bool ReadLayers(CXmlStreamReader& reader,
+                  std::vector<XmlLayerInfo>& layer_infos) const;
+  bool ReadLayerInfo(CXmlStreamReader& reader, XmlLayerInfo& info) const;
+  bool ReadMaterialInfo(CXmlStreamReader& reader, XmlMaterialInfo& info) const;
+  bool ReadMaterials(CXmlStreamReader& reader,
+                     std::vector<XmlMaterialInfo>& mat_infos) const;
+  bool ReadComponentDefinitions(CXmlStreamReader& reader,
+                      std::vector<XmlComponentDefinitionInfo>& def_infos,
+                      CXmlNameTable* names, CXmlArena* arena) const;
+  bool ReadComponentDefinitionInfo(CXmlStreamReader& reader,
+                                   XmlComponentDefinitionInfo& info,
+                                   CXmlNameTable* names) const;
+  // Given 'aliases', also reads the Alias elements of a definition
+  bool ReadEntities(CXmlStreamReader& reader, XmlEntitiesInfo& entities,
+                    SUTransformation* transform, CXmlNameTable* names,
+                    std::vector<XmlReadTask>* group_tasks = NULL,
+                    std::vector<std::string>* aliases = NULL) const;
+  bool ReadGroupInfo(CXmlStreamReader& reader, XmlGroupInfo& info,
+                     CXmlNameTable* names) const;
+  bool ReadEdgeInfo(CXmlStreamReader& reader, XmlEdgeInfo& info) const;
+  bool ReadFaceInfo(CXmlStreamReader& reader, XmlFaceInfo& info) const;
+  bool ReadFaceVertices(CXmlStreamReader& reader, XmlFaceInfo& info) const;
+  bool ReadPackedFaceVertices(CXmlStreamReader& reader, int triangle_count,
+                              XmlFaceInfo& info) const;
+  bool ReadCurveInfo(CXmlStreamReader& reader, XmlCurveInfo& info) const;
+  bool ReadTransformation(CXmlStreamReader& reader,
+                          SUTransformation& transform) const;
+  bool ReadComponentInstanceInfo(CXmlStreamReader& reader,
+                                 XmlComponentInstanceInfo& info) const;
+
+  // Parallel reads. GetModelInfo collects the component definitions or the
+  // top level groups as tasks, and ReadTasks reads them on the read threads
+  // and appends them to the model. With interned names, 'outer_names' holds
+  // the names the model's geometry interned around its groups.
+  bool parallel_read() const;
+  bool ReadTasks(const std::vector<XmlReadTask>& tasks, bool definitions,
+                 XmlModelInfo& model_info, CXmlNameTable* names,
+                 const CXmlNameTable* outer_names = NULL) const;
+  bool ReadTask(const XmlReadTask& task, XmlComponentDefinitionInfo& info,
+                CXmlNameTable* names) const;
+  bool ReadTask(const XmlReadTask& task, XmlGroupInfo& info,
+                CXmlNameTable* names) const;
+
+  // Lazy definitions. The definitions are added to the model without their
+  // entities, and their elements are kept as tasks. lazy_read tells whether
+  // the open file is read that way.
+  bool lazy_read() const;
+  bool IndexComponentDefinitions(const tinyxml2::XMLNode* parent_node,
+                                 XmlModelInfo& model_info) const;
+  bool IndexComponentDefinitions(CXmlStreamReader& reader,
+                                 XmlModelInfo& model_info) const;
+  void AddLazyDefinition(const std::string& name, const XmlReadTask& task,
+                         XmlModelInfo& model_info) const;
+
  private:
   // Let TinyXML do the xml handling
   tinyxml2::XMLDocument* xml_doc_;
   tinyxml2::XMLNode* parent_node_;
+  // The emptied DOM of the last file, for the next Open to reuse
+  tinyxml2::XMLDocument* spare_doc_;
+  int dom_block_size_;
+
+  // Used instead of xml_doc_ when reading in kReadStreaming mode
+  CXmlStreamReader* stream_reader_;
+  // The file contents in kReadMapped mode
+  CXmlMappedFile* mapped_file_;
+
+  // Used instead of xml_doc_ when writing in kWriteStreaming mode. The file
+  // is printed to memory and handed to codec_file_ a piece at a time.
+  tinyxml2::XMLPrinter* printer_;
+  CXmlCodecFile* codec_file_;
+  // Of the file written last
+  XmlWriteStats write_stats_;
+  // Text handed on to codec_file_ so far
+  uint64_t flushed_size_;
+  // The hashes of the open digests, and how many of them don't write text
+  std::vector<uint64_t> digests_;
+  size_t quiet_digests_;
+  std::string temp_filename_;
 
   // The path to the file to which we are writing
   std::string filename_;
   bool create_new_file_;
+  int xml_version_;
+  bool intern_names_;
+  bool use_arena_;
+  bool use_face_store_;
+  unsigned read_threads_;
+  bool lazy_definitions_;
+  // Where the lazy definitions of the last model are, by index and by name
+  mutable std::vector<XmlReadTask> definition_sources_;
+  mutable std::map<std::string, size_t> definition_indices_;
 };
 
 #endif // SKPTOXML_COMMON_XMLFILE_H
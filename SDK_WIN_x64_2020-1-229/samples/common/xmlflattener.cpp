@@ -0,0 +1,357 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmlflattener.h"
+
+#include <math.h>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#include "./xmlfile.h"
+#include "./xmlparallel.h"
+
+using XmlGeomUtils::CTransform;
+using XmlGeomUtils::CVector3d;
+
+// The triangles of the faces of one entities block, in its own coordinates.
+// The batches are named after the materials and layers of the faces, which
+// are empty where the faces inherit them.
+typedef std::vector<XmlTriangleBatch> XmlLocalMesh;
+
+// The batches one top level instance or group, or the top level faces, add
+// to the model
+struct XmlFlattenedItem {
+  XmlFlattenedItem() : ok_(true) {}
+
+  std::vector<XmlTriangleBatch> batches_;
+  std::map<std::pair<std::string, std::string>, size_t> batch_indices_;
+  // The definitions above the entities being flattened
+  std::vector<size_t> path_;
+  bool ok_;
+};
+
+static XmlTriangleBatch& FindBatch(
+    std::vector<XmlTriangleBatch>& batches,
+    std::map<std::pair<std::string, std::string>, size_t>& batch_indices,
+    const std::string& material_name, const std::string& layer_name) {
+  std::pair<std::map<std::pair<std::string, std::string>, size_t>::iterator,
+            bool> it = batch_indices.insert(std::make_pair(
+      std::make_pair(material_name, layer_name), batches.size()));
+  if (it.second) {
+    batches.push_back(XmlTriangleBatch());
+    batches.back().material_name_ = material_name;
+    batches.back().layer_name_ = layer_name;
+  }
+  return batches[it.first->second];
+}
+
+//------------------------------------------------------------------------------
+
+static void AddFace(const XmlFaceInfo& face, const CXmlNameTable& names,
+                    XmlLocalMesh& mesh,
+                    std::map<std::pair<std::string, std::string>, size_t>&
+                        batch_indices,
+                    std::vector<double>& points) {
+  const size_t count = face.vertices_.size();
+  if (count < 3)
+    return;
+  XmlTriangleBatch& batch = FindBatch(
+      mesh, batch_indices,
+      names.Resolve(face.front_mat_id_, face.front_mat_name_),
+      names.Resolve(face.layer_id_, face.layer_name_));
+  const size_t first = batch.positions_.size() / 3;
+  const size_t first_index = batch.indices_.size();
+
+  points.resize(count * 3);
+  for (size_t i = 0; i < count; ++i) {
+    const XmlGeomUtils::CPoint3d& vertex = face.vertices_[i].vertex_;
+    points[i * 3] = vertex.x();
+    points[i * 3 + 1] = vertex.y();
+    points[i * 3 + 2] = vertex.z();
+  }
+  batch.positions_.insert(batch.positions_.end(), points.begin(),
+                          points.end());
+  for (size_t i = 0; i < count; ++i) {
+    const XmlGeomUtils::CPoint3d& coord =
+        face.vertices_[i].front_texture_coord_;
+    batch.texture_coords_.push_back(face.has_front_texture_ ? coord.x() : 0);
+    batch.texture_coords_.push_back(face.has_front_texture_ ? coord.y() : 0);
+  }
+
+  // The corners of a single loop face go around it, the others are
+  // triangles already
+  CVector3d normal;
+  if (face.has_single_loop_) {
+    XmlGeomUtils::TriangulatePolygon(&points[0], count, batch.indices_);
+    normal = XmlGeomUtils::PolygonNormal(&points[0], count);
+  } else {
+    for (size_t i = 0; i + 2 < face.indices_.size(); i += 3) {
+      uint32_t corners[3] = {
+        face.indices_[i], face.indices_[i + 1], face.indices_[i + 2]
+      };
+      if (corners[0] >= count || corners[1] >= count || corners[2] >= count)
+        continue;
+      double triangle[9];
+      for (int j = 0; j < 3; ++j) {
+        batch.indices_.push_back(corners[j]);
+        triangle[j * 3] = points[corners[j] * 3];
+        triangle[j * 3 + 1] = points[corners[j] * 3 + 1];
+        triangle[j * 3 + 2] = points[corners[j] * 3 + 2];
+      }
+      normal += XmlGeomUtils::PolygonNormal(triangle, 3);
+    }
+  }
+  for (size_t i = first_index; i < batch.indices_.size(); ++i) {
+    batch.indices_[i] += static_cast<uint32_t>(first);
+  }
+
+  const double length = sqrt(normal.x() * normal.x() +
+                             normal.y() * normal.y() +
+                             normal.z() * normal.z());
+  if (length > 0.0)
+    normal /= length;
+  for (size_t i = 0; i < count; ++i) {
+    batch.normals_.push_back(normal.x());
+    batch.normals_.push_back(normal.y());
+    batch.normals_.push_back(normal.z());
+  }
+}
+
+static void BuildLocalMesh(const XmlEntitiesInfo& entities,
+                           const CXmlNameTable& names, XmlLocalMesh& mesh) {
+  std::map<std::pair<std::string, std::string>, size_t> batch_indices;
+  std::vector<double> points;
+  for (size_t i = 0; i < entities.faces_.size(); ++i) {
+    AddFace(entities.faces_[i], names, mesh, batch_indices, points);
+  }
+  XmlFaceInfo face_info;
+  for (CXmlFaceStore::const_iterator it = entities.face_store_.begin();
+       it != entities.face_store_.end(); ++it) {
+    it->GetFaceInfo(face_info);
+    AddFace(face_info, names, mesh, batch_indices, points);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+// CXmlFlattenPass - One call to CXmlFlattener::Flatten. The faces of the
+// entities blocks that can be reached more than once, those in definitions,
+// are triangulated once up front. Each top level instance or group is then
+// flattened on its own, and the results are joined in order.
+class CXmlFlattenPass {
+ public:
+  CXmlFlattenPass(const XmlModelInfo& model_info, unsigned threads)
+    : model_info_(model_info), threads_(threads) {}
+
+  bool Run(std::vector<XmlTriangleBatch>& batches);
+
+ private:
+  void FlattenItem(size_t item, XmlFlattenedItem& result) const;
+  void Flatten(const XmlEntitiesInfo& entities,
+               const CTransform& transform,
+               const std::string& material_name,
+               const std::string& layer_name,
+               XmlFlattenedItem& result) const;
+  void FlattenInstance(const XmlComponentInstanceInfo& info,
+                       const CTransform& transform,
+                       const std::string& material_name,
+                       const std::string& layer_name,
+                       XmlFlattenedItem& result) const;
+  void FlattenFaces(const XmlEntitiesInfo& entities,
+                    const CTransform& transform,
+                    const std::string& material_name,
+                    const std::string& layer_name,
+                    XmlFlattenedItem& result) const;
+  static void Append(const XmlTriangleBatch& from, bool mirrored,
+                     XmlTriangleBatch& to);
+
+ private:
+  const XmlModelInfo& model_info_;
+  unsigned threads_;
+  std::unordered_map<std::string, size_t> definitions_;
+  std::vector<XmlLocalMesh> meshes_;
+  std::unordered_map<const XmlEntitiesInfo*, size_t> mesh_indices_;
+};
+
+bool CXmlFlattenPass::Run(std::vector<XmlTriangleBatch>& batches) {
+  batches.clear();
+  const std::vector<XmlComponentDefinitionInfo>& defs =
+      model_info_.definitions_;
+  std::vector<const XmlEntitiesInfo*> blocks;
+  for (size_t i = 0; i < defs.size(); ++i) {
+    definitions_.insert(std::make_pair(defs[i].name_, i));
+    defs[i].entities_.CollectBlocks(blocks);
+  }
+  meshes_.resize(blocks.size());
+  XmlParallel::For(blocks.size(), threads_,
+                   [&](size_t block, unsigned /*thread*/) {
+    BuildLocalMesh(*blocks[block], model_info_.names_, meshes_[block]);
+  });
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    mesh_indices_.insert(std::make_pair(blocks[i], i));
+  }
+
+  const XmlEntitiesInfo& entities = model_info_.entities_;
+  const size_t items = entities.component_instances_.size() +
+                       entities.groups_.size() + 1;
+  std::vector<XmlFlattenedItem> results(items);
+  XmlParallel::For(items, threads_, [&](size_t item, unsigned /*thread*/) {
+    FlattenItem(item, results[item]);
+  });
+
+  bool ok = true;
+  std::map<std::pair<std::string, std::string>, size_t> batch_indices;
+  for (size_t item = 0; item < items; ++item) {
+    XmlFlattenedItem& result = results[item];
+    ok = ok && result.ok_;
+    for (size_t i = 0; i < result.batches_.size(); ++i) {
+      const XmlTriangleBatch& from = result.batches_[i];
+      Append(from, false, FindBatch(batches, batch_indices,
+                                    from.material_name_, from.layer_name_));
+    }
+    result = XmlFlattenedItem();
+  }
+  return ok;
+}
+
+void CXmlFlattenPass::FlattenItem(size_t item,
+                                  XmlFlattenedItem& result) const {
+  static const std::string kNoName;
+  const CTransform identity;
+  const XmlEntitiesInfo& entities = model_info_.entities_;
+  const size_t instances = entities.component_instances_.size();
+  const size_t groups = entities.groups_.size();
+  if (item < instances) {
+    FlattenInstance(entities.component_instances_[item], identity, kNoName,
+                    kNoName, result);
+  } else if (item < instances + groups) {
+    const XmlGroupInfo& group = entities.groups_[item - instances];
+    Flatten(*group.entities_, CTransform(group.transform_),
+            kNoName, kNoName, result);
+  } else {
+    FlattenFaces(entities, identity, kNoName, kNoName, result);
+  }
+}
+
+void CXmlFlattenPass::Flatten(const XmlEntitiesInfo& entities,
+                              const CTransform& transform,
+                              const std::string& material_name,
+                              const std::string& layer_name,
+                              XmlFlattenedItem& result) const {
+  for (size_t i = 0; i < entities.component_instances_.size(); ++i) {
+    FlattenInstance(entities.component_instances_[i], transform,
+                    material_name, layer_name, result);
+  }
+  for (size_t i = 0; i < entities.groups_.size(); ++i) {
+    const XmlGroupInfo& group = entities.groups_[i];
+    Flatten(*group.entities_, transform * CTransform(group.transform_),
+            material_name, layer_name, result);
+  }
+  FlattenFaces(entities, transform, material_name, layer_name, result);
+}
+
+void CXmlFlattenPass::FlattenInstance(const XmlComponentInstanceInfo& info,
+                                      const CTransform& transform,
+                                      const std::string& material_name,
+                                      const std::string& layer_name,
+                                      XmlFlattenedItem& result) const {
+  const CXmlNameTable& names = model_info_.names_;
+  std::unordered_map<std::string, size_t>::const_iterator it =
+      definitions_.find(
+          names.Resolve(info.definition_id_, info.definition_name_));
+  if (it == definitions_.end() ||
+      std::find(result.path_.begin(), result.path_.end(), it->second) !=
+          result.path_.end()) {
+    result.ok_ = false;
+    return;
+  }
+  const std::string& material =
+      names.Resolve(info.material_id_, info.material_name_);
+  const std::string& layer = names.Resolve(info.layer_id_, info.layer_name_);
+  result.path_.push_back(it->second);
+  Flatten(model_info_.definitions_[it->second].entities_,
+          transform * CTransform(info.transform_),
+          material.empty() ? material_name : material,
+          layer.empty() ? layer_name : layer, result);
+  result.path_.pop_back();
+}
+
+void CXmlFlattenPass::FlattenFaces(const XmlEntitiesInfo& entities,
+                                   const CTransform& transform,
+                                   const std::string& material_name,
+                                   const std::string& layer_name,
+                                   XmlFlattenedItem& result) const {
+  // Top level groups are only reached once, their faces aren't kept
+  XmlLocalMesh local_mesh;
+  const XmlLocalMesh* mesh = &local_mesh;
+  std::unordered_map<const XmlEntitiesInfo*, size_t>::const_iterator it =
+      mesh_indices_.find(&entities);
+  if (it != mesh_indices_.end()) {
+    mesh = &meshes_[it->second];
+  } else {
+    BuildLocalMesh(entities, model_info_.names_, local_mesh);
+  }
+
+  const bool mirrored = transform.IsMirrored();
+  std::vector<double> points;
+  XmlTriangleBatch world;
+  for (size_t i = 0; i < mesh->size(); ++i) {
+    const XmlTriangleBatch& local = (*mesh)[i];
+    const size_t count = local.positions_.size() / 3;
+    world.positions_.resize(count * 3);
+    world.normals_.resize(count * 3);
+    if (count > 0) {
+      transform.TransformPoints(&local.positions_[0], count,
+                                &world.positions_[0]);
+      transform.TransformNormals(&local.normals_[0], count,
+                                 &world.normals_[0]);
+    }
+    world.texture_coords_ = local.texture_coords_;
+    world.indices_ = local.indices_;
+    Append(world, mirrored,
+           FindBatch(result.batches_, result.batch_indices_,
+                     local.material_name_.empty() ? material_name
+                                                  : local.material_name_,
+                     local.layer_name_.empty() ? layer_name
+                                               : local.layer_name_));
+  }
+}
+
+void CXmlFlattenPass::Append(const XmlTriangleBatch& from, bool mirrored,
+                             XmlTriangleBatch& to) {
+  const uint32_t first = static_cast<uint32_t>(to.positions_.size() / 3);
+  to.positions_.insert(to.positions_.end(), from.positions_.begin(),
+                       from.positions_.end());
+  to.normals_.insert(to.normals_.end(), from.normals_.begin(),
+                     from.normals_.end());
+  to.texture_coords_.insert(to.texture_coords_.end(),
+                            from.texture_coords_.begin(),
+                            from.texture_coords_.end());
+  const size_t index = to.indices_.size();
+  to.indices_.resize(index + from.indices_.size());
+  uint32_t* indices = to.indices_.empty() ? NULL : &to.indices_[index];
+  for (size_t i = 0; i + 2 < from.indices_.size(); i += 3) {
+    indices[i] = from.indices_[i] + first;
+    indices[i + 1] = from.indices_[mirrored ? i + 2 : i + 1] + first;
+    indices[i + 2] = from.indices_[mirrored ? i + 1 : i + 2] + first;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+CXmlFlattener::CXmlFlattener() : threads_(0) {
+}
+
+void CXmlFlattener::TriangulateFaces(const XmlEntitiesInfo& entities,
+                                     const CXmlNameTable& names,
+                                     std::vector<XmlTriangleBatch>& batches) {
+  batches.clear();
+  BuildLocalMesh(entities, names, batches);
+}
+
+bool CXmlFlattener::Flatten(const XmlModelInfo& model_info,
+                            std::vector<XmlTriangleBatch>& batches) const {
+  CXmlFlattenPass pass(model_info, threads_);
+  return pass.Run(batches);
+}
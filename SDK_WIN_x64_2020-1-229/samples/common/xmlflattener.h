@@ -0,0 +1,66 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLFLATTENER_H
+#define SKPTOXML_COMMON_XMLFLATTENER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CXmlNameTable;
+struct XmlModelInfo;
+struct XmlEntitiesInfo;
+
+// The triangles of a model sharing a material and a layer. Faces don't
+// share vertices, so the per vertex arrays can hold each face's normal and
+// texture coordinates.
+struct XmlTriangleBatch {
+  std::string material_name_;
+  std::string layer_name_;
+  std::vector<double> positions_;       // x y z per vertex
+  std::vector<double> normals_;         // x y z per vertex, unit length
+  std::vector<double> texture_coords_;  // u v per vertex, 0 0 if none
+  std::vector<uint32_t> indices_;       // 3 per triangle, counterclockwise
+};
+
+// CXmlFlattener - Turns the hierarchy of a model info into world space
+// triangles. The groups and component instances above each face are
+// resolved, their transformations composed once per path through the
+// hierarchy, and the vertices of a whole entities block transformed in one
+// go. Triangles seen in a mirror, under a transformation with a negative
+// determinant, have their corners reversed so they still face out.
+//
+// Faces without a material or a layer take those of the innermost component
+// instance above them that has one. Only front sides are output; edges and
+// curves are left out.
+class CXmlFlattener {
+ public:
+  CXmlFlattener();
+
+  // The number of threads the top level instances and groups are spread
+  // over, 0 meaning one per core (the default). See XmlParallel::For.
+  unsigned threads() const { return threads_; }
+  void set_threads(unsigned threads) { threads_ = threads; }
+
+  // Replaces 'batches' by the triangles of the model, one batch per
+  // material and layer in order of first use. Faces are taken in the order
+  // CXmlFile writes them, those of each entities block grouped by the
+  // material and layer they name themselves. The component definitions
+  // must have been loaded.
+  // Returns false if an instance refers to a definition that isn't in the
+  // model, or that contains itself, which are skipped.
+  bool Flatten(const XmlModelInfo& model_info,
+               std::vector<XmlTriangleBatch>& batches) const;
+
+  // Replaces 'batches' by the triangles of the faces of 'entities' alone, in
+  // its own coordinates. Batches are named after the materials and layers
+  // the faces name, which are empty where the faces inherit them.
+  static void TriangulateFaces(const XmlEntitiesInfo& entities,
+                               const CXmlNameTable& names,
+                               std::vector<XmlTriangleBatch>& batches);
+
+ private:
+  unsigned threads_;
+};
+
+#endif // SKPTOXML_COMMON_XMLFLATTENER_H
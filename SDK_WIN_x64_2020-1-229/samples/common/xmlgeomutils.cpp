@@ -2,6 +2,19 @@
 
 #include "./xmlgeomutils.h"
 
+#include <math.h>
+// The kernels round each product on its own, see CTransform. GCC and Clang
+// builds get -ffp-contract=off from CMakeLists.txt.
+#if defined(_MSC_VER)
+#pragma fp_contract(off)
+#endif
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+#if !defined(XMLGEOMUTILS_NO_SIMD) && (defined(_M_X64) || defined(__x86_64__))
+#define XMLGEOMUTILS_SIMD
+#include <immintrin.h>
+#endif
 
 namespace XmlGeomUtils {
 
@@ -106,4 +119,424 @@ bool CVector3d::operator!=(const CVector3d& v) const {
   return !operator==(v);
 }
 
+// Transformation Kernels----------------------------------------
+// Each kernel maps the packed x y z triples of 'in' through the 4x4 matrix
+// 'm', kept by columns. Points get the translation in the last column added.
+// Normals don't, and are made unit length. Every path adds up the terms in
+// the same order, without fused multiply-adds, so they agree bit for bit.
+
+#if defined(XMLGEOMUTILS_SIMD)
+
+#if defined(_MSC_VER)
+#define XMLGEOMUTILS_AVX_FUNCTION
+#else
+#define XMLGEOMUTILS_AVX_FUNCTION __attribute__((target("avx")))
+#endif
+
+// XMLGEOMUTILS_NO_AVX keeps the SSE2 kernels, so they can be tested on CPUs
+// with AVX too
+static bool DetectAVX() {
+#if defined(XMLGEOMUTILS_NO_AVX)
+  return false;
+#elif defined(_MSC_VER)
+  // The OS must save the YMM registers too
+  int info[4];
+  __cpuid(info, 1);
+  const int kOsxsaveAndAvx = (1 << 27) | (1 << 28);
+  return (info[2] & kOsxsaveAndAvx) == kOsxsaveAndAvx &&
+         (_xgetbv(0) & 6) == 6;
+#else
+  return __builtin_cpu_supports("avx") != 0;
+#endif
+}
+
+static bool UseAVX() {
+  static const bool use_avx = DetectAVX();
+  return use_avx;
+}
+
+// SSE2 holds x y in one register and z in the low half of another
+static void StoreSSE2(__m128d xy, __m128d z, double* out) {
+  _mm_storeu_pd(out, xy);
+  _mm_store_sd(out + 2, z);
+}
+
+static void StoreSSE2(__m128d xy, __m128d z, float* out) {
+  _mm_storel_pi(reinterpret_cast<__m64*>(out), _mm_cvtpd_ps(xy));
+  _mm_store_ss(out + 2, _mm_cvtpd_ps(z));
+}
+
+template <bool kNormals, typename T>
+static void TransformSSE2(const double* m, const double* in, size_t count,
+                          T* out) {
+  const __m128d c0 = _mm_loadu_pd(m);
+  const __m128d c0z = _mm_load_sd(m + 2);
+  const __m128d c1 = _mm_loadu_pd(m + 4);
+  const __m128d c1z = _mm_load_sd(m + 6);
+  const __m128d c2 = _mm_loadu_pd(m + 8);
+  const __m128d c2z = _mm_load_sd(m + 10);
+  const __m128d c3 = _mm_loadu_pd(m + 12);
+  const __m128d c3z = _mm_load_sd(m + 14);
+  for (size_t i = 0; i < count; ++i, in += 3, out += 3) {
+    const __m128d in_xy = _mm_loadu_pd(in);
+    const __m128d x = _mm_unpacklo_pd(in_xy, in_xy);
+    const __m128d y = _mm_unpackhi_pd(in_xy, in_xy);
+    const __m128d z = _mm_load_sd(in + 2);
+    __m128d xy = _mm_add_pd(_mm_add_pd(_mm_mul_pd(c0, x), _mm_mul_pd(c1, y)),
+                            _mm_mul_pd(c2, _mm_unpacklo_pd(z, z)));
+    __m128d zz = _mm_add_sd(_mm_add_sd(_mm_mul_sd(c0z, x),
+                                       _mm_mul_sd(c1z, y)),
+                            _mm_mul_sd(c2z, z));
+    if (kNormals) {
+      const __m128d squares = _mm_mul_pd(xy, xy);
+      const __m128d sum = _mm_add_sd(
+          _mm_add_sd(squares, _mm_unpackhi_pd(squares, squares)),
+          _mm_mul_sd(zz, zz));
+      const double length = _mm_cvtsd_f64(_mm_sqrt_sd(sum, sum));
+      if (length > 0.0) {
+        const __m128d scale = _mm_set1_pd(1.0 / length);
+        xy = _mm_mul_pd(xy, scale);
+        zz = _mm_mul_sd(zz, scale);
+      }
+    } else {
+      xy = _mm_add_pd(xy, c3);
+      zz = _mm_add_sd(zz, c3z);
+    }
+    StoreSSE2(xy, zz, out);
+  }
+}
+
+XMLGEOMUTILS_AVX_FUNCTION static void StoreAVX(__m256d v, double* out) {
+  _mm_storeu_pd(out, _mm256_castpd256_pd128(v));
+  _mm_store_sd(out + 2, _mm256_extractf128_pd(v, 1));
+}
+
+XMLGEOMUTILS_AVX_FUNCTION static void StoreAVX(__m256d v, float* out) {
+  const __m128 f = _mm256_cvtpd_ps(v);
+  _mm_storel_pi(reinterpret_cast<__m64*>(out), f);
+  _mm_store_ss(out + 2, _mm_movehl_ps(f, f));
+}
+
+// AVX holds x y z and a 0 in one register. The 4th element is never
+// stored, so 'out' can run right up to the end of its array.
+template <bool kNormals, typename T>
+XMLGEOMUTILS_AVX_FUNCTION static void TransformAVX(const double* m,
+                                                   const double* in,
+                                                   size_t count, T* out) {
+  const __m256d c0 = _mm256_loadu_pd(m);
+  const __m256d c1 = _mm256_loadu_pd(m + 4);
+  const __m256d c2 = _mm256_loadu_pd(m + 8);
+  const __m256d c3 = _mm256_loadu_pd(m + 12);
+  for (size_t i = 0; i < count; ++i, in += 3, out += 3) {
+    const __m256d x = _mm256_broadcast_sd(in);
+    const __m256d y = _mm256_broadcast_sd(in + 1);
+    const __m256d z = _mm256_broadcast_sd(in + 2);
+    __m256d v = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(c0, x), _mm256_mul_pd(c1, y)),
+        _mm256_mul_pd(c2, z));
+    if (kNormals) {
+      const __m256d squares = _mm256_mul_pd(v, v);
+      const __m128d xy = _mm256_castpd256_pd128(squares);
+      const __m128d sum = _mm_add_sd(_mm_add_sd(xy, _mm_unpackhi_pd(xy, xy)),
+                                     _mm256_extractf128_pd(squares, 1));
+      const double length = _mm_cvtsd_f64(_mm_sqrt_sd(sum, sum));
+      if (length > 0.0)
+        v = _mm256_mul_pd(v, _mm256_set1_pd(1.0 / length));
+    } else {
+      v = _mm256_add_pd(v, c3);
+    }
+    StoreAVX(v, out);
+  }
+}
+
+#else  // XMLGEOMUTILS_SIMD
+
+static void Store(double x, double y, double z, double* out) {
+  out[0] = x;
+  out[1] = y;
+  out[2] = z;
+}
+
+static void Store(double x, double y, double z, float* out) {
+  out[0] = static_cast<float>(x);
+  out[1] = static_cast<float>(y);
+  out[2] = static_cast<float>(z);
+}
+
+template <bool kNormals, typename T>
+static void TransformScalar(const double* m, const double* in, size_t count,
+                            T* out) {
+  for (size_t i = 0; i < count; ++i, in += 3, out += 3) {
+    const double x = in[0];
+    const double y = in[1];
+    const double z = in[2];
+    double tx = m[0] * x + m[4] * y + m[8] * z;
+    double ty = m[1] * x + m[5] * y + m[9] * z;
+    double tz = m[2] * x + m[6] * y + m[10] * z;
+    if (kNormals) {
+      const double length = sqrt(tx * tx + ty * ty + tz * tz);
+      if (length > 0.0) {
+        const double scale = 1.0 / length;
+        tx *= scale;
+        ty *= scale;
+        tz *= scale;
+      }
+    } else {
+      tx += m[12];
+      ty += m[13];
+      tz += m[14];
+    }
+    Store(tx, ty, tz, out);
+  }
+}
+
+#endif  // XMLGEOMUTILS_SIMD
+
+template <bool kNormals, typename T>
+static void Transform(const double* m, const double* in, size_t count,
+                      T* out) {
+#if defined(XMLGEOMUTILS_SIMD)
+  if (UseAVX()) {
+    TransformAVX<kNormals>(m, in, count, out);
+  } else {
+    TransformSSE2<kNormals>(m, in, count, out);
+  }
+#else
+  TransformScalar<kNormals>(m, in, count, out);
+#endif
+}
+
+// Transformation Class----------------------------------------
+CTransform::CTransform() {
+  for (int i = 0; i < 16; ++i) {
+    values_[i] = i % 5 == 0 ? 1.0 : 0.0;
+  }
+}
+
+CTransform::CTransform(const SUTransformation& transform) {
+  const double w = transform.values[15];
+  for (int i = 0; i < 16; ++i) {
+    values_[i] = w == 1.0 || w == 0.0 ? transform.values[i]
+                                      : transform.values[i] / w;
+  }
+}
+
+SUTransformation CTransform::GetSUTransformation() const {
+  SUTransformation transform;
+  for (int i = 0; i < 16; ++i) {
+    transform.values[i] = values_[i];
+  }
+  return transform;
+}
+
+CTransform CTransform::operator*(const CTransform& t) const {
+  CTransform product;
+  for (int col = 0; col < 4; ++col) {
+    for (int row = 0; row < 4; ++row) {
+      double sum = 0.0;
+      for (int k = 0; k < 4; ++k) {
+        sum += values_[k * 4 + row] * t.values_[col * 4 + k];
+      }
+      product.values_[col * 4 + row] = sum;
+    }
+  }
+  return product;
+}
+
+void CTransform::operator*=(const CTransform& t) {
+  *this = *this * t;
+}
+
+double CTransform::Determinant() const {
+  const double* m = values_;
+  return m[0] * (m[5] * m[10] - m[9] * m[6]) -
+         m[4] * (m[1] * m[10] - m[9] * m[2]) +
+         m[8] * (m[1] * m[6] - m[5] * m[2]);
+}
+
+// The cofactor of row 'row' and column 'col' of the linear part. Taking the
+// other rows and columns cyclically gives it its sign.
+static double Cofactor(const double* m, int row, int col) {
+  const int r1 = (row + 1) % 3;
+  const int r2 = (row + 2) % 3;
+  const int c1 = (col + 1) % 3;
+  const int c2 = (col + 2) % 3;
+  return m[c1 * 4 + r1] * m[c2 * 4 + r2] - m[c2 * 4 + r1] * m[c1 * 4 + r2];
+}
+
+bool CTransform::GetInverse(CTransform& inverse) const {
+  const double det = Determinant();
+  if (det == 0.0)
+    return false;
+  CTransform result;
+  double* r = result.values_;
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 3; ++col) {
+      r[col * 4 + row] = Cofactor(values_, col, row) / det;
+    }
+  }
+  for (int row = 0; row < 3; ++row) {
+    r[12 + row] = -(r[row] * values_[12] + r[4 + row] * values_[13] +
+                    r[8 + row] * values_[14]);
+  }
+  inverse = result;
+  return true;
+}
+
+void CTransform::GetNormalMatrix(double* matrix) const {
+  const double sign = IsMirrored() ? -1.0 : 1.0;
+  for (int i = 0; i < 16; ++i) {
+    matrix[i] = 0.0;
+  }
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 3; ++col) {
+      matrix[col * 4 + row] = sign * Cofactor(values_, row, col);
+    }
+  }
+}
+
+CPoint3d CTransform::operator*(const CPoint3d& pt) const {
+  const double in[3] = { pt.x(), pt.y(), pt.z() };
+  double out[3];
+  TransformPoints(in, 1, out);
+  return CPoint3d(out[0], out[1], out[2]);
+}
+
+CVector3d CTransform::TransformVector(const CVector3d& vec) const {
+  const double* m = values_;
+  return CVector3d(m[0] * vec.x() + m[4] * vec.y() + m[8] * vec.z(),
+                   m[1] * vec.x() + m[5] * vec.y() + m[9] * vec.z(),
+                   m[2] * vec.x() + m[6] * vec.y() + m[10] * vec.z());
+}
+
+CVector3d CTransform::TransformNormal(const CVector3d& normal) const {
+  const double in[3] = { normal.x(), normal.y(), normal.z() };
+  double out[3];
+  TransformNormals(in, 1, out);
+  return CVector3d(out[0], out[1], out[2]);
+}
+
+void CTransform::TransformPoints(const double* points, size_t count,
+                                 double* out) const {
+  Transform<false>(values_, points, count, out);
+}
+
+void CTransform::TransformPoints(const double* points, size_t count,
+                                 float* out) const {
+  Transform<false>(values_, points, count, out);
+}
+
+void CTransform::TransformNormals(const double* normals, size_t count,
+                                  double* out) const {
+  double matrix[16];
+  GetNormalMatrix(matrix);
+  Transform<true>(matrix, normals, count, out);
+}
+
+void CTransform::TransformNormals(const double* normals, size_t count,
+                                  float* out) const {
+  double matrix[16];
+  GetNormalMatrix(matrix);
+  Transform<true>(matrix, normals, count, out);
+}
+
+// Polygon Utilities----------------------------------------
+CVector3d PolygonNormal(const double* points, size_t count) {
+  double x = 0.0;
+  double y = 0.0;
+  double z = 0.0;
+  for (size_t i = 0; i < count; ++i) {
+    const double* p = points + i * 3;
+    const double* q = points + (i + 1 < count ? i + 1 : 0) * 3;
+    x += (p[1] - q[1]) * (p[2] + q[2]);
+    y += (p[2] - q[2]) * (p[0] + q[0]);
+    z += (p[0] - q[0]) * (p[1] + q[1]);
+  }
+  return CVector3d(x, y, z);
+}
+
+// Twice the signed area of the 2d triangle a b c
+static double Cross2d(const double* a, const double* b, const double* c) {
+  return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+void TriangulatePolygon(const double* points, size_t count,
+                        std::vector<uint32_t>& indices) {
+  if (count < 3)
+    return;
+  if (count == 3) {
+    indices.push_back(0);
+    indices.push_back(1);
+    indices.push_back(2);
+    return;
+  }
+
+  // Work in the coordinate plane the polygon is closest to, seen from the
+  // side its normal points to, so its corners go counterclockwise
+  const CVector3d normal = PolygonNormal(points, count);
+  const double nx = fabs(normal.x());
+  const double ny = fabs(normal.y());
+  const double nz = fabs(normal.z());
+  int u = 0;
+  int v = 1;
+  double facing = normal.z();
+  if (nx >= ny && nx >= nz) {
+    u = 1;
+    v = 2;
+    facing = normal.x();
+  } else if (ny >= nz) {
+    u = 2;
+    v = 0;
+    facing = normal.y();
+  }
+  std::vector<double> flat(count * 2);
+  for (size_t i = 0; i < count; ++i) {
+    flat[i * 2] = points[i * 3 + u];
+    flat[i * 2 + 1] = points[i * 3 + v] * (facing < 0.0 ? -1.0 : 1.0);
+  }
+
+  // The corners not clipped yet form a ring
+  std::vector<uint32_t> next(count);
+  std::vector<uint32_t> prev(count);
+  for (size_t i = 0; i < count; ++i) {
+    next[i] = static_cast<uint32_t>(i + 1 < count ? i + 1 : 0);
+    prev[i] = static_cast<uint32_t>(i > 0 ? i - 1 : count - 1);
+  }
+
+  uint32_t corner = 0;
+  size_t left = count;
+  size_t tried = 0;
+  while (left > 3) {
+    const uint32_t a = prev[corner];
+    const uint32_t c = next[corner];
+    const double* pa = &flat[a * 2];
+    const double* pb = &flat[corner * 2];
+    const double* pc = &flat[c * 2];
+    // An ear is convex and has no other corner inside it. After a full turn
+    // without one the polygon is degenerate, and any corner will do.
+    bool ear = tried >= left || Cross2d(pa, pb, pc) > 0.0;
+    for (uint32_t i = next[c]; ear && tried < left && i != a; i = next[i]) {
+      const double* p = &flat[i * 2];
+      ear = Cross2d(pa, pb, p) < 0.0 || Cross2d(pb, pc, p) < 0.0 ||
+            Cross2d(pc, pa, p) < 0.0;
+    }
+    if (!ear) {
+      corner = c;
+      ++tried;
+      continue;
+    }
+    indices.push_back(a);
+    indices.push_back(corner);
+    indices.push_back(c);
+    next[a] = c;
+    prev[c] = a;
+    corner = c;
+    --left;
+    tried = 0;
+  }
+  indices.push_back(prev[corner]);
+  indices.push_back(corner);
+  indices.push_back(next[corner]);
+}
+
 } // end namespace XmlGeomUtils
@@ -3,6 +3,10 @@
 #ifndef SKPTOXML_COMMON_XMLGEOMUTILS_H
 #define SKPTOXML_COMMON_XMLGEOMUTILS_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
 #include <SketchUpAPI/geometry.h>
 
 // This module defines geometric classes that are useful in processing
@@ -10,6 +14,11 @@
 
 namespace XmlGeomUtils {
 
+// Misc Utilities--------------------------------------
+// Coordinates closer than this on every axis are taken to be the same, as
+// by CVector3d::operator==
+extern const double EqualTol;
+
 // Vector Class----------------------------------------
 class CVector3d {
  public:
@@ -93,6 +102,82 @@ class CPoint3d {
   double z_;
 };
 
+// Transformation Class----------------------------------------
+// A 4x4 matrix kept by columns, like SUTransformation. SketchUp sometimes
+// scales uniformly through the last element, which is divided out on
+// construction unless it is 0. The bottom row is otherwise kept as given,
+// but the determinant, the inverse and the point, vector and normal
+// transforms treat it as 0 0 0 1: they only use the affine part.
+//
+// The batch functions work on packed x y z triples. They use AVX when the
+// CPU and OS support it, and SSE2 otherwise; builds for targets other than
+// x64, and builds with XMLGEOMUTILS_NO_SIMD defined, use scalar loops;
+// builds with XMLGEOMUTILS_NO_AVX defined keep to SSE2. All give the same
+// results bit for bit as long as xmlgeomutils.cpp is built without FMA
+// contraction, which compilers for targets with FMA, like ARM64, do by
+// default. 'out' may be the same array as the input, but may not overlap
+// it otherwise.
+class CTransform {
+ public:
+  CTransform();  // The identity
+  explicit CTransform(const SUTransformation& transform);
+  ~CTransform() {}
+
+  const double* values() const { return values_; }
+  SUTransformation GetSUTransformation() const;
+
+  // this * t, which applies t first
+  CTransform operator*(const CTransform& t) const;
+  void operator*=(const CTransform& t);
+
+  // Of the linear part, negative for a transformation that mirrors
+  double Determinant() const;
+  bool IsMirrored() const { return Determinant() < 0.0; }
+
+  // Returns false, leaving 'inverse' as is, for a singular transformation
+  bool GetInverse(CTransform& inverse) const;
+
+  CPoint3d operator*(const CPoint3d& pt) const;
+  CVector3d TransformVector(const CVector3d& vec) const;
+  // Through the inverse transpose of the linear part, then made unit
+  // length. Zero vectors, and normals flattened by a singular
+  // transformation, come out zero.
+  CVector3d TransformNormal(const CVector3d& normal) const;
+
+  void TransformPoints(const double* points, size_t count,
+                       double* out) const;
+  void TransformPoints(const double* points, size_t count, float* out) const;
+  void TransformNormals(const double* normals, size_t count,
+                        double* out) const;
+  void TransformNormals(const double* normals, size_t count,
+                        float* out) const;
+
+ private:
+  // The inverse transpose of the linear part up to a positive scale, by
+  // columns, which normals go through
+  void GetNormalMatrix(double* matrix) const;
+
+ private:
+  double values_[16];
+};
+
+
+// Polygon Utilities----------------------------------------
+// 'points' are the x y z of the 'count' corners of a planar polygon, in
+// order around it.
+
+// The normal of the polygon by Newell's method, with a length of twice its
+// area, pointing the way the corners wind counterclockwise around
+CVector3d PolygonNormal(const double* points, size_t count);
+
+// Splits a simple polygon, which may be concave, into count - 2 triangles
+// by ear clipping. Appends 3 corner indices per triangle to 'indices', each
+// wound like the polygon. Degenerate polygons still give count - 2
+// triangles, some of them with no area.
+void TriangulatePolygon(const double* points, size_t count,
+                        std::vector<uint32_t>& indices);
+
+
 } // end namespace XmlGeomUtils
 
 #endif // SKPTOXML_COMMON_XMLGEOMUTILS_H
@@ -0,0 +1,226 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmlinstancer.h"
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#include "./xmlfile.h"
+#include "./xmlparallel.h"
+
+using XmlGeomUtils::CTransform;
+
+// Mesh, inherited material and layer, and whether the transforms mirror
+typedef std::tuple<size_t, std::string, std::string, bool> XmlInstanceSetKey;
+
+static XmlInstanceSet& FindSet(std::vector<XmlInstanceSet>& sets,
+                               std::map<XmlInstanceSetKey, size_t>& indices,
+                               const XmlInstanceSetKey& key) {
+  std::pair<std::map<XmlInstanceSetKey, size_t>::iterator, bool> it =
+      indices.insert(std::make_pair(key, sets.size()));
+  if (it.second) {
+    sets.push_back(XmlInstanceSet());
+    sets.back().mesh_ = std::get<0>(key);
+    sets.back().material_name_ = std::get<1>(key);
+    sets.back().layer_name_ = std::get<2>(key);
+    sets.back().mirrored_ = std::get<3>(key);
+  }
+  return sets[it.first->second];
+}
+
+//------------------------------------------------------------------------------
+
+// CXmlInstancePass - One call to CXmlInstancer::Build. The hierarchy is
+// walked first, giving each entities block with faces a mesh and a set of
+// transforms per inherited material and layer. The meshes are then
+// triangulated in parallel, and the sets of meshes that don't inherit a
+// material or a layer are joined.
+class CXmlInstancePass {
+ public:
+  CXmlInstancePass(const XmlModelInfo& model_info, unsigned threads,
+                   XmlInstancedModel& model)
+    : model_info_(model_info), threads_(threads), model_(model), ok_(true) {}
+
+  bool Run();
+
+ private:
+  void Visit(const XmlEntitiesInfo& entities,
+             const std::string& definition_name,
+             const CTransform& transform,
+             const std::string& material_name,
+             const std::string& layer_name);
+  void VisitInstance(const XmlComponentInstanceInfo& info,
+                     const CTransform& transform,
+                     const std::string& material_name,
+                     const std::string& layer_name);
+  void AddInstance(const XmlEntitiesInfo& entities,
+                   const std::string& definition_name,
+                   const CTransform& transform,
+                   const std::string& material_name,
+                   const std::string& layer_name);
+  void JoinSets();
+
+ private:
+  const XmlModelInfo& model_info_;
+  unsigned threads_;
+  XmlInstancedModel& model_;
+  std::unordered_map<std::string, size_t> definitions_;
+  std::vector<const XmlEntitiesInfo*> blocks_;
+  std::unordered_map<const XmlEntitiesInfo*, size_t> mesh_indices_;
+  std::map<XmlInstanceSetKey, size_t> set_indices_;
+  // The definitions above the entities being visited
+  std::vector<size_t> path_;
+  bool ok_;
+};
+
+bool CXmlInstancePass::Run() {
+  model_ = XmlInstancedModel();
+  const std::vector<XmlComponentDefinitionInfo>& defs =
+      model_info_.definitions_;
+  for (size_t i = 0; i < defs.size(); ++i) {
+    definitions_.insert(std::make_pair(defs[i].name_, i));
+  }
+  static const std::string kNoName;
+  Visit(model_info_.entities_, kNoName, CTransform(), kNoName,
+        kNoName);
+
+  XmlParallel::For(blocks_.size(), threads_,
+                   [&](size_t mesh, unsigned /*thread*/) {
+    CXmlFlattener::TriangulateFaces(*blocks_[mesh], model_info_.names_,
+                                    model_.meshes_[mesh].batches_);
+  });
+  JoinSets();
+  return ok_;
+}
+
+void CXmlInstancePass::Visit(const XmlEntitiesInfo& entities,
+                             const std::string& definition_name,
+                             const CTransform& transform,
+                             const std::string& material_name,
+                             const std::string& layer_name) {
+  for (size_t i = 0; i < entities.component_instances_.size(); ++i) {
+    VisitInstance(entities.component_instances_[i], transform,
+                  material_name, layer_name);
+  }
+  static const std::string kNoName;
+  for (size_t i = 0; i < entities.groups_.size(); ++i) {
+    const XmlGroupInfo& group = entities.groups_[i];
+    Visit(*group.entities_, kNoName,
+          transform * CTransform(group.transform_), material_name,
+          layer_name);
+  }
+  AddInstance(entities, definition_name, transform, material_name,
+              layer_name);
+}
+
+void CXmlInstancePass::VisitInstance(const XmlComponentInstanceInfo& info,
+                                     const CTransform& transform,
+                                     const std::string& material_name,
+                                     const std::string& layer_name) {
+  const CXmlNameTable& names = model_info_.names_;
+  std::unordered_map<std::string, size_t>::const_iterator it =
+      definitions_.find(
+          names.Resolve(info.definition_id_, info.definition_name_));
+  if (it == definitions_.end() ||
+      std::find(path_.begin(), path_.end(), it->second) != path_.end()) {
+    ok_ = false;
+    return;
+  }
+  const std::string& material =
+      names.Resolve(info.material_id_, info.material_name_);
+  const std::string& layer = names.Resolve(info.layer_id_, info.layer_name_);
+  const XmlComponentDefinitionInfo& definition =
+      model_info_.definitions_[it->second];
+  path_.push_back(it->second);
+  Visit(definition.entities_, definition.name_,
+        transform * CTransform(info.transform_),
+        material.empty() ? material_name : material,
+        layer.empty() ? layer_name : layer);
+  path_.pop_back();
+}
+
+void CXmlInstancePass::AddInstance(const XmlEntitiesInfo& entities,
+                                   const std::string& definition_name,
+                                   const CTransform& transform,
+                                   const std::string& material_name,
+                                   const std::string& layer_name) {
+  if (entities.faces_.empty() && entities.face_store_.empty())
+    return;
+  std::pair<std::unordered_map<const XmlEntitiesInfo*, size_t>::iterator,
+            bool> it = mesh_indices_.insert(
+      std::make_pair(&entities, blocks_.size()));
+  if (it.second) {
+    blocks_.push_back(&entities);
+    model_.meshes_.push_back(XmlInstancedMesh());
+    model_.meshes_.back().definition_name_ = definition_name;
+  }
+  XmlInstanceSet& set = FindSet(
+      model_.instance_sets_, set_indices_,
+      XmlInstanceSetKey(it.first->second, material_name, layer_name,
+                        transform.IsMirrored()));
+  set.transforms_.insert(set.transforms_.end(), transform.values(),
+                         transform.values() + 16);
+}
+
+// Drops the meshes that turned out to have no triangles, and the names of
+// the sets that no batch inherits, joining the sets that become the same
+void CXmlInstancePass::JoinSets() {
+  static const size_t kDropped = static_cast<size_t>(-1);
+  std::vector<XmlInstancedMesh> meshes;
+  std::vector<size_t> mesh_indices(model_.meshes_.size(), kDropped);
+  std::vector<char> inherits_material(model_.meshes_.size(), 0);
+  std::vector<char> inherits_layer(model_.meshes_.size(), 0);
+  for (size_t i = 0; i < model_.meshes_.size(); ++i) {
+    XmlInstancedMesh& mesh = model_.meshes_[i];
+    bool has_triangles = false;
+    for (size_t j = 0; j < mesh.batches_.size(); ++j) {
+      const XmlTriangleBatch& batch = mesh.batches_[j];
+      has_triangles = has_triangles || !batch.indices_.empty();
+      inherits_material[i] |= batch.material_name_.empty();
+      inherits_layer[i] |= batch.layer_name_.empty();
+    }
+    if (has_triangles) {
+      mesh_indices[i] = meshes.size();
+      meshes.push_back(std::move(mesh));
+    }
+  }
+
+  std::vector<XmlInstanceSet> sets;
+  std::map<XmlInstanceSetKey, size_t> set_indices;
+  static const std::string kNoName;
+  for (size_t i = 0; i < model_.instance_sets_.size(); ++i) {
+    XmlInstanceSet& from = model_.instance_sets_[i];
+    const size_t mesh = from.mesh_;
+    if (mesh_indices[mesh] == kDropped)
+      continue;
+    XmlInstanceSet& to = FindSet(
+        sets, set_indices,
+        XmlInstanceSetKey(
+            mesh_indices[mesh],
+            inherits_material[mesh] ? from.material_name_ : kNoName,
+            inherits_layer[mesh] ? from.layer_name_ : kNoName,
+            from.mirrored_));
+    if (to.transforms_.empty()) {
+      to.transforms_.swap(from.transforms_);
+    } else {
+      to.transforms_.insert(to.transforms_.end(), from.transforms_.begin(),
+                            from.transforms_.end());
+    }
+  }
+  model_.meshes_.swap(meshes);
+  model_.instance_sets_.swap(sets);
+}
+
+//------------------------------------------------------------------------------
+
+CXmlInstancer::CXmlInstancer() : threads_(0) {
+}
+
+bool CXmlInstancer::Build(const XmlModelInfo& model_info,
+                          XmlInstancedModel& model) const {
+  CXmlInstancePass pass(model_info, threads_, model);
+  return pass.Run();
+}
@@ -0,0 +1,76 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLINSTANCER_H
+#define SKPTOXML_COMMON_XMLINSTANCER_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "./xmlflattener.h"
+
+struct XmlModelInfo;
+
+// The triangles of the faces of one entities block, in its own coordinates:
+// those of a component definition, of a group, or the top level faces of
+// the model. Batches with an empty material or layer name take those of the
+// instance set drawing them.
+struct XmlInstancedMesh {
+  // Empty for groups and the top level
+  std::string definition_name_;
+  std::vector<XmlTriangleBatch> batches_;
+};
+
+// The places one mesh is drawn at with the same inherited material and
+// layer. Each batch of the mesh makes one instanced draw of the set.
+struct XmlInstanceSet {
+  XmlInstanceSet() : mesh_(0), mirrored_(false) {}
+
+  size_t mesh_;
+  // Empty when no batch of the mesh inherits it
+  std::string material_name_;
+  std::string layer_name_;
+  // The transforms mirror, so the triangles wind clockwise once transformed
+  // and the front faces are the clockwise ones
+  bool mirrored_;
+  // 16 per instance, a world matrix by columns as CTransform keeps it, to
+  // be uploaded as is. Normals go through its inverse transpose.
+  std::vector<double> transforms_;
+};
+
+struct XmlInstancedModel {
+  std::vector<XmlInstancedMesh> meshes_;
+  std::vector<XmlInstanceSet> instance_sets_;
+};
+
+// CXmlInstancer - Turns the hierarchy of a model info into meshes that are
+// each stored once and drawn many times, instead of the copy per instance
+// CXmlFlattener gives. Every entities block with faces becomes a mesh, and
+// the instances and groups leading to it are resolved into world matrices,
+// composed once per path through the hierarchy. A group nested in a
+// definition shares its mesh between the instances of that definition.
+//
+// Faces without a material or a layer take those of the innermost component
+// instance above them that has one. Only front sides are output; edges and
+// curves are left out.
+class CXmlInstancer {
+ public:
+  CXmlInstancer();
+
+  // The number of threads the meshes are triangulated on, 0 meaning one per
+  // core (the default). See XmlParallel::For.
+  unsigned threads() const { return threads_; }
+  void set_threads(unsigned threads) { threads_ = threads; }
+
+  // Replaces 'model' by the meshes of the model info and the places they
+  // are drawn at. Meshes and sets are in order of first use, faces in the
+  // order CXmlFile writes them. The component definitions must have been
+  // loaded. Returns false if an instance refers to a definition that isn't
+  // in the model, or that contains itself, which are skipped.
+  bool Build(const XmlModelInfo& model_info, XmlInstancedModel& model) const;
+
+ private:
+  unsigned threads_;
+};
+
+#endif // SKPTOXML_COMMON_XMLINSTANCER_H
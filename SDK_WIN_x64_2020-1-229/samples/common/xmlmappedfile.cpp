@@ -0,0 +1,119 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmlmappedfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CXmlMappedFile::CXmlMappedFile()
+  : is_open_(false),
+    data_(NULL),
+    size_(0)
+#ifdef _WIN32
+    , file_handle_(INVALID_HANDLE_VALUE),
+    mapping_handle_(NULL)
+#endif
+{
+}
+
+CXmlMappedFile::~CXmlMappedFile() {
+  Close();
+}
+
+#ifdef _WIN32
+
+bool CXmlMappedFile::Open(const std::string& filename) {
+  Close();
+
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                            NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  file_handle_ = file;
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) ||
+      static_cast<ULONGLONG>(file_size.QuadPart) > static_cast<size_t>(-1)) {
+    Close();
+    return false;
+  }
+  size_ = static_cast<size_t>(file_size.QuadPart);
+
+  // Empty files can't be mapped, but they are still valid to open
+  if (size_ > 0) {
+    mapping_handle_ = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0,
+                                         NULL);
+    if (mapping_handle_ != NULL) {
+      data_ = static_cast<const char*>(
+          MapViewOfFile(mapping_handle_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (data_ == NULL) {
+      Close();
+      return false;
+    }
+  }
+  is_open_ = true;
+  return true;
+}
+
+void CXmlMappedFile::Close() {
+  if (data_ != NULL)
+    UnmapViewOfFile(data_);
+  if (mapping_handle_ != NULL)
+    CloseHandle(mapping_handle_);
+  if (file_handle_ != INVALID_HANDLE_VALUE)
+    CloseHandle(file_handle_);
+  mapping_handle_ = NULL;
+  file_handle_ = INVALID_HANDLE_VALUE;
+  data_ = NULL;
+  size_ = 0;
+  is_open_ = false;
+}
+
+#else
+
+bool CXmlMappedFile::Open(const std::string& filename) {
+  Close();
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat file_info;
+  bool ok = fstat(fd, &file_info) == 0 &&
+            static_cast<unsigned long long>(file_info.st_size) <=
+            static_cast<size_t>(-1);
+  if (ok && file_info.st_size > 0) {
+    size_ = static_cast<size_t>(file_info.st_size);
+    void* data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED) {
+      // The file is read front to back, once
+      madvise(data, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(data);
+    } else {
+      size_ = 0;
+      ok = false;
+    }
+  }
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+  is_open_ = ok;
+  return ok;
+}
+
+void CXmlMappedFile::Close() {
+  if (data_ != NULL)
+    munmap(const_cast<char*>(data_), size_);
+  data_ = NULL;
+  size_ = 0;
+  is_open_ = false;
+}
+
+#endif
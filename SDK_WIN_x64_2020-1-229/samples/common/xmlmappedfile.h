@@ -0,0 +1,40 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLMAPPEDFILE_H
+#define SKPTOXML_COMMON_XMLMAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+// CXmlMappedFile - Maps a whole file read-only into memory. Processes that
+// map the same file share its pages in the system file cache instead of each
+// holding a private copy.
+class CXmlMappedFile {
+ public:
+  CXmlMappedFile();
+  ~CXmlMappedFile();
+
+  // Fails if the file can't be opened, or doesn't fit in the address space.
+  bool Open(const std::string& filename);
+  void Close();
+  bool IsOpen() const { return is_open_; }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  // Not copyable
+  CXmlMappedFile(const CXmlMappedFile&);
+  CXmlMappedFile& operator=(const CXmlMappedFile&);
+
+ private:
+  bool is_open_;
+  const char* data_;
+  size_t size_;
+#ifdef _WIN32
+  void* file_handle_;
+  void* mapping_handle_;
+#endif
+};
+
+#endif // SKPTOXML_COMMON_XMLMAPPEDFILE_H
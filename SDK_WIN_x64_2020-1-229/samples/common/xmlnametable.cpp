@@ -0,0 +1,32 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmlnametable.h"
+
+CXmlNameTable::CXmlNameTable() {
+  clear();
+}
+
+void CXmlNameTable::clear() {
+  names_.assign(1, std::string());
+  ids_.clear();
+  ids_[std::string()] = kNoName;
+}
+
+uint32_t CXmlNameTable::Intern(const std::string& name) {
+  // Look up first, so known names don't cost a copy
+  std::map<std::string, uint32_t>::const_iterator it = ids_.find(name);
+  if (it != ids_.end())
+    return it->second;
+
+  const uint32_t id = static_cast<uint32_t>(names_.size());
+  names_.push_back(name);
+  ids_.insert(std::make_pair(name, id));
+  return id;
+}
+
+uint32_t CXmlNameTable::Find(const std::string& name) const {
+  std::map<std::string, uint32_t>::const_iterator it = ids_.find(name);
+  if (it == ids_.end())
+    return kNoName;
+  return it->second;
+}
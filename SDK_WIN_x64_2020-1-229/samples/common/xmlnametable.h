@@ -0,0 +1,40 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLNAMETABLE_H
+#define SKPTOXML_COMMON_XMLNAMETABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// CXmlNameTable - Interns the layer, material and definition names of a
+// model. Every distinct name gets a dense ID, so entities can refer to a
+// name by index instead of keeping a copy of it. ID 0 is the empty string.
+class CXmlNameTable {
+ public:
+  enum { kNoName = 0 };
+
+  CXmlNameTable();
+
+  // Returns the ID of a name, adding the name if it is new
+  uint32_t Intern(const std::string& name);
+  // Returns the ID of a name, or kNoName if it hasn't been interned
+  uint32_t Find(const std::string& name) const;
+
+  const std::string& GetName(uint32_t id) const { return names_[id]; }
+  // The name an entity refers to: name 'id' if it has one, else 'name', the
+  // string it was read or built with
+  const std::string& Resolve(uint32_t id, const std::string& name) const {
+    return id != kNoName ? names_[id] : name;
+  }
+  size_t size() const { return names_.size(); }
+  void clear();
+
+ private:
+  std::vector<std::string> names_;
+  std::map<std::string, uint32_t> ids_;
+};
+
+#endif // SKPTOXML_COMMON_XMLNAMETABLE_H
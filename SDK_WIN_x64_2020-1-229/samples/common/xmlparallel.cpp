@@ -0,0 +1,69 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmlparallel.h"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace XmlParallel {
+
+unsigned ThreadCount(unsigned threads) {
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+  return threads > 0 ? threads : 1;
+}
+
+void For(size_t count, unsigned threads,
+         const std::function<void(size_t item, unsigned thread)>& fn) {
+  threads = ThreadCount(threads);
+  if (threads > count)
+    threads = static_cast<unsigned>(count);
+  if (threads <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      fn(i, 0);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next_item(0);
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  std::function<void(unsigned)> work = [&](unsigned thread) {
+    try {
+      for (;;) {
+        size_t item = next_item++;
+        if (item >= count)
+          break;
+        fn(item, thread);
+      }
+    } catch (...) {
+      // Makes the other threads run out of items
+      next_item = count;
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error)
+        error = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(threads - 1);
+  try {
+    for (unsigned thread = 1; thread < threads; ++thread) {
+      workers.push_back(std::thread(work, thread));
+    }
+  } catch (const std::system_error&) {
+    // Out of threads, the ones running take the remaining items
+  }
+  work(0);
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i].join();
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+} // end namespace XmlParallel
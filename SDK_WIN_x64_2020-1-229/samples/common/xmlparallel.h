@@ -0,0 +1,29 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLPARALLEL_H
+#define SKPTOXML_COMMON_XMLPARALLEL_H
+
+#include <stddef.h>
+#include <functional>
+
+// Helpers to spread independent pieces of work over a few threads.
+
+namespace XmlParallel {
+
+// The number of threads to use when 'threads' are asked for: 0 means one per
+// hardware thread. Never less than 1.
+unsigned ThreadCount(unsigned threads);
+
+// Calls fn(item, thread) for every item in [0, count), on up to 'threads'
+// threads (see ThreadCount), the calling thread being one of them. Items are
+// handed out one at a time in increasing order, so large and small items
+// even out. 'thread' is in [0, threads) and no two calls with the same
+// 'thread' run at the same time, which makes it an index for per thread
+// state. Returns when all items are done. If a call throws, the remaining
+// items are skipped and the first exception is rethrown.
+void For(size_t count, unsigned threads,
+         const std::function<void(size_t item, unsigned thread)>& fn);
+
+} // end namespace XmlParallel
+
+#endif // SKPTOXML_COMMON_XMLPARALLEL_H
@@ -0,0 +1,661 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <cstring>
+
+#include "./xmlstreamreader.h"
+#include "./tinyxml2.h"
+#include "./xmlcodec.h"
+#include "./xmltagtable.h"
+
+using tinyxml2::XMLUtil;
+
+// The window starts at this size and doubles whenever a single tag does not
+// fit into it.
+static const size_t kInitialWindowSize = 64 * 1024;
+
+// Returns 1 if the 'size' bytes at 'p' start with 'prefix', 0 if they do not
+// and -1 if there are too few bytes to tell.
+static int StartsWith(const char* p, size_t size, const char* prefix) {
+  size_t length = strlen(prefix);
+  size_t n = size < length ? size : length;
+  if (memcmp(p, prefix, n) != 0)
+    return 0;
+  return n == length ? 1 : -1;
+}
+
+// Finds 'pattern' in [begin, end). Returns NULL if not found.
+static const char* FindPattern(const char* begin, const char* end,
+                               const char* pattern) {
+  size_t length = strlen(pattern);
+  while (begin + length <= end) {
+    const char* p = static_cast<const char*>(
+        memchr(begin, pattern[0], end - begin - length + 1));
+    if (p == NULL)
+      return NULL;
+    if (memcmp(p, pattern, length) == 0)
+      return p;
+    begin = p + 1;
+  }
+  return NULL;
+}
+
+static const char* SkipWhiteSpace(const char* p, const char* end) {
+  while (p < end && XMLUtil::IsWhiteSpace(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+static const char* SkipName(const char* p, const char* end) {
+  if (p < end && XMLUtil::IsNameStartChar(static_cast<unsigned char>(*p))) {
+    ++p;
+    while (p < end && XMLUtil::IsNameChar(static_cast<unsigned char>(*p))) {
+      ++p;
+    }
+  }
+  return p;
+}
+
+// Decodes the character or entity reference at 'p' and appends it to
+// 'value'. Returns the position after the reference.
+static const char* DecodeReference(const char* p, const char* end,
+                                   std::string* value) {
+  static const struct {
+    const char* pattern;
+    char value;
+  } kEntities[] = {
+    { "&quot;", '"' },
+    { "&amp;", '&' },
+    { "&apos;", '\'' },
+    { "&lt;", '<' },
+    { "&gt;", '>' }
+  };
+
+  if (p + 1 < end && p[1] == '#') {
+    const char* semicolon = static_cast<const char*>(
+        memchr(p, ';', end - p));
+    const bool hex = p + 2 < end && p[2] == 'x';
+    const char* digit = p + (hex ? 3 : 2);
+    unsigned long ucs = 0;
+    bool valid = semicolon != NULL && digit < semicolon;
+    for (; valid && digit < semicolon; ++digit) {
+      char c = *digit;
+      if (c >= '0' && c <= '9') {
+        ucs = ucs * (hex ? 16 : 10) + (c - '0');
+      } else if (hex && c >= 'a' && c <= 'f') {
+        ucs = ucs * 16 + (c - 'a' + 10);
+      } else if (hex && c >= 'A' && c <= 'F') {
+        ucs = ucs * 16 + (c - 'A' + 10);
+      } else {
+        valid = false;
+      }
+    }
+    if (valid) {
+      char utf8[8] = { 0 };
+      int length = 0;
+      XMLUtil::ConvertUTF32ToUTF8(ucs, utf8, &length);
+      value->append(utf8, length);
+      return semicolon + 1;
+    }
+  } else {
+    for (size_t i = 0; i < sizeof(kEntities) / sizeof(kEntities[0]); ++i) {
+      if (StartsWith(p, end - p, kEntities[i].pattern) == 1) {
+        value->push_back(kEntities[i].value);
+        return p + strlen(kEntities[i].pattern);
+      }
+    }
+  }
+  // Not a reference we understand, keep it as it is
+  value->push_back(*p);
+  return p + 1;
+}
+
+// Appends the text in [p, end) to 'value', translating entities and line
+// endings the way tinyxml2 does.
+static void AppendDecoded(const char* p, const char* end, std::string* value) {
+  while (p < end) {
+    // Copy runs of ordinary characters in one go
+    const char* run = p;
+    while (p < end && *p != '&' && *p != '\r' && *p != '\n') {
+      ++p;
+    }
+    value->append(run, p - run);
+    if (p == end)
+      break;
+
+    if (*p == '&') {
+      p = DecodeReference(p, end, value);
+    } else {
+      // CR-LF, LF-CR and lone CR or LF all become LF
+      char other = *p == '\r' ? '\n' : '\r';
+      p += (p + 1 < end && p[1] == other) ? 2 : 1;
+      value->push_back('\n');
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+
+CXmlStreamReader::CXmlStreamReader()
+  : file_(NULL),
+    is_open_(false),
+    eof_(true),
+    data_(NULL),
+    pos_(0),
+    end_(0),
+    discarded_(0),
+    tag_offset_(0),
+    node_type_(kNone),
+    pending_end_(false),
+    name_(NULL),
+    name_size_(0),
+    element_tags_(NULL),
+    attribute_tags_(NULL),
+    tag_id_(CXmlTagTable::kUnknown) {
+}
+
+CXmlStreamReader::~CXmlStreamReader() {
+  Close();
+}
+
+bool CXmlStreamReader::Open(const std::string& filename) {
+  Close();
+
+  file_ = new CXmlCodecFile;
+  if (!file_->OpenRead(filename)) {
+    delete file_;
+    file_ = NULL;
+    return false;
+  }
+
+  buffer_.resize(kInitialWindowSize);
+  data_ = &buffer_[0];
+  is_open_ = true;
+  eof_ = false;
+  Fill();
+  SkipByteOrderMark();
+  return true;
+}
+
+bool CXmlStreamReader::Open(const char* data, size_t size) {
+  Close();
+
+  // The whole document is the window, there is nothing left to read
+  data_ = data;
+  end_ = size;
+  is_open_ = true;
+  SkipByteOrderMark();
+  return true;
+}
+
+void CXmlStreamReader::SkipByteOrderMark() {
+  if (end_ > 0 && StartsWith(data_, end_, "\xef\xbb\xbf") == 1)
+    pos_ = 3;
+}
+
+void CXmlStreamReader::Close() {
+  delete file_;
+  file_ = NULL;
+  std::vector<char>().swap(buffer_);
+  data_ = NULL;
+  is_open_ = false;
+  eof_ = true;
+  pos_ = 0;
+  end_ = 0;
+  discarded_ = 0;
+  tag_offset_ = 0;
+  node_type_ = kNone;
+  pending_end_ = false;
+  name_ = NULL;
+  name_size_ = 0;
+  tag_id_ = CXmlTagTable::kUnknown;
+  ClearAttributes();
+  open_names_.clear();
+  open_elements_.clear();
+}
+
+bool CXmlStreamReader::Fill() {
+  if (eof_ || file_ == NULL)
+    return false;
+
+  // Keep only the data that has not been tokenized yet
+  if (pos_ > 0) {
+    discarded_ += pos_;
+    memmove(&buffer_[0], &buffer_[pos_], end_ - pos_);
+    end_ -= pos_;
+    pos_ = 0;
+  }
+  if (end_ == buffer_.size()) {
+    buffer_.resize(buffer_.size() * 2);
+    data_ = &buffer_[0];
+  }
+
+  size_t read = file_->Read(&buffer_[end_], buffer_.size() - end_);
+  if (read == 0) {
+    eof_ = true;
+    return false;
+  }
+  end_ += read;
+  return true;
+}
+
+CXmlStreamReader::NodeType CXmlStreamReader::SetError() {
+  node_type_ = kError;
+  pending_end_ = false;
+  return node_type_;
+}
+
+bool CXmlStreamReader::FindMarkupEnd(size_t* markup_end) const {
+  const char* begin = data_;
+  const char* p = begin + pos_;
+  const char* end = begin + end_;
+  size_t size = end_ - pos_;
+  if (size < 2)
+    return false;
+
+  // Multi-character delimiters: comments, CDATA sections and declarations
+  static const char* const kOpeners[] = { "<!--", "<![CDATA[", "<?" };
+  static const char* const kClosers[] = { "-->", "]]>", "?>" };
+  for (int i = 0; i < 3; ++i) {
+    int match = StartsWith(p, size, kOpeners[i]);
+    if (match < 0 && !eof_)
+      return false;
+    if (match > 0) {
+      const char* close = FindPattern(p + strlen(kOpeners[i]), end,
+                                      kClosers[i]);
+      if (close == NULL)
+        return false;
+      *markup_end = (close - begin) + strlen(kClosers[i]);
+      return true;
+    }
+  }
+
+  // Tags and DOCTYPEs end at the first '>' that is not inside quotes
+  char quote = 0;
+  for (const char* q = p + 1; q < end; ++q) {
+    if (quote != 0) {
+      if (*q == quote)
+        quote = 0;
+    } else if (*q == '"' || *q == '\'') {
+      quote = *q;
+    } else if (*q == '>') {
+      *markup_end = (q - begin) + 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+CXmlStreamReader::NodeType CXmlStreamReader::Next() {
+  return NextTag(NULL);
+}
+
+CXmlStreamReader::NodeType CXmlStreamReader::NextTag(std::string* raw_text) {
+  if (pending_end_) {
+    // Second half of an empty element
+    pending_end_ = false;
+    open_names_.resize(open_elements_.back());
+    open_elements_.pop_back();
+    node_type_ = kEndElement;
+    return node_type_;
+  }
+  if (node_type_ == kError || node_type_ == kEndOfDocument)
+    return node_type_;
+
+  for (;;) {
+    // Skip character data up to the next markup
+    if (!is_open_)
+      return SetError();
+    const char* begin = data_;
+    const char* lt = pos_ == end_ ? NULL : static_cast<const char*>(
+        memchr(begin + pos_, '<', end_ - pos_));
+    if (raw_text != NULL)
+      raw_text->append(begin + pos_, (lt != NULL ? lt - begin : end_) - pos_);
+    if (lt == NULL) {
+      pos_ = end_;
+      if (!Fill()) {
+        if (!open_elements_.empty())
+          return SetError();
+        node_type_ = kEndOfDocument;
+        return node_type_;
+      }
+      continue;
+    }
+    pos_ = lt - begin;
+
+    size_t markup_end = 0;
+    if (!FindMarkupEnd(&markup_end)) {
+      if (!Fill())
+        return SetError();
+      continue;
+    }
+
+    char type = data_[pos_ + 1];
+    if (type == '!' || type == '?') {
+      // Comment, CDATA, declaration or DOCTYPE. CDATA is text too, but it
+      // must not be entity decoded later.
+      static const size_t kCDataOpenSize = 9;
+      static const size_t kCDataCloseSize = 3;
+      if (raw_text != NULL &&
+          StartsWith(data_ + pos_, markup_end - pos_, "<![CDATA[") == 1) {
+        const char* p = data_ + pos_ + kCDataOpenSize;
+        const char* end = data_ + markup_end - kCDataCloseSize;
+        for (; p < end; ++p) {
+          if (*p == '&')
+            raw_text->append("&amp;");
+          else
+            raw_text->push_back(*p);
+        }
+      }
+      pos_ = markup_end;
+      continue;
+    }
+
+    tag_offset_ = discarded_ + pos_;
+    bool ok = type == '/' ? ParseEndTag(markup_end) :
+                            ParseStartTag(markup_end);
+    pos_ = markup_end;
+    return ok ? node_type_ : SetError();
+  }
+}
+
+bool CXmlStreamReader::ParseStartTag(size_t markup_end) {
+  const char* p = data_ + pos_ + 1;
+  const char* end = data_ + markup_end;
+
+  name_ = p;
+  p = SkipName(p, end);
+  name_size_ = p - name_;
+  if (name_size_ == 0)
+    return false;
+  tag_id_ = element_tags_ != NULL ? element_tags_->Find(name_, name_size_) :
+                                    CXmlTagTable::kUnknown;
+
+  ClearAttributes();
+  bool empty_element = false;
+  for (;;) {
+    p = SkipWhiteSpace(p, end);
+    if (p >= end)
+      return false;
+    if (*p == '>')
+      break;
+    if (*p == '/' && p + 1 < end && p[1] == '>') {
+      empty_element = true;
+      break;
+    }
+
+    // name="value" or name='value'
+    Attribute attrib;
+    attrib.name_ = p;
+    p = SkipName(p, end);
+    attrib.name_size_ = p - attrib.name_;
+    if (attrib.name_size_ == 0)
+      return false;
+    p = SkipWhiteSpace(p, end);
+    if (p >= end || *p != '=')
+      return false;
+    p = SkipWhiteSpace(p + 1, end);
+    if (p >= end || (*p != '"' && *p != '\''))
+      return false;
+    const char quote = *p++;
+    const char* value_end = static_cast<const char*>(
+        memchr(p, quote, end - p));
+    if (value_end == NULL)
+      return false;
+    attrib.value_ = p;
+    attrib.value_size_ = value_end - p;
+    attrib.id_ = attribute_tags_ != NULL ?
+        attribute_tags_->Find(attrib.name_, attrib.name_size_) :
+        CXmlTagTable::kUnknown;
+    attributes_.push_back(attrib);
+    // Like FindAttribute(name), the first of duplicate attributes wins
+    if (attrib.id_ != CXmlTagTable::kUnknown &&
+        attribute_slots_[attrib.id_] == 0)
+      attribute_slots_[attrib.id_] = attributes_.size();
+    p = value_end + 1;
+  }
+
+  open_elements_.push_back(open_names_.size());
+  open_names_.append(name_, name_size_);
+  node_type_ = kStartElement;
+  pending_end_ = empty_element;
+  return true;
+}
+
+bool CXmlStreamReader::ParseEndTag(size_t markup_end) {
+  const char* p = data_ + pos_ + 2;
+  const char* end = data_ + markup_end;
+
+  name_ = p;
+  p = SkipName(p, end);
+  name_size_ = p - name_;
+  p = SkipWhiteSpace(p, end);
+  if (name_size_ == 0 || p >= end || *p != '>' || open_elements_.empty())
+    return false;
+
+  // The end tag must close the innermost open element
+  size_t open_begin = open_elements_.back();
+  if (open_names_.size() - open_begin != name_size_ ||
+      memcmp(open_names_.data() + open_begin, name_, name_size_) != 0)
+    return false;
+
+  open_names_.resize(open_begin);
+  open_elements_.pop_back();
+  ClearAttributes();
+  tag_id_ = element_tags_ != NULL ? element_tags_->Find(name_, name_size_) :
+                                    CXmlTagTable::kUnknown;
+  node_type_ = kEndElement;
+  return true;
+}
+
+bool CXmlStreamReader::NextChildElement() {
+  return Next() == kStartElement;
+}
+
+bool CXmlStreamReader::ReadText(std::string* text) {
+  text->clear();
+  if (node_type_ != kStartElement)
+    return false;
+
+  bool ok = true;
+  std::string raw_text;
+  size_t depth = open_elements_.size();
+  for (;;) {
+    NodeType type = NextTag(&raw_text);
+    if (type == kError || type == kEndOfDocument)
+      return false;
+    if (type == kEndElement && open_elements_.size() < depth)
+      break;
+    if (type == kStartElement) {
+      // Mixed content isn't text
+      ok = false;
+      if (!SkipElement())
+        return false;
+    }
+  }
+  AppendDecoded(raw_text.data(), raw_text.data() + raw_text.size(), text);
+  return ok;
+}
+
+bool CXmlStreamReader::SkipElement() {
+  if (node_type_ != kStartElement)
+    return false;
+  size_t depth = open_elements_.size();
+  for (;;) {
+    NodeType type = Next();
+    if (type == kError || type == kEndOfDocument)
+      return false;
+    if (type == kEndElement && open_elements_.size() < depth)
+      return true;
+  }
+}
+
+std::string CXmlStreamReader::Name() const {
+  return std::string(name_, name_size_);
+}
+
+bool CXmlStreamReader::NameIs(const std::string& name) const {
+  return name.size() == name_size_ &&
+         memcmp(name.data(), name_, name_size_) == 0;
+}
+
+void CXmlStreamReader::set_tag_tables(const CXmlTagTable* element_tags,
+                                      const CXmlTagTable* attribute_tags) {
+  ClearAttributes();
+  element_tags_ = element_tags;
+  attribute_tags_ = attribute_tags;
+  attribute_slots_.assign(
+      attribute_tags != NULL ? attribute_tags->size() : 0, 0);
+  tag_id_ = CXmlTagTable::kUnknown;
+}
+
+void CXmlStreamReader::ClearAttributes() {
+  // Only the slots of the current attributes can be set
+  for (std::vector<Attribute>::const_iterator it = attributes_.begin();
+       it != attributes_.end(); ++it) {
+    if (it->id_ != CXmlTagTable::kUnknown)
+      attribute_slots_[it->id_] = 0;
+  }
+  attributes_.clear();
+}
+
+const CXmlStreamReader::Attribute* CXmlStreamReader::FindAttribute(
+    int id) const {
+  if (id <= CXmlTagTable::kUnknown ||
+      static_cast<size_t>(id) >= attribute_slots_.size())
+    return NULL;
+  const size_t slot = attribute_slots_[id];
+  return slot != 0 ? &attributes_[slot - 1] : NULL;
+}
+
+const CXmlStreamReader::Attribute* CXmlStreamReader::FindAttribute(
+    const char* name) const {
+  size_t size = strlen(name);
+  for (std::vector<Attribute>::const_iterator it = attributes_.begin();
+       it != attributes_.end(); ++it) {
+    if (it->name_size_ == size && memcmp(it->name_, name, size) == 0)
+      return &(*it);
+  }
+  return NULL;
+}
+
+bool CXmlStreamReader::HasAttribute(const char* name) const {
+  return FindAttribute(name) != NULL;
+}
+
+bool CXmlStreamReader::HasAttribute(int id) const {
+  return FindAttribute(id) != NULL;
+}
+
+void CXmlStreamReader::DecodeValue(const Attribute& attrib,
+                                   std::string* value) const {
+  value->clear();
+  value->reserve(attrib.value_size_);
+  AppendDecoded(attrib.value_, attrib.value_ + attrib.value_size_, value);
+}
+
+const char* CXmlStreamReader::DecodeNumber(const Attribute& attrib,
+                                           char* buffer, size_t buffer_size,
+                                           std::string* storage) const {
+  const char* p = attrib.value_;
+  const size_t size = attrib.value_size_;
+  if (size < buffer_size &&
+      memchr(p, '&', size) == NULL && memchr(p, '\r', size) == NULL &&
+      memchr(p, '\n', size) == NULL) {
+    memcpy(buffer, p, size);
+    buffer[size] = 0;
+    return buffer;
+  }
+  DecodeValue(attrib, storage);
+  return storage->c_str();
+}
+
+bool CXmlStreamReader::ReadString(const Attribute* attrib,
+                                  std::string* value) const {
+  if (attrib == NULL)
+    return false;
+  DecodeValue(*attrib, value);
+  return true;
+}
+
+bool CXmlStreamReader::ReadInt(const Attribute* attrib, int* value) const {
+  if (attrib == NULL)
+    return false;
+  char buffer[64];
+  std::string storage;
+  return XMLUtil::ToInt(
+      DecodeNumber(*attrib, buffer, sizeof(buffer), &storage), value);
+}
+
+bool CXmlStreamReader::ReadUnsigned(const Attribute* attrib,
+                                    unsigned* value) const {
+  if (attrib == NULL)
+    return false;
+  char buffer[64];
+  std::string storage;
+  return XMLUtil::ToUnsigned(
+      DecodeNumber(*attrib, buffer, sizeof(buffer), &storage), value);
+}
+
+bool CXmlStreamReader::ReadBool(const Attribute* attrib, bool* value) const {
+  if (attrib == NULL)
+    return false;
+  char buffer[64];
+  std::string storage;
+  return XMLUtil::ToBool(
+      DecodeNumber(*attrib, buffer, sizeof(buffer), &storage), value);
+}
+
+bool CXmlStreamReader::ReadDouble(const Attribute* attrib,
+                                  double* value) const {
+  if (attrib == NULL)
+    return false;
+  char buffer[64];
+  std::string storage;
+  return XMLUtil::ToDouble(
+      DecodeNumber(*attrib, buffer, sizeof(buffer), &storage), value);
+}
+
+bool CXmlStreamReader::QueryStringAttribute(const char* name,
+                                            std::string* value) const {
+  return ReadString(FindAttribute(name), value);
+}
+
+bool CXmlStreamReader::QueryIntAttribute(const char* name, int* value) const {
+  return ReadInt(FindAttribute(name), value);
+}
+
+bool CXmlStreamReader::QueryUnsignedAttribute(const char* name,
+                                              unsigned* value) const {
+  return ReadUnsigned(FindAttribute(name), value);
+}
+
+bool CXmlStreamReader::QueryBoolAttribute(const char* name,
+                                          bool* value) const {
+  return ReadBool(FindAttribute(name), value);
+}
+
+bool CXmlStreamReader::QueryDoubleAttribute(const char* name,
+                                            double* value) const {
+  return ReadDouble(FindAttribute(name), value);
+}
+
+bool CXmlStreamReader::QueryStringAttribute(int id, std::string* value) const {
+  return ReadString(FindAttribute(id), value);
+}
+
+bool CXmlStreamReader::QueryIntAttribute(int id, int* value) const {
+  return ReadInt(FindAttribute(id), value);
+}
+
+bool CXmlStreamReader::QueryUnsignedAttribute(int id, unsigned* value) const {
+  return ReadUnsigned(FindAttribute(id), value);
+}
+
+bool CXmlStreamReader::QueryBoolAttribute(int id, bool* value) const {
+  return ReadBool(FindAttribute(id), value);
+}
+
+bool CXmlStreamReader::QueryDoubleAttribute(int id, double* value) const {
+  return ReadDouble(FindAttribute(id), value);
+}
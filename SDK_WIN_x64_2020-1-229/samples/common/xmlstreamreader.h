@@ -0,0 +1,183 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLSTREAMREADER_H
+#define SKPTOXML_COMMON_XMLSTREAMREADER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class CXmlCodecFile;
+class CXmlTagTable;
+
+// CXmlStreamReader - A forward-only, pull style XML tokenizer. Unlike
+// tinyxml2::XMLDocument it never builds a DOM: the file is read through a
+// window that only has to hold the current tag, and each call to Next()
+// reports the next start or end tag. Declarations, comments, DOCTYPEs and
+// character data are skipped.
+//
+// The reader can also tokenize a document that is already in memory, such as
+// a CXmlMappedFile. Nothing is copied then: names and attribute values point
+// straight into the caller's data until they are queried.
+//
+// Element names and attributes refer to the current tag only and are
+// invalidated by the next call to Next().
+//
+// Given tag tables, the reader also classifies every element and attribute
+// name while tokenizing. Callers can then switch on tag_id() and fetch
+// attributes by ID without comparing any strings.
+class CXmlStreamReader {
+ public:
+  enum NodeType {
+    kNone,
+    kStartElement,
+    kEndElement,
+    kEndOfDocument,
+    kError
+  };
+
+  CXmlStreamReader();
+  ~CXmlStreamReader();
+
+  // Compressed files are decompressed as they are read, see CXmlCodecFile.
+  bool Open(const std::string& filename);
+  // Reads from 'data', which must stay valid until Close() is called.
+  bool Open(const char* data, size_t size);
+  void Close();
+  bool IsOpen() const { return is_open_; }
+
+  // Advances to the next start or end tag. An empty element (<a/>) is
+  // reported as a start tag immediately followed by its end tag.
+  NodeType Next();
+
+  // Advances to the next child of the current start tag. Returns false once
+  // the end tag of the current element has been reached. Every child must be
+  // fully consumed (up to its end tag) before the next call.
+  bool NextChildElement();
+
+  // From a start tag, advances to the matching end tag.
+  bool SkipElement();
+
+  // From a start tag, reads the element's text and advances to its end tag.
+  // Returns false if the element has child elements.
+  bool ReadText(std::string* text);
+
+  NodeType node_type() const { return node_type_; }
+  bool error() const { return node_type_ == kError; }
+
+  // Byte offsets into the document: where the current tag starts, and where
+  // it ends. After SkipElement(), offset() is just past the end tag, so an
+  // element can be tokenized again on its own from [tag_offset(), offset()).
+  size_t tag_offset() const { return tag_offset_; }
+  size_t offset() const { return discarded_ + pos_; }
+
+  // Number of elements enclosing the current tag, the tag itself included.
+  size_t depth() const { return open_elements_.size() + (
+      node_type_ == kEndElement ? 1 : 0); }
+
+  // Name of the current start or end tag.
+  std::string Name() const;
+  bool NameIs(const std::string& name) const;
+
+  // Tables to classify element and attribute names with, either may be
+  // NULL. The tables must outlive the reader.
+  void set_tag_tables(const CXmlTagTable* element_tags,
+                      const CXmlTagTable* attribute_tags);
+  // ID of the current tag's name in the element table, or
+  // CXmlTagTable::kUnknown
+  int tag_id() const { return tag_id_; }
+
+  // Attributes of the current start tag. Values are entity decoded.
+  bool HasAttribute(const char* name) const;
+  bool QueryStringAttribute(const char* name, std::string* value) const;
+  bool QueryIntAttribute(const char* name, int* value) const;
+  bool QueryUnsignedAttribute(const char* name, unsigned* value) const;
+  bool QueryBoolAttribute(const char* name, bool* value) const;
+  bool QueryDoubleAttribute(const char* name, double* value) const;
+
+  // The same, by ID in the attribute table
+  bool HasAttribute(int id) const;
+  bool QueryStringAttribute(int id, std::string* value) const;
+  bool QueryIntAttribute(int id, int* value) const;
+  bool QueryUnsignedAttribute(int id, unsigned* value) const;
+  bool QueryBoolAttribute(int id, bool* value) const;
+  bool QueryDoubleAttribute(int id, double* value) const;
+
+ private:
+  struct Attribute {
+    const char* name_;
+    size_t name_size_;
+    const char* value_;
+    size_t value_size_;
+    int id_;
+  };
+
+  // Moves the unparsed data to the front of the window and reads more of
+  // the file, growing the window if it is full. Returns false at the end of
+  // the file.
+  bool Fill();
+  // Next(), optionally collecting the character data it skips. The text is
+  // appended undecoded, except that CDATA sections are escaped.
+  NodeType NextTag(std::string* raw_text);
+  void SkipByteOrderMark();
+
+  // Finds the end of the markup starting at pos_, or returns false if the
+  // markup is not completely in the window yet.
+  bool FindMarkupEnd(size_t* markup_end) const;
+
+  bool ParseStartTag(size_t markup_end);
+  bool ParseEndTag(size_t markup_end);
+
+  const Attribute* FindAttribute(const char* name) const;
+  const Attribute* FindAttribute(int id) const;
+  void ClearAttributes();
+  // Query*Attribute() for an attribute that may be NULL
+  bool ReadString(const Attribute* attrib, std::string* value) const;
+  bool ReadInt(const Attribute* attrib, int* value) const;
+  bool ReadUnsigned(const Attribute* attrib, unsigned* value) const;
+  bool ReadBool(const Attribute* attrib, bool* value) const;
+  bool ReadDouble(const Attribute* attrib, double* value) const;
+  // Copies an attribute value into a string, translating entities and line
+  // endings the way tinyxml2 does.
+  void DecodeValue(const Attribute& attrib, std::string* value) const;
+  // Copies a decoded attribute value into 'buffer' if it fits, otherwise
+  // into 'storage'. Returns the null terminated result.
+  const char* DecodeNumber(const Attribute& attrib, char* buffer,
+                           size_t buffer_size, std::string* storage) const;
+
+  NodeType SetError();
+
+ private:
+  CXmlCodecFile* file_;
+  bool is_open_;
+  bool eof_;
+
+  // The window into the file: [pos_, end_) has not been tokenized yet.
+  // data_ points to buffer_ when reading a file, or to the caller's data.
+  std::vector<char> buffer_;
+  const char* data_;
+  size_t pos_;
+  size_t end_;
+  // Bytes of the file dropped from the front of the window so far
+  size_t discarded_;
+  size_t tag_offset_;
+
+  NodeType node_type_;
+  bool pending_end_;
+  const char* name_;
+  size_t name_size_;
+  std::vector<Attribute> attributes_;
+
+  const CXmlTagTable* element_tags_;
+  const CXmlTagTable* attribute_tags_;
+  int tag_id_;
+  // For each attribute ID, 1 + the index of that attribute of the current
+  // tag in attributes_, or 0 if the tag doesn't have it
+  std::vector<size_t> attribute_slots_;
+
+  // Names of the currently open elements, to match end tags.
+  std::string open_names_;
+  std::vector<size_t> open_elements_;
+};
+
+#endif // SKPTOXML_COMMON_XMLSTREAMREADER_H
@@ -0,0 +1,52 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <cstring>
+
+#include "./xmltagtable.h"
+
+CXmlTagTable::CXmlTagTable(const std::string* names, size_t count)
+  : names_(1), mask_(0) {
+  // At most half the slots are used, so probe sequences stay short
+  size_t slot_count = 8;
+  while (slot_count < count * 2) {
+    slot_count *= 2;
+  }
+  slots_.assign(slot_count, static_cast<int>(kUnknown));
+  mask_ = slot_count - 1;
+
+  for (size_t i = 0; i < count; ++i) {
+    const int id = static_cast<int>(names_.size());
+    names_.push_back(names[i]);
+    size_t slot = Hash(names[i].data(), names[i].size()) & mask_;
+    while (slots_[slot] != kUnknown) {
+      slot = (slot + 1) & mask_;
+    }
+    slots_[slot] = id;
+  }
+}
+
+size_t CXmlTagTable::Hash(const char* name, size_t size) {
+  // FNV-1a over the whole name, the names are short
+  size_t hash = 2166136261U;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(name[i])) * 16777619U;
+  }
+  return hash;
+}
+
+int CXmlTagTable::Find(const char* name, size_t size) const {
+  size_t slot = Hash(name, size) & mask_;
+  for (;;) {
+    const int id = slots_[slot];
+    if (id == kUnknown)
+      return kUnknown;
+    const std::string& candidate = names_[id];
+    if (candidate.size() == size && memcmp(candidate.data(), name, size) == 0)
+      return id;
+    slot = (slot + 1) & mask_;
+  }
+}
+
+int CXmlTagTable::Find(const char* name) const {
+  return Find(name, strlen(name));
+}
@@ -0,0 +1,43 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLTAGTABLE_H
+#define SKPTOXML_COMMON_XMLTAGTABLE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// CXmlTagTable - A fixed set of element or attribute names, each with a
+// small ID, so a reader can classify a name once and then switch on the ID
+// instead of comparing strings. IDs are dense and start at 1 in the order
+// the names were given; kUnknown is returned for any other name. The table
+// is built once and is safe to share between threads afterwards.
+class CXmlTagTable {
+ public:
+  enum { kUnknown = 0 };
+
+  // 'names' holds 'count' distinct names
+  CXmlTagTable(const std::string* names, size_t count);
+
+  int Find(const char* name, size_t size) const;
+  int Find(const char* name) const;
+  int Find(const std::string& name) const {
+    return Find(name.data(), name.size());
+  }
+
+  const std::string& GetName(int id) const { return names_[id]; }
+  // Number of IDs, kUnknown included
+  size_t size() const { return names_.size(); }
+
+ private:
+  static size_t Hash(const char* name, size_t size);
+
+ private:
+  std::vector<std::string> names_;
+  // Open addressing: a power of 2 number of slots holding IDs, kUnknown
+  // for empty slots
+  std::vector<int> slots_;
+  size_t mask_;
+};
+
+#endif // SKPTOXML_COMMON_XMLTAGTABLE_H
@@ -0,0 +1,335 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include "./xmlweld.h"
+
+#include <math.h>
+#include <atomic>
+#include <unordered_map>
+
+#include "./xmlfile.h"
+#include "./xmlparallel.h"
+
+using XmlGeomUtils::CPoint3d;
+
+namespace {
+
+// A cell of the hash grid
+struct XmlWeldCell {
+  int64_t x_;
+  int64_t y_;
+  int64_t z_;
+
+  bool operator==(const XmlWeldCell& cell) const {
+    return x_ == cell.x_ && y_ == cell.y_ && z_ == cell.z_;
+  }
+};
+
+struct XmlWeldCellHash {
+  size_t operator()(const XmlWeldCell& cell) const {
+    uint64_t h = static_cast<uint64_t>(cell.x_) * 0x9e3779b97f4a7c15ULL;
+    h ^= static_cast<uint64_t>(cell.y_) * 0xc2b2ae3d27d4eb4fULL;
+    h ^= static_cast<uint64_t>(cell.z_) * 0x165667b19e3779f9ULL;
+    return static_cast<size_t>(h ^ (h >> 29));
+  }
+};
+
+} // end anonymous namespace
+
+// Cell numbers stay within this, so the cells around them can be numbered
+// too. Positions further out than this many tolerances aren't gridded.
+static const double kMaxCell = 4611686018427387904.0;  // 2^62
+
+// CXmlVertexWelder - Gives positions within a tolerance of each other the
+// same vertex. Each vertex is listed in the grid cell its position falls in.
+// With cells as wide as the tolerance, a position only has to be compared
+// with the vertices of its own cell and the 26 around it.
+class CXmlVertexWelder {
+ public:
+  enum { kNoVertex = 0xffffffff };
+
+  explicit CXmlVertexWelder(double tolerance)
+    : tolerance_(tolerance), scale_(1.0 / tolerance) {}
+
+  // Moves 'point' onto the vertex it is welded to and returns that vertex.
+  // A point the grid can't hold gets a vertex of its own.
+  uint32_t Weld(CPoint3d& point);
+
+  void Reserve(size_t vertices);
+  const std::vector<double>& positions() const { return positions_; }
+  std::vector<double>& positions() { return positions_; }
+  size_t vertex_count() const { return next_.size(); }
+
+ private:
+  // Returns false for a position with a coordinate that isn't finite or is
+  // more than kMaxCell tolerances out, and for any position if the
+  // tolerance isn't a positive number
+  bool GetCell(const double* p, XmlWeldCell& cell) const;
+  uint32_t Find(const XmlWeldCell& cell, const double* p) const;
+
+ private:
+  double tolerance_;
+  double scale_;
+  std::vector<double> positions_;  // x y z per vertex
+  // The last vertex added to each cell, and for each vertex the one added
+  // to its cell before it
+  std::unordered_map<XmlWeldCell, uint32_t, XmlWeldCellHash> cells_;
+  std::vector<uint32_t> next_;
+};
+
+void CXmlVertexWelder::Reserve(size_t vertices) {
+  positions_.reserve(vertices * 3);
+  next_.reserve(vertices);
+  cells_.reserve(vertices);
+}
+
+bool CXmlVertexWelder::GetCell(const double* p, XmlWeldCell& cell) const {
+  if (!(tolerance_ > 0.0))
+    return false;
+  double cells[3];
+  for (int i = 0; i < 3; ++i) {
+    cells[i] = floor(p[i] * scale_);
+    // Also false for NaN
+    if (!(fabs(cells[i]) <= kMaxCell))
+      return false;
+  }
+  cell.x_ = static_cast<int64_t>(cells[0]);
+  cell.y_ = static_cast<int64_t>(cells[1]);
+  cell.z_ = static_cast<int64_t>(cells[2]);
+  return true;
+}
+
+uint32_t CXmlVertexWelder::Find(const XmlWeldCell& cell,
+                                const double* p) const {
+  std::unordered_map<XmlWeldCell, uint32_t, XmlWeldCellHash>::const_iterator
+      it = cells_.find(cell);
+  if (it == cells_.end())
+    return kNoVertex;
+  // The earliest vertex of the cell is kept if several are in reach
+  uint32_t found = kNoVertex;
+  for (uint32_t v = it->second; v != kNoVertex; v = next_[v]) {
+    const double* q = &positions_[v * 3];
+    if (fabs(p[0] - q[0]) <= tolerance_ && fabs(p[1] - q[1]) <= tolerance_ &&
+        fabs(p[2] - q[2]) <= tolerance_)
+      found = v;
+  }
+  return found;
+}
+
+uint32_t CXmlVertexWelder::Weld(CPoint3d& point) {
+  const double p[3] = { point.x(), point.y(), point.z() };
+  const uint32_t vertex = static_cast<uint32_t>(next_.size());
+  XmlWeldCell cell;
+  if (!GetCell(p, cell)) {
+    positions_.insert(positions_.end(), p, p + 3);
+    next_.push_back(kNoVertex);
+    return vertex;
+  }
+
+  // The earliest vertex in reach in the cell or the 26 around it wins, so
+  // the result doesn't depend on the order the cells are looked in
+  uint32_t found = kNoVertex;
+  for (int i = 0; i < 27; ++i) {
+    const XmlWeldCell neighbor = {
+      cell.x_ + i % 3 - 1, cell.y_ + i / 3 % 3 - 1, cell.z_ + i / 9 - 1
+    };
+    const uint32_t v = Find(neighbor, p);
+    if (v < found)
+      found = v;
+  }
+  if (found != kNoVertex) {
+    const double* q = &positions_[found * 3];
+    point.SetLocation(q[0], q[1], q[2]);
+    return found;
+  }
+
+  positions_.insert(positions_.end(), p, p + 3);
+  std::pair<std::unordered_map<XmlWeldCell, uint32_t,
+                               XmlWeldCellHash>::iterator, bool> it =
+      cells_.insert(std::make_pair(cell, vertex));
+  next_.push_back(it.second ? static_cast<uint32_t>(kNoVertex)
+                            : it.first->second);
+  it.first->second = vertex;
+  return vertex;
+}
+
+//------------------------------------------------------------------------------
+
+static bool SameCoords(const CPoint3d& a, const CPoint3d& b) {
+  return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+}
+
+// CXmlFaceWelder - Welds the faces and edges of one entities block
+class CXmlFaceWelder {
+ public:
+  CXmlFaceWelder(double tolerance, XmlWeldedVertices* vertices)
+    : welder_(tolerance), vertices_(vertices), welded_(0) {}
+
+  size_t Run(XmlEntitiesInfo& entities);
+
+ private:
+  void WeldFace(XmlFaceInfo& face);
+  void WeldEdge(XmlEdgeInfo& edge);
+
+ private:
+  CXmlVertexWelder welder_;
+  XmlWeldedVertices* vertices_;
+  size_t welded_;
+  // For the face being welded, the vertex of the face each welded vertex
+  // has become, valid where face_of_ holds the face's number
+  std::vector<uint32_t> face_vertex_;
+  std::vector<uint32_t> face_of_;
+  size_t face_;
+  std::vector<uint32_t> welded_vertices_;
+  std::vector<uint32_t> new_indices_;
+};
+
+size_t CXmlFaceWelder::Run(XmlEntitiesInfo& entities) {
+  size_t corners = 0;
+  for (size_t i = 0; i < entities.faces_.size(); ++i) {
+    corners += entities.faces_[i].vertices_.size();
+  }
+  CXmlFaceStore& store = entities.face_store_;
+  for (CXmlFaceStore::const_iterator it = store.begin(); it != store.end();
+       ++it) {
+    corners += it->vertex_count();
+  }
+  welder_.Reserve(corners);
+  if (vertices_ != NULL) {
+    *vertices_ = XmlWeldedVertices();
+    vertices_->face_vertices_.reserve(corners);
+    vertices_->face_offsets_.push_back(0);
+  }
+
+  face_ = 0;
+  for (size_t i = 0; i < entities.faces_.size(); ++i) {
+    WeldFace(entities.faces_[i]);
+  }
+  if (!store.empty()) {
+    // The store's arrays are rebuilt, since faces can lose vertices
+    CXmlFaceStore welded;
+    welded.reserve(store.size());
+    XmlFaceInfo face;
+    for (CXmlFaceStore::const_iterator it = store.begin();
+         it != store.end(); ++it) {
+      it->GetFaceInfo(face);
+      WeldFace(face);
+      welded.AddFace(face);
+    }
+    store = std::move(welded);
+  }
+
+  for (size_t i = 0; i < entities.edges_.size(); ++i) {
+    WeldEdge(entities.edges_[i]);
+  }
+  for (size_t i = 0; i < entities.curves_.size(); ++i) {
+    XmlCurveInfo& curve = entities.curves_[i];
+    for (size_t j = 0; j < curve.edges_.size(); ++j) {
+      WeldEdge(curve.edges_[j]);
+    }
+  }
+  if (vertices_ != NULL)
+    vertices_->positions_.swap(welder_.positions());
+  return welded_;
+}
+
+void CXmlFaceWelder::WeldFace(XmlFaceInfo& face) {
+  ++face_;
+  const size_t count = face.vertices_.size();
+  welded_vertices_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    const size_t before = welder_.vertex_count();
+    welded_vertices_[i] = welder_.Weld(face.vertices_[i].vertex_);
+    if (welder_.vertex_count() == before)
+      ++welded_;
+  }
+
+  // Corners of a triangulated face that became one are joined. Vertices
+  // are only moved towards the front, and the vectors only shrink, so the
+  // face's arena isn't touched.
+  if (!face.has_single_loop_) {
+    face_vertex_.resize(welder_.vertex_count());
+    face_of_.resize(welder_.vertex_count(), 0);
+    new_indices_.resize(count);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const uint32_t v = welded_vertices_[i];
+      if (face_of_[v] == face_) {
+        const XmlFaceVertex& a = face.vertices_[face_vertex_[v]];
+        const XmlFaceVertex& b = face.vertices_[i];
+        if (SameCoords(a.front_texture_coord_, b.front_texture_coord_) &&
+            SameCoords(a.back_texture_coord_, b.back_texture_coord_)) {
+          new_indices_[i] = face_vertex_[v];
+          continue;
+        }
+      } else {
+        face_of_[v] = static_cast<uint32_t>(face_);
+        face_vertex_[v] = static_cast<uint32_t>(kept);
+      }
+      new_indices_[i] = static_cast<uint32_t>(kept);
+      face.vertices_[kept] = face.vertices_[i];
+      welded_vertices_[kept] = v;
+      ++kept;
+    }
+    if (kept < count) {
+      face.vertices_.resize(kept);
+      welded_vertices_.resize(kept);
+      for (size_t i = 0; i < face.indices_.size(); ++i) {
+        if (face.indices_[i] < count)
+          face.indices_[i] = new_indices_[face.indices_[i]];
+      }
+    }
+  }
+
+  if (vertices_ != NULL) {
+    vertices_->face_vertices_.insert(vertices_->face_vertices_.end(),
+                                     welded_vertices_.begin(),
+                                     welded_vertices_.end());
+    vertices_->face_offsets_.push_back(
+        static_cast<uint32_t>(vertices_->face_vertices_.size()));
+  }
+}
+
+void CXmlFaceWelder::WeldEdge(XmlEdgeInfo& edge) {
+  CPoint3d* ends[2] = { &edge.start_, &edge.end_ };
+  for (int i = 0; i < 2; ++i) {
+    const size_t before = welder_.vertex_count();
+    const uint32_t v = welder_.Weld(*ends[i]);
+    if (welder_.vertex_count() == before)
+      ++welded_;
+    if (vertices_ != NULL)
+      vertices_->edge_vertices_.push_back(v);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+namespace XmlWeld {
+
+size_t WeldEntities(XmlEntitiesInfo& entities, double tolerance,
+                    XmlWeldedVertices* vertices) {
+  CXmlFaceWelder welder(tolerance, vertices);
+  return welder.Run(entities);
+}
+
+size_t WeldModel(XmlModelInfo& model_info, double tolerance,
+                 unsigned threads, std::vector<XmlWeldedVertices>* vertices) {
+  std::vector<XmlEntitiesInfo*> blocks;
+  model_info.entities_.CollectBlocks(blocks);
+  for (size_t i = 0; i < model_info.definitions_.size(); ++i) {
+    model_info.definitions_[i].entities_.CollectBlocks(blocks);
+  }
+  // Sized up front, so each thread only touches its own blocks' entries
+  if (vertices != NULL) {
+    vertices->clear();
+    vertices->resize(blocks.size());
+  }
+  std::atomic<size_t> welded(0);
+  XmlParallel::For(blocks.size(), threads,
+                   [&](size_t block, unsigned /*thread*/) {
+    welded += WeldEntities(*blocks[block], tolerance,
+                           vertices != NULL ? &(*vertices)[block] : NULL);
+  });
+  return welded;
+}
+
+} // end namespace XmlWeld
@@ -0,0 +1,72 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLWELD_H
+#define SKPTOXML_COMMON_XMLWELD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "./xmlgeomutils.h"
+
+struct XmlModelInfo;
+struct XmlEntitiesInfo;
+
+// The positions an entities block's faces and edges share once welded
+struct XmlWeldedVertices {
+  std::vector<double> positions_;  // x y z per welded vertex
+  // The welded vertex of each face vertex: the vertices_ of faces_ and then
+  // of face_store_, in order. Face i has [face_offsets_[i],
+  // face_offsets_[i + 1]), so there is one more offset than faces.
+  std::vector<uint32_t> face_vertices_;
+  std::vector<uint32_t> face_offsets_;
+  // The welded vertices of the start and end of each edge of edges_, and
+  // then of the edges of curves_ in order
+  std::vector<uint32_t> edge_vertices_;
+};
+
+// Joins vertices that are meant to be the same but were written apart. Faces
+// read from a file each have their own copy of every corner, and rounding
+// can leave copies a little apart.
+
+namespace XmlWeld {
+
+// Welds the face and edge vertices of 'entities', not those of the groups in
+// it. Vertices within 'tolerance' of each other on every axis, like
+// CVector3d::operator== takes them, are moved onto the position of the first
+// of them. The positions are found through a hash grid with cells
+// 'tolerance' wide, so the time taken grows linearly with the number of
+// vertices.
+//
+// Vertices with a coordinate that isn't finite, or more than 2^62
+// tolerances from the origin, don't fit in the grid and are never welded.
+// Neither is anything if 'tolerance' isn't a positive number.
+//
+// A triangulated face keeps one vertex for corners that end up at the same
+// position with the same texture coordinates, and its indices_ are changed
+// to match. The corners of single loop faces are only moved, so their
+// loops keep their length.
+//
+// If 'vertices' isn't NULL it is replaced by the welded positions and the
+// vertex each face and edge vertex was welded to. Returns the number of
+// vertices that were welded to an earlier one.
+size_t WeldEntities(XmlEntitiesInfo& entities, double tolerance,
+                    XmlWeldedVertices* vertices);
+
+// Welds every entities block of the model, the top level, groups and loaded
+// component definitions alike, on up to 'threads' threads (see
+// XmlParallel::For). Vertices of different blocks are never welded, as
+// component instances and groups place them apart. Returns the number of
+// vertices welded to an earlier one.
+//
+// If 'vertices' isn't NULL it is replaced by the welded vertices of each
+// block, as WeldEntities gives them: the top level, then each definition,
+// each followed by the groups in it depth first.
+size_t WeldModel(XmlModelInfo& model_info,
+                 double tolerance = XmlGeomUtils::EqualTol,
+                 unsigned threads = 0,
+                 std::vector<XmlWeldedVertices>* vertices = NULL);
+
+} // end namespace XmlWeld
+
+#endif // SKPTOXML_COMMON_XMLWELD_H
@@ -0,0 +1,100 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+// Exports a model of nested groups, as the nightly job does: once in full,
+// then incrementally with nothing changed, then incrementally after a face
+// at the bottom of the nesting has moved, which writes every group above it
+// again. Each element should be digested once per export, so the last
+// export should take about as long as the full one at any depth; digesting
+// each group again for every group around it made it take twice as long at
+// a depth of 64. The text of a chain grows with the square of its depth
+// from the indentation, so compare the exports with each other rather than
+// across depths. The first argument is the directory the files go to, the
+// second the number of faces in each group.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "../common/xmlexporter.h"
+#include "../common/xmlexportmanifest.h"
+#include "../tests/fakesketchup.h"
+#include "../../common/benchmarks/xmlbenchmark.h"
+
+using XmlBenchmark::CTimer;
+using namespace FakeSketchUp;
+
+static const char kModelFile[] = "reexport_benchmark.skp";
+
+// A chain of 'depth' groups with 'faces' faces in each, and next to it a
+// definition of as many faces that is placed at the top. Returns the
+// innermost group.
+static Group& BuildModel(Model& model, int depth, int faces) {
+  Definition& definition = AddDefinition(model, "Window");
+  for (int i = 0; i < faces; ++i)
+    AddFace(definition.entities_, 4, i, 0.0, 0.0);
+  AddInstance(model.entities_, definition, 0.0, 0.0, 0.0);
+
+  Entities* entities = &model.entities_;
+  Group* group = NULL;
+  for (int level = 0; level < depth; ++level) {
+    group = &AddGroup(*entities, 0.0, 0.0, 1.0);
+    entities = &group->entities_;
+    for (int i = 0; i < faces; ++i)
+      AddFace(*entities, 4, i, level, 0.0);
+  }
+  return *group;
+}
+
+// Returns the seconds the export took, or a negative number if it failed
+static double Export(const std::string& filename, bool incremental,
+                     CXmlExportStats& stats) {
+  CXmlOptions options;
+  options.set_export_incremental(incremental);
+  CXmlExporter exporter;
+  exporter.SetOptions(options);
+  CTimer timer;
+  if (!exporter.Convert(kModelFile, filename, NULL))
+    return -1.0;
+  const double seconds = timer.seconds();
+  stats = exporter.stats();
+  return seconds;
+}
+
+static bool Measure(const std::string& directory, int depth, int faces) {
+  Model model;
+  Group& innermost = BuildModel(model, depth, faces);
+  SetModel(kModelFile, &model);
+  const std::string filename = directory + "/reexport_benchmark.xml";
+  remove(filename.c_str());
+  remove(CXmlExportManifest::FilenameOf(filename).c_str());
+
+  CXmlExportStats stats;
+  const double full = Export(filename, true, stats);
+  const double unchanged = Export(filename, true, stats);
+  const size_t unchanged_copies = stats.copied_elements();
+  innermost.entities_.faces_[0].vertices_[0].position_.z = 0.5;
+  const double changed = Export(filename, true, stats);
+  SetModel(kModelFile, NULL);
+  remove(filename.c_str());
+  remove(CXmlExportManifest::FilenameOf(filename).c_str());
+  if (full < 0.0 || unchanged < 0.0 || changed < 0.0)
+    return false;
+
+  printf("%5d  %7zu  %8.3fs  %8.3fs (%zu copied)  %8.3fs (%zu copied)"
+         "  %5.2fx\n", depth, stats.faces(), full, unchanged,
+         unchanged_copies, changed, stats.copied_elements(), changed / full);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const std::string directory = argc > 1 ? argv[1] : ".";
+  const int faces = argc > 2 ? atoi(argv[2]) : 200;
+  printf("depth    faces      full   unchanged                "
+         "moved face        moved/full\n");
+  const int depths[] = { 1, 4, 16, 64 };
+  for (int d = 0; d < 4; ++d) {
+    if (!Measure(directory, depths[d], faces))
+      return 1;
+  }
+  return 0;
+}
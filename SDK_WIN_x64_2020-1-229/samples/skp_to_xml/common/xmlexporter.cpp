@@ -1,5 +1,7 @@
 // Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
 
+#include <cstdio>
+#include <functional>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -88,7 +90,8 @@ static std::string GetComponentDefinitionName(
   return name.utf8();
 }
 
-CXmlExporter::CXmlExporter() {
+CXmlExporter::CXmlExporter()
+    : incremental_(false), digest_only_(false), counted_(false) {
   SUSetInvalid(model_);
   SUSetInvalid(texture_writer_);
 }
@@ -127,11 +130,13 @@ bool CXmlExporter::Convert(const std::string& src_file,
     SUSetInvalid(texture_writer_);
     SU_CALL(SUTextureWriterCreate(&texture_writer_));
 
-    // Open the xml file for creation
-    if (!file_.Open(dst_file, true)) {
+    // Open the xml file for creation. Tags are written out as the model is
+    // traversed, rather than kept in memory until the end.
+    if (!file_.Open(dst_file, CXmlFile::kWriteStreaming)) {
       ReleaseModelObjects();
       return exported;
     }
+    StartIncrementalExport(dst_file);
 
     // Write textures
     HandleProgress(progress_callback, 0.0, "Writing Texture Files...");
@@ -140,6 +145,9 @@ bool CXmlExporter::Convert(const std::string& src_file,
     // Write file header
     int major_ver = 0, minor_ver = 0, build_no = 0;
     SU_CALL(SUModelGetVersion(model_, &major_ver, &minor_ver, &build_no));
+    file_.set_xml_version(options_.export_packed_faces() ?
+                          CXmlFile::kXmlVersionPackedFaces :
+                          CXmlFile::kXmlVersionVertexElements);
     file_.WriteHeader(major_ver, minor_ver, build_no);
 
     // Layers
@@ -158,12 +166,29 @@ bool CXmlExporter::Convert(const std::string& src_file,
     HandleProgress(progress_callback, 60.0, "Writing Geometry...");
     WriteGeometry();
 
-    file_.Close(IsCancelled(progress_callback));
-
-    HandleProgress(progress_callback, 100.0, "Export Complete");
-    exported = true;
+    // The last export has to be closed before the new one replaces it
+    last_file_.Close();
+    const uint64_t text_size = file_.text_size();
+    const bool cancelled = IsCancelled(progress_callback);
+    // A file that wasn't written gets no manifest, the last one still
+    // describes what is on disk. Otherwise it goes before the new file
+    // replaces the old one, so it can't be taken for the new one's if the
+    // new manifest is never saved.
+    if (!cancelled)
+      remove(CXmlExportManifest::FilenameOf(dst_file).c_str());
+    exported = file_.Close(cancelled);
+    if (exported && !cancelled)
+      FinishIncrementalExport(dst_file, text_size);
+    XmlWriteStats write_stats;
+    file_.GetWriteStats(write_stats);
+    stats_.set_bytes_written(write_stats.bytes_written_);
+    stats_.set_write_stall_seconds(write_stats.stall_seconds_);
+
+    if (exported)
+      HandleProgress(progress_callback, 100.0, "Export Complete");
   } catch(...) {
     exported = false;
+    last_file_.Close();
     file_.Close(true);
   }
   ReleaseModelObjects();
@@ -171,6 +196,112 @@ bool CXmlExporter::Convert(const std::string& src_file,
   return exported;
 }
 
+void CXmlExporter::StartIncrementalExport(const std::string& dst_file) {
+  manifest_.Clear();
+  last_manifest_.Clear();
+  last_file_.Close();
+  digests_.clear();
+  digest_only_ = false;
+  counted_ = false;
+  // The manifest locates elements in the text, which a compressed file
+  // would have to be decompressed for
+  incremental_ = options_.export_incremental() &&
+      CXmlCodecFile::CodecOf(dst_file) == CXmlCodecFile::kCodecNone;
+  if (!incremental_)
+    return;
+
+  // Without the last export and a manifest that matches it, everything is
+  // written
+  if (!last_manifest_.Load(CXmlExportManifest::FilenameOf(dst_file)) ||
+      !last_manifest_.Describes(dst_file) ||
+      !last_file_.Open(dst_file) ||
+      last_file_.size() != last_manifest_.file_size()) {
+    last_manifest_.Clear();
+    last_file_.Close();
+  }
+}
+
+void CXmlExporter::FinishIncrementalExport(const std::string& dst_file,
+                                           uint64_t text_size) {
+  std::string manifest_file = CXmlExportManifest::FilenameOf(dst_file);
+  if (incremental_) {
+    // Only for the file on disk being the text just written
+    if (!manifest_.SetFile(dst_file) || manifest_.file_size() != text_size ||
+        !manifest_.Save(manifest_file))
+      remove(manifest_file.c_str());
+  } else {
+    // It would describe a file that is gone now
+    remove(manifest_file.c_str());
+  }
+  manifest_.Clear();
+  last_manifest_.Clear();
+  digests_.clear();
+}
+
+void CXmlExporter::WriteElement(SUEntityRef entity,
+                                const std::function<void()>& write) {
+  int64_t id = 0;
+  if (!incremental_ || SUEntityGetPersistentID(entity, &id) != SU_ERROR_NONE) {
+    write();
+    return;
+  }
+  if (digest_only_) {
+    // Part of an enclosing element that is only being digested. The digest
+    // is kept for when the enclosing element is written.
+    file_.BeginDigest(false);
+    write();
+    const uint64_t digest = file_.EndDigest();
+    file_.AddDigest(digest);
+    digests_[id] = digest;
+    return;
+  }
+
+  // Find out whether the element has changed since the last export, by
+  // digesting it without writing it, unless that was done with an enclosing
+  // element
+  const CXmlExportManifest::Element* last = last_manifest_.Find(id);
+  uint64_t digest = 0;
+  bool digested = false;
+  std::unordered_map<int64_t, uint64_t>::iterator cached = digests_.find(id);
+  if (cached != digests_.end()) {
+    digest = cached->second;
+    digested = true;
+    digests_.erase(cached);
+  } else if (last != NULL) {
+    digest_only_ = true;
+    file_.BeginDigest(false);
+    write();
+    digest = file_.EndDigest();
+    digest_only_ = false;
+    digested = true;
+  }
+
+  const uint64_t begin = file_.text_size();
+  if (last != NULL && digest == last->digest_) {
+    // Its faces and edges have been counted by the digest pass
+    file_.CopyElement(last_file_.data() + last->begin_,
+                      static_cast<size_t>(last->end_ - last->begin_));
+    file_.AddDigest(digest);
+    manifest_.AddCopy(last_manifest_, *last, begin);
+    stats_.AddCopiedElement();
+    return;
+  }
+
+  // Or are counted now, but only once
+  const bool counted = counted_;
+  counted_ = counted_ || digested;
+  file_.BeginDigest(true);
+  write();
+  counted_ = counted;
+  CXmlExportManifest::Element element;
+  element.id_ = id;
+  element.digest_ = file_.EndDigest();
+  element.begin_ = begin;
+  element.end_ = file_.text_size();
+  file_.AddDigest(element.digest_);
+  manifest_.Add(element);
+}
+
 void CXmlExporter::WriteTextureFiles() {
   if (options_.export_materials()) {
     // Load the textures into the texture writer
@@ -191,11 +322,10 @@ void CXmlExporter::WriteTextureFiles() {
 
 void CXmlExporter::WriteLayers() {
   if (options_.export_layers()) {
-    file_.StartLayers();
-
     // Get the number of layers
     size_t num_layers = 0;
     SU_CALL(SUModelGetNumLayers(model_, &num_layers));
+    file_.StartLayers(num_layers);
     if (num_layers > 0) {
       // Get the layers
       std::vector<SULayerRef> layers(num_layers);
@@ -324,7 +454,8 @@ void CXmlExporter::WriteMaterials() {
       if (num_layers > 0) {
         std::vector<SULayerRef> layers(num_layers);
         SU_CALL(SUModelGetLayers(model_, num_layers, &layers[0], &num_layers));
-        file_.StartMaterials();
+        // Layers without a material are skipped, so this is at most the count
+        file_.StartMaterials(num_layers);
         for (size_t i = 0; i < num_layers; i++)  {
           SULayerRef layer = layers[i];
           SUMaterialRef material = SU_INVALID;
@@ -338,7 +469,7 @@ void CXmlExporter::WriteMaterials() {
       size_t count = 0;
       SU_CALL(SUModelGetNumMaterials(model_, &count));
       if (count > 0) {
-        file_.StartMaterials();
+        file_.StartMaterials(count);
         std::vector<SUMaterialRef> materials(count);
         SU_CALL(SUModelGetMaterials(model_, count, &materials[0], &count));
         for (size_t i=0; i<count; i++) {
@@ -375,14 +506,15 @@ void CXmlExporter::WriteComponentDefinitions() {
   size_t num_comp_defs = 0;
   SU_CALL(SUModelGetNumComponentDefinitions(model_, &num_comp_defs));
   if (num_comp_defs > 0) {
-    file_.StartComponentDefinitions();
+    file_.StartComponentDefinitions(num_comp_defs);
 
     std::vector<SUComponentDefinitionRef> comp_defs(num_comp_defs);
     SU_CALL(SUModelGetComponentDefinitions(model_, num_comp_defs, &comp_defs[0],
                                            &num_comp_defs));
     for (size_t def = 0; def < num_comp_defs; ++def) {
       SUComponentDefinitionRef comp_def = comp_defs[def];
-      WriteComponentDefinition(comp_def);
+      WriteElement(SUComponentDefinitionToEntity(comp_def),
+                   [this, comp_def] { WriteComponentDefinition(comp_def); });
     }
 
     file_.PopParentNode();
@@ -400,6 +532,24 @@ void CXmlExporter::WriteComponentDefinition(SUComponentDefinitionRef comp_def) {
   file_.PopParentNode();
 }
 
+void CXmlExporter::WriteGroup(SUGroupRef group) {
+  SUEntitiesRef group_entities = SU_INVALID;
+  SU_CALL(SUGroupGetEntities(group, &group_entities));
+  inheritance_manager_.PushElement(group);
+  file_.StartGroup();
+
+  // Write entities
+  WriteEntities(group_entities);
+
+  // Write transformation
+  SUTransformation transform;
+  SU_CALL(SUGroupGetTransform(group, &transform));
+  file_.WriteTransformation(transform);
+
+  file_.PopParentNode();
+  inheritance_manager_.PopElement();
+}
+
 void CXmlExporter::WriteEntities(SUEntitiesRef entities) {
   // Component instances
   size_t num_instances = 0;
@@ -444,22 +594,9 @@ void CXmlExporter::WriteEntities(SUEntitiesRef entities) {
     SU_CALL(SUEntitiesGetGroups(entities, num_groups, &groups[0], &num_groups));
     for (size_t g = 0; g < num_groups; g++) {
       SUGroupRef group = groups[g];
-      SUComponentDefinitionRef group_component = SU_INVALID;
-      SUEntitiesRef group_entities = SU_INVALID;
-      SU_CALL(SUGroupGetEntities(group, &group_entities));
-      inheritance_manager_.PushElement(group);
-      file_.StartGroup();
-
-      // Write entities
-      WriteEntities(group_entities);
-
-      // Write transformation
-      SUTransformation transform;
-      SU_CALL(SUGroupGetTransform(group, &transform));
-      file_.WriteTransformation(transform);
-
-      file_.PopParentNode();
-      inheritance_manager_.PopElement();
+      WriteElement(SUGroupToEntity(group), [this, group] {
+        WriteGroup(group);
+      });
     }
   }
 
@@ -642,32 +779,33 @@ void CXmlExporter::WriteFace(SUFaceRef face) {
                                            &back_stq[0], &count));
     }
 
-    for (size_t i_triangle = 0; i_triangle < num_triangles; i_triangle++) {
+    // The mesh vertices are shared by the triangles, keep them that way
+    info.vertices_.resize(num_vertices);
+    for (size_t i = 0; i < num_vertices; i++) {
+      XmlFaceVertex& vertex_info = info.vertices_[i];
+      vertex_info.vertex_.SetLocation(vertices[i].x, vertices[i].y,
+                                      vertices[i].z);
 
-      // Three points in each triangle
-      for (size_t i = 0; i < 3; i++) {
-        XmlFaceVertex vertex_info;
-        // Get vertex
-        size_t index = indices[i_triangle * 3 + i];
-        vertex_info.vertex_.SetLocation(vertices[index].x,
-                                        vertices[index].y,
-                                        vertices[index].z);
-
-        if (info.has_front_texture_) {
-          SUPoint3D stq = front_stq[index];
-          vertex_info.front_texture_coord_ = CPoint3d(stq.x, stq.y, 0);
-        }
+      if (info.has_front_texture_) {
+        SUPoint3D stq = front_stq[i];
+        vertex_info.front_texture_coord_ = CPoint3d(stq.x, stq.y, 0);
+      }
 
-        if (info.has_back_texture_) {
-          SUPoint3D stq = back_stq[index];
-          vertex_info.back_texture_coord_ = CPoint3d(stq.x, stq.y, 0);
-        }
-        info.vertices_.push_back(vertex_info);
+      if (info.has_back_texture_) {
+        SUPoint3D stq = back_stq[i];
+        vertex_info.back_texture_coord_ = CPoint3d(stq.x, stq.y, 0);
       }
     }
+
+    // Three indices in each triangle
+    info.indices_.resize(num_retrieved);
+    for (size_t i = 0; i < num_retrieved; i++) {
+      info.indices_[i] = static_cast<uint32_t>(indices[i]);
+    }
   }
 
-  stats_.AddFace();
+  if (!counted_)
+    stats_.AddFace();
   file_.WriteFaceInfo(info);
 
   SU_CALL(SUUVHelperRelease(&uv_helper));
@@ -714,7 +852,8 @@ void CXmlExporter::WriteEdge(SUEdgeRef edge) {
 
   XmlEdgeInfo info = GetEdgeInfo(edge);
   file_.WriteEdgeInfo(info);
-  stats_.AddEdge();
+  if (!counted_)
+    stats_.AddEdge();
 }
 
 void CXmlExporter::WriteCurve(SUCurveRef curve) {
@@ -3,10 +3,16 @@
 #ifndef SKPTOXML_COMMON_XMLEXPORTER_H
 #define SKPTOXML_COMMON_XMLEXPORTER_H
 
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "./xmlexportmanifest.h"
 #include "./xmlinheritancemanager.h"
 #include "./xmloptions.h"
 #include "./xmlstats.h"
 #include "../../common/xmlfile.h"
+#include "../../common/xmlmappedfile.h"
 
 #include <SketchUpAPI/import_export/pluginprogresscallback.h>
 #include <SketchUpAPI/model/defs.h>
@@ -45,12 +51,23 @@ private:
 
   void WriteGeometry();
   void WriteEntities(SUEntitiesRef entities);
+  void WriteGroup(SUGroupRef group);
   void WriteFace(SUFaceRef face);
   void WriteEdge(SUEdgeRef edge);
   void WriteCurve(SUCurveRef curve);
 
   XmlEdgeInfo GetEdgeInfo(SUEdgeRef edge) const;
 
+  // Incremental exports. WriteElement writes a component definition or a
+  // group with 'write', unless it is unchanged since the last export, and
+  // then copies its text from there instead. 'write' may be called twice,
+  // but each element is digested once: a digest pass keeps the digests of
+  // the elements nested in it, which are used when they are written.
+  void StartIncrementalExport(const std::string& dst_file);
+  void FinishIncrementalExport(const std::string& dst_file,
+                               uint64_t text_size);
+  void WriteElement(SUEntityRef entity, const std::function<void()>& write);
+
 private:
   CXmlOptions options_;
 
@@ -67,6 +84,21 @@ private:
 
   // File & stats
   CXmlFile file_;
+
+  // Incremental exports: the manifest and the text of the last export, and
+  // the manifest of this one
+  bool incremental_;
+  CXmlExportManifest last_manifest_;
+  CXmlMappedFile last_file_;
+  CXmlExportManifest manifest_;
+  // Set while an element is digested without being written
+  bool digest_only_;
+  // The digests of nested elements from the digest pass of an enclosing
+  // one, until they are written or copied
+  std::unordered_map<int64_t, uint64_t> digests_;
+  // Set while writing an element whose faces and edges a digest pass has
+  // counted already
+  bool counted_;
 };
 
 #endif // SKPTOXML_COMMON_XMLEXPORTER_H
@@ -0,0 +1,165 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "./xmlexportmanifest.h"
+
+// Changes whenever the elements would be written differently for the same
+// digest, so the text of older exports isn't copied into newer ones, or the
+// format changes
+static const int kManifestVersion = 2;
+static const char kManifestTag[] = "SkpToXMLManifest";
+
+static FILE* OpenFile(const std::string& filename, const char* mode) {
+  FILE* file = NULL;
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+  if (fopen_s(&file, filename.c_str(), mode) != 0)
+    file = NULL;
+#else
+  file = fopen(filename.c_str(), mode);
+#endif
+  return file;
+}
+
+// The size of a file and its modification time, in nanoseconds where the
+// system keeps them
+static bool GetFileInfo(const std::string& filename, uint64_t& size,
+                        int64_t& time) {
+#if defined(_WIN32)
+  struct _stat64 info;
+  if (_stat64(filename.c_str(), &info) != 0)
+    return false;
+  time = static_cast<int64_t>(info.st_mtime) * 1000000000;
+#else
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0)
+    return false;
+#if defined(__APPLE__)
+  const struct timespec& mtime = info.st_mtimespec;
+#else
+  const struct timespec& mtime = info.st_mtim;
+#endif
+  time = static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+#endif
+  size = static_cast<uint64_t>(info.st_size);
+  return true;
+}
+
+CXmlExportManifest::CXmlExportManifest() : file_size_(0), file_time_(0) {
+}
+
+std::string CXmlExportManifest::FilenameOf(const std::string& xml_filename) {
+  return xml_filename + ".manifest";
+}
+
+bool CXmlExportManifest::Load(const std::string& filename) {
+  Clear();
+  FILE* file = OpenFile(filename, "r");
+  if (file == NULL)
+    return false;
+
+  char tag[32];
+  int version = 0;
+  unsigned long long file_size = 0;
+  long long file_time = 0;
+  bool ok = fscanf(file, "%31s %d %llu %lld", tag, &version, &file_size,
+                   &file_time) == 4 &&
+            std::string(tag) == kManifestTag && version == kManifestVersion;
+  file_size_ = file_size;
+  file_time_ = file_time;
+
+  long long id;
+  unsigned long long digest, begin, end;
+  while (ok) {
+    int count = fscanf(file, "%lld %llx %llu %llu", &id, &digest, &begin,
+                       &end);
+    if (count == EOF)
+      break;
+    ok = count == 4 && begin < end && end <= file_size_;
+    if (ok) {
+      Element element = { id, digest, begin, end };
+      Add(element);
+    }
+  }
+  fclose(file);
+  if (!ok)
+    Clear();
+  return ok;
+}
+
+bool CXmlExportManifest::Save(const std::string& filename) const {
+  // Written next to the real one, so a failed save leaves that intact
+  std::string temp_filename = filename + ".tmp";
+  FILE* file = OpenFile(temp_filename, "w");
+  if (file == NULL)
+    return false;
+
+  bool ok = fprintf(file, "%s %d %llu %lld\n", kManifestTag, kManifestVersion,
+                    static_cast<unsigned long long>(file_size_),
+                    static_cast<long long>(file_time_)) > 0;
+  for (size_t i = 0; i < elements_.size() && ok; ++i) {
+    const Element& element = elements_[i];
+    ok = fprintf(file, "%lld %016llx %llu %llu\n",
+                 static_cast<long long>(element.id_),
+                 static_cast<unsigned long long>(element.digest_),
+                 static_cast<unsigned long long>(element.begin_),
+                 static_cast<unsigned long long>(element.end_)) > 0;
+  }
+  ok = fclose(file) == 0 && ok;
+  if (ok) {
+    remove(filename.c_str());
+    ok = rename(temp_filename.c_str(), filename.c_str()) == 0;
+  }
+  if (!ok)
+    remove(temp_filename.c_str());
+  return ok;
+}
+
+void CXmlExportManifest::Clear() {
+  file_size_ = 0;
+  file_time_ = 0;
+  elements_.clear();
+  indices_.clear();
+}
+
+bool CXmlExportManifest::SetFile(const std::string& xml_filename) {
+  return GetFileInfo(xml_filename, file_size_, file_time_);
+}
+
+bool CXmlExportManifest::Describes(const std::string& xml_filename) const {
+  uint64_t size;
+  int64_t time;
+  return GetFileInfo(xml_filename, size, time) && size == file_size_ &&
+         time == file_time_;
+}
+
+void CXmlExportManifest::Add(const Element& element) {
+  // The first one wins if an ID comes up twice
+  if (indices_.insert(std::make_pair(element.id_, elements_.size())).second)
+    elements_.push_back(element);
+}
+
+void CXmlExportManifest::AddCopy(const CXmlExportManifest& last,
+                                 const Element& element, uint64_t begin) {
+  // The elements inside come right before it, and are the only ones before
+  // it that start within it
+  const size_t index = &element - &last.elements_[0];
+  size_t first = index;
+  while (first > 0 && last.elements_[first - 1].begin_ >= element.begin_) {
+    --first;
+  }
+  for (size_t i = first; i <= index; ++i) {
+    Element copy = last.elements_[i];
+    copy.begin_ = copy.begin_ - element.begin_ + begin;
+    copy.end_ = copy.end_ - element.begin_ + begin;
+    Add(copy);
+  }
+}
+
+const CXmlExportManifest::Element* CXmlExportManifest::Find(
+    int64_t id) const {
+  std::map<int64_t, size_t>::const_iterator it = indices_.find(id);
+  return it != indices_.end() ? &elements_[it->second] : NULL;
+}
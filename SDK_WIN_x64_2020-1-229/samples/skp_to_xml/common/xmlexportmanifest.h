@@ -0,0 +1,62 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_COMMON_XMLEXPORTMANIFEST_H
+#define SKPTOXML_COMMON_XMLEXPORTMANIFEST_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// CXmlExportManifest - What an incremental export wrote, kept next to the
+// xml file as <file>.manifest. Each component definition and group is
+// listed by the persistent ID of its entity, with the digest of what was
+// written for it and where its text is in the file. The next export of the
+// model copies that text instead of writing the element again if the digest
+// is still the same.
+class CXmlExportManifest {
+ public:
+  struct Element {
+    int64_t id_;
+    uint64_t digest_;
+    // The element's text is [begin_, end_) in the file
+    uint64_t begin_;
+    uint64_t end_;
+  };
+
+  CXmlExportManifest();
+
+  static std::string FilenameOf(const std::string& xml_filename);
+
+  // Load fails if the file is missing, malformed or of another version
+  bool Load(const std::string& filename);
+  bool Save(const std::string& filename) const;
+  void Clear();
+
+  // Elements are added after the elements inside them
+  void Add(const Element& element);
+  // Adds 'element' of 'last', whose text has been copied to 'begin', and
+  // the elements inside it
+  void AddCopy(const CXmlExportManifest& last, const Element& element,
+               uint64_t begin);
+  // Returns NULL if there is no element of that ID
+  const Element* Find(int64_t id) const;
+  size_t size() const { return elements_.size(); }
+
+  // The size and modification time of the xml file the manifest describes.
+  // It only describes the file while both stay the same, so a file that was
+  // replaced or edited since, even to the same size, isn't copied from.
+  uint64_t file_size() const { return file_size_; }
+  int64_t file_time() const { return file_time_; }
+  // Takes them from the file, returns false if it can't be read
+  bool SetFile(const std::string& xml_filename);
+  bool Describes(const std::string& xml_filename) const;
+
+ private:
+  uint64_t file_size_;
+  int64_t file_time_;
+  std::vector<Element> elements_;
+  std::map<int64_t, size_t> indices_;
+};
+
+#endif // SKPTOXML_COMMON_XMLEXPORTMANIFEST_H
@@ -12,6 +12,8 @@ class CXmlOptions {
    export_materials_by_layer_ = false;
    export_layers_ = true;
    export_options_ = false;
+   export_packed_faces_ = false;
+   export_incremental_ = false;
   }
 
   virtual ~CXmlOptions(void) {}
@@ -38,6 +40,21 @@ class CXmlOptions {
   inline bool export_options() const { return export_options_; }
   inline void set_export_options(bool value) { export_options_ = value; }
 
+  // Write faces as packed vertex arrays (xmlversion 4) rather than one
+  // element per vertex (xmlversion 3). Off by default: readers that only
+  // know version 3 reject version 4 files.
+  inline bool export_packed_faces() const { return export_packed_faces_; }
+  inline void set_export_packed_faces(bool value) {
+      export_packed_faces_ = value;
+  }
+
+  // Copy the component definitions and groups that haven't changed since
+  // the last export to the same file from there, see CXmlExportManifest
+  inline bool export_incremental() const { return export_incremental_; }
+  inline void set_export_incremental(bool value) {
+      export_incremental_ = value;
+  }
+
  private:
   bool export_materials_;
   bool export_faces_;
@@ -45,6 +62,8 @@ class CXmlOptions {
   bool export_materials_by_layer_;
   bool export_layers_;
   bool export_options_;
+  bool export_packed_faces_;
+  bool export_incremental_;
 };
 
 #endif // SKPTOXML_COMMON_XMLOPTIONS_H
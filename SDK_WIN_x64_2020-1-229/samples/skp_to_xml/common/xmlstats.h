@@ -3,6 +3,9 @@
 #ifndef SKPTOXML_COMMON_XMLSTATS_H
 #define SKPTOXML_COMMON_XMLSTATS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 // Export Statistics - a struct to help count our exported objects.  These
 // are displayed at the end of the export in the results dialog.
 class CXmlExportStats {
@@ -13,6 +16,9 @@ class CXmlExportStats {
     edges_ = 0;
     layers_ = 0;
     options_ = 0;
+    copied_elements_ = 0;
+    bytes_written_ = 0;
+    write_stall_seconds_ = 0.0;
   }
 
   inline void set_textures(size_t num) { textures_ = num; }
@@ -20,12 +26,23 @@ class CXmlExportStats {
   inline void AddFace() { faces_++; }
   inline void AddLayer() { layers_++; }
   inline void AddOption() { options_++; }
+  // Definitions and groups an incremental export copied from the last one
+  inline void AddCopiedElement() { copied_elements_++; }
+  // The size of the file, and how long the export waited for it to be
+  // written. A long wait means the disk is what holds the export up.
+  inline void set_bytes_written(uint64_t bytes) { bytes_written_ = bytes; }
+  inline void set_write_stall_seconds(double seconds) {
+    write_stall_seconds_ = seconds;
+  }
 
   size_t textures() const { return textures_; }
   size_t faces() const { return faces_; }
   size_t edges() const { return edges_; }
   size_t layers() const { return layers_; }
   size_t options() const { return options_; }
+  size_t copied_elements() const { return copied_elements_; }
+  uint64_t bytes_written() const { return bytes_written_; }
+  double write_stall_seconds() const { return write_stall_seconds_; }
 
  protected:
   size_t textures_;
@@ -33,6 +50,9 @@ class CXmlExportStats {
   size_t edges_;
   size_t layers_;
   size_t options_;
+  size_t copied_elements_;
+  uint64_t bytes_written_;
+  double write_stall_seconds_;
 };
 
 #endif // SKPTOXML_COMMON_XMLSTATS_H
@@ -0,0 +1,998 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include "./fakesketchup.h"
+
+#include <SketchUpAPI/initialize.h>
+#include <SketchUpAPI/unicodestring.h>
+#include <SketchUpAPI/model/component_definition.h>
+#include <SketchUpAPI/model/component_instance.h>
+#include <SketchUpAPI/model/curve.h>
+#include <SketchUpAPI/model/drawing_element.h>
+#include <SketchUpAPI/model/edge.h>
+#include <SketchUpAPI/model/entities.h>
+#include <SketchUpAPI/model/entity.h>
+#include <SketchUpAPI/model/face.h>
+#include <SketchUpAPI/model/group.h>
+#include <SketchUpAPI/model/image.h>
+#include <SketchUpAPI/model/layer.h>
+#include <SketchUpAPI/model/loop.h>
+#include <SketchUpAPI/model/material.h>
+#include <SketchUpAPI/model/mesh_helper.h>
+#include <SketchUpAPI/model/model.h>
+#include <SketchUpAPI/model/texture.h>
+#include <SketchUpAPI/model/texture_writer.h>
+#include <SketchUpAPI/model/uv_helper.h>
+#include <SketchUpAPI/model/vertex.h>
+
+using namespace FakeSketchUp;
+
+namespace {
+
+// Objects the API creates for the caller, which are freed when released
+// or at the latest by SUTerminate
+struct String : Object {
+  std::string text_;
+};
+
+struct TextureWriter : Object {
+  std::set<const Texture*> textures_;
+};
+
+struct UVHelper : Object {};
+
+struct MeshHelper : Object {
+  const Face* face_;
+};
+
+std::map<std::string, Model*>& Models() {
+  static std::map<std::string, Model*> models;
+  return models;
+}
+
+// The model being exported, whose Layer0 elements without a layer are on
+const Model* g_model = NULL;
+
+std::set<Object*>& Helpers() {
+  static std::set<Object*> helpers;
+  return helpers;
+}
+
+template <typename T>
+T* NewHelper() {
+  T* helper = new T;
+  Helpers().insert(helper);
+  return helper;
+}
+
+void ReleaseHelper(Object* helper) {
+  if (Helpers().erase(helper) > 0)
+    delete helper;
+}
+
+// The object behind a reference, or NULL if it isn't a T
+template <typename T, typename Ref>
+T* Get(Ref ref) {
+  return dynamic_cast<T*>(static_cast<Object*>(ref.ptr));
+}
+
+template <typename Ref>
+Ref MakeRef(const Object* object) {
+  Ref ref;
+  ref.ptr = static_cast<void*>(const_cast<Object*>(object));
+  return ref;
+}
+
+// Copies 'objects' into an output array the way the API does
+template <typename Ref, typename Container>
+SUResult GetAll(const Container& objects, size_t len, Ref out[],
+                size_t* count) {
+  if (out == NULL || count == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *count = std::min(len, objects.size());
+  for (size_t i = 0; i < *count; ++i) {
+    out[i] = MakeRef<Ref>(&objects[i]);
+  }
+  return SU_ERROR_NONE;
+}
+
+template <typename Ref, typename T>
+SUResult GetAll(const std::vector<std::unique_ptr<T> >& objects, size_t len,
+                Ref out[], size_t* count) {
+  if (out == NULL || count == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *count = std::min(len, objects.size());
+  for (size_t i = 0; i < *count; ++i) {
+    out[i] = MakeRef<Ref>(objects[i].get());
+  }
+  return SU_ERROR_NONE;
+}
+
+template <typename T>
+SUResult GetValue(const T& value, T* out) {
+  if (out == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *out = value;
+  return SU_ERROR_NONE;
+}
+
+SUResult SetString(const std::string& text, SUStringRef* out) {
+  String* string = out != NULL ? Get<String>(*out) : NULL;
+  if (string == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  string->text_ = text;
+  return SU_ERROR_NONE;
+}
+
+// A reference that is set if 'object' is, and SU_ERROR_NO_DATA if not
+template <typename Ref>
+SUResult GetOptional(const Object* object, Ref* out) {
+  if (out == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  if (object == NULL) {
+    SUSetInvalid(*out);
+    return SU_ERROR_NO_DATA;
+  }
+  *out = MakeRef<Ref>(object);
+  return SU_ERROR_NONE;
+}
+
+const Texture* TextureOf(const Material* material) {
+  if (material == NULL || material->type_ == SUMaterialType_Colored)
+    return NULL;
+  return &material->texture_;
+}
+
+void LoadTexture(TextureWriter* writer, const Material* material) {
+  if (const Texture* texture = TextureOf(material))
+    writer->textures_.insert(texture);
+}
+
+SUPoint3D Point(double x, double y, double z) {
+  SUPoint3D point = { x, y, z };
+  return point;
+}
+
+SUTransformation Translation(double x, double y, double z) {
+  SUTransformation transform = {
+    { 1.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0,
+      0.0, 0.0, 1.0, 0.0, x, y, z, 1.0 }
+  };
+  return transform;
+}
+
+} // end namespace
+
+//------------------------------------------------------------------------------
+
+namespace FakeSketchUp {
+
+Model::Model() {
+  id_ = NewId();
+  AddLayer(*this, "Layer0");
+}
+
+void SetModel(const std::string& filename, Model* model) {
+  if (model != NULL)
+    Models()[filename] = model;
+  else
+    Models().erase(filename);
+}
+
+int64_t NewId() {
+  static int64_t last_id = 1000;
+  return ++last_id;
+}
+
+Layer& AddLayer(Model& model, const std::string& name,
+                const Material* material) {
+  model.layers_.push_back(Layer());
+  Layer& layer = model.layers_.back();
+  layer.id_ = NewId();
+  layer.name_ = name;
+  layer.material_ = material;
+  return layer;
+}
+
+Material& AddMaterial(Model& model, const std::string& name,
+                      SUMaterialType type) {
+  model.materials_.push_back(Material());
+  Material& material = model.materials_.back();
+  material.id_ = NewId();
+  material.name_ = name;
+  material.type_ = type;
+  material.texture_.id_ = NewId();
+  return material;
+}
+
+Definition& AddDefinition(Model& model, const std::string& name) {
+  model.definitions_.push_back(Definition());
+  Definition& definition = model.definitions_.back();
+  definition.id_ = NewId();
+  definition.name_ = name;
+  return definition;
+}
+
+Face& AddFace(Entities& entities, int count, double x, double y, double z) {
+  entities.faces_.push_back(Face());
+  Face& face = entities.faces_.back();
+  face.id_ = NewId();
+  for (int i = 0; i < count; ++i) {
+    const double angle = 6.283185307179586 * i / count;
+    face.vertices_.push_back(Vertex());
+    face.vertices_.back().position_ =
+        Point(x + cos(angle), y + sin(angle), z);
+  }
+  return face;
+}
+
+Edge& AddEdge(Entities& entities, double x, double y, double z) {
+  entities.edges_.push_back(Edge());
+  Edge& edge = entities.edges_.back();
+  edge.id_ = NewId();
+  edge.start_.position_ = Point(x, y, z);
+  edge.end_.position_ = Point(x + 1.0, y + 0.5, z);
+  return edge;
+}
+
+Curve& AddCurve(Entities& entities, int count, double x, double y,
+                double z) {
+  entities.curves_.push_back(Curve());
+  Curve& curve = entities.curves_.back();
+  curve.id_ = NewId();
+  for (int i = 0; i < count; ++i) {
+    curve.edges_.push_back(Edge());
+    Edge& edge = curve.edges_.back();
+    edge.id_ = NewId();
+    edge.start_.position_ = Point(x + i, y, z);
+    edge.end_.position_ = Point(x + i + 1.0, y, z);
+  }
+  return curve;
+}
+
+Group& AddGroup(Entities& entities, double x, double y, double z) {
+  entities.groups_.emplace_back(new Group);
+  Group& group = *entities.groups_.back();
+  group.id_ = NewId();
+  group.entities_.id_ = NewId();
+  group.transform_ = Translation(x, y, z);
+  return group;
+}
+
+Instance& AddInstance(Entities& entities, const Definition& definition,
+                      double x, double y, double z) {
+  entities.instances_.push_back(Instance());
+  Instance& instance = entities.instances_.back();
+  instance.id_ = NewId();
+  instance.definition_ = &definition;
+  instance.transform_ = Translation(x, y, z);
+  return instance;
+}
+
+} // end namespace FakeSketchUp
+
+//------------------------------------------------------------------------------
+// Initialization, strings and models
+
+void SUInitialize() {
+}
+
+void SUTerminate() {
+  for (std::set<Object*>::iterator it = Helpers().begin();
+       it != Helpers().end(); ++it) {
+    delete *it;
+  }
+  Helpers().clear();
+}
+
+SUResult SUStringCreate(SUStringRef* out_string_ref) {
+  if (out_string_ref == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *out_string_ref = MakeRef<SUStringRef>(NewHelper<String>());
+  return SU_ERROR_NONE;
+}
+
+SUResult SUStringRelease(SUStringRef* string_ref) {
+  if (string_ref == NULL || Get<String>(*string_ref) == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  ReleaseHelper(Get<String>(*string_ref));
+  SUSetInvalid(*string_ref);
+  return SU_ERROR_NONE;
+}
+
+SUResult SUStringGetUTF8Length(SUStringRef string_ref, size_t* out_length) {
+  const String* string = Get<String>(string_ref);
+  if (string == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(string->text_.size(), out_length);
+}
+
+// Copies up to 'char_array_length' characters and a terminating zero after
+// them, which is what the exporter gives room for
+SUResult SUStringGetUTF8(SUStringRef string_ref, size_t char_array_length,
+                         char* out_char_array,
+                         size_t* out_number_of_chars_copied) {
+  const String* string = Get<String>(string_ref);
+  if (string == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  if (out_char_array == NULL || out_number_of_chars_copied == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  const size_t count = std::min(char_array_length, string->text_.size());
+  memcpy(out_char_array, string->text_.data(), count);
+  out_char_array[count] = 0;
+  *out_number_of_chars_copied = count;
+  return SU_ERROR_NONE;
+}
+
+SUResult SUModelCreateFromFile(SUModelRef* model, const char* file_path) {
+  if (model == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  std::map<std::string, Model*>::const_iterator it =
+      Models().find(file_path);
+  if (it == Models().end())
+    return SU_ERROR_SERIALIZATION;
+  *model = MakeRef<SUModelRef>(it->second);
+  g_model = it->second;
+  return SU_ERROR_NONE;
+}
+
+// The model belongs to the test
+SUResult SUModelRelease(SUModelRef* model) {
+  if (model == NULL || Get<Model>(*model) == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  if (Get<Model>(*model) == g_model)
+    g_model = NULL;
+  SUSetInvalid(*model);
+  return SU_ERROR_NONE;
+}
+
+SUResult SUModelGetVersion(SUModelRef model, int* major, int* minor,
+                           int* build) {
+  if (Get<Model>(model) == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  if (major == NULL || minor == NULL || build == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *major = 20;
+  *minor = 1;
+  *build = 229;
+  return SU_ERROR_NONE;
+}
+
+SUResult SUModelGetEntities(SUModelRef model, SUEntitiesRef* entities) {
+  const Model* fake = Get<Model>(model);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(&fake->entities_, entities);
+}
+
+SUResult SUModelGetNumLayers(SUModelRef model, size_t* count) {
+  const Model* fake = Get<Model>(model);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->layers_.size(), count);
+}
+
+SUResult SUModelGetLayers(SUModelRef model, size_t len, SULayerRef layers[],
+                          size_t* count) {
+  const Model* fake = Get<Model>(model);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetAll(fake->layers_, len, layers, count);
+}
+
+SUResult SUModelGetNumMaterials(SUModelRef model, size_t* count) {
+  const Model* fake = Get<Model>(model);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->materials_.size(), count);
+}
+
+SUResult SUModelGetMaterials(SUModelRef model, size_t len,
+                             SUMaterialRef materials[], size_t* count) {
+  const Model* fake = Get<Model>(model);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetAll(fake->materials_, len, materials, count);
+}
+
+SUResult SUModelGetNumComponentDefinitions(SUModelRef model, size_t* count) {
+  const Model* fake = Get<Model>(model);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->definitions_.size(), count);
+}
+
+SUResult SUModelGetComponentDefinitions(
+    SUModelRef model, size_t len, SUComponentDefinitionRef definitions[],
+    size_t* count) {
+  const Model* fake = Get<Model>(model);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetAll(fake->definitions_, len, definitions, count);
+}
+
+//------------------------------------------------------------------------------
+// Entities
+
+SUResult SUEntityGetID(SUEntityRef entity, int32_t* entity_id) {
+  const Object* object = Get<Object>(entity);
+  if (object == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(static_cast<int32_t>(object->id_), entity_id);
+}
+
+SUResult SUEntityGetPersistentID(SUEntityRef entity, int64_t* entity_pid) {
+  const Object* object = Get<Object>(entity);
+  if (object == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(object->id_, entity_pid);
+}
+
+SUEntityRef SUComponentDefinitionToEntity(SUComponentDefinitionRef comp_def) {
+  return MakeRef<SUEntityRef>(Get<Object>(comp_def));
+}
+
+SUEntityRef SUComponentInstanceToEntity(SUComponentInstanceRef instance) {
+  return MakeRef<SUEntityRef>(Get<Object>(instance));
+}
+
+SUEntityRef SUGroupToEntity(SUGroupRef group) {
+  return MakeRef<SUEntityRef>(Get<Object>(group));
+}
+
+SUEntityRef SUImageToEntity(SUImageRef image) {
+  return MakeRef<SUEntityRef>(Get<Object>(image));
+}
+
+SUEntityRef SULayerToEntity(SULayerRef layer) {
+  return MakeRef<SUEntityRef>(Get<Object>(layer));
+}
+
+SUEntityRef SUTextureToEntity(SUTextureRef texture) {
+  return MakeRef<SUEntityRef>(Get<Object>(texture));
+}
+
+SUDrawingElementRef SUComponentInstanceToDrawingElement(
+    SUComponentInstanceRef instance) {
+  return MakeRef<SUDrawingElementRef>(Get<Element>(instance));
+}
+
+SUDrawingElementRef SUEdgeToDrawingElement(SUEdgeRef edge) {
+  return MakeRef<SUDrawingElementRef>(Get<Element>(edge));
+}
+
+SUDrawingElementRef SUFaceToDrawingElement(SUFaceRef face) {
+  return MakeRef<SUDrawingElementRef>(Get<Element>(face));
+}
+
+SUDrawingElementRef SUGroupToDrawingElement(SUGroupRef group) {
+  return MakeRef<SUDrawingElementRef>(Get<Element>(group));
+}
+
+SUResult SUDrawingElementGetLayer(SUDrawingElementRef elem,
+                                  SULayerRef* layer) {
+  const Element* element = Get<Element>(elem);
+  if (element == NULL || g_model == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(element->layer_ != NULL ? element->layer_ :
+                                               &g_model->layers_[0],
+                     layer);
+}
+
+SUResult SUDrawingElementGetMaterial(SUDrawingElementRef elem,
+                                     SUMaterialRef* material) {
+  const Element* element = Get<Element>(elem);
+  if (element == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(element->material_, material);
+}
+
+SUResult SUEntitiesGetNumFaces(SUEntitiesRef entities, size_t* count) {
+  const Entities* fake = Get<Entities>(entities);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->faces_.size(), count);
+}
+
+SUResult SUEntitiesGetFaces(SUEntitiesRef entities, size_t len,
+                            SUFaceRef faces[], size_t* count) {
+  const Entities* fake = Get<Entities>(entities);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetAll(fake->faces_, len, faces, count);
+}
+
+// All edges are stand-alone, faces have none of their own
+SUResult SUEntitiesGetNumEdges(SUEntitiesRef entities,
+                               bool /*standalone_only*/, size_t* count) {
+  const Entities* fake = Get<Entities>(entities);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->edges_.size(), count);
+}
+
+SUResult SUEntitiesGetEdges(SUEntitiesRef entities, bool /*standalone_only*/,
+                            size_t len, SUEdgeRef edges[], size_t* count) {
+  const Entities* fake = Get<Entities>(entities);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetAll(fake->edges_, len, edges, count);
+}
+
+SUResult SUEntitiesGetNumCurves(SUEntitiesRef entities, size_t* count) {
+  const Entities* fake = Get<Entities>(entities);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->curves_.size(), count);
+}
+
+SUResult SUEntitiesGetCurves(SUEntitiesRef entities, size_t len,
+                             SUCurveRef curves[], size_t* count) {
+  const Entities* fake = Get<Entities>(entities);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetAll(fake->curves_, len, curves, count);
+}
+
+SUResult SUEntitiesGetNumGroups(SUEntitiesRef entities, size_t* count) {
+  const Entities* fake = Get<Entities>(entities);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->groups_.size(), count);
+}
+
+SUResult SUEntitiesGetGroups(SUEntitiesRef entities, size_t len,
+                             SUGroupRef groups[], size_t* count) {
+  const Entities* fake = Get<Entities>(entities);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetAll(fake->groups_, len, groups, count);
+}
+
+SUResult SUEntitiesGetNumInstances(SUEntitiesRef entities, size_t* count) {
+  const Entities* fake = Get<Entities>(entities);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->instances_.size(), count);
+}
+
+SUResult SUEntitiesGetInstances(SUEntitiesRef entities, size_t len,
+                                SUComponentInstanceRef instances[],
+                                size_t* count) {
+  const Entities* fake = Get<Entities>(entities);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetAll(fake->instances_, len, instances, count);
+}
+
+// The fake has no images
+SUResult SUEntitiesGetNumImages(SUEntitiesRef entities, size_t* count) {
+  if (Get<Entities>(entities) == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(static_cast<size_t>(0), count);
+}
+
+SUResult SUEntitiesGetImages(SUEntitiesRef entities, size_t /*len*/,
+                             SUImageRef /*images*/[], size_t* count) {
+  if (Get<Entities>(entities) == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(static_cast<size_t>(0), count);
+}
+
+//------------------------------------------------------------------------------
+// Definitions, instances and groups
+
+SUResult SUComponentDefinitionGetName(SUComponentDefinitionRef comp_def,
+                                      SUStringRef* name) {
+  const Definition* definition = Get<Definition>(comp_def);
+  if (definition == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return SetString(definition->name_, name);
+}
+
+SUResult SUComponentDefinitionGetEntities(SUComponentDefinitionRef comp_def,
+                                          SUEntitiesRef* entities) {
+  const Definition* definition = Get<Definition>(comp_def);
+  if (definition == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(&definition->entities_, entities);
+}
+
+SUResult SUComponentInstanceGetDefinition(
+    SUComponentInstanceRef instance, SUComponentDefinitionRef* component) {
+  const Instance* fake = Get<Instance>(instance);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(fake->definition_, component);
+}
+
+SUResult SUComponentInstanceGetTransform(SUComponentInstanceRef instance,
+                                         SUTransformation* transform) {
+  const Instance* fake = Get<Instance>(instance);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->transform_, transform);
+}
+
+SUResult SUGroupGetEntities(SUGroupRef group, SUEntitiesRef* entities) {
+  const Group* fake = Get<Group>(group);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(&fake->entities_, entities);
+}
+
+SUResult SUGroupGetTransform(SUGroupRef group, SUTransformation* transform) {
+  const Group* fake = Get<Group>(group);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->transform_, transform);
+}
+
+//------------------------------------------------------------------------------
+// Layers and materials
+
+SUResult SULayerGetName(SULayerRef layer, SUStringRef* name) {
+  const Layer* fake = Get<Layer>(layer);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return SetString(fake->name_, name);
+}
+
+SUResult SULayerGetMaterial(SULayerRef layer, SUMaterialRef* material) {
+  const Layer* fake = Get<Layer>(layer);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(fake->material_, material);
+}
+
+SUResult SULayerGetVisibility(SULayerRef layer, bool* visible) {
+  const Layer* fake = Get<Layer>(layer);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->visible_, visible);
+}
+
+SUResult SUMaterialGetNameLegacyBehavior(SUMaterialRef material,
+                                         SUStringRef* name) {
+  const Material* fake = Get<Material>(material);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return SetString(fake->name_, name);
+}
+
+SUResult SUMaterialGetType(SUMaterialRef material, SUMaterialType* type) {
+  const Material* fake = Get<Material>(material);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->type_, type);
+}
+
+SUResult SUMaterialGetColor(SUMaterialRef material, SUColor* color) {
+  const Material* fake = Get<Material>(material);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->color_, color);
+}
+
+SUResult SUMaterialGetUseOpacity(SUMaterialRef material, bool* use_opacity) {
+  const Material* fake = Get<Material>(material);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->use_opacity_, use_opacity);
+}
+
+SUResult SUMaterialGetOpacity(SUMaterialRef material, double* alpha) {
+  const Material* fake = Get<Material>(material);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->opacity_, alpha);
+}
+
+SUResult SUMaterialGetTexture(SUMaterialRef material, SUTextureRef* texture) {
+  const Material* fake = Get<Material>(material);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(TextureOf(fake), texture);
+}
+
+SUResult SUTextureGetDimensions(SUTextureRef texture, size_t* width,
+                                size_t* height, double* s_scale,
+                                double* t_scale) {
+  const Texture* fake = Get<Texture>(texture);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  if (width == NULL || height == NULL || s_scale == NULL || t_scale == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *width = fake->width_;
+  *height = fake->height_;
+  *s_scale = fake->s_scale_;
+  *t_scale = fake->t_scale_;
+  return SU_ERROR_NONE;
+}
+
+// Textures aren't written anywhere
+SUResult SUTextureWriteToFile(SUTextureRef texture,
+                              const char* /*file_path*/) {
+  return Get<Texture>(texture) != NULL ? SU_ERROR_NONE :
+                                         SU_ERROR_INVALID_INPUT;
+}
+
+//------------------------------------------------------------------------------
+// Faces, edges and curves
+
+SUResult SUFaceGetFrontMaterial(SUFaceRef face, SUMaterialRef* material) {
+  const Face* fake = Get<Face>(face);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(fake->material_, material);
+}
+
+SUResult SUFaceGetBackMaterial(SUFaceRef face, SUMaterialRef* material) {
+  const Face* fake = Get<Face>(face);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(fake->back_material_, material);
+}
+
+SUResult SUFaceGetNumInnerLoops(SUFaceRef face, size_t* count) {
+  const Face* fake = Get<Face>(face);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(static_cast<size_t>(fake->triangles_.empty() ? 0 : 1),
+                  count);
+}
+
+// A loop is its face
+SUResult SUFaceGetOuterLoop(SUFaceRef face, SULoopRef* loop) {
+  const Face* fake = Get<Face>(face);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(fake, loop);
+}
+
+SUResult SULoopGetNumVertices(SULoopRef loop, size_t* count) {
+  const Face* fake = Get<Face>(loop);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->vertices_.size(), count);
+}
+
+SUResult SULoopGetVertices(SULoopRef loop, size_t len,
+                           SUVertexRef vertices[], size_t* count) {
+  const Face* fake = Get<Face>(loop);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetAll(fake->vertices_, len, vertices, count);
+}
+
+SUResult SUVertexGetPosition(SUVertexRef vertex, SUPoint3D* position) {
+  const Vertex* fake = Get<Vertex>(vertex);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->position_, position);
+}
+
+SUResult SUEdgeGetStartVertex(SUEdgeRef edge, SUVertexRef* vertex) {
+  const Edge* fake = Get<Edge>(edge);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(&fake->start_, vertex);
+}
+
+SUResult SUEdgeGetEndVertex(SUEdgeRef edge, SUVertexRef* vertex) {
+  const Edge* fake = Get<Edge>(edge);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetOptional(&fake->end_, vertex);
+}
+
+SUResult SUEdgeGetColor(SUEdgeRef edge, SUColor* color) {
+  const Edge* fake = Get<Edge>(edge);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->color_, color);
+}
+
+SUResult SUCurveGetNumEdges(SUCurveRef curve, size_t* count) {
+  const Curve* fake = Get<Curve>(curve);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->edges_.size(), count);
+}
+
+SUResult SUCurveGetEdges(SUCurveRef curve, size_t len, SUEdgeRef edges[],
+                         size_t* count) {
+  const Curve* fake = Get<Curve>(curve);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetAll(fake->edges_, len, edges, count);
+}
+
+//------------------------------------------------------------------------------
+// Texture writer, UV and mesh helpers. Texture coordinates are made up from
+// the positions: (x, y) in front and (-x, y) at the back.
+
+SUResult SUTextureWriterCreate(SUTextureWriterRef* writer) {
+  if (writer == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *writer = MakeRef<SUTextureWriterRef>(NewHelper<TextureWriter>());
+  return SU_ERROR_NONE;
+}
+
+SUResult SUTextureWriterRelease(SUTextureWriterRef* writer) {
+  if (writer == NULL || Get<TextureWriter>(*writer) == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  ReleaseHelper(Get<TextureWriter>(*writer));
+  SUSetInvalid(*writer);
+  return SU_ERROR_NONE;
+}
+
+SUResult SUTextureWriterLoadEntity(SUTextureWriterRef writer,
+                                   SUEntityRef entity, long* texture_id) {
+  TextureWriter* fake = Get<TextureWriter>(writer);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  const Material* material = NULL;
+  if (const Element* element = Get<Element>(entity))
+    material = element->material_;
+  else if (const Layer* layer = Get<Layer>(entity))
+    material = layer->material_;
+  LoadTexture(fake, material);
+  const Texture* texture = TextureOf(material);
+  return GetValue(texture != NULL ? static_cast<long>(texture->id_) : 0L,
+                  texture_id);
+}
+
+SUResult SUTextureWriterLoadFace(SUTextureWriterRef writer, SUFaceRef face,
+                                 long* front_texture_id,
+                                 long* back_texture_id) {
+  TextureWriter* fake = Get<TextureWriter>(writer);
+  const Face* fake_face = Get<Face>(face);
+  if (fake == NULL || fake_face == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  if (front_texture_id == NULL || back_texture_id == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  LoadTexture(fake, fake_face->material_);
+  LoadTexture(fake, fake_face->back_material_);
+  const Texture* front = TextureOf(fake_face->material_);
+  const Texture* back = TextureOf(fake_face->back_material_);
+  *front_texture_id = front != NULL ? static_cast<long>(front->id_) : 0;
+  *back_texture_id = back != NULL ? static_cast<long>(back->id_) : 0;
+  return SU_ERROR_NONE;
+}
+
+SUResult SUTextureWriterGetNumTextures(SUTextureWriterRef writer,
+                                       size_t* count) {
+  const TextureWriter* fake = Get<TextureWriter>(writer);
+  if (fake == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(fake->textures_.size(), count);
+}
+
+SUResult SUTextureWriterWriteAllTextures(SUTextureWriterRef writer,
+                                         const char* /*directory*/) {
+  return Get<TextureWriter>(writer) != NULL ? SU_ERROR_NONE :
+                                              SU_ERROR_INVALID_INPUT;
+}
+
+SUResult SUFaceGetUVHelper(SUFaceRef face, bool /*front*/, bool /*back*/,
+                           SUTextureWriterRef /*texture_writer*/,
+                           SUUVHelperRef* uv_helper) {
+  if (Get<Face>(face) == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  if (uv_helper == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *uv_helper = MakeRef<SUUVHelperRef>(NewHelper<UVHelper>());
+  return SU_ERROR_NONE;
+}
+
+SUResult SUUVHelperRelease(SUUVHelperRef* uv_helper) {
+  if (uv_helper == NULL || Get<UVHelper>(*uv_helper) == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  ReleaseHelper(Get<UVHelper>(*uv_helper));
+  SUSetInvalid(*uv_helper);
+  return SU_ERROR_NONE;
+}
+
+SUResult SUUVHelperGetFrontUVQ(SUUVHelperRef uv_helper,
+                               const SUPoint3D* point, SUUVQ* uvq) {
+  if (Get<UVHelper>(uv_helper) == NULL || point == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  SUUVQ value = { point->x, point->y, 1.0 };
+  return GetValue(value, uvq);
+}
+
+SUResult SUUVHelperGetBackUVQ(SUUVHelperRef uv_helper,
+                              const SUPoint3D* point, SUUVQ* uvq) {
+  if (Get<UVHelper>(uv_helper) == NULL || point == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  SUUVQ value = { -point->x, point->y, 1.0 };
+  return GetValue(value, uvq);
+}
+
+SUResult SUMeshHelperCreateWithTextureWriter(
+    SUMeshHelperRef* mesh_ref, SUFaceRef face_ref,
+    SUTextureWriterRef /*texture_writer_ref*/) {
+  const Face* face = Get<Face>(face_ref);
+  if (face == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  if (mesh_ref == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  MeshHelper* mesh = NewHelper<MeshHelper>();
+  mesh->face_ = face;
+  *mesh_ref = MakeRef<SUMeshHelperRef>(mesh);
+  return SU_ERROR_NONE;
+}
+
+SUResult SUMeshHelperGetNumVertices(SUMeshHelperRef mesh_ref,
+                                    size_t* count) {
+  const MeshHelper* mesh = Get<MeshHelper>(mesh_ref);
+  if (mesh == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(mesh->face_->vertices_.size(), count);
+}
+
+SUResult SUMeshHelperGetVertices(SUMeshHelperRef mesh_ref, size_t len,
+                                 SUPoint3D vertices[], size_t* count) {
+  const MeshHelper* mesh = Get<MeshHelper>(mesh_ref);
+  if (mesh == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  if (vertices == NULL || count == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *count = std::min(len, mesh->face_->vertices_.size());
+  for (size_t i = 0; i < *count; ++i) {
+    vertices[i] = mesh->face_->vertices_[i].position_;
+  }
+  return SU_ERROR_NONE;
+}
+
+SUResult SUMeshHelperGetNumTriangles(SUMeshHelperRef mesh_ref,
+                                     size_t* count) {
+  const MeshHelper* mesh = Get<MeshHelper>(mesh_ref);
+  if (mesh == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  return GetValue(mesh->face_->triangles_.size() / 3, count);
+}
+
+SUResult SUMeshHelperGetVertexIndices(SUMeshHelperRef mesh_ref, size_t len,
+                                      size_t indices[], size_t* count) {
+  const MeshHelper* mesh = Get<MeshHelper>(mesh_ref);
+  if (mesh == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  if (indices == NULL || count == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *count = std::min(len, mesh->face_->triangles_.size());
+  std::copy(mesh->face_->triangles_.begin(),
+            mesh->face_->triangles_.begin() + *count, indices);
+  return SU_ERROR_NONE;
+}
+
+static SUResult GetSTQCoords(SUMeshHelperRef mesh_ref, double sign,
+                             size_t len, SUPoint3D stq[], size_t* count) {
+  const MeshHelper* mesh = Get<MeshHelper>(mesh_ref);
+  if (mesh == NULL)
+    return SU_ERROR_INVALID_INPUT;
+  if (stq == NULL || count == NULL)
+    return SU_ERROR_NULL_POINTER_OUTPUT;
+  *count = std::min(len, mesh->face_->vertices_.size());
+  for (size_t i = 0; i < *count; ++i) {
+    const SUPoint3D& position = mesh->face_->vertices_[i].position_;
+    stq[i] = Point(sign * position.x, position.y, 1.0);
+  }
+  return SU_ERROR_NONE;
+}
+
+SUResult SUMeshHelperGetFrontSTQCoords(SUMeshHelperRef mesh_ref, size_t len,
+                                       SUPoint3D stq[], size_t* count) {
+  return GetSTQCoords(mesh_ref, 1.0, len, stq, count);
+}
+
+SUResult SUMeshHelperGetBackSTQCoords(SUMeshHelperRef mesh_ref, size_t len,
+                                      SUPoint3D stq[], size_t* count) {
+  return GetSTQCoords(mesh_ref, -1.0, len, stq, count);
+}
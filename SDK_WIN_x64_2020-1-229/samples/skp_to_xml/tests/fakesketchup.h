@@ -0,0 +1,168 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+#ifndef SKPTOXML_SKP_TO_XML_TESTS_FAKESKETCHUP_H
+#define SKPTOXML_SKP_TO_XML_TESTS_FAKESKETCHUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <SketchUpAPI/color.h>
+#include <SketchUpAPI/geometry.h>
+#include <SketchUpAPI/model/material.h>
+
+// An in-process fake of the part of the SketchUp C API the exporter uses,
+// so the exporter can be run without SketchUp. A test builds a model out of
+// the structs below and registers it under a file name, which
+// SUModelCreateFromFile then "loads". Every reference the API hands out
+// points at one of these structs, so a test can change the model between
+// two exports and see what the exporter makes of it. Containers are deques
+// so that references stay valid as a model grows.
+
+namespace FakeSketchUp {
+
+// Anything the API has a reference type for
+struct Object {
+  Object() : id_(0) {}
+  virtual ~Object() {}
+
+  // The persistent ID, or the entity ID of a texture
+  int64_t id_;
+};
+
+struct Texture : Object {
+  Texture() : width_(64), height_(32), s_scale_(0.5), t_scale_(0.25) {}
+
+  size_t width_;
+  size_t height_;
+  double s_scale_;
+  double t_scale_;
+};
+
+struct Material : Object {
+  Material() : type_(SUMaterialType_Colored), use_opacity_(false),
+               opacity_(1.0) {
+    color_.red = color_.green = color_.blue = color_.alpha = 255;
+  }
+
+  std::string name_;
+  // Textured materials have 'texture_'
+  SUMaterialType type_;
+  SUColor color_;
+  bool use_opacity_;
+  double opacity_;
+  Texture texture_;
+};
+
+struct Layer : Object {
+  Layer() : material_(NULL), visible_(true) {}
+
+  std::string name_;
+  const Material* material_;
+  bool visible_;
+};
+
+struct Vertex : Object {
+  Vertex() : position_() {}
+
+  SUPoint3D position_;
+};
+
+// A drawing element, with its own material if it has one
+struct Element : Object {
+  Element() : layer_(NULL), material_(NULL) {}
+
+  const Layer* layer_;
+  const Material* material_;
+};
+
+// The material of a face is its front material
+struct Face : Element {
+  Face() : back_material_(NULL) {}
+
+  // The outer loop
+  std::deque<Vertex> vertices_;
+  const Material* back_material_;
+  // A face with holes is handed to the exporter as this triangulation of
+  // 'vertices_' instead of as its loop
+  std::vector<size_t> triangles_;
+};
+
+struct Edge : Element {
+  Edge() { color_.red = color_.green = color_.blue = color_.alpha = 0; }
+
+  Vertex start_;
+  Vertex end_;
+  SUColor color_;
+};
+
+struct Curve : Object {
+  std::deque<Edge> edges_;
+};
+
+struct Definition;
+struct Group;
+
+struct Instance : Element {
+  Instance() : definition_(NULL), transform_() {}
+
+  const Definition* definition_;
+  SUTransformation transform_;
+};
+
+struct Entities : Object {
+  std::deque<Face> faces_;
+  std::deque<Edge> edges_;
+  std::deque<Curve> curves_;
+  std::deque<Instance> instances_;
+  std::vector<std::unique_ptr<Group> > groups_;
+};
+
+struct Group : Element {
+  Entities entities_;
+  SUTransformation transform_;
+};
+
+struct Definition : Object {
+  std::string name_;
+  Entities entities_;
+};
+
+// Like in SketchUp, the first layer is "Layer0", which drawing elements
+// without a layer of their own are on
+struct Model : Object {
+  Model();
+
+  std::deque<Layer> layers_;
+  std::deque<Material> materials_;
+  std::deque<Definition> definitions_;
+  Entities entities_;
+};
+
+// Makes 'model' what SUModelCreateFromFile loads from 'filename', until it
+// is set to NULL. The model must outlive the exports of it.
+void SetModel(const std::string& filename, Model* model);
+
+// A new persistent ID, for objects that are added to a model
+int64_t NewId();
+
+// Builders for the tests. The new objects get persistent IDs.
+Layer& AddLayer(Model& model, const std::string& name,
+                const Material* material = NULL);
+Material& AddMaterial(Model& model, const std::string& name,
+                      SUMaterialType type = SUMaterialType_Colored);
+Definition& AddDefinition(Model& model, const std::string& name);
+// A face of 'count' corners around (x, y, z)
+Face& AddFace(Entities& entities, int count, double x, double y, double z);
+Edge& AddEdge(Entities& entities, double x, double y, double z);
+Curve& AddCurve(Entities& entities, int count, double x, double y, double z);
+Group& AddGroup(Entities& entities, double x, double y, double z);
+Instance& AddInstance(Entities& entities, const Definition& definition,
+                      double x, double y, double z);
+
+} // end namespace FakeSketchUp
+
+#endif // SKPTOXML_SKP_TO_XML_TESTS_FAKESKETCHUP_H
@@ -0,0 +1,454 @@
+// Copyright 2013 Trimble Navigation Limited. All Rights Reserved.
+
+// Runs the exporter against the fake SketchUp API, to check that an
+// incremental export writes what a full export of the same model would,
+// copying only what hasn't changed, and keeps its manifest in step with the
+// file.
+
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <sys/utime.h>
+#define utime _utime
+#define utimbuf _utimbuf
+#else
+#include <utime.h>
+#endif
+#include <string>
+
+#include "../common/xmlexporter.h"
+#include "../common/xmlexportmanifest.h"
+#include "../../common/tests/xmltest.h"
+#include "./fakesketchup.h"
+
+using XmlTest::TempPath;
+using namespace FakeSketchUp;
+
+namespace {
+
+const char kModelFile[] = "model.skp";
+
+// Two definitions, the second only used at the top level, and two groups,
+// the first with another group in it, on layers and with materials to
+// inherit. A face with holes comes as triangles, textured on both sides.
+struct TestModel {
+  TestModel() {
+    Material& red = AddMaterial(model_, "Red");
+    red.color_.green = red.color_.blue = 0;
+    Material& brick = AddMaterial(model_, "Brick & Mortar",
+                                  SUMaterialType_ColorizedTexture);
+    glass_ = &AddMaterial(model_, "Glass");
+    Material& glass = *glass_;
+    glass.use_opacity_ = true;
+    glass.opacity_ = 0.25;
+    walls_ = &AddLayer(model_, "Walls", &red);
+    Layer& roof = AddLayer(model_, "Roof");
+    roof.visible_ = false;
+
+    window_ = &AddDefinition(model_, "Window");
+    AddFace(window_->entities_, 4, 0.0, 0.0, 1.0).material_ = &glass;
+    AddEdge(window_->entities_, 0.0, 0.0, 2.0);
+    door_ = &AddDefinition(model_, "Door <front>");
+    AddFace(door_->entities_, 5, 1.0, 0.0, 0.0);
+    door_group_ = &AddGroup(door_->entities_, 0.0, 1.0, 0.0);
+    AddFace(door_group_->entities_, 3, 0.5, 0.5, 0.5);
+
+    Entities& top = model_.entities_;
+    AddInstance(top, *window_, 10.0, 0.0, 0.0);
+    AddInstance(top, *window_, 20.0, 0.0, 0.0).layer_ = &roof;
+    AddInstance(top, *door_, 30.0, 0.0, 0.0).material_ = &red;
+
+    outer_ = &AddGroup(top, 1.0, 2.0, 3.0);
+    outer_->layer_ = walls_;
+    AddFace(outer_->entities_, 4, 0.0, 0.0, 0.0).layer_ = walls_;
+    AddCurve(outer_->entities_, 3, 0.0, 5.0, 0.0);
+    inner_ = &AddGroup(outer_->entities_, 0.0, 0.0, 1.0);
+    inner_->material_ = &glass;
+    AddFace(inner_->entities_, 6, 2.0, 2.0, 2.0);
+    AddEdge(inner_->entities_, 2.0, 2.0, 3.0).layer_ = &roof;
+
+    last_ = &AddGroup(top, -1.0, -2.0, -3.0);
+    Face& holed = AddFace(last_->entities_, 6, 0.0, 0.0, 0.0);
+    holed.material_ = &brick;
+    holed.back_material_ = &brick;
+    const size_t triangles[] = { 0, 1, 2, 2, 3, 4, 4, 5, 0 };
+    holed.triangles_.assign(triangles, triangles + 9);
+    AddFace(top, 4, 50.0, 50.0, 0.0).layer_ = walls_;
+    AddEdge(top, 50.0, 50.0, 1.0);
+  }
+
+  Model model_;
+  Material* glass_;
+  Layer* walls_;
+  Definition* window_;
+  Definition* door_;
+  Group* door_group_;
+  Group* outer_;
+  Group* inner_;
+  Group* last_;
+};
+
+// Definitions and groups at the top level, which are copied or written as
+// a whole. A nested element is copied into an enclosing one that is
+// written again, and is counted as copied too.
+const size_t kTopElements = 4;
+
+// A path for a test's export, without what an earlier run left there
+std::string ExportPath(const std::string& name) {
+  const std::string filename = TempPath(name);
+  remove(filename.c_str());
+  remove(CXmlExportManifest::FilenameOf(filename).c_str());
+  return filename;
+}
+
+bool Export(Model& model, const std::string& filename, bool incremental,
+            CXmlExportStats* stats = NULL,
+            SketchUpPluginProgressCallback* callback = NULL) {
+  SetModel(kModelFile, &model);
+  CXmlOptions options;
+  options.set_export_incremental(incremental);
+  CXmlExporter exporter;
+  exporter.SetOptions(options);
+  const bool ok = exporter.Convert(kModelFile, filename, callback);
+  SetModel(kModelFile, NULL);
+  if (stats != NULL)
+    *stats = exporter.stats();
+  return ok;
+}
+
+// Exports 'model' to 'filename' incrementally, and checks that the result
+// is what a full export gives. Returns the number of copied elements.
+size_t ExportIncremental(Model& model, const std::string& filename) {
+  CXmlExportStats stats;
+  if (!Export(model, filename, true, &stats)) {
+    XmlTest::Fail(__FILE__, __LINE__, "can't export " + filename);
+    return 0;
+  }
+  CXmlExportStats full_stats;
+  const std::string full_file = filename + ".full.xml";
+  if (!Export(model, full_file, false, &full_stats)) {
+    XmlTest::Fail(__FILE__, __LINE__, "can't export " + full_file);
+    return 0;
+  }
+  const std::string text = XmlTest::ReadFile(filename);
+  if (text.empty() || text != XmlTest::ReadFile(full_file))
+    XmlTest::Fail(__FILE__, __LINE__, filename + " isn't a full export");
+  // Copied elements are still counted
+  if (stats.faces() != full_stats.faces() ||
+      stats.edges() != full_stats.edges())
+    XmlTest::Fail(__FILE__, __LINE__, filename + " has other counts");
+  remove(full_file.c_str());
+  return stats.copied_elements();
+}
+
+bool LoadManifest(const std::string& filename,
+                  CXmlExportManifest& manifest) {
+  return manifest.Load(CXmlExportManifest::FilenameOf(filename));
+}
+
+// The manifest's ranges hold the elements' text
+void ExpectManifestMatches(const std::string& filename,
+                           const TestModel& test_model) {
+  CXmlExportManifest manifest;
+  XML_ASSERT(LoadManifest(filename, manifest));
+  const std::string text = XmlTest::ReadFile(filename);
+  XML_EXPECT_EQ(static_cast<uint64_t>(text.size()), manifest.file_size());
+  const Object* elements[] = {
+    test_model.window_, test_model.door_, test_model.door_group_,
+    test_model.outer_, test_model.inner_, test_model.last_
+  };
+  const char* starts[] = {
+    "<ComponentDefinition", "<ComponentDefinition", "<Group", "<Group",
+    "<Group", "<Group"
+  };
+  XML_EXPECT_EQ(static_cast<size_t>(6), manifest.size());
+  for (int i = 0; i < 6; ++i) {
+    const CXmlExportManifest::Element* element =
+        manifest.Find(elements[i]->id_);
+    XML_ASSERT(element != NULL);
+    XML_ASSERT(element->end_ <= text.size());
+    const std::string element_text =
+        text.substr(static_cast<size_t>(element->begin_),
+                    static_cast<size_t>(element->end_ - element->begin_));
+    // From the end of the element before
+    const size_t start = element_text.find_first_not_of(" \n");
+    XML_ASSERT(start != std::string::npos);
+    XML_EXPECT(element_text.compare(start, strlen(starts[i]), starts[i]) == 0);
+    XML_EXPECT(element_text.compare(element_text.size() - 1, 1, ">") == 0);
+  }
+}
+
+// Cancels once the exporter has reported 'message'
+class CCancelAfter : public SketchUpPluginProgressCallback {
+ public:
+  explicit CCancelAfter(const std::string& message)
+    : message_(message), cancelled_(false) {}
+
+  bool HasBeenCancelled() { return cancelled_; }
+  void SetPercentDone(double /*percent*/) {}
+  void SetStepSize(double /*percent*/) {}
+  void Step() {}
+  void SetProgressMessage(const std::string& utf8_message) {
+    if (utf8_message == message_)
+      cancelled_ = true;
+  }
+
+ private:
+  std::string message_;
+  bool cancelled_;
+};
+
+} // end namespace
+
+// The export reads back as the model it was made from
+XML_TEST(ExportReadsBack) {
+  TestModel test_model;
+  const std::string filename = ExportPath("full.xml");
+  CXmlExportStats stats;
+  XML_ASSERT(Export(test_model.model_, filename, false, &stats));
+  XML_EXPECT(!XmlTest::FileExists(CXmlExportManifest::FilenameOf(filename)));
+  XML_EXPECT_EQ(static_cast<size_t>(7), stats.faces());
+  XML_EXPECT_EQ(static_cast<size_t>(3), stats.edges());
+  XML_EXPECT_EQ(static_cast<size_t>(3), stats.layers());
+  XML_EXPECT_EQ(static_cast<size_t>(1), stats.textures());
+  XML_EXPECT_EQ(static_cast<size_t>(0), stats.copied_elements());
+
+  CXmlFile file;
+  XmlModelInfo model_info;
+  XML_ASSERT(file.Open(filename, false, CXmlFile::kReadStreaming));
+  XML_ASSERT(file.GetModelInfo(model_info));
+  // Version 4 has to be asked for
+  XML_EXPECT_EQ(static_cast<int>(CXmlFile::kXmlVersionVertexElements),
+                file.xml_version());
+  file.Close(false);
+  XML_ASSERT(model_info.layers_.size() == 3);
+  XML_EXPECT_EQ(std::string("Walls"),
+                std::string(model_info.layers_[1].name_.c_str()));
+  XML_EXPECT(model_info.layers_[1].has_material_info_);
+  XML_EXPECT(!model_info.layers_[2].is_visible_);
+  XML_ASSERT(model_info.materials_.size() == 3);
+  XML_EXPECT(model_info.materials_[1].has_texture_);
+  XML_EXPECT(model_info.materials_[2].has_alpha_);
+  XML_ASSERT(model_info.definitions_.size() == 2);
+  XML_EXPECT_EQ(std::string("Door <front>"),
+                std::string(model_info.definitions_[1].name_.c_str()));
+  XML_EXPECT_EQ(static_cast<size_t>(1),
+                model_info.definitions_[1].entities_.groups_.size());
+
+  const XmlEntitiesInfo& top = model_info.entities_;
+  XML_EXPECT_EQ(static_cast<size_t>(3), top.component_instances_.size());
+  XML_ASSERT(top.groups_.size() == 2);
+  XML_EXPECT_EQ(1.0, top.groups_[0].transform_.values[12]);
+  const XmlEntitiesInfo& outer = *top.groups_[0].entities_;
+  XML_EXPECT_EQ(static_cast<size_t>(1), outer.groups_.size());
+  XML_EXPECT_EQ(static_cast<size_t>(1), outer.curves_.size());
+  const XmlEntitiesInfo& last = *top.groups_[1].entities_;
+  XML_ASSERT(last.faces_.size() == 1);
+  XML_EXPECT(!last.faces_[0].has_single_loop_);
+  XML_EXPECT_EQ(static_cast<size_t>(9), last.faces_[0].indices_.size());
+  XML_EXPECT(last.faces_[0].has_back_texture_);
+}
+
+// Exported again unchanged, every element is copied from the last export
+XML_TEST(UnchangedElementsAreCopied) {
+  TestModel test_model;
+  const std::string filename = ExportPath("unchanged.xml");
+  XML_EXPECT_EQ(static_cast<size_t>(0),
+                ExportIncremental(test_model.model_, filename));
+  ExpectManifestMatches(filename, test_model);
+  const std::string manifest_text =
+      XmlTest::ReadFile(CXmlExportManifest::FilenameOf(filename));
+
+  XML_EXPECT_EQ(kTopElements, ExportIncremental(test_model.model_, filename));
+  ExpectManifestMatches(filename, test_model);
+  // The same elements in the same places, only the file's time is new
+  const std::string new_manifest_text =
+      XmlTest::ReadFile(CXmlExportManifest::FilenameOf(filename));
+  XML_EXPECT(manifest_text.substr(manifest_text.find('\n')) ==
+             new_manifest_text.substr(new_manifest_text.find('\n')));
+  XML_EXPECT_EQ(kTopElements, ExportIncremental(test_model.model_, filename));
+}
+
+// A changed element is written again, and so are the elements around it,
+// but not the ones inside it or next to it
+XML_TEST(ChangedElementsAreWritten) {
+  TestModel test_model;
+  const std::string filename = ExportPath("changed.xml");
+  ExportIncremental(test_model.model_, filename);
+
+  // A face in a definition, whose nested group is copied
+  test_model.door_->entities_.faces_[0].vertices_[0].position_.z = 0.5;
+  XML_EXPECT_EQ(kTopElements,
+                ExportIncremental(test_model.model_, filename));
+  ExpectManifestMatches(filename, test_model);
+
+  // A face in a group, whose nested group is copied
+  test_model.outer_->entities_.faces_[0].vertices_[1].position_.x = 7.0;
+  XML_EXPECT_EQ(kTopElements,
+                ExportIncremental(test_model.model_, filename));
+  ExpectManifestMatches(filename, test_model);
+
+  // A face in the nested group, which rewrites both groups
+  test_model.inner_->entities_.faces_[0].vertices_.pop_back();
+  XML_EXPECT_EQ(kTopElements - 1,
+                ExportIncremental(test_model.model_, filename));
+  ExpectManifestMatches(filename, test_model);
+
+  // An element added to a definition
+  AddEdge(test_model.window_->entities_, 3.0, 3.0, 3.0);
+  XML_EXPECT_EQ(kTopElements - 1,
+                ExportIncremental(test_model.model_, filename));
+  ExpectManifestMatches(filename, test_model);
+
+  // A new group is written, the others are copied
+  AddFace(AddGroup(test_model.model_.entities_, 5.0, 5.0, 5.0).entities_,
+          3, 0.0, 0.0, 0.0);
+  XML_EXPECT_EQ(kTopElements,
+                ExportIncremental(test_model.model_, filename));
+}
+
+// What an element inherits is part of its digest: a material renamed
+// changes the faces that inherit it from a group, and the groups around
+// them
+XML_TEST(InheritedChangesAreWritten) {
+  TestModel test_model;
+  const std::string filename = ExportPath("inherited.xml");
+  ExportIncremental(test_model.model_, filename);
+  test_model.glass_->name_ = "Frosted glass";
+  XML_EXPECT_EQ(static_cast<size_t>(2),
+                ExportIncremental(test_model.model_, filename));
+  ExpectManifestMatches(filename, test_model);
+
+  // A layer renamed changes the faces on it, but not the nested group
+  test_model.walls_->name_ = "Outer walls";
+  XML_EXPECT_EQ(kTopElements,
+                ExportIncremental(test_model.model_, filename));
+
+  // The group's transform is its own
+  test_model.last_->transform_.values[13] = 4.0;
+  XML_EXPECT_EQ(kTopElements - 1,
+                ExportIncremental(test_model.model_, filename));
+}
+
+// Removed elements are gone from the file and the manifest
+XML_TEST(RemovedElementsAreDropped) {
+  TestModel test_model;
+  const std::string filename = ExportPath("removed.xml");
+  ExportIncremental(test_model.model_, filename);
+  const int64_t door_id = test_model.door_->id_;
+  const int64_t door_group_id = test_model.door_group_->id_;
+  const int64_t last_id = test_model.last_->id_;
+
+  Model& model = test_model.model_;
+  model.entities_.instances_.pop_back();
+  model.definitions_.pop_back();
+  model.entities_.groups_.pop_back();
+  XML_EXPECT_EQ(static_cast<size_t>(2),
+                ExportIncremental(model, filename));
+  CXmlExportManifest manifest;
+  XML_ASSERT(LoadManifest(filename, manifest));
+  XML_EXPECT_EQ(static_cast<size_t>(3), manifest.size());
+  XML_EXPECT(manifest.Find(door_id) == NULL);
+  XML_EXPECT(manifest.Find(door_group_id) == NULL);
+  XML_EXPECT(manifest.Find(last_id) == NULL);
+  XML_EXPECT(manifest.Find(test_model.inner_->id_) != NULL);
+  XML_EXPECT(XmlTest::ReadFile(filename).find("Door") == std::string::npos);
+}
+
+// Without a manifest that matches the file, everything is written
+XML_TEST(StaleManifestsAreIgnored) {
+  TestModel test_model;
+  const std::string filename = ExportPath("stale.xml");
+  const std::string manifest_file = CXmlExportManifest::FilenameOf(filename);
+  ExportIncremental(test_model.model_, filename);
+
+  // Missing
+  remove(manifest_file.c_str());
+  XML_EXPECT_EQ(static_cast<size_t>(0),
+                ExportIncremental(test_model.model_, filename));
+  XML_EXPECT(XmlTest::FileExists(manifest_file));
+
+  // The file was changed since
+  const std::string text = XmlTest::ReadFile(filename);
+  XML_ASSERT(XmlTest::WriteFile(filename, text + "\n"));
+  XML_EXPECT_EQ(static_cast<size_t>(0),
+                ExportIncremental(test_model.model_, filename));
+
+  // Changed to the same size, or replaced by another file of the same size
+  // without its manifest. Setting the time makes sure it differs even where
+  // the file system keeps coarse times.
+  std::string same_size = XmlTest::ReadFile(filename);
+  const size_t door = same_size.find("Door");
+  XML_ASSERT(door != std::string::npos);
+  same_size[door] = 'F';
+  XML_ASSERT(XmlTest::WriteFile(filename, same_size));
+  struct utimbuf times;
+  times.actime = times.modtime = 1000000000;
+  XML_ASSERT(utime(filename.c_str(), &times) == 0);
+  XML_EXPECT_EQ(static_cast<size_t>(0),
+                ExportIncremental(test_model.model_, filename));
+  XML_EXPECT(XmlTest::ReadFile(filename).find("Foor") == std::string::npos);
+
+  // Malformed, or of another version
+  const std::string manifest_text = XmlTest::ReadFile(manifest_file);
+  XML_ASSERT(XmlTest::WriteFile(manifest_file,
+                                manifest_text.substr(0, 40) + " x"));
+  XML_EXPECT_EQ(static_cast<size_t>(0),
+                ExportIncremental(test_model.model_, filename));
+  std::string other_version = XmlTest::ReadFile(manifest_file);
+  const size_t version = other_version.find("SkpToXMLManifest 2 ");
+  XML_ASSERT(version == 0);
+  other_version.replace(version, 19, "SkpToXMLManifest 0 ");
+  XML_ASSERT(XmlTest::WriteFile(manifest_file, other_version));
+  XML_EXPECT_EQ(static_cast<size_t>(0),
+                ExportIncremental(test_model.model_, filename));
+
+  // A full export takes away the manifest, which no longer describes the
+  // file
+  XML_ASSERT(Export(test_model.model_, filename, false));
+  XML_EXPECT(!XmlTest::FileExists(manifest_file));
+  XML_EXPECT_EQ(static_cast<size_t>(0),
+                ExportIncremental(test_model.model_, filename));
+}
+
+// A compressed export is never incremental
+XML_TEST(CompressedExportsAreFull) {
+  if (!CXmlCodecFile::IsSupported(CXmlCodecFile::kCodecGzip))
+    return;
+  TestModel test_model;
+  const std::string filename = ExportPath("compressed.xml.gz");
+  CXmlExportStats stats;
+  XML_ASSERT(Export(test_model.model_, filename, true, &stats));
+  XML_ASSERT(Export(test_model.model_, filename, true, &stats));
+  XML_EXPECT_EQ(static_cast<size_t>(0), stats.copied_elements());
+  XML_EXPECT(!XmlTest::FileExists(CXmlExportManifest::FilenameOf(filename)));
+}
+
+// A cancelled export leaves the last one and its manifest alone
+XML_TEST(CancelledExportKeepsLastOne) {
+  TestModel test_model;
+  const std::string filename = ExportPath("cancelled.xml");
+  const std::string manifest_file = CXmlExportManifest::FilenameOf(filename);
+  ExportIncremental(test_model.model_, filename);
+  const std::string text = XmlTest::ReadFile(filename);
+  const std::string manifest_text = XmlTest::ReadFile(manifest_file);
+
+  test_model.door_->name_ = "Back door";
+  const char* messages[] = { "Writing Definitions...", "Writing Geometry..." };
+  for (int i = 0; i < 2; ++i) {
+    CCancelAfter callback(messages[i]);
+    XML_EXPECT(!Export(test_model.model_, filename, true, NULL, &callback));
+    XML_EXPECT(text == XmlTest::ReadFile(filename));
+    XML_EXPECT(manifest_text == XmlTest::ReadFile(manifest_file));
+  }
+  XML_EXPECT_EQ(kTopElements,
+                ExportIncremental(test_model.model_, filename));
+}
+
+// A model that can't be loaded writes nothing
+XML_TEST(MissingModelFailsToExport) {
+  const std::string filename = ExportPath("missing.xml");
+  CXmlExporter exporter;
+  XML_EXPECT(!exporter.Convert("no such model.skp", filename, NULL));
+  XML_EXPECT(!XmlTest::FileExists(filename));
+}
@@ -5,6 +5,7 @@
 
 #include "./xmlimporter.h"
 #include "../../common/utils.h"
+#include "../../common/xmldedup.h"
 
 #include <SketchUpAPI/initialize.h>
 #include <SketchUpAPI/model/component_definition.h>
@@ -37,10 +38,20 @@ bool CXmlImporter::Convert(const std::string& xml_in,
     // Initialize the SDK
     SUInitialize();
 
-    // Open the xml file
-    if (!file_.Open(xml_in, false)) {
+    // Open the xml file. The model info is all we need from it, so there is
+    // no point in loading the whole DOM. Mapping the file lets processes
+    // importing the same file share its pages.
+    if (!file_.Open(xml_in, false, CXmlFile::kReadMapped)) {
       throw std::exception();
     }
+    // Faces are only read back once, keep them in a few flat arrays. Names
+    // are looked up by ID. The model isn't read into an arena: its entities
+    // still have destructors to run, and the arena's blocks cost more memory
+    // than they save in freeing, see CXmlFile::set_use_arena.
+    file_.set_intern_names(true);
+    file_.set_use_face_store(true);
+    // Definitions and top level groups are read on all cores
+    file_.set_read_threads(0);
 
     // Get model info from xml
     HandleProgress(progress_callback, 0.0, "Reading xml file...");
@@ -50,6 +61,10 @@ bool CXmlImporter::Convert(const std::string& xml_in,
     // Done with the xml file
     file_.Close(false);
 
+    if (imported && options_.merge_identical_definitions()) {
+      XmlDedup::MergeIdenticalDefinitions(model_info);
+    }
+
     if (imported) {
       // Create model
       SUSetInvalid(model_);
@@ -57,15 +72,15 @@ bool CXmlImporter::Convert(const std::string& xml_in,
 
       // Layers
       HandleProgress(progress_callback, 25.0, "Creating layers...");
-      CreateLayers(model_info.layers_);
+      CreateLayers(model_info.layers_, model_info.names_);
 
       // Materials
       HandleProgress(progress_callback, 50.0, "Creating materials...");
-      CreateMaterials(model_info.materials_);
+      CreateMaterials(model_info.materials_, model_info.names_);
 
       // Component definitions
       HandleProgress(progress_callback, 75.0, "Creating definitions...");
-      CreateDefinitions(model_info.definitions_);
+      CreateDefinitions(model_info.definitions_, model_info.names_);
 
       // Geometry
       SUEntitiesRef model_entities = SU_INVALID;
@@ -97,14 +112,18 @@ void CXmlImporter::ReleaseModelObjects() {
     SUSetInvalid(model_);
   }
 
-  layers_map_.clear();
-  materials_map_.clear();
+  layers_.clear();
+  materials_.clear();
+  comp_defs_.clear();
 
   // Terminate the SDK
   SUTerminate();
 }
 
-void CXmlImporter::CreateLayers(const std::vector<XmlLayerInfo>& layer_infos) {
+void CXmlImporter::CreateLayers(const std::vector<XmlLayerInfo>& layer_infos,
+                                const CXmlNameTable& names) {
+  SULayerRef no_layer = SU_INVALID;
+  layers_.assign(names.size(), no_layer);
 
   for (std::vector<XmlLayerInfo>::const_iterator it = layer_infos.begin(),
        ite = layer_infos.end(); it != ite; ++it) {
@@ -138,12 +157,15 @@ void CXmlImporter::CreateLayers(const std::vector<XmlLayerInfo>& layer_infos) {
     }
 
     // Map to the id from the file.
-    layers_map_.insert(std::make_pair(info.name_, layer));
+    layers_[names.Find(info.name_)] = layer;
   }
 }
 
 void CXmlImporter::CreateMaterials(
-    const std::vector<XmlMaterialInfo>& mat_infos) {
+    const std::vector<XmlMaterialInfo>& mat_infos,
+    const CXmlNameTable& names) {
+  SUMaterialRef no_material = SU_INVALID;
+  materials_.assign(names.size(), no_material);
 
   std::string texture_dir = file_.GetTextureDirectory();
 
@@ -181,7 +203,7 @@ void CXmlImporter::CreateMaterials(
     SU_CALL(SUModelAddMaterials(model_, 1, &material));
 
     // Map to the id from the file.
-    materials_map_.insert(std::make_pair(info.name_, material));
+    materials_[names.Find(info.name_)] = material;
   }
 }
 
@@ -190,96 +212,97 @@ static SUPoint3D ConvertPoint(const CPoint3d& pt) {
   return su_pt;
 }
 
-static SUPoint3D PointFromVertex(const XmlFaceVertex& vertex) {
-  return ConvertPoint(vertex.vertex_);
-}
-
 static SUPoint2D ConvertTextureCoords(const CPoint3d& pt) {
   SUPoint2D coords = { pt.x(), pt.y() };
   return coords;
 }
 
-SULayerRef CXmlImporter::FindLayer(const std::string& layer_name) const {
-  std::map<std::string, SULayerRef>::const_iterator itl =
-      layers_map_.find(layer_name);
+SULayerRef CXmlImporter::FindLayer(uint32_t layer_id) const {
   SULayerRef layer = SU_INVALID;
-  if (itl != layers_map_.end()) {
-    layer = itl->second;
+  if (layer_id < layers_.size()) {
+    layer = layers_[layer_id];
   }
   return layer;
 }
 
-SUMaterialRef CXmlImporter::FindMaterial(const std::string& mat_name) const {
-  std::map<std::string, SUMaterialRef>::const_iterator itm =
-      materials_map_.find(mat_name);
+SUMaterialRef CXmlImporter::FindMaterial(uint32_t mat_id) const {
   SUMaterialRef material = SU_INVALID;
-  if (itm != materials_map_.end()) {
-    material = itm->second;
+  if (mat_id < materials_.size()) {
+    material = materials_[mat_id];
   }
   return material;
 }
 
+static size_t FaceVertex(const uint32_t* face_vertices, size_t i) {
+  return face_vertices != NULL ? face_vertices[i] : i;
+}
+
 // Implementation function for CreateEntities. Given a geometry input, adds
-// a face with 'num_face_vertices' vertices starting at global vertex index
-// 'global_vertex_count'. Also keeps track of a running vertex count within
-// the face (in case it is tessellated).
+// a face with 'num_face_vertices' vertices. 'face_vertices' lists them as
+// indices into the vertices of 'face', or is NULL to take them in order. The
+// vertices of 'face' were added to the geometry input starting at index
+// 'first_vertex'.
 void CXmlImporter::BuildFaceInput(SUGeometryInputRef geom_input,
-                                  const XmlFaceInfo& face_info,
+                                  const CXmlFaceView& face,
+                                  const uint32_t* face_vertices,
                                   size_t num_face_vertices,
-                                  size_t& face_vertex_count,
-                                  size_t& global_vertex_count) {
+                                  size_t first_vertex) {
   // Set up an outer loop input for the face
   SULoopInputRef loop = SU_INVALID;
   SU_CALL(SULoopInputCreate(&loop));
   for (size_t i = 0; i < num_face_vertices; ++i) {
-    SU_CALL(SULoopInputAddVertexIndex(loop, global_vertex_count + i));
+    const size_t vertex = FaceVertex(face_vertices, i);
+    SU_CALL(SULoopInputAddVertexIndex(loop, first_vertex + vertex));
   }
   // Add the face
   size_t face_index = 0;
   SU_CALL(SUGeometryInputAddFace(geom_input, &loop, &face_index));
 
   // Set the layer
-  if (!face_info.layer_name_.empty()) {
-    SULayerRef layer = FindLayer(face_info.layer_name_);
+  if (face.layer_id() != CXmlNameTable::kNoName) {
+    SULayerRef layer = FindLayer(face.layer_id());
     SU_CALL(SUGeometryInputFaceSetLayer(geom_input, face_index, layer));
   }
 
   // Set up the material input (Front face)
-  if (!face_info.front_mat_name_.empty()) {
+  if (face.front_mat_id() != CXmlNameTable::kNoName) {
     SUMaterialInput mat_input = { 0 };
-    mat_input.material = FindMaterial(face_info.front_mat_name_);
-    if (face_info.has_front_texture_) {
+    mat_input.material = FindMaterial(face.front_mat_id());
+    if (face.has_front_texture()) {
       mat_input.num_uv_coords = std::min(num_face_vertices, (size_t)4);
       for (size_t i = 0; i < mat_input.num_uv_coords; ++i) {
-        mat_input.vertex_indices[i] = global_vertex_count + i;
+        const size_t vertex = FaceVertex(face_vertices, i);
+        mat_input.vertex_indices[i] = first_vertex + vertex;
         mat_input.uv_coords[i] = ConvertTextureCoords(
-            face_info.vertices_[face_vertex_count + i].front_texture_coord_);
+            face.front_texture_coord(vertex));
       }
     }
     SU_CALL(SUGeometryInputFaceSetFrontMaterial(geom_input, face_index,
                                                 &mat_input));
   }
   // Set up the material input (Back face)
-  if (!face_info.back_mat_name_.empty()) {
+  if (face.back_mat_id() != CXmlNameTable::kNoName) {
     SUMaterialInput mat_input = { 0 };
-    mat_input.material = FindMaterial(face_info.back_mat_name_);
-    if (face_info.has_back_texture_) {
+    mat_input.material = FindMaterial(face.back_mat_id());
+    if (face.has_back_texture()) {
       mat_input.num_uv_coords = std::min(num_face_vertices, (size_t)4);
       for (size_t i = 0; i < mat_input.num_uv_coords; ++i) {
-        mat_input.vertex_indices[i] = global_vertex_count + i;
+        const size_t vertex = FaceVertex(face_vertices, i);
+        mat_input.vertex_indices[i] = first_vertex + vertex;
         mat_input.uv_coords[i] = ConvertTextureCoords(
-            face_info.vertices_[face_vertex_count + i].back_texture_coord_);
+            face.back_texture_coord(vertex));
       }
     }
     SU_CALL(SUGeometryInputFaceSetBackMaterial(geom_input, face_index,
                                                &mat_input));
   }
-  face_vertex_count+= num_face_vertices;
-  global_vertex_count += num_face_vertices;
 };
 
 void CXmlImporter::CreateDefinitions(
-    const std::vector<XmlComponentDefinitionInfo>& def_infos) {
+    const std::vector<XmlComponentDefinitionInfo>& def_infos,
+    const CXmlNameTable& names) {
+  SUComponentDefinitionRef no_definition = SU_INVALID;
+  comp_defs_.assign(names.size(), CompDef(no_definition, NULL));
   for (std::vector<XmlComponentDefinitionInfo>::const_iterator it =
        def_infos.begin(), ite = def_infos.end(); it != ite; ++it) {
     SUComponentDefinitionRef definition = SU_INVALID;
@@ -287,8 +310,7 @@ void CXmlImporter::CreateDefinitions(
     SU_CALL(SUComponentDefinitionSetName(definition, it->name_.c_str()));
     // Add definition to model before making any other operation on it.
     SU_CALL(SUModelAddComponentDefinitions(model_, 1, &definition));
-    comp_def_map_.insert(std::make_pair(it->name_,
-                                        std::make_pair(definition, &(*it))));
+    comp_defs_[names.Find(it->name_)] = CompDef(definition, &(*it));
   }
 }
 
@@ -297,32 +319,32 @@ bool CXmlImporter::CreateEntities(const XmlEntitiesInfo& info,
   bool ok = true;
 
   // Component instances
-  for (std::vector<XmlComponentInstanceInfo>::const_iterator it =
+  for (XmlArenaVector<XmlComponentInstanceInfo>::const_iterator it =
        info.component_instances_.begin(), ite = info.component_instances_.end();
        it != ite; ++it) {
     const XmlComponentInstanceInfo& instance_info = *it;
     // Find the definition
-    CompDefMap::const_iterator itdef =
-        comp_def_map_.find(instance_info.definition_name_);
-    if (itdef == comp_def_map_.end()) {
+    if (instance_info.definition_id_ >= comp_defs_.size() ||
+        comp_defs_[instance_info.definition_id_].second == NULL) {
       ok = false;
       continue;
     }
-    SUComponentDefinitionRef definition = itdef->second.first;
-    const XmlComponentDefinitionInfo* def_info = itdef->second.second;
+    const CompDef& comp_def = comp_defs_[instance_info.definition_id_];
+    SUComponentDefinitionRef definition = comp_def.first;
+    const XmlComponentDefinitionInfo* def_info = comp_def.second;
     // Create the instance
     SUComponentInstanceRef instance = SU_INVALID;
     SU_CALL(SUComponentDefinitionCreateInstance(definition, &instance));
     // Add the instance to the parent entities
     SU_CALL(SUEntitiesAddInstance(entities, instance, NULL));
     // Set material and layer if set
-    if (!instance_info.layer_name_.empty()) {
-      SULayerRef layer = FindLayer(instance_info.layer_name_);
+    if (instance_info.layer_id_ != CXmlNameTable::kNoName) {
+      SULayerRef layer = FindLayer(instance_info.layer_id_);
       SU_CALL(SUDrawingElementSetLayer(
               SUComponentInstanceToDrawingElement(instance), layer));
     }
-    if (!instance_info.material_name_.empty()) {
-      SUMaterialRef mat = FindMaterial(instance_info.material_name_);
+    if (instance_info.material_id_ != CXmlNameTable::kNoName) {
+      SUMaterialRef mat = FindMaterial(instance_info.material_id_);
       SU_CALL(SUDrawingElementSetMaterial(
               SUComponentInstanceToDrawingElement(instance), mat));
     }
@@ -336,7 +358,7 @@ bool CXmlImporter::CreateEntities(const XmlEntitiesInfo& info,
   }
 
   // Groups
-  for (std::vector<XmlGroupInfo>::const_iterator it = info.groups_.begin(),
+  for (XmlArenaVector<XmlGroupInfo>::const_iterator it = info.groups_.begin(),
        ite = info.groups_.end(); it != ite; ++it) {
     const XmlGroupInfo& group_info = *it;
     // Create a group
@@ -357,32 +379,31 @@ bool CXmlImporter::CreateEntities(const XmlEntitiesInfo& info,
   SU_CALL(SUGeometryInputCreate(&geom_input));
 
   size_t global_vertex_count = 0;
-  for (std::vector<XmlFaceInfo>::const_iterator it = info.faces_.begin(),
-       ite = info.faces_.end(); it != ite; ++it) {
-    const XmlFaceInfo& face_info = *it;
+  for (CXmlFaceStore::const_iterator it = info.face_store_.begin(),
+       ite = info.face_store_.end(); it != ite; ++it) {
+    const CXmlFaceView& face = *it;
     // Add vertices
-    for (std::vector<XmlFaceVertex>::const_iterator it =
-         face_info.vertices_.begin(), ite = face_info.vertices_.end();
-         it != ite; ++it) {
-      SUPoint3D pt = PointFromVertex(*it);
+    const size_t num_vertices = face.vertex_count();
+    for (size_t i = 0; i < num_vertices; ++i) {
+      SUPoint3D pt = ConvertPoint(face.vertex(i));
       SU_CALL(SUGeometryInputAddVertex(geom_input, &pt));
     }
-    const size_t num_vertices = face_info.vertices_.size();
-    if (face_info.has_single_loop_) {
+    if (face.has_single_loop()) {
       // Face has an outer loop only.
-      size_t face_vertex_count = 0;
-      BuildFaceInput(geom_input, face_info, num_vertices, face_vertex_count,
+      BuildFaceInput(geom_input, face, NULL, num_vertices,
                      global_vertex_count);
     } else {
-      // The face was tessellated into a triangular mesh.
-      assert(num_vertices % 3 == 0);
-      const size_t num_triangles = num_vertices / 3;
-      size_t face_vertex_count = 0;
+      // The face was tessellated into a triangular mesh, whose triangles
+      // share the face's vertices.
+      assert(face.index_count() % 3 == 0);
+      const size_t num_triangles = face.index_count() / 3;
+      const uint32_t* indices = face.indices();
       for (size_t tri_index = 0; tri_index < num_triangles; ++tri_index) {
-        BuildFaceInput(geom_input, face_info, 3, face_vertex_count,
+        BuildFaceInput(geom_input, face, &indices[tri_index * 3], 3,
                        global_vertex_count);
       }
     }
+    global_vertex_count += num_vertices;
   }
 
   // Fill the entities
@@ -392,7 +413,7 @@ bool CXmlImporter::CreateEntities(const XmlEntitiesInfo& info,
 
   // Create stand-alone edges
   if (!info.edges_.empty()) {
-    for (std::vector<XmlEdgeInfo>::const_iterator it = info.edges_.begin(),
+    for (XmlArenaVector<XmlEdgeInfo>::const_iterator it = info.edges_.begin(),
           ite = info.edges_.end(); it != ite; ++it) {
       const XmlEdgeInfo& edge_info = *it;
       SUPoint3D start_pt = ConvertPoint(edge_info.start_);
@@ -406,7 +427,7 @@ bool CXmlImporter::CreateEntities(const XmlEntitiesInfo& info,
       }
       // Layer
       if (edge_info.has_layer_) {
-        SULayerRef layer = FindLayer(edge_info.layer_name_);
+        SULayerRef layer = FindLayer(edge_info.layer_id_);
         SU_CALL(SUDrawingElementSetLayer(SUEdgeToDrawingElement(edge), layer));
       }
       // Add to the entities
@@ -4,7 +4,8 @@
 #define XMLTOSKP_COMMON_XMLIMPORTER_H
 
 #include <string>
-#include <map>
+#include <utility>
+#include <vector>
 #include "../../common/xmlfile.h"
 #include "./xmloptions.h"
 
@@ -23,18 +24,21 @@ class CXmlImporter {
 
  private:
   void ReleaseModelObjects();
-  void CreateLayers(const std::vector<XmlLayerInfo>& layer_infos);
-  void CreateMaterials(const std::vector<XmlMaterialInfo>& mat_infos);
+  void CreateLayers(const std::vector<XmlLayerInfo>& layer_infos,
+                    const CXmlNameTable& names);
+  void CreateMaterials(const std::vector<XmlMaterialInfo>& mat_infos,
+                       const CXmlNameTable& names);
   void CreateDefinitions(
-      const std::vector<XmlComponentDefinitionInfo>& def_infos);
+      const std::vector<XmlComponentDefinitionInfo>& def_infos,
+      const CXmlNameTable& names);
   bool CreateEntities(const XmlEntitiesInfo& info, SUEntitiesRef entities);
-  SULayerRef FindLayer(const std::string& layer_name) const;
-  SUMaterialRef FindMaterial(const std::string& mat_name) const;
+  SULayerRef FindLayer(uint32_t layer_id) const;
+  SUMaterialRef FindMaterial(uint32_t mat_id) const;
   void BuildFaceInput(SUGeometryInputRef geom_input,
-                      const XmlFaceInfo& face_info,
+                      const CXmlFaceView& face,
+                      const uint32_t* face_vertices,
                       size_t num_face_vertices,
-                      size_t& face_vertex_count,
-                      size_t& global_vertex_count);
+                      size_t first_vertex);
 
  private:
   // File
@@ -46,15 +50,15 @@ class CXmlImporter {
   // The model reference
   SUModelRef model_;
 
-  // Name to entity maps
-  std::map<std::string, SULayerRef> layers_map_;
-  std::map<std::string, SUMaterialRef> materials_map_;
+  // Entities by the name IDs of the model info
+  std::vector<SULayerRef> layers_;
+  std::vector<SUMaterialRef> materials_;
 
-  // Name to component definition map
-  typedef std::map<std::string,
-                   std::pair<SUComponentDefinitionRef,
-                             const XmlComponentDefinitionInfo*> > CompDefMap;
-  CompDefMap comp_def_map_;
+  // Component definitions by name ID. The info is NULL for names that
+  // aren't definitions.
+  typedef std::pair<SUComponentDefinitionRef,
+                    const XmlComponentDefinitionInfo*> CompDef;
+  std::vector<CompDef> comp_defs_;
 };
 
 #endif // XMLTOSKP_COMMON_XMLIMPORTER_H
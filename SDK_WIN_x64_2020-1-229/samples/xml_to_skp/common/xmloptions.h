@@ -8,6 +8,7 @@ class CXmlOptions {
  public:
   CXmlOptions() {
    merge_coplanar_faces_ = true;
+   merge_identical_definitions_ = false;
   }
 
   inline bool merge_coplanar_faces() const
@@ -15,8 +16,16 @@ class CXmlOptions {
   inline void set_merge_coplanar_faces(bool value)
       { merge_coplanar_faces_ = value; }
 
+  // Whether definitions with identical entities are created once, with the
+  // instances of all of them referring to it
+  inline bool merge_identical_definitions() const
+      { return merge_identical_definitions_; }
+  inline void set_merge_identical_definitions(bool value)
+      { merge_identical_definitions_ = value; }
+
  private:
   bool merge_coplanar_faces_;
+  bool merge_identical_definitions_;
 };
 
 #endif // XMLTOSKP_COMMON_XMLOPTIONS_H